@@ -0,0 +1,14 @@
+// RigidBodyQuantizationCheck.js - For validating the sizes and decoding errors of the compact rigid body updates.
+
+function log(msg)
+{
+    console.LogInfo("[Tests::RigidBodyQuantizationCheck]: " + msg);
+}
+
+var tundraLogic = framework.GetModuleByName("TundraLogic");
+if (!tundraLogic)
+    console.LogError("[Tests::RigidBodyQuantizationCheck]: FAILED: TundraLogic module not found.");
+else if (!tundraLogic.CheckRigidBodyQuantization())
+    console.LogError("[Tests::RigidBodyQuantizationCheck]: FAILED: See the errors above.");
+else
+    log("OK");
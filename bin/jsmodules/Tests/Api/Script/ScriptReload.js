@@ -0,0 +1,65 @@
+// ScriptReload.js - For validating that the signal handlers of an EC_Script run once after the script is reloaded, and not at all after it is unloaded.
+// Run both with and without --sharedScriptEngine.
+
+function log(msg)
+{
+    console.LogInfo("[Tests::ScriptReload]: " + msg);
+}
+
+function fail(msg)
+{
+    console.LogError("[Tests::ScriptReload]: FAILED: " + msg);
+}
+
+var testScene = framework.Scene().CreateScene("ScriptReloadTest", false, true);
+var entity = testScene.CreateLocalEntity(["EC_Script"]);
+var handledCount = 0;
+var loadCount = 0;
+
+function OnHandled()
+{
+    ++handledCount;
+}
+
+// Triggers the action the handler script is connected to, and checks how many times its handler ran.
+function Ping(step, expectedCount)
+{
+    handledCount = 0;
+    entity.Exec(1, "ScriptReloadTestPing");
+    if (handledCount != expectedCount)
+    {
+        fail(step + ": the handler ran " + handledCount + " times, expected " + expectedCount + ".");
+        return false;
+    }
+    log(step + ": OK");
+    return true;
+}
+
+function OnScriptLoaded()
+{
+    ++loadCount;
+    // Continue after the script has finished its evaluation.
+    frame.DelayedExecute(0).Triggered.connect(loadCount == 1 ? AfterFirstRun : AfterReload);
+}
+
+function AfterFirstRun()
+{
+    if (Ping("First run", 1))
+        entity.script.Run(); // Unloads the script and runs it again.
+}
+
+function AfterReload()
+{
+    if (!Ping("Reload", 1))
+        return;
+    entity.script.Unload();
+    if (Ping("Unload", 0))
+        log("PASSED");
+    framework.Scene().RemoveScene("ScriptReloadTest");
+}
+
+entity.Action("ScriptReloadTestHandled").Triggered.connect(OnHandled);
+entity.Action("ScriptReloadTestLoaded").Triggered.connect(OnScriptLoaded);
+
+entity.script.runOnLoad = true;
+entity.script.scriptRef = new AssetReference("local://ScriptReloadHandler.js");
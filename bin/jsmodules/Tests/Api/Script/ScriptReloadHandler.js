@@ -0,0 +1,9 @@
+// ScriptReloadHandler.js - The EC_Script run and reloaded by ScriptReload.js.
+
+function OnPing()
+{
+    me.Exec(1, "ScriptReloadTestHandled");
+}
+
+me.Action("ScriptReloadTestPing").Triggered.connect(OnPing);
+me.Exec(1, "ScriptReloadTestLoaded");
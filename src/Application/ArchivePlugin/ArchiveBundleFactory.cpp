@@ -3,7 +3,8 @@
 #include "ArchiveBundleFactory.h"
 #include "ZipAssetBundle.h"
 
-ArchiveBundleFactory::ArchiveBundleFactory()
+ArchiveBundleFactory::ArchiveBundleFactory(bool extractToCache) :
+    extractToCache_(extractToCache)
 {
     typesExtensions_ << ".zip";
 }
@@ -21,6 +22,6 @@ QStringList ArchiveBundleFactory::TypeExtensions() const
 AssetBundlePtr ArchiveBundleFactory::CreateEmptyAssetBundle(AssetAPI *owner, const QString &name)
 {
     if (name.endsWith(".zip", Qt::CaseInsensitive))
-        return AssetBundlePtr(new ZipAssetBundle(owner, Type(), name));
+        return AssetBundlePtr(new ZipAssetBundle(owner, Type(), name, extractToCache_));
     return AssetBundlePtr();
 }
@@ -10,7 +10,8 @@ class ArchiveBundleFactory : public IAssetBundleTypeFactory
 Q_OBJECT
     
 public:
-    ArchiveBundleFactory();
+    /// @param extractToCache Whether the created bundles extract their files to the asset cache, see ZipAssetBundle.
+    explicit ArchiveBundleFactory(bool extractToCache = false);
 
     virtual QString Type() const;
     virtual QStringList TypeExtensions() const;
@@ -18,4 +19,5 @@ public:
 
 private:
     QStringList typesExtensions_;
+    bool extractToCache_;
 };
@@ -11,6 +11,7 @@ extern "C"
     DLLEXPORT void TundraPluginMain(Framework *framework)
     {
         Framework::SetInstance(framework);
-        framework->Asset()->RegisterAssetBundleTypeFactory(AssetBundleTypeFactoryPtr(new ArchiveBundleFactory()));
+        const bool extractToCache = framework->HasCommandLineParameter("--extractZipBundles");
+        framework->Asset()->RegisterAssetBundleTypeFactory(AssetBundleTypeFactoryPtr(new ArchiveBundleFactory(extractToCache)));
     }
 }
@@ -12,10 +12,39 @@
 #include <QDateTime>
 #include <QThreadPool>
 
-ZipAssetBundle::ZipAssetBundle(AssetAPI *owner, const QString &type, const QString &name) :
+namespace
+{
+
+const quint32 cLocalFileHeaderSignature = 0x04034b50;
+const quint32 cCentralFileHeaderSignature = 0x02014b50;
+const quint32 cEndOfCentralDirectorySignature = 0x06054b50;
+const qint64 cLocalFileHeaderSize = 30;
+const qint64 cCentralFileHeaderSize = 46;
+const qint64 cEndOfCentralDirectorySize = 22;
+const qint64 cMaxZipCommentSize = 0xFFFF;
+const uint cEncryptedFlag = 0x0001;
+const uint cUtf8NameFlag = 0x0800;
+const uint cCompressionStored = 0;
+
+/// The values in a zip are little-endian, and not necessarily aligned.
+uint ReadU16(const uchar *data)
+{
+    return (uint)data[0] | ((uint)data[1] << 8);
+}
+
+quint32 ReadU32(const uchar *data)
+{
+    return (quint32)data[0] | ((quint32)data[1] << 8) | ((quint32)data[2] << 16) | ((quint32)data[3] << 24);
+}
+
+}
+
+ZipAssetBundle::ZipAssetBundle(AssetAPI *owner, const QString &type, const QString &name, bool extractToCache) :
     IAssetBundle(owner, type, name),
     archive_(0),
-    fileCount_(-1)
+    mapped_(0),
+    fileCount_(-1),
+    extractToCache_(extractToCache)
 {
 }
 
@@ -27,6 +56,8 @@ ZipAssetBundle::~ZipAssetBundle()
 void ZipAssetBundle::DoUnload()
 {
     Close();
+    files_.clear();
+    fileIndices_.clear();
     fileCount_ = -1;
 }
 
@@ -38,7 +69,7 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
         return false;
     }
 
-    /* We want to detect if the extracted files are already up to date to save time.
+    /* When extracting, we want to detect if the extracted files are already up to date to save time.
        If the last modified date for the sub asset is the same as the parent zip file, 
        we don't extract it. If the zip is re-downloaded from source everything will get unpacked even
        if only one file would have changed inside it. We could do uncompressed size comparisons
@@ -49,50 +80,56 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
        was not changed, we don't have a mechanism to get the last modified date properly except from
        the asset cache. For local scenes this should be fine as there is no real need to
        zip the scene up as you already have the disk sources right there in the storage.
-       The last modified query will fail if the file is open with zziplib, do it first. */
-    QDateTime zipLastModified = assetAPI_->GetAssetCache()->LastModified(Name());
-        
-    zzip_error_t error = ZZIP_NO_ERROR;
-    archive_ = zzip_dir_open(QDir::toNativeSeparators(DiskSource()).toStdString().c_str(), &error);
-    if (CheckAndLogZzipError(error) || CheckAndLogArchiveError(archive_) || !archive_)
+       The last modified query will fail if the file is open, do it first. */
+    QDateTime zipLastModified;
+    if (extractToCache_)
+        zipLastModified = assetAPI_->GetAssetCache()->LastModified(Name());
+
+    archiveFile_.setFileName(DiskSource());
+    if (!archiveFile_.open(QIODevice::ReadOnly))
     {
-        archive_ = 0;
+        LogError("ZipAssetBundle: Failed to open " + DiskSource() + ": " + archiveFile_.errorString());
         return false;
     }
-    
+    mapped_ = archiveFile_.size() > 0 ? archiveFile_.map(0, archiveFile_.size()) : 0;
+    if (!mapped_)
+    {
+        LogError("ZipAssetBundle: Failed to map " + DiskSource() + " to memory: " + archiveFile_.errorString());
+        Close();
+        return false;
+    }
+    if (!ReadCentralDirectory())
+    {
+        DoUnload();
+        return false;
+    }
+
     int uncompressing = 0;
-    
-    ZZIP_DIRENT archiveEntry;
-    while(zzip_dir_read(archive_, &archiveEntry))
+    for(int i = 0; i < files_.size(); ++i)
     {
-        QString relativePath = QDir::fromNativeSeparators(archiveEntry.d_name);
-        if (!relativePath.endsWith("/"))
-        {
-            QString subAssetRef = GetFullAssetReference(relativePath);
-            
-            ZipArchiveFile file;
-            file.relativePath = relativePath;
-            file.cachePath = assetAPI_->GetAssetCache()->GetDiskSourceByRef(subAssetRef);
-            file.lastModified = assetAPI_->GetAssetCache()->LastModified(subAssetRef);
-            file.compressedSize = archiveEntry.d_csize;
-            file.uncompressedSize = archiveEntry.st_size;
-            
-            /* Mark this file for extraction. If both cache files have valid dates
-               and they differ extract. If they have the same date stamp skip extraction.
-               Note that file.lastModified will be non-valid for non cached files so we 
-               will cover also missing files. */
-            file.doExtract = (zipLastModified.isValid() && file.lastModified.isValid()) ? (zipLastModified != file.lastModified) : true;
-            if (file.doExtract)
-                uncompressing++;
+        ZipArchiveFile &file = files_[i];
+        fileIndices_[file.relativePath.toLower()] = i;
+        if (!extractToCache_)
+            continue;
 
-            files_ << file;
-            fileCount_++;
-        }
+        QString subAssetRef = GetFullAssetReference(file.relativePath);
+        file.cachePath = assetAPI_->GetAssetCache()->GetDiskSourceByRef(subAssetRef);
+        file.lastModified = assetAPI_->GetAssetCache()->LastModified(subAssetRef);
+
+        /* Mark this file for extraction. If both cache files have valid dates
+           and they differ extract. If they have the same date stamp skip extraction.
+           Note that file.lastModified will be non-valid for non cached files so we 
+           will cover also missing files. */
+        file.doExtract = (zipLastModified.isValid() && file.lastModified.isValid()) ? (zipLastModified != file.lastModified) : true;
+        if (file.doExtract)
+            uncompressing++;
     }
-    
-    // Close the zzip directory ptr
-    Close();
-    
+    fileCount_ = files_.size();
+
+    // The extracted files are loaded from the cache, so the archive is not needed any more.
+    if (extractToCache_)
+        Close();
+
     // If the zip file was empty we don't want IsLoaded to fail on the files_ check.
     // The bundle loaded fine but there was no content, log a warning.
     if (files_.isEmpty())
@@ -102,7 +139,7 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
         emit Loaded(this);
         return true;
     }
-    
+
     // Don't spin the worker if all sub assets are up to date in cache.
     if (uncompressing > 0)
     {   
@@ -120,6 +157,124 @@ bool ZipAssetBundle::DeserializeFromDiskSource()
     return true;
 }
 
+bool ZipAssetBundle::ReadCentralDirectory()
+{
+    const qint64 size = archiveFile_.size();
+
+    // The end of central directory record is at the end of the zip, followed only by the comment of the zip.
+    qint64 end = -1;
+    for(qint64 pos = size - cEndOfCentralDirectorySize; pos >= 0 && pos >= size - cEndOfCentralDirectorySize - cMaxZipCommentSize; --pos)
+        if (ReadU32(mapped_ + pos) == cEndOfCentralDirectorySignature)
+        {
+            end = pos;
+            break;
+        }
+    if (end < 0)
+    {
+        LogError("ZipAssetBundle: Not a zip file, or the zip is corrupted: " + Name());
+        return false;
+    }
+
+    const uint entryCount = ReadU16(mapped_ + end + 10);
+    qint64 pos = ReadU32(mapped_ + end + 16);
+    for(uint i = 0; i < entryCount; ++i)
+    {
+        const uchar *header = mapped_ + pos;
+        if (pos + cCentralFileHeaderSize > end || ReadU32(header) != cCentralFileHeaderSignature)
+        {
+            LogError("ZipAssetBundle: Corrupted central directory in " + Name());
+            return false;
+        }
+        const uint flags = ReadU16(header + 8);
+        const uint nameLength = ReadU16(header + 28);
+        const qint64 headerSize = cCentralFileHeaderSize + nameLength + ReadU16(header + 30) + ReadU16(header + 32);
+        if (pos + headerSize > end)
+        {
+            LogError("ZipAssetBundle: Corrupted central directory in " + Name());
+            return false;
+        }
+        pos += headerSize;
+
+        QByteArray name((const char *)header + cCentralFileHeaderSize, nameLength);
+        if (name.endsWith('/'))
+            continue;
+
+        ZipArchiveFile file;
+        file.archiveName = name;
+        file.relativePath = QDir::fromNativeSeparators((flags & cUtf8NameFlag) ? QString::fromUtf8(name) : QString::fromLatin1(name));
+        file.compressionMethod = ReadU16(header + 10);
+        file.compressedSize = ReadU32(header + 20);
+        file.uncompressedSize = ReadU32(header + 24);
+        file.localHeaderOffset = ReadU32(header + 42);
+        file.doExtract = false;
+        if (flags & cEncryptedFlag)
+        {
+            LogWarning("ZipAssetBundle: Skipping encrypted file " + file.relativePath + " in " + Name());
+            continue;
+        }
+        files_ << file;
+    }
+    return true;
+}
+
+bool ZipAssetBundle::ReadFile(const ZipArchiveFile &file, std::vector<u8> &data)
+{
+    if (file.compressionMethod == cCompressionStored)
+    {
+        // The stored files are copied straight from the mapped archive. The length of the extra field
+        // in the local header may differ from the one in the central directory, so the local header is read.
+        const qint64 size = archiveFile_.size();
+        const qint64 headerPos = file.localHeaderOffset;
+        if (!mapped_ || headerPos + cLocalFileHeaderSize > size || ReadU32(mapped_ + headerPos) != cLocalFileHeaderSignature)
+        {
+            LogError("ZipAssetBundle: Corrupted local header for " + file.relativePath + " in " + Name());
+            return false;
+        }
+        const qint64 dataPos = headerPos + cLocalFileHeaderSize + ReadU16(mapped_ + headerPos + 26) + ReadU16(mapped_ + headerPos + 28);
+        if (dataPos + file.uncompressedSize > size)
+        {
+            LogError("ZipAssetBundle: Truncated file " + file.relativePath + " in " + Name());
+            return false;
+        }
+        data.assign(mapped_ + dataPos, mapped_ + dataPos + file.uncompressedSize);
+        return true;
+    }
+
+    // The compressed files are uncompressed with zziplib, which is opened on the first need.
+    if (!archive_)
+    {
+        zzip_error_t error = ZZIP_NO_ERROR;
+        archive_ = zzip_dir_open(QDir::toNativeSeparators(DiskSource()).toStdString().c_str(), &error);
+        if (CheckAndLogZzipError(error) || CheckAndLogArchiveError(archive_) || !archive_)
+        {
+            archive_ = 0;
+            return false;
+        }
+    }
+    ZZIP_FILE *zzipFile = zzip_file_open(archive_, file.archiveName.constData(), ZZIP_ONLYZIP);
+    if (!zzipFile || CheckAndLogArchiveError(archive_))
+    {
+        if (zzipFile)
+            zzip_file_close(zzipFile);
+        return false;
+    }
+
+    data.resize(file.uncompressedSize);
+    zzip_ssize_t totalRead = 0;
+    zzip_ssize_t chunkRead = 0;
+    while(totalRead < (zzip_ssize_t)data.size() && 0 < (chunkRead = zzip_read(zzipFile, &data[totalRead], data.size() - totalRead)))
+        totalRead += chunkRead;
+    zzip_file_close(zzipFile);
+
+    if (totalRead != (zzip_ssize_t)data.size())
+    {
+        LogError("ZipAssetBundle: Failed to uncompress " + file.relativePath + " from " + Name());
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
 bool ZipAssetBundle::DeserializeFromData(const u8 * /*data*/, size_t /*numBytes*/)
 {
     /** @note At this point it seems zzip needs a disk source to do processing
@@ -131,20 +286,28 @@ std::vector<u8> ZipAssetBundle::GetSubAssetData(const QString &subAssetName)
 {
     /* Makes no sense to keep the whole zip file contents in memory as only
        few files could be wanted from a 100mb bundle. Additionally all asset would take 2x the memory.
-       We could make this function also open the zip file and uncompress the data for every sub asset request. 
-       But that would be rather pointless, not to mention slower, as we already have the unpacked individual 
-       assets on disk. If the unpacking to disk changes we might need to rethink this. */
+       The data is read from the archive for every sub asset request, unless the files have been
+       unpacked to disk, in which case they are read from the individual cache files. */
+    std::vector<u8> data;
+    if (extractToCache_)
+    {
+        QString filePath = GetSubAssetDiskSource(subAssetName);
+        if (filePath.isEmpty())
+            return std::vector<u8>();
+        return LoadFileToVector(filePath, data) ? data : std::vector<u8>();
+    }
 
-    QString filePath = GetSubAssetDiskSource(subAssetName);
-    if (filePath.isEmpty())
+    QHash<QString, int>::const_iterator iter = fileIndices_.find(QDir::fromNativeSeparators(subAssetName).toLower());
+    if (iter == fileIndices_.end())
         return std::vector<u8>();
-
-    std::vector<u8> data;
-    return LoadFileToVector(filePath, data) ? data : std::vector<u8>();
+    return ReadFile(files_[iter.value()], data) ? data : std::vector<u8>();
 }
 
 QString ZipAssetBundle::GetSubAssetDiskSource(const QString &subAssetName)
 {
+    // When reading from the archive, the cache may have files extracted by an earlier run, which may be out of date.
+    if (!extractToCache_)
+        return QString();
     return assetAPI_->GetAssetCache()->FindInCache(GetFullAssetReference(subAssetName));
 }
 
@@ -186,4 +349,10 @@ void ZipAssetBundle::Close()
         zzip_dir_close(archive_);
         archive_ = 0;
     }
+    if (mapped_)
+    {
+        archiveFile_.unmap(const_cast<uchar *>(mapped_));
+        mapped_ = 0;
+    }
+    archiveFile_.close();
 }
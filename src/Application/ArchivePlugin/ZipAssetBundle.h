@@ -6,15 +6,25 @@
 #include "IAssetBundle.h"
 #include "ZipWorker.h"
 
+#include <QFile>
+#include <QHash>
+
 struct zzip_dir;
 
 /// Provides zip packed asset bundle support.
+/** The central directory of the zip is indexed when the bundle is loaded, and the sub assets are read straight from the archive
+    when requested: the stored files are copied from the memory mapped zip, and the deflated ones are uncompressed with zziplib.
+    The archive is kept open, and mapped, until the bundle is unloaded.
+
+    If the bundle is created to extract its files (--extractZipBundles), the files are instead unpacked to the asset cache
+    in a worker thread when the bundle is loaded, and the sub assets are loaded from the cache files. */
 class ZipAssetBundle : public IAssetBundle
 {
     Q_OBJECT
 
 public:
-    ZipAssetBundle(AssetAPI *owner, const QString &type, const QString &name);
+    /// @param extractToCache Whether the files are extracted to the asset cache when loaded, instead of being read from the archive on demand.
+    ZipAssetBundle(AssetAPI *owner, const QString &type, const QString &name, bool extractToCache = false);
     ~ZipAssetBundle();
 
     /// IAssetBundle override.
@@ -27,12 +37,12 @@ public:
     /// IAssetBundle override.
     /** Our current zziplib implementation requires disk source for processing.
         So we fail DeserializeFromData and try our best here to.
-        This function unpacks the archive content to asset cache to normal cache files
-        and provides the sub asset data via GetSubAssetData and GetSubAssetDiskSource. */
+        This function indexes the files of the archive, and if extracting, unpacks them to the asset cache to normal cache files.
+        The sub asset data is provided via GetSubAssetData and GetSubAssetDiskSource. */
     virtual bool DeserializeFromDiskSource();
 
     /// IAssetBundle override.
-    /** @todo If we must support this in memory method with zzip 
+    /** @todo If we must support this in memory method with zzip
         we could store the data to disk and open it. Be sure to change RequiresDiskSource to false.
         @return Currently not applicable, so false always. */
     virtual bool DeserializeFromData(const u8 *data, size_t numBytes);
@@ -45,30 +55,47 @@ public:
     virtual std::vector<u8> GetSubAssetData(const QString &subAssetName);
 
     /// IAssetBundle override.
+    /** @return The cache file of the sub asset if the files are extracted, otherwise an empty string. */
     virtual QString GetSubAssetDiskSource(const QString &subAssetName);
-    
+
 private slots:
     /// Returns full asset reference for a sub asset.
     QString GetFullAssetReference(const QString &subAssetName);
-    
+
     /// Handler for asynch loading completion.
     void OnAsynchLoadCompleted(bool successful);
-    
+
 private:
     /// IAssetBundle override.
     virtual void DoUnload();
 
+    /// Reads the file list of the zip from its central directory. The archive must be mapped.
+    bool ReadCentralDirectory();
+
+    /// Reads the contents of a file from the archive.
+    bool ReadFile(const ZipArchiveFile &file, std::vector<u8> &data);
+
     /// Closes zip file.
     void Close();
-    
-    /// Zziplib ptr to the zip file.
+
+    /// Zziplib ptr to the zip file. Opened when the first deflated file is read.
     zzip_dir *archive_;
-    
+
+    /// The zip file, and its contents mapped to memory if the files are read from the archive.
+    QFile archiveFile_;
+    const uchar *mapped_;
+
     /// Zip sub assets.
     ZipFileList files_;
 
+    /// Indices of the sub assets in files_, keyed by their lowercase relative paths.
+    QHash<QString, int> fileIndices_;
+
     /// Count of files inside this zip.
     int fileCount_;
+
+    /// Are the files extracted to the asset cache.
+    bool extractToCache_;
 };
 
 typedef shared_ptr<ZipAssetBundle> ArchiveAssetPtr;
@@ -5,6 +5,7 @@
 #include <QObject>
 #include <QRunnable>
 #include <QString>
+#include <QByteArray>
 #include <QDateTime>
 #include <QList>
 
@@ -13,7 +14,10 @@ struct zzip_dir;
 struct ZipArchiveFile
 {
     QString relativePath;
+    QByteArray archiveName; ///< The name of the file as stored in the zip.
     QString cachePath;
+    uint compressionMethod; ///< 0 if stored, 8 if deflated.
+    uint localHeaderOffset; ///< Offset of the local file header from the start of the zip.
     uint compressedSize;
     uint uncompressedSize;
     QDateTime lastModified;
@@ -1892,12 +1892,14 @@ void TimeProfilerWindow::RefreshOgreSceneComplexityPage()
         // Get Ogre meshes from terrain EC
         else if (terrain)
         {
+            // The patches of a terrain chunk share the same node, so count each node once.
+            std::set<Ogre::SceneNode*> terrain_nodes;
             for(uint y=0; y<terrain->PatchHeight(); ++y)
             {
                 for(uint x=0; x<terrain->PatchWidth(); ++x)
                 {
                     Ogre::SceneNode *node = terrain->GetPatch(static_cast<int>(x), static_cast<int>(y)).node;
-                    if (!node)
+                    if (!node || !terrain_nodes.insert(node).second)
                         continue;
                     if (!node->numAttachedObjects())
                         continue;
@@ -10,9 +10,11 @@
 
 #include "JavascriptInstance.h"
 #include "JavascriptModule.h"
+#include "ScriptExecutionMonitor.h"
 #include "ScriptMetaTypeDefines.h"
 #include "ScriptCoreTypeDefines.h"
 #include "EC_Script.h"
+#include "Entity.h"
 #include "ScriptAsset.h"
 #include "AssetAPI.h"
 #include "Application.h"
@@ -35,6 +37,7 @@ Q_DECLARE_METATYPE(QScriptClass*)
 
 JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     sourceFile(fileName),
     module_(module),
     evaluated(false)
@@ -45,6 +48,7 @@ JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule
 
 JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
     evaluated(false)
 {
@@ -58,6 +62,7 @@ JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModul
 
 JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
     evaluated(false)
 {
@@ -92,7 +97,7 @@ QMap<QString, uint> JavascriptInstance::DumpEngineInformation()
     uint qobjCount = 0;
     uint qobjMethodCount = 0;   
 
-    GetObjectInformation(engine_->globalObject(), ids, valueCount, objectCount, nullCount, numberCount, boolCount, stringCount, arrayCount, funcCount, qobjCount, qobjMethodCount);
+    GetObjectInformation(GlobalScope(), ids, valueCount, objectCount, nullCount, numberCount, boolCount, stringCount, arrayCount, funcCount, qobjCount, qobjMethodCount);
 
     QMap<QString, uint> dump;
     dump["QScriptValues"] = valueCount;
@@ -176,11 +181,7 @@ void JavascriptInstance::Load()
 
     // Determine based on code origin whether it can be trusted with system access or not
     if (useAssetAPI)
-    {
-        trusted_ = true;
-        for(unsigned i = 0; i < scriptRefs_.size(); ++i)
-            trusted_ = trusted_ && scriptRefs_[i]->IsTrusted();
-    }
+        trusted_ = IsSourceTrusted();
     else // Local file: always trusted.
     {
         program_ = LoadScript(sourceFile);
@@ -207,6 +208,91 @@ void JavascriptInstance::Load()
     }
 }
 
+bool JavascriptInstance::IsSourceTrusted() const
+{
+    // Local files are always trusted.
+    for(size_t i = 0; i < scriptRefs_.size(); ++i)
+        if (!scriptRefs_[i]->IsTrusted())
+            return false;
+    return true;
+}
+
+QScriptValue JavascriptInstance::GlobalScope() const
+{
+    if (sharedEngine_)
+        return scope_;
+    return engine_ ? engine_->globalObject() : QScriptValue();
+}
+
+QString JavascriptInstance::Name() const
+{
+    QString name = sourceFile;
+    if (!scriptRefs_.empty())
+    {
+        name = scriptRefs_[0]->Name();
+        if (scriptRefs_.size() > 1)
+            name += QString(" (+%1 more)").arg(scriptRefs_.size() - 1);
+    }
+    ComponentPtr owner = owner_.lock();
+    if (owner && owner->ParentEntity())
+        name = owner->ParentEntity()->ToString() + " " + name;
+    return name;
+}
+
+void JavascriptInstance::AddSignalConnection(const QScriptValue &signal, const QScriptValueList &arguments)
+{
+    SignalConnection connection;
+    connection.signal = signal;
+    connection.arguments = arguments;
+    signalConnections_.push_back(connection);
+}
+
+void JavascriptInstance::RemoveSignalConnection(const QScriptValue &signal, const QScriptValueList &arguments)
+{
+    for(std::vector<SignalConnection>::iterator iter = signalConnections_.begin(); iter != signalConnections_.end(); ++iter)
+    {
+        if (!iter->signal.strictlyEquals(signal) || iter->arguments.size() != arguments.size())
+            continue;
+        bool equal = true;
+        for(int i = 0; i < arguments.size() && equal; ++i)
+            equal = iter->arguments[i].strictlyEquals(arguments[i]);
+        if (equal)
+        {
+            signalConnections_.erase(iter);
+            return;
+        }
+    }
+}
+
+void JavascriptInstance::DisconnectSignals()
+{
+    // Take the list first, so that the disconnects below do not modify it while it is being iterated.
+    std::vector<SignalConnection> connections;
+    connections.swap(signalConnections_);
+    for(size_t i = 0; i < connections.size(); ++i)
+    {
+        connections[i].signal.property("disconnect").call(connections[i].signal, connections[i].arguments);
+        // The connection is already gone if the sender was deleted, or if the script disconnected it through another signal object.
+        if (engine_->hasUncaughtException())
+            engine_->clearExceptions();
+    }
+}
+
+QScriptValue JavascriptInstance::Evaluate(const QString &program, const QString &fileName)
+{
+    if (!sharedEngine_)
+        return engine_->evaluate(program, fileName);
+
+    // Evaluate in a context that has the scope of this instance as its activation object. The declarations of the script then go
+    // to the scope instead of the global object, and the functions the script defines resolve names through the scope when called later.
+    QScriptContext *context = engine_->pushContext();
+    context->setActivationObject(scope_);
+    context->setThisObject(scope_);
+    QScriptValue result = engine_->evaluate(module_->CompiledProgram(program, fileName));
+    engine_->popContext();
+    return result;
+}
+
 QString JavascriptInstance::LoadScript(const QString &fileName)
 {
     PROFILE(JSInstance_LoadScript);
@@ -304,7 +390,7 @@ void JavascriptInstance::Run()
         QString scriptSourceFilename = (useAssets ? scriptRefs_[i]->Name() : sourceFile);
         QString &scriptContent = (useAssets ? scriptRefs_[i]->scriptContent : program_);
 
-        QScriptValue result = engine_->evaluate(scriptContent, scriptSourceFilename);
+        QScriptValue result = Evaluate(scriptContent, scriptSourceFilename);
         CheckAndPrintException("In run/evaluate: ", result);
     }
     
@@ -326,7 +412,7 @@ bool JavascriptInstance::RegisterService(QObject *serviceObject, const QString &
     }
 
     QScriptValue scriptValue = engine_->newQObject(serviceObject);
-    engine_->globalObject().setProperty(name, scriptValue);
+    GlobalScope().setProperty(name, scriptValue);
     return true;
 }
 
@@ -459,17 +545,33 @@ void JavascriptInstance::CreateEngine()
 {
     if (engine_)
         DeleteEngine();
-    engine_ = new QScriptEngine;
-    connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
+
+    // Untrusted scripts always get an engine of their own, as in the shared engine they could reach whatever the trusted scripts have imported.
+    sharedEngine_ = module_->SharedEngineEnabled() && IsSourceTrusted();
+    if (sharedEngine_)
+    {
+        engine_ = module_->SharedEngine();
+        scope_ = engine_->newObject();
+    }
+    else
+    {
+        engine_ = new QScriptEngine;
+        connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
 //#ifndef QT_NO_SCRIPTTOOLS
-//    debugger_ = new QScriptEngineDebugger();
-//    debugger.attachTo(engine_);
-////  debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
+//        debugger_ = new QScriptEngineDebugger();
+//        debugger.attachTo(engine_);
+////      debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
 //#endif
 
-    ExposeQtMetaTypes(engine_);
-    ExposeCoreTypes(engine_);
-    ExposeCoreApiMetaTypes(engine_);
+        ExposeQtMetaTypes(engine_);
+        ExposeCoreTypes(engine_);
+        ExposeCoreApiMetaTypes(engine_);
+        module_->AttachExecutionMonitor(engine_);
+    }
+
+    ScriptExecutionMonitor *monitor = dynamic_cast<ScriptExecutionMonitor *>(engine_->agent());
+    if (monitor)
+        monitor->AddInstance(this);
 
     EC_Script *ec = dynamic_cast<EC_Script *>(owner_.lock().get());
     module_->PrepareScriptInstance(this, ec);
@@ -482,7 +584,8 @@ void JavascriptInstance::DeleteEngine()
         return;
 
     program_ = "";
-    engine_->abortEvaluation();
+    if (!sharedEngine_) // Aborting the shared engine would abort the other scripts too.
+        engine_->abortEvaluation();
 
     // As a convention, we call a function 'OnScriptDestroyed' for each JS script
     // so that they can clean up their data before the script is removed from the object,
@@ -490,14 +593,25 @@ void JavascriptInstance::DeleteEngine()
     
     emit ScriptUnloading();
     
-    QScriptValue destructor = engine_->globalObject().property("OnScriptDestroyed");
+    QScriptValue destructor = GlobalScope().property("OnScriptDestroyed");
     if (!destructor.isUndefined())
     {
-        QScriptValue result = destructor.call();
+        QScriptValue result = destructor.call(GlobalScope());
         CheckAndPrintException("In script destructor: ", result);
     }
+
+    ScriptExecutionMonitor *monitor = dynamic_cast<ScriptExecutionMonitor *>(engine_->agent());
+    if (monitor)
+        monitor->RemoveInstance(this);
     
-    SAFE_DELETE(engine_);
+    if (sharedEngine_)
+    {
+        DisconnectSignals();
+        scope_ = QScriptValue();
+        engine_ = 0;
+    }
+    else
+        SAFE_DELETE(engine_);
     //SAFE_DELETE(debugger_);
 }
 
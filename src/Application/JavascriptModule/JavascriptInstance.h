@@ -12,6 +12,8 @@
 #include "AssetFwd.h"
 #include "JavascriptFwd.h"
 
+#include <QScriptValue>
+
 //#include <QtScript>
 //#ifndef QT_NO_SCRIPTTOOLS
 //#include <QScriptEngineDebugger>
@@ -20,6 +22,13 @@
 class JavascriptModule;
 
 /// Javascript script instance used wit EC_Script.
+/** Normally each instance has a script engine of its own. When the shared script engine is enabled (--sharedScriptEngine), trusted
+    instances instead run in the engine of the JavascriptModule, each in a scope object of its own: the variables and functions the
+    scripts declare, and the services registered to them, are properties of the scope, which lies in front of the global object of the
+    shared engine. The bindings of the core types are then created only once, and the compiled programs are cached by the module.
+    The signal connections a script makes with connect() in the shared engine are recorded, and disconnected when it is unloaded.
+    @note In the shared engine, a value assigned to an undeclared variable goes to the global object and is seen by all the scripts,
+    and the connections made from C++ on behalf of a script, for example with qScriptConnect, stay in place after it is unloaded. */
 class JavascriptInstance : public IScriptInstance
 {
     Q_OBJECT
@@ -59,6 +68,13 @@ public:
     //void SetPrototype(QScriptable *prototype, );
     QScriptEngine* Engine() const { return engine_; }
 
+    /// Returns the object that holds the global variables of this script instance.
+    /** This is the scope object of the instance if it runs in the shared engine, otherwise the global object of its engine. */
+    QScriptValue GlobalScope() const;
+
+    /// Returns true if this instance runs in the shared script engine of the JavascriptModule.
+    bool UsesSharedEngine() const { return sharedEngine_; }
+
     /// Sets owner (EC_Script) component.
     /** @param owner Owner component. */
     void SetOwner(const ComponentPtr &owner) { owner_ = owner; }
@@ -66,6 +82,17 @@ public:
     /// Return owner component
     ComponentWeakPtr Owner() const { return owner_; }
 
+    /// Returns a name that identifies this instance in the logs: the entity of the owner component, if any, and the script file.
+    QString Name() const;
+
+    /// Records a signal connection the script made in the shared engine, so that it can be disconnected when the script is unloaded.
+    /** @param signal The signal function connect was called on.
+        @param arguments The arguments of the connect call. */
+    void AddSignalConnection(const QScriptValue &signal, const QScriptValueList &arguments);
+
+    /// Forgets a signal connection the script has disconnected in the shared engine.
+    void RemoveSignalConnection(const QScriptValue &signal, const QScriptValueList &arguments);
+
 public slots:
     /// Loads a given script in engine. This function can be used to create a property as you could include js-files.
     /** Multiple inclusion of same file is prevented. (by using simple string compare)
@@ -99,11 +126,30 @@ private:
     void DeleteEngine();
 
     QString LoadScript(const QString &fileName);
+
+    /// Returns true if all the script sources of this instance can be trusted with system access.
+    bool IsSourceTrusted() const;
+
+    /// Evaluates the given script in the scope of this instance.
+    QScriptValue Evaluate(const QString &program, const QString &fileName);
     
+    /// Disconnects the signal connections the script has made in the shared engine.
+    void DisconnectSignals();
+
     void GetObjectInformation(const QScriptValue &object, QSet<qint64> &ids, uint &valueCount, uint &objectCount, uint &nullCount, uint &numberCount, 
         uint &boolCount, uint &stringCount, uint &arrayCount, uint &funcCount, uint &qobjCount, uint &qobjMethodCount);
         
-    QScriptEngine *engine_; ///< Qt script engine.
+    QScriptEngine *engine_; ///< Qt script engine. Owned by the JavascriptModule if sharedEngine_ is true.
+    bool sharedEngine_; ///< Does this instance run in the shared script engine.
+    QScriptValue scope_; ///< The scope object of this instance in the shared script engine.
+
+    /// A signal connection made by the script in the shared script engine.
+    struct SignalConnection
+    {
+        QScriptValue signal; ///< The signal function connect was called on.
+        QScriptValueList arguments; ///< The handler function, optionally preceded by its this object.
+    };
+    std::vector<SignalConnection> signalConnections_; ///< The connections to disconnect when the script is unloaded from the shared engine.
 
     // The script content for a JavascriptInstance is loaded either using the Asset API or 
     // using an absolute path name from the local file system.
@@ -35,18 +35,125 @@
 #include <QtScript>
 #include <QDomElement>
 
+#include <algorithm>
+
 #include "StaticPluginRegistry.h"
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+/// The scripts are compiled again whenever their assets change, so the program cache is emptied when it grows this large.
+const int cMaxCachedScriptPrograms = 512;
+
+/// A script that keeps exceeding the soft budget is warned about at most once in this many seconds.
+const double cScriptBudgetWarningInterval = 5.0;
+
+/// Returns the script time budget in milliseconds given with the command line parameter, or zero if none was given.
+float ReadScriptBudget(Framework *framework, const QString &parameter)
+{
+    QStringList values = framework->CommandLineParameters(parameter);
+    if (values.isEmpty())
+        return 0.f;
+    bool ok;
+    float budget = values.first().toFloat(&ok);
+    if (!ok || budget < 0.f)
+    {
+        LogWarning("Erroneous script time budget given with " + parameter + ": " + values.first() + ". Ignoring.");
+        return 0.f;
+    }
+    return budget;
+}
+
+bool ScriptTotalTimeGreater(const ScriptExecutionStats &a, const ScriptExecutionStats &b)
+{
+    return a.totalTime > b.totalTime;
+}
+
+/// Returns the script instance of the shared engine that the calling script code belongs to, or null if there is none.
+/** The functions a script defines have the scope object of its instance in their scope chain, as the script is evaluated with the scope
+    as the activation object. The scope holds the instance itself as the "engine" service. */
+JavascriptInstance *CallingSharedEngineInstance(QScriptContext *context)
+{
+    for(QScriptContext *caller = context->parentContext(); caller; caller = caller->parentContext())
+        foreach(const QScriptValue &scope, caller->scopeChain())
+        {
+            JavascriptInstance *instance = qobject_cast<JavascriptInstance *>(scope.property("engine").toQObject());
+            if (instance && instance->GlobalScope().strictlyEquals(scope))
+                return instance;
+        }
+    return 0;
+}
+
+QScriptValueList CallArguments(QScriptContext *context)
+{
+    QScriptValueList arguments;
+    for(int i = 0; i < context->argumentCount(); ++i)
+        arguments << context->argument(i);
+    return arguments;
+}
+
+/// Replaces Function.prototype.connect in the shared engine, recording the connections to the instance of the calling script.
+QScriptValue TrackedSignalConnect(QScriptContext *context, QScriptEngine *engine)
+{
+    const QScriptValueList arguments = CallArguments(context);
+    QScriptValue result = context->callee().data().call(context->thisObject(), arguments);
+    if (!engine->hasUncaughtException())
+    {
+        JavascriptInstance *instance = CallingSharedEngineInstance(context);
+        if (instance)
+            instance->AddSignalConnection(context->thisObject(), arguments);
+    }
+    return result;
+}
+
+/// Replaces Function.prototype.disconnect in the shared engine, forgetting the connections the calling script disconnects.
+QScriptValue TrackedSignalDisconnect(QScriptContext *context, QScriptEngine *engine)
+{
+    const QScriptValueList arguments = CallArguments(context);
+    QScriptValue result = context->callee().data().call(context->thisObject(), arguments);
+    if (!engine->hasUncaughtException())
+    {
+        JavascriptInstance *instance = CallingSharedEngineInstance(context);
+        if (instance)
+            instance->RemoveSignalConnection(context->thisObject(), arguments);
+    }
+    return result;
+}
+
+/// Wraps the given function of Function.prototype with a native function that gets the original one as its data.
+void WrapFunctionPrototypeMethod(QScriptEngine *engine, const QString &name, QScriptEngine::FunctionSignature wrapper)
+{
+    QScriptValue functionPrototype = engine->globalObject().property("Function").property("prototype");
+    QScriptValue original = functionPrototype.property(name);
+    if (!original.isFunction())
+    {
+        LogWarning("JavascriptModule: Function.prototype." + name + " not found, signal connections of the scripts in the shared script engine are not tracked.");
+        return;
+    }
+    QScriptValue tracked = engine->newFunction(wrapper);
+    tracked.setData(original);
+    functionPrototype.setProperty(name, tracked);
+}
+
+}
+
 JavascriptModule::JavascriptModule() :
     IModule("Javascript"),
-    engine(new QScriptEngine(this))
+    engine(new QScriptEngine(this)),
+    sharedEngine(0),
+    sharedEngineEnabled(false),
+    executionMonitoring(false),
+    softBudget(0.f),
+    hardBudget(0.f)
 {
 }
 
 JavascriptModule::~JavascriptModule()
 {
+    programCache.clear();
+    SAFE_DELETE(sharedEngine);
     SAFE_DELETE(engine);
 }
 
@@ -72,6 +179,11 @@ void JavascriptModule::Initialize()
 
     RegisterCoreMetaTypes();
 
+    sharedEngineEnabled = framework_->HasCommandLineParameter("--sharedScriptEngine");
+    softBudget = ReadScriptBudget(framework_, "--scriptSoftBudget");
+    hardBudget = ReadScriptBudget(framework_, "--scriptHardBudget");
+    executionMonitoring = framework_->HasCommandLineParameter("--scriptProfiling") || softBudget > 0.f || hardBudget > 0.f;
+
     framework_->Console()->RegisterCommand(
         "JsExec", "Execute given code in the embedded Javascript interpreter. Usage: JsExec(mycodestring)",
         this, SLOT(RunString(const QString &)));
@@ -88,6 +200,14 @@ void JavascriptModule::Initialize()
         "JsDumpInfo", "Dumps all EC_Script information to console",
         this, SLOT(DumpScriptInfo()));
 
+    framework_->Console()->RegisterCommand(
+        "JsProfile", "Prints the time each script has spent executing, the most time consuming first. Requires --scriptProfiling.",
+        this, SLOT(DumpScriptProfile()));
+
+    framework_->Console()->RegisterCommand(
+        "JsProfileReset", "Clears the accumulated script execution times.",
+        this, SLOT(ResetScriptProfile()));
+
     // Initialize startup scripts
     LoadStartupScripts();
 
@@ -151,6 +271,43 @@ void JavascriptModule::DumpScriptInfo()
     }
 }
 
+void JavascriptModule::DumpScriptProfile()
+{
+    if (!executionMonitoring)
+    {
+        LogInfo("Script profiling is not enabled. Start with --scriptProfiling to enable it.");
+        return;
+    }
+    if (executionStats.empty())
+    {
+        LogInfo("No script calls recorded.");
+        return;
+    }
+
+    // Each script instance is printed on its own line, even if several instances run the same script.
+    std::vector<ScriptExecutionStats> sorted = executionStats;
+    std::sort(sorted.begin(), sorted.end(), ScriptTotalTimeGreater);
+
+    for(size_t i = 0; i < sorted.size(); ++i)
+    {
+        const ScriptExecutionStats &stats = sorted[i];
+        QString statsStr = QString("calls %1 total %2 ms avg %3 ms max %4 ms")
+            .arg(stats.calls).arg(stats.totalTime, 0, 'f', 2).arg(stats.calls > 0 ? stats.totalTime / stats.calls : 0.0, 0, 'f', 3)
+            .arg(stats.maxTime, 0, 'f', 2);
+        if (stats.overBudget > 0)
+            statsStr += QString(" over budget %1").arg(stats.overBudget);
+        if (stats.aborted > 0)
+            statsStr += QString(" aborted %1").arg(stats.aborted);
+        LogInfo(stats.name + " { " + statsStr + " }");
+    }
+}
+
+void JavascriptModule::ResetScriptProfile()
+{
+    executionStats.clear();
+    executionStatsIndices.clear();
+}
+
 void JavascriptModule::RunScript(const QString &scriptFileName)
 {
     QFile scriptFile(scriptFileName);
@@ -370,7 +527,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalScope();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -384,7 +541,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     const QString& appAndClassName = instance->className.Get();
-    QScriptValue constructor = appEngine->globalObject().property(className);
+    QScriptValue constructor = globalObject.property(className);
     QScriptValue object;
     if (constructor.isFunction())
     {
@@ -424,8 +581,7 @@ void JavascriptModule::RemoveScriptObject(EC_Script* instance)
     if (!jsInstance || !jsInstance->IsEvaluated())
         return;
     
-    QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalScope();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -489,11 +645,10 @@ void JavascriptModule::CreateScriptObjects(EC_Script* app)
 
 void JavascriptModule::RemoveScriptObjects(JavascriptInstance* jsInstance)
 {
-    QScriptEngine* appEngine = jsInstance->Engine();
-    if (!appEngine)
+    if (!jsInstance->Engine())
         return;
     
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalScope();
     
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -659,31 +814,121 @@ void JavascriptModule::UnloadStartupScripts()
     startupScripts_.clear();
 }
 
-void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
+void JavascriptModule::ConnectScriptEngineCreatedHandlers()
 {
-    PROFILE(JSModule_PrepareScriptInstance);
     static std::set<QObject*> checked;
-    
-    // Register framework's dynamic properties (service objects) and the framework itself to the script engine
+
     QList<QByteArray> properties = framework_->dynamicPropertyNames();
     for(QList<QByteArray>::size_type i = 0; i < properties.size(); ++i)
     {
-        QString name = properties[i];
-        QObject* serviceobject = framework_->property(name.toStdString().c_str()).value<QObject*>();
-        if (instance->RegisterService(serviceobject, name))
+        QObject* serviceobject = framework_->property(properties[i]).value<QObject*>();
+        if (serviceobject && checked.find(serviceobject) == checked.end())
         {
-            if (checked.find(serviceobject) == checked.end())
-            {
-                // Check if the service object has an OnScriptEngineCreated() slot, and give it a chance to perform further actions
-                const QMetaObject* meta = serviceobject->metaObject();
-                if (meta->indexOfSlot("OnScriptEngineCreated(QScriptEngine*)") != -1)
-                    QObject::connect(this, SIGNAL(ScriptEngineCreated(QScriptEngine*)), serviceobject, SLOT(OnScriptEngineCreated(QScriptEngine*)));
-                
-                checked.insert(serviceobject);
-            }
+            // Check if the service object has an OnScriptEngineCreated() slot, and give it a chance to perform further actions
+            const QMetaObject* meta = serviceobject->metaObject();
+            if (meta->indexOfSlot("OnScriptEngineCreated(QScriptEngine*)") != -1)
+                QObject::connect(this, SIGNAL(ScriptEngineCreated(QScriptEngine*)), serviceobject, SLOT(OnScriptEngineCreated(QScriptEngine*)));
+            
+            checked.insert(serviceobject);
         }
     }
+}
+
+QScriptEngine *JavascriptModule::SharedEngine()
+{
+    if (!sharedEngine)
+    {
+        PROFILE(JSModule_CreateSharedEngine);
+        sharedEngine = new QScriptEngine(this);
+        connect(sharedEngine, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSharedEngineSignalHandlerException(const QScriptValue &)));
 
+        ExposeQtMetaTypes(sharedEngine);
+        ExposeCoreTypes(sharedEngine);
+        ExposeCoreApiMetaTypes(sharedEngine);
+        AttachExecutionMonitor(sharedEngine);
+
+        // The connections of a script are not removed with an engine of its own, so track them for disconnecting when it is unloaded.
+        WrapFunctionPrototypeMethod(sharedEngine, "connect", TrackedSignalConnect);
+        WrapFunctionPrototypeMethod(sharedEngine, "disconnect", TrackedSignalDisconnect);
+
+        ConnectScriptEngineCreatedHandlers();
+        emit ScriptEngineCreated(sharedEngine);
+    }
+    return sharedEngine;
+}
+
+QScriptProgram JavascriptModule::CompiledProgram(const QString &program, const QString &fileName)
+{
+    const QPair<QString, QString> key(fileName, program);
+    QHash<QPair<QString, QString>, QScriptProgram>::const_iterator iter = programCache.find(key);
+    if (iter != programCache.end())
+        return iter.value();
+
+    if (programCache.size() >= cMaxCachedScriptPrograms)
+        programCache.clear();
+    // QScriptProgram compiles itself when first evaluated, and the copies share the compiled code.
+    QScriptProgram compiled(program, fileName);
+    programCache.insert(key, compiled);
+    return compiled;
+}
+
+void JavascriptModule::AttachExecutionMonitor(QScriptEngine *scriptEngine)
+{
+    // The engine takes the ownership of the agent.
+    if (executionMonitoring && !scriptEngine->agent())
+        scriptEngine->setAgent(new ScriptExecutionMonitor(scriptEngine, this));
+}
+
+void JavascriptModule::RecordScriptExecution(const JavascriptInstance *instance, const QString &name, double time, bool aborted)
+{
+    // The calls of unknown instances are accounted together, on a row of their own.
+    QHash<const JavascriptInstance *, size_t>::const_iterator iter = executionStatsIndices.find(instance);
+    if (iter == executionStatsIndices.end())
+    {
+        iter = executionStatsIndices.insert(instance, executionStats.size());
+        executionStats.push_back(ScriptExecutionStats());
+        executionStats.back().name = name;
+    }
+    ScriptExecutionStats &stats = executionStats[iter.value()];
+    ++stats.calls;
+    stats.totalTime += time;
+    stats.maxTime = std::max(stats.maxTime, time);
+    if (aborted)
+        ++stats.aborted;
+
+    if (softBudget > 0.f && time > softBudget)
+    {
+        ++stats.overBudget;
+        const tick_t now = GetCurrentClockTime();
+        if (stats.lastWarningTime == 0 || (double)(now - stats.lastWarningTime) / GetCurrentClockFreq() >= cScriptBudgetWarningInterval)
+        {
+            stats.lastWarningTime = now;
+            LogWarning("Script " + name + " took " + QString::number(time, 'f', 1) + " ms in one call, over the soft budget of " +
+                QString::number(softBudget) + " ms. " + QString::number(stats.overBudget) + " calls over the budget so far.");
+        }
+    }
+}
+
+void JavascriptModule::RetireScriptExecutionStats(const JavascriptInstance *instance)
+{
+    executionStatsIndices.remove(instance);
+}
+
+void JavascriptModule::OnSharedEngineSignalHandlerException(const QScriptValue& exception)
+{
+    LogError(exception.toString());
+    foreach(const QString &error, sharedEngine->uncaughtExceptionBacktrace())
+        LogError(error);
+    LogError("Line " + QString::number(sharedEngine->uncaughtExceptionLineNumber()) + ".");
+}
+
+void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
+{
+    PROFILE(JSModule_PrepareScriptInstance);
+    ConnectScriptEngineCreatedHandlers();
+
+    // Register framework's dynamic properties (service objects) and the framework itself to the script engine
+    QList<QByteArray> properties = framework_->dynamicPropertyNames();
     instance->RegisterService(framework_, "framework");
     instance->RegisterService(instance, "engine");
     
@@ -697,7 +942,9 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
         instance->RegisterService(comp->ParentScene(), "scene");
     }
 
-    emit ScriptEngineCreated(instance->Engine());
+    // The shared engine was announced when it was created.
+    if (!instance->UsesSharedEngine())
+        emit ScriptEngineCreated(instance->Engine());
 }
 
 extern "C"
@@ -12,8 +12,13 @@
 #include "AssetFwd.h"
 #include "SceneFwd.h"
 #include "JavascriptFwd.h"
+#include "ScriptExecutionMonitor.h"
 
 #include <QVariant>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QScriptProgram>
 
 class JavascriptInstance;
 
@@ -36,8 +41,43 @@ public:
         @param comp Script component, null by default. */
     void PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp = 0);
 
+    /// Returns true if the trusted script instances run in a single shared script engine. Enabled with --sharedScriptEngine.
+    bool SharedEngineEnabled() const { return sharedEngineEnabled; }
+
+    /// Returns the script engine shared by the script instances, creating it and the bindings of the core types on the first call.
+    QScriptEngine *SharedEngine();
+
+    /// Returns the compiled program of the given script source for the shared script engine.
+    /** The programs are cached by the source and the file name, so the scripts that are run many times, or by many EC_Scripts, are parsed only once. */
+    QScriptProgram CompiledProgram(const QString &program, const QString &fileName);
+
+    /// Installs a ScriptExecutionMonitor to the given script engine, if the script profiling or the script time budgets are enabled.
+    void AttachExecutionMonitor(QScriptEngine *scriptEngine);
+
+    /// Returns the time in milliseconds after which a call into a script is aborted, or zero if unlimited. Set with --scriptHardBudget.
+    float ScriptHardBudget() const { return hardBudget; }
+
+    /// Accounts a call into a script instance to its statistics, and warns if the call exceeded the soft budget (--scriptSoftBudget).
+    /** @param instance The script instance, or null if the instance of the call is not known.
+        @param name Name of the script instance, see JavascriptInstance::Name.
+        @param time Duration of the call in milliseconds.
+        @param aborted Whether the call was aborted for exceeding the hard budget. */
+    void RecordScriptExecution(const JavascriptInstance *instance, const QString &name, double time, bool aborted);
+
+    /// Keeps the statistics of a script instance that is being unloaded, but accounts the calls of any later instance separately.
+    void RetireScriptExecutionStats(const JavascriptInstance *instance);
+
+    /// Returns the accumulated execution times of the script instances, including the ones unloaded since the last reset.
+    const std::vector<ScriptExecutionStats> &ScriptExecutionStatistics() const { return executionStats; }
+
 public slots:
     void DumpScriptInfo();
+
+    /// Prints the accumulated execution times of the scripts, the most time consuming first.
+    void DumpScriptProfile();
+
+    /// Clears the accumulated execution times of the scripts.
+    void ResetScriptProfile();
     
     /// Executes js file.
     void RunScript(const QString &scriptFilename);
@@ -78,9 +118,25 @@ private:
     /// Remove script class instances for all EC_Scripts depending on this script application
     void RemoveScriptObjects(JavascriptInstance* jsInstance);
 
+    /// Connects the OnScriptEngineCreated() slots of the framework's dynamic service objects to ScriptEngineCreated(), if not already connected.
+    void ConnectScriptEngineCreatedHandlers();
+
     /// Default engine for console & commandline script execution
     QScriptEngine *engine;
 
+    /// The engine the trusted script instances run in, if the shared script engine is enabled. Created on first use.
+    QScriptEngine *sharedEngine;
+    bool sharedEngineEnabled;
+
+    /// The programs compiled for the shared script engine, keyed by the file name and the source.
+    QHash<QPair<QString, QString>, QScriptProgram> programCache;
+
+    bool executionMonitoring; ///< Are the script engines monitored, enabled by --scriptProfiling or by either of the budgets.
+    float softBudget; ///< Duration of a call into a script in milliseconds after which a warning is logged, or zero if unlimited.
+    float hardBudget; ///< Duration of a call into a script in milliseconds after which it is aborted, or zero if unlimited.
+    std::vector<ScriptExecutionStats> executionStats;
+    QHash<const JavascriptInstance *, size_t> executionStatsIndices; ///< Indices to executionStats of the loaded script instances.
+
     /// Engines for executing startup (possibly persistent) scripts
     std::vector<JavascriptInstance *> startupScripts_;
 
@@ -89,6 +145,7 @@ private slots:
     void LoadStartupScripts();
     void ScriptEvaluated();
     void ScriptUnloading();
+    void OnSharedEngineSignalHandlerException(const QScriptValue& exception);
 
     void SceneAdded(const QString &name);
     void ComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change);
@@ -0,0 +1,181 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in LICENSE
+ *
+ *  @file   ScriptExecutionMonitor.cpp
+ *  @brief  Measures the time the script instances spend executing, and enforces the script time budgets.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptExecutionMonitor.h"
+#include "JavascriptInstance.h"
+#include "JavascriptModule.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <QScriptEngine>
+#include <QScriptContext>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Reading the clock on every statement would slow the scripts down, so the hard budget is checked only once per this many statements.
+const uint cStatementsPerBudgetCheck = 64;
+
+}
+
+ScriptExecutionMonitor::ScriptExecutionMonitor(QScriptEngine *engine, JavascriptModule *module_) :
+    QScriptEngineAgent(engine),
+    module(module_),
+    depth(0),
+    callStartTime(0),
+    callInstance(0),
+    callAborted(false),
+    statementCounter(0)
+{
+}
+
+void ScriptExecutionMonitor::AddInstance(JavascriptInstance *instance)
+{
+    MonitoredInstance monitored;
+    monitored.instance = instance;
+    instances.push_back(monitored);
+    IndexInstances();
+}
+
+void ScriptExecutionMonitor::RemoveInstance(JavascriptInstance *instance)
+{
+    for(size_t i = 0; i < instances.size(); ++i)
+        if (instances[i].instance == instance)
+        {
+            instances.erase(instances.begin() + i);
+            IndexInstances();
+            break;
+        }
+    // An instance that is removed during its own call, e.g. by itself, is retired once the call has been recorded.
+    if (depth == 0 || callInstance != instance)
+        module->RetireScriptExecutionStats(instance);
+}
+
+void ScriptExecutionMonitor::IndexInstances()
+{
+    scopeIndices.clear();
+    for(size_t i = 0; i < instances.size(); ++i)
+        scopeIndices[instances[i].instance->GlobalScope().objectId()] = (int)i;
+    calleeIndices.clear();
+}
+
+void ScriptExecutionMonitor::functionEntry(qint64 /*scriptId*/)
+{
+    if (depth++ > 0)
+        return;
+
+    const int index = CurrentInstance();
+    callInstance = index >= 0 ? instances[index].instance : 0;
+    callName = index >= 0 ? InstanceName(index) : QString("(unknown script)");
+    callAborted = false;
+    statementCounter = 0;
+#ifdef PROFILING
+    Profiler *p = Framework::Instance() ? Framework::Instance()->GetProfiler() : 0;
+    if (p)
+        p->StartBlock(("JS " + callName).toStdString());
+#endif
+    callStartTime = GetCurrentClockTime();
+}
+
+void ScriptExecutionMonitor::functionExit(qint64 /*scriptId*/, const QScriptValue & /*returnValue*/)
+{
+    if (depth == 0) // The monitor was attached in the middle of a call.
+        return;
+    if (--depth == 0)
+        EndCall();
+}
+
+void ScriptExecutionMonitor::positionChange(qint64 /*scriptId*/, int /*lineNumber*/, int /*columnNumber*/)
+{
+    const float hardBudget = module->ScriptHardBudget();
+    if (depth == 0 || callAborted || hardBudget <= 0.f || ++statementCounter % cStatementsPerBudgetCheck != 0)
+        return;
+
+    const double elapsed = (GetCurrentClockTime() - callStartTime) * 1000.0 / GetCurrentClockFreq();
+    if (elapsed > hardBudget)
+    {
+        callAborted = true;
+        LogError("Script " + callName + " has been running for " + QString::number(elapsed, 'f', 1) + " ms, over the hard budget of " +
+            QString::number(hardBudget) + " ms. Aborting it.");
+        engine()->abortEvaluation();
+    }
+}
+
+int ScriptExecutionMonitor::CurrentInstance()
+{
+    if (instances.size() == 1)
+        return 0;
+
+    QScriptContext *context = engine()->currentContext();
+    if (!context)
+        return -1;
+    const QScriptValue callee = context->callee();
+    const qint64 calleeId = callee.isFunction() ? callee.objectId() : -1;
+    if (calleeId != -1)
+    {
+        QHash<qint64, CalleeInstance>::const_iterator iter = calleeIndices.find(calleeId);
+        if (iter != calleeIndices.end())
+            return iter.value().index;
+    }
+
+    // In the shared engine, the functions of an instance find its scope object in their scope chain.
+    int index = -1;
+    QScriptValueList scopeChain = context->scopeChain();
+    for(int i = 0; i < scopeChain.size() && index < 0; ++i)
+    {
+        QHash<qint64, int>::const_iterator iter = scopeIndices.find(scopeChain[i].objectId());
+        if (iter != scopeIndices.end())
+            index = iter.value();
+    }
+    if (calleeId != -1)
+    {
+        CalleeInstance cached;
+        cached.callee = callee;
+        cached.index = index;
+        calleeIndices[calleeId] = cached;
+    }
+    return index;
+}
+
+QString ScriptExecutionMonitor::InstanceName(int index)
+{
+    // The owner of an instance is set after its engine is created, so the name is looked up on the first call.
+    MonitoredInstance &monitored = instances[index];
+    if (monitored.name.isEmpty())
+        monitored.name = monitored.instance->Name();
+    return monitored.name;
+}
+
+void ScriptExecutionMonitor::EndCall()
+{
+    const double elapsed = (GetCurrentClockTime() - callStartTime) * 1000.0 / GetCurrentClockFreq();
+    // Recording the call may log, which may invoke the scripts again, so the state of the call is copied first.
+    JavascriptInstance *instance = callInstance;
+    const QString name = callName;
+    const bool aborted = callAborted;
+#ifdef PROFILING
+    Profiler *p = Framework::Instance() ? Framework::Instance()->GetProfiler() : 0;
+    if (p)
+        p->EndBlock(("JS " + name).toStdString());
+#endif
+    module->RecordScriptExecution(instance, name, elapsed, aborted);
+
+    if (instance)
+    {
+        bool monitored = false;
+        for(size_t i = 0; i < instances.size() && !monitored; ++i)
+            monitored = instances[i].instance == instance;
+        if (!monitored)
+            module->RetireScriptExecutionStats(instance);
+    }
+}
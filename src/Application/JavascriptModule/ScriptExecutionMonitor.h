@@ -0,0 +1,108 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in LICENSE
+ *
+ *  @file   ScriptExecutionMonitor.h
+ *  @brief  Measures the time the script instances spend executing, and enforces the script time budgets.
+ */
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <QScriptEngineAgent>
+#include <QScriptValue>
+#include <QString>
+#include <QHash>
+
+#include <vector>
+
+class JavascriptInstance;
+class JavascriptModule;
+
+/// Accumulated execution time of one script instance, see JavascriptModule::ScriptExecutionStatistics.
+struct ScriptExecutionStats
+{
+    ScriptExecutionStats() : calls(0), totalTime(0.0), maxTime(0.0), overBudget(0), aborted(0), lastWarningTime(0) {}
+
+    QString name; ///< Name of the script instance when its first call was recorded, see JavascriptInstance::Name.
+    u64 calls; ///< Number of calls made into the script from C++.
+    double totalTime; ///< Total time spent in the calls, in milliseconds.
+    double maxTime; ///< Time spent in the slowest call, in milliseconds.
+    uint overBudget; ///< Number of calls that exceeded the soft budget.
+    uint aborted; ///< Number of calls aborted for exceeding the hard budget.
+    tick_t lastWarningTime; ///< When the last soft budget warning of this script was logged.
+};
+
+/// Measures the time the script instances spend executing in a script engine, and enforces the script time budgets.
+/** The monitor is installed as the agent of a script engine by JavascriptModule::AttachExecutionMonitor. Each call the engine receives
+    from C++, such as a signal handler invocation or the evaluation of a script, is timed from its entry to the outermost script function
+    to the exit from it, and is attributed to the instance whose scope the function runs in. The calls nested in it are counted in the
+    outermost call.
+
+    A call that takes longer than the soft budget is reported with a warning. A call that runs longer than the hard budget is aborted
+    with QScriptEngine::abortEvaluation() when it next executes a script statement, so a call stuck in a native function
+    is aborted only after that returns.
+    @note Installing an agent disables some of the optimizations of the script engine, so the monitor is attached only when
+    the script profiling or the budgets are enabled from the command line. */
+class ScriptExecutionMonitor : public QScriptEngineAgent
+{
+public:
+    ScriptExecutionMonitor(QScriptEngine *engine, JavascriptModule *module);
+
+    /// Adds a script instance that runs in the monitored engine.
+    void AddInstance(JavascriptInstance *instance);
+
+    /// Removes a script instance. Called when the instance leaves the engine. Its statistics are kept in the module.
+    void RemoveInstance(JavascriptInstance *instance);
+
+    /// QScriptEngineAgent override.
+    void functionEntry(qint64 scriptId);
+
+    /// QScriptEngineAgent override.
+    void functionExit(qint64 scriptId, const QScriptValue &returnValue);
+
+    /// QScriptEngineAgent override.
+    void positionChange(qint64 scriptId, int lineNumber, int columnNumber);
+
+private:
+    /// Returns the index of the instance that the current function runs in, or -1 if not known.
+    int CurrentInstance();
+
+    /// Returns the name under which the calls of the given instance are reported.
+    QString InstanceName(int index);
+
+    /// Recreates scopeIndices and clears calleeIndices. Called when the instances change.
+    void IndexInstances();
+
+    /// Ends the measured call and reports it to the module.
+    void EndCall();
+
+    JavascriptModule *module;
+
+    struct MonitoredInstance
+    {
+        JavascriptInstance *instance;
+        QString name;
+    };
+    std::vector<MonitoredInstance> instances;
+
+    /// Indices to instances, keyed by the object IDs of the scope objects of the instances.
+    QHash<qint64, int> scopeIndices;
+
+    struct CalleeInstance
+    {
+        QScriptValue callee; ///< Holds the function, so that its object ID is not reused while it is cached.
+        int index;
+    };
+    /// The instances that the outermost functions called so far run in, keyed by the object IDs of the functions.
+    /** A signal handler is usually the same function on every call, so its scope chain only needs to be looked up once. */
+    QHash<qint64, CalleeInstance> calleeIndices;
+
+    int depth; ///< Depth of the script function calls in the engine. The measured call is the one at depth 1.
+    tick_t callStartTime;
+    JavascriptInstance *callInstance; ///< The instance the measured call is accounted to, or null if not known.
+    QString callName; ///< The name of the instance of the measured call, for the log and the profiler.
+    bool callAborted;
+    uint statementCounter; ///< Used for checking the hard budget only every few statements.
+};
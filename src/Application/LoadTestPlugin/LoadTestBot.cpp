@@ -0,0 +1,460 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "LoadTestBot.h"
+
+#include "TundraMessages.h"
+#include "MsgLogin.h"
+#include "MsgLoginReply.h"
+#include "EC_DynamicComponent.h"
+#include "IAttribute.h"
+#include "CoreStringUtils.h"
+#include "LoggingFunctions.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+#include "Math/MathFunc.h"
+
+#include <kNet.h>
+
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Entity and component ID the bot uses for its entity before the server assigns the real ones.
+const entity_id_t cLocalEntityId = 1;
+const component_id_t cLocalComponentId = 1;
+
+/// Seconds between camera updates, the same as the interval of Client after the initial update.
+const float cCameraUpdateInterval = 0.5f;
+
+/// Radius of the circle the bots move on.
+const float cMoveRadius = 20.f;
+
+}
+
+const char * const LoadTestBot::cComponentName = "LoadTestBot";
+
+LoadTestBotStats::LoadTestBotStats() :
+    messagesIn(0),
+    messagesOut(0),
+    bytesIn(0),
+    bytesOut(0),
+    connectTime(-1.f),
+    loginTime(-1.f),
+    editsSent(0),
+    editsReceived(0)
+{
+}
+
+LoadTestBot::LoadTestBot(int index, tick_t testStartTime, float editInterval) :
+    index_(index),
+    state_(Disconnected),
+    testStartTime_(testStartTime),
+    editInterval_(editInterval),
+    nextEditTime_(0.f),
+    nextCameraTime_(0.f),
+    entityId_(0),
+    componentId_(0)
+{
+}
+
+LoadTestBot::~LoadTestBot()
+{
+    if (connection_)
+        connection_->Close(0);
+}
+
+bool LoadTestBot::Connect(kNet::Network &network, const char *address, unsigned short port, kNet::SocketTransportLayer transport)
+{
+    connection_ = network.Connect(address, port, transport, this);
+    if (!connection_)
+    {
+        LogError(QString("LoadTestBot%1: Unable to connect to %2:%3").arg(index_).arg(address).arg(port));
+        state_ = Failed;
+        return false;
+    }
+
+    if (transport == kNet::SocketOverUDP)
+        dynamic_cast<kNet::UDPMessageConnection*>(connection_.ptr())->SetDatagramSendRate(500);
+    if (connection_->GetSocket() && connection_->GetSocket()->TransportLayer() == kNet::SocketOverTCP)
+        connection_->GetSocket()->SetNaglesAlgorithmEnabled(false);
+
+    state_ = Connecting;
+    return true;
+}
+
+void LoadTestBot::Update()
+{
+    if (!connection_)
+        return;
+
+    try
+    {
+        connection_->Process();
+    }
+    catch(kNet::NetException &e)
+    {
+        LogError(QString("LoadTestBot%1: Failed to process messages: %2").arg(index_).arg(e.what()));
+        state_ = Failed;
+    }
+
+    if (connection_->GetConnectionState() == kNet::ConnectionClosed || (!connection_->IsReadOpen() && connection_->IsWriteOpen()))
+    {
+        if (state_ != Failed)
+            LogWarning(QString("LoadTestBot%1: Connection lost").arg(index_));
+        connection_->Close(0);
+        connection_ = 0;
+        state_ = Failed;
+        return;
+    }
+
+    if (state_ == Connecting && connection_->GetConnectionState() == kNet::ConnectionOK)
+    {
+        stats_.connectTime = Elapsed();
+        SendLogin();
+        state_ = LoggingIn;
+    }
+
+    if (state_ == Editing)
+    {
+        const float now = Elapsed();
+        if (now >= nextCameraTime_)
+        {
+            SendCameraUpdate();
+            nextCameraTime_ = now + cCameraUpdateInterval;
+        }
+        if (now >= nextEditTime_)
+        {
+            SendEdit();
+            // Do not try to catch up if the frame rate is lower than the edit rate.
+            nextEditTime_ = Max(nextEditTime_ + editInterval_, now);
+        }
+    }
+}
+
+void LoadTestBot::Disconnect()
+{
+    if (!connection_)
+        return;
+
+    if (state_ == Editing && connection_->GetConnectionState() == kNet::ConnectionOK)
+    {
+        kNet::DataSerializer ds(sendBuffer_, sizeof(sendBuffer_));
+        ds.AddVLE<kNet::VLE8_16_32>(0); // Scene ID
+        ds.AddVLE<kNet::VLE8_16_32>(entityId_);
+        QueueMessage(cRemoveEntityMessage, true, ds.BytesFilled());
+        connection_->Process();
+    }
+    connection_->Disconnect(0);
+    connection_ = 0;
+    if (state_ != Failed)
+        state_ = Disconnected;
+}
+
+QString LoadTestBot::StateName() const
+{
+    switch(state_)
+    {
+    case Disconnected: return "disconnected";
+    case Connecting: return "connecting";
+    case LoggingIn: return "loggingIn";
+    case CreatingEntity: return "creatingEntity";
+    case Editing: return "editing";
+    case Failed: default: return "failed";
+    }
+}
+
+float LoadTestBot::RoundTripTime() const
+{
+    if (!connection_ || connection_->GetConnectionState() != kNet::ConnectionOK)
+        return -1.f;
+    return connection_->RoundTripTime();
+}
+
+float LoadTestBot::Elapsed() const
+{
+    return (float)((f64)(GetCurrentClockTime() - testStartTime_) / (f64)GetCurrentClockFreq());
+}
+
+void LoadTestBot::QueueMessage(kNet::message_id_t id, bool reliable, size_t numBytes)
+{
+    kNet::NetworkMessage *msg = connection_->StartNewMessage(id, numBytes);
+    if (numBytes > 0)
+        memcpy(msg->data, sendBuffer_, numBytes);
+    msg->contentID = 0;
+    msg->reliable = reliable;
+    msg->inOrder = true;
+    msg->priority = 100; // Fixed priority as in those defined with xml
+    connection_->EndAndQueueMessage(msg, numBytes);
+
+    ++stats_.messagesOut;
+    stats_.bytesOut += numBytes;
+    ++stats_.messageCountsOut[id];
+}
+
+void LoadTestBot::SendLogin()
+{
+    MsgLogin msg;
+    const QString xml = QString("<login><username value=\"LoadTestBot%1\"/></login>").arg(index_);
+    msg.loginData = StringToBuffer(xml.toStdString());
+    connection_->Send(msg);
+
+    ++stats_.messagesOut;
+    stats_.bytesOut += msg.Size();
+    ++stats_.messageCountsOut[MsgLogin::messageID];
+}
+
+void LoadTestBot::SendCreateEntity()
+{
+    // Encode the attributes first, the size goes before them.
+    char attrData[256];
+    kNet::DataSerializer attrDs(attrData, sizeof(attrData));
+    WriteAttributes(attrDs, true);
+
+    kNet::DataSerializer ds(sendBuffer_, sizeof(sendBuffer_));
+    ds.AddVLE<kNet::VLE8_16_32>(0); // Scene ID
+    ds.AddVLE<kNet::VLE8_16_32>(cLocalEntityId);
+    ds.Add<u8>(1); // Temporary, so that the bot entities are never saved with the scene.
+    ds.AddVLE<kNet::VLE8_16_32>(1); // Number of components
+    ds.AddVLE<kNet::VLE8_16_32>(cLocalComponentId);
+    ds.AddVLE<kNet::VLE8_16_32>(EC_DynamicComponent::TypeIdStatic());
+    ds.AddString(cComponentName);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
+    ds.AddArray<u8>((const u8*)attrData, (u32)attrDs.BytesFilled());
+    QueueMessage(cCreateEntityMessage, true, ds.BytesFilled());
+}
+
+void LoadTestBot::SendEdit()
+{
+    char attrData[256];
+    kNet::DataSerializer attrDs(attrData, sizeof(attrData));
+    WriteAttributes(attrDs, false);
+
+    kNet::DataSerializer ds(sendBuffer_, sizeof(sendBuffer_));
+    ds.AddVLE<kNet::VLE8_16_32>(0); // Scene ID
+    ds.AddVLE<kNet::VLE8_16_32>(entityId_);
+    ds.AddVLE<kNet::VLE8_16_32>(componentId_);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
+    ds.AddArray<u8>((const u8*)attrData, (u32)attrDs.BytesFilled());
+    QueueMessage(cEditAttributesMessage, true, ds.BytesFilled());
+    ++stats_.editsSent;
+}
+
+void LoadTestBot::WriteAttributes(kNet::DataSerializer &ds, bool create) const
+{
+    // Each bot moves on its own circle around the origin, so that the bots are spread over the scene for the interest management.
+    const float now = Elapsed();
+    const float angle = now * 0.5f + index_;
+    const float3 position(Cos(angle) * (cMoveRadius + index_), 0.f, Sin(angle) * (cMoveRadius + index_));
+    const float sentTime = now * 1000.f;
+
+    if (create)
+    {
+        // Dynamic attribute list: index, type, name and value of each attribute.
+        ds.Add<u8>(0);
+        ds.Add<u8>((u8)cAttributeFloat3);
+        ds.AddString("position");
+        ds.Add<float>(position.x);
+        ds.Add<float>(position.y);
+        ds.Add<float>(position.z);
+        ds.Add<u8>(1);
+        ds.Add<u8>((u8)cAttributeReal);
+        ds.AddString("sentTime");
+        ds.Add<float>(sentTime);
+    }
+    else
+    {
+        // Indexing method 1: attribute count, then index and value of each attribute.
+        ds.Add<kNet::bit>(0);
+        ds.Add<u8>(2);
+        ds.Add<u8>(0);
+        ds.Add<float>(position.x);
+        ds.Add<float>(position.y);
+        ds.Add<float>(position.z);
+        ds.Add<u8>(1);
+        ds.Add<float>(sentTime);
+    }
+}
+
+void LoadTestBot::SendCameraUpdate()
+{
+    // The camera looks at the origin from the position of the bot, as an avatar camera following the bot would.
+    const float angle = Elapsed() * 0.5f + index_;
+    const float3 position(Cos(angle) * (cMoveRadius + index_), 2.f, Sin(angle) * (cMoveRadius + index_));
+    const Quat orientation = Quat::RotateY(-angle);
+
+    kNet::DataSerializer ds(sendBuffer_, sizeof(sendBuffer_));
+    ds.AddSignedFixedPoint(11, 8, orientation.x);
+    ds.AddSignedFixedPoint(11, 8, orientation.y);
+    ds.AddSignedFixedPoint(11, 8, orientation.z);
+    ds.AddSignedFixedPoint(11, 8, orientation.w);
+    ds.AddSignedFixedPoint(11, 8, position.x);
+    ds.AddSignedFixedPoint(11, 8, position.y);
+    ds.AddSignedFixedPoint(11, 8, position.z);
+    QueueMessage(cCameraOrientationUpdate, true, ds.BytesFilled());
+}
+
+void LoadTestBot::HandleMessage(kNet::MessageConnection * /*source*/, kNet::packet_id_t /*packetId*/, kNet::message_id_t id, const char *data, size_t numBytes)
+{
+    ++stats_.messagesIn;
+    stats_.bytesIn += numBytes;
+    ++stats_.messageCountsIn[id];
+    stats_.messageBytesIn[id] += numBytes;
+
+    try
+    {
+        switch(id)
+        {
+        case cLoginReplyMessage:
+            HandleLoginReply(data, numBytes);
+            break;
+        case cCreateEntityMessage:
+            HandleCreateEntity(data, numBytes);
+            break;
+        case cCreateEntityReplyMessage:
+            HandleCreateEntityReply(data, numBytes);
+            break;
+        case cEditAttributesMessage:
+            HandleEditAttributes(data, numBytes);
+            break;
+        case cRemoveEntityMessage:
+            HandleRemoveEntity(data, numBytes);
+            break;
+        }
+    }
+    catch(kNet::NetException &e)
+    {
+        LogWarning(QString("LoadTestBot%1: Failed to deserialize message %2: %3").arg(index_).arg(id).arg(e.what()));
+    }
+}
+
+void LoadTestBot::HandleLoginReply(const char *data, size_t numBytes)
+{
+    MsgLoginReply msg(data, numBytes);
+    if (!msg.success)
+    {
+        LogError(QString("LoadTestBot%1: Login refused by the server").arg(index_));
+        state_ = Failed;
+        return;
+    }
+    stats_.loginTime = Elapsed();
+    SendCreateEntity();
+    state_ = CreatingEntity;
+}
+
+void LoadTestBot::HandleCreateEntity(const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    ds.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+    const entity_id_t entityId = ds.ReadVLE<kNet::VLE8_16_32>();
+    ds.Read<u8>(); // Temporary
+    const unsigned numComponents = ds.ReadVLE<kNet::VLE8_16_32>();
+    for(unsigned i = 0; i < numComponents; ++i)
+    {
+        const component_id_t compId = ds.ReadVLE<kNet::VLE8_16_32>();
+        const u32 typeId = ds.ReadVLE<kNet::VLE8_16_32>();
+        const std::string name = ds.ReadString();
+        const u32 attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
+        ReadAttributeData(ds, attrDataSize);
+        if (typeId == EC_DynamicComponent::TypeIdStatic() && name == cComponentName)
+            botComponents_.insert(std::make_pair(entityId, compId));
+    }
+}
+
+void LoadTestBot::HandleCreateEntityReply(const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    ds.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+    ds.ReadVLE<kNet::VLE8_16_32>(); // Entity ID sent by us
+    entityId_ = ds.ReadVLE<kNet::VLE8_16_32>();
+    const unsigned numComponents = ds.ReadVLE<kNet::VLE8_16_32>();
+    for(unsigned i = 0; i < numComponents; ++i)
+    {
+        const component_id_t senderCompId = ds.ReadVLE<kNet::VLE8_16_32>();
+        const component_id_t compId = ds.ReadVLE<kNet::VLE8_16_32>();
+        if (senderCompId == cLocalComponentId)
+            componentId_ = compId;
+    }
+
+    state_ = Editing;
+    nextEditTime_ = nextCameraTime_ = Elapsed();
+}
+
+void LoadTestBot::HandleEditAttributes(const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    ds.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+    const entity_id_t entityId = ds.ReadVLE<kNet::VLE8_16_32>();
+    while(ds.BitsLeft() >= 8)
+    {
+        const component_id_t compId = ds.ReadVLE<kNet::VLE8_16_32>();
+        const u32 attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
+        ReadAttributeData(ds, attrDataSize);
+        if (botComponents_.find(std::make_pair(entityId, compId)) == botComponents_.end())
+            continue;
+
+        kNet::DataDeserializer attrDs(attrDataSize > 0 ? (const char*)&receiveBuffer_[0] : 0, attrDataSize);
+
+        // The bot component has two attributes: the position (float3) at index 0 and the sent time (float) at index 1.
+        float sentTime = -1.f;
+        if (!attrDs.Read<kNet::bit>())
+        {
+            // Method 1: indices
+            const u8 numChangedAttrs = attrDs.Read<u8>();
+            for(unsigned i = 0; i < numChangedAttrs; ++i)
+            {
+                const u8 attrIndex = attrDs.Read<u8>();
+                if (attrIndex == 0)
+                {
+                    attrDs.Read<float>();
+                    attrDs.Read<float>();
+                    attrDs.Read<float>();
+                }
+                else if (attrIndex == 1)
+                    sentTime = attrDs.Read<float>();
+                else
+                    break;
+            }
+        }
+        else
+        {
+            // Method 2: bitmask
+            if (attrDs.Read<kNet::bit>())
+            {
+                attrDs.Read<float>();
+                attrDs.Read<float>();
+                attrDs.Read<float>();
+            }
+            if (attrDs.BitsLeft() > 0 && attrDs.Read<kNet::bit>())
+                sentTime = attrDs.Read<float>();
+        }
+
+        if (sentTime >= 0.f)
+            RecordLatency(sentTime);
+    }
+}
+
+void LoadTestBot::HandleRemoveEntity(const char *data, size_t numBytes)
+{
+    kNet::DataDeserializer ds(data, numBytes);
+    ds.ReadVLE<kNet::VLE8_16_32>(); // Scene ID
+    const entity_id_t entityId = ds.ReadVLE<kNet::VLE8_16_32>();
+    std::set<std::pair<entity_id_t, component_id_t> >::iterator iter = botComponents_.lower_bound(std::make_pair(entityId, (component_id_t)0));
+    while(iter != botComponents_.end() && iter->first == entityId)
+        botComponents_.erase(iter++);
+}
+
+void LoadTestBot::ReadAttributeData(kNet::DataDeserializer &ds, u32 numBytes)
+{
+    receiveBuffer_.resize(numBytes);
+    if (numBytes > 0)
+        ds.ReadArray<u8>(&receiveBuffer_[0], numBytes);
+}
+
+void LoadTestBot::RecordLatency(float sentTime)
+{
+    ++stats_.editsReceived;
+    stats_.latencies.push_back(Max(Elapsed() * 1000.f - sentTime, 0.f));
+}
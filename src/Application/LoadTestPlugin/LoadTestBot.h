@@ -0,0 +1,127 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <kNet/IMessageHandler.h>
+#include <kNet/Network.h>
+
+#include <QString>
+
+#include <map>
+#include <set>
+#include <vector>
+
+/// Traffic and latency statistics of one load test bot.
+struct LoadTestBotStats
+{
+    LoadTestBotStats();
+
+    u32 messagesIn; ///< Number of messages received.
+    u32 messagesOut; ///< Number of messages sent.
+    u64 bytesIn; ///< Payload bytes received, excluding kNet packet headers.
+    u64 bytesOut; ///< Payload bytes sent, excluding kNet packet headers.
+    std::map<u32, u32> messageCountsIn; ///< Received message counts per message ID.
+    std::map<u32, u64> messageBytesIn; ///< Received payload bytes per message ID.
+    std::map<u32, u32> messageCountsOut; ///< Sent message counts per message ID.
+    float connectTime; ///< Seconds from the start of the test to ConnectionOK, or -1 if not connected.
+    float loginTime; ///< Seconds from the start of the test to the login reply, or -1 if not logged in.
+    u32 editsSent; ///< Number of attribute edits sent.
+    u32 editsReceived; ///< Number of attribute edits of the other bots received.
+    std::vector<float> latencies; ///< Milliseconds from an edit being sent by another bot to it being received by this bot.
+};
+
+/// A headless, scriptless Tundra client that logs in, moves its camera and edits an entity of its own.
+/** The bot speaks the Tundra protocol directly on a kNet connection, without a scene of its own. After logging in it creates
+    a temporary entity with a dynamic component that holds a position and a timestamp, and then edits the component at a fixed rate.
+    The other bots of the same process receive the edits through the server, and measure the update latency from the timestamp,
+    since all the bots share the same clock. */
+class LoadTestBot : public kNet::IMessageHandler
+{
+public:
+    /// Name of the dynamic component the bots replicate. Used to recognize the components of the other bots.
+    static const char * const cComponentName;
+
+    /** @param index Index of the bot, used in its username and in its movement pattern.
+        @param testStartTime Clock time of the start of the test, the origin of all the timestamps.
+        @param editInterval Seconds between entity edits. */
+    LoadTestBot(int index, tick_t testStartTime, float editInterval);
+    ~LoadTestBot();
+
+    /// Starts connecting to the server.
+    bool Connect(kNet::Network &network, const char *address, unsigned short port, kNet::SocketTransportLayer transport);
+
+    /// Processes the connection and sends the scripted camera and entity updates that are due.
+    void Update();
+
+    /// Removes the entity of the bot from the server and disconnects.
+    void Disconnect();
+
+    /// Returns the connection state name to be used in reports.
+    QString StateName() const;
+
+    int Index() const { return index_; }
+    const LoadTestBotStats &Stats() const { return stats_; }
+
+    /// Returns the round-trip time of the connection in milliseconds as estimated by kNet, or -1 if not connected.
+    float RoundTripTime() const;
+
+    /// kNet::IMessageHandler override.
+    void HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t id, const char *data, size_t numBytes);
+
+private:
+    enum State
+    {
+        Disconnected,
+        Connecting,
+        LoggingIn,
+        CreatingEntity,
+        Editing,
+        Failed
+    };
+
+    /// Returns seconds since the start of the test.
+    float Elapsed() const;
+
+    /// Queues a message built in sendBuffer_.
+    void QueueMessage(kNet::message_id_t id, bool reliable, size_t numBytes);
+
+    void SendLogin();
+    void SendCreateEntity();
+    void SendEdit();
+    void SendCameraUpdate();
+
+    void HandleLoginReply(const char *data, size_t numBytes);
+    void HandleCreateEntity(const char *data, size_t numBytes);
+    void HandleCreateEntityReply(const char *data, size_t numBytes);
+    void HandleEditAttributes(const char *data, size_t numBytes);
+    void HandleRemoveEntity(const char *data, size_t numBytes);
+
+    /// Writes the attributes of the bot component, as a dynamic attribute list or as an edit.
+    void WriteAttributes(kNet::DataSerializer &ds, bool create) const;
+
+    /// Reads the attribute data of one component of a message to receiveBuffer_.
+    void ReadAttributeData(kNet::DataDeserializer &ds, u32 numBytes);
+
+    /// Records the latency of one edit received from another bot.
+    void RecordLatency(float sentTime);
+
+    int index_;
+    State state_;
+    tick_t testStartTime_;
+    float editInterval_;
+    float nextEditTime_;
+    float nextCameraTime_;
+    entity_id_t entityId_; ///< ID of the entity of the bot on the server.
+    component_id_t componentId_; ///< ID of the component of the bot on the server.
+    Ptr(kNet::MessageConnection) connection_;
+    LoadTestBotStats stats_;
+
+    /// The bot components of the other bots, as pairs of entity and component IDs.
+    std::set<std::pair<entity_id_t, component_id_t> > botComponents_;
+
+    char sendBuffer_[1400];
+    std::vector<u8> receiveBuffer_;
+};
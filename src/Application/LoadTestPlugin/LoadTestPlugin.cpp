@@ -0,0 +1,325 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "LoadTestPlugin.h"
+#include "LoadTestBot.h"
+
+#include "Framework.h"
+#include "CoreDefines.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <kNet.h>
+
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Seconds between starting the connections of consecutive bots, so that the server does not get all the logins in the same frame.
+const float cConnectInterval = 0.05f;
+
+/// Returns the JSON object of the given latency samples.
+QString LatencyJson(std::vector<float> latencies)
+{
+    if (latencies.empty())
+        return "{ \"samples\": 0 }";
+
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < latencies.size(); ++i)
+        sum += latencies[i];
+
+    const size_t n = latencies.size();
+    return QString("{ \"samples\": %1, \"min\": %2, \"avg\": %3, \"median\": %4, \"p95\": %5, \"p99\": %6, \"max\": %7 }")
+        .arg((qulonglong)n)
+        .arg(latencies.front())
+        .arg(sum / n)
+        .arg(latencies[n / 2])
+        .arg(latencies[std::min(n - 1, n * 95 / 100)])
+        .arg(latencies[std::min(n - 1, n * 99 / 100)])
+        .arg(latencies.back());
+}
+
+/// Returns the JSON object of message counts or bytes per message ID.
+template<typename T>
+QString MessageMapJson(const std::map<u32, T> &messages)
+{
+    QStringList entries;
+    for(typename std::map<u32, T>::const_iterator iter = messages.begin(); iter != messages.end(); ++iter)
+        entries << QString("\"%1\": %2").arg(iter->first).arg((qulonglong)iter->second);
+    return "{ " + entries.join(", ") + " }";
+}
+
+}
+
+LoadTestPlugin::LoadTestPlugin() :
+    IModule("LoadTest"),
+    enabled_(false),
+    numBots_(10),
+    serverAddress_("127.0.0.1"),
+    serverPort_(2345),
+    transport_(kNet::SocketOverUDP),
+    duration_(60.f),
+    editInterval_(0.1f),
+    connectInterval_(cConnectInterval),
+    reportFile_("loadtest.json"),
+    startTime_(0),
+    numStarted_(0)
+{
+}
+
+LoadTestPlugin::~LoadTestPlugin()
+{
+    DeleteBots();
+}
+
+void LoadTestPlugin::Initialize()
+{
+    if (!framework_->HasCommandLineParameter("--loadTest"))
+        return;
+    if (!ReadParameters())
+    {
+        LogError("LoadTestPlugin: Invalid parameters, the load test is not started.");
+        return;
+    }
+
+    LogInfo(QString("LoadTestPlugin: Starting %1 bots against %2:%3 (%4) for %5 seconds")
+        .arg(numBots_).arg(serverAddress_).arg(serverPort_).arg(kNet::SocketTransportLayerToString(transport_).c_str()).arg(duration_));
+
+    enabled_ = true;
+    startTime_ = GetCurrentClockTime();
+    for(int i = 0; i < numBots_; ++i)
+        bots_.push_back(new LoadTestBot(i, startTime_, editInterval_));
+}
+
+void LoadTestPlugin::Uninitialize()
+{
+    DeleteBots();
+}
+
+bool LoadTestPlugin::ReadParameters()
+{
+    QStringList params = framework_->CommandLineParameters("--loadTestBots");
+    if (!params.isEmpty())
+    {
+        bool ok;
+        numBots_ = params.first().toInt(&ok);
+        if (!ok || numBots_ <= 0)
+        {
+            LogError("LoadTestPlugin: --loadTestBots must be a positive integer.");
+            return false;
+        }
+    }
+
+    params = framework_->CommandLineParameters("--loadTestServer");
+    if (!params.isEmpty())
+    {
+        QStringList address = params.first().split(':');
+        serverAddress_ = address.first().trimmed();
+        if (address.size() > 1)
+        {
+            bool ok;
+            serverPort_ = (unsigned short)address[1].toUInt(&ok);
+            if (!ok || serverPort_ == 0)
+            {
+                LogError("LoadTestPlugin: Invalid port in --loadTestServer " + params.first());
+                return false;
+            }
+        }
+    }
+
+    params = framework_->CommandLineParameters("--protocol");
+    if (!params.isEmpty())
+    {
+        transport_ = kNet::StringToSocketTransportLayer(params.first().trimmed().toStdString().c_str());
+        if (transport_ == kNet::InvalidTransportLayer)
+        {
+            LogError("LoadTestPlugin: Invalid protocol " + params.first());
+            return false;
+        }
+    }
+
+    params = framework_->CommandLineParameters("--loadTestDuration");
+    if (!params.isEmpty())
+    {
+        bool ok;
+        duration_ = params.first().toFloat(&ok);
+        if (!ok || duration_ <= 0.f)
+        {
+            LogError("LoadTestPlugin: --loadTestDuration must be a positive number of seconds.");
+            return false;
+        }
+    }
+
+    params = framework_->CommandLineParameters("--loadTestEditRate");
+    if (!params.isEmpty())
+    {
+        bool ok;
+        const float rate = params.first().toFloat(&ok);
+        if (!ok || rate <= 0.f)
+        {
+            LogError("LoadTestPlugin: --loadTestEditRate must be a positive number of edits per second.");
+            return false;
+        }
+        editInterval_ = 1.f / rate;
+    }
+
+    params = framework_->CommandLineParameters("--loadTestReport");
+    if (!params.isEmpty())
+        reportFile_ = params.first();
+
+    return true;
+}
+
+void LoadTestPlugin::Update(f64 /*frametime*/)
+{
+    if (!enabled_)
+        return;
+
+    PROFILE(LoadTestPlugin_Update);
+
+    const float elapsed = (float)((f64)(GetCurrentClockTime() - startTime_) / (f64)GetCurrentClockFreq());
+
+    // Ramp up the connections.
+    while(numStarted_ < (int)bots_.size() && elapsed >= numStarted_ * connectInterval_)
+    {
+        bots_[numStarted_]->Connect(network_, serverAddress_.toStdString().c_str(), serverPort_, transport_);
+        ++numStarted_;
+    }
+
+    for(size_t i = 0; i < bots_.size(); ++i)
+        bots_[i]->Update();
+
+    if (elapsed >= duration_)
+        Finish();
+}
+
+void LoadTestPlugin::Finish()
+{
+    const float duration = (float)((f64)(GetCurrentClockTime() - startTime_) / (f64)GetCurrentClockFreq());
+    enabled_ = false;
+
+    // The report is written before disconnecting, so that it has the round-trip times of the connections.
+    WriteReport(duration);
+    for(size_t i = 0; i < bots_.size(); ++i)
+        bots_[i]->Disconnect();
+
+    LogInfo("LoadTestPlugin: Load test finished, exiting.");
+    framework_->Exit();
+}
+
+QString LoadTestPlugin::Report(float duration) const
+{
+    LoadTestBotStats totals;
+    int numLoggedIn = 0;
+    QStringList clients;
+    for(size_t i = 0; i < bots_.size(); ++i)
+    {
+        const LoadTestBot *bot = bots_[i];
+        const LoadTestBotStats &stats = bot->Stats();
+        if (stats.loginTime >= 0.f)
+            ++numLoggedIn;
+
+        totals.messagesIn += stats.messagesIn;
+        totals.messagesOut += stats.messagesOut;
+        totals.bytesIn += stats.bytesIn;
+        totals.bytesOut += stats.bytesOut;
+        totals.editsSent += stats.editsSent;
+        totals.editsReceived += stats.editsReceived;
+        for(std::map<u32, u32>::const_iterator iter = stats.messageCountsIn.begin(); iter != stats.messageCountsIn.end(); ++iter)
+            totals.messageCountsIn[iter->first] += iter->second;
+        for(std::map<u32, u64>::const_iterator iter = stats.messageBytesIn.begin(); iter != stats.messageBytesIn.end(); ++iter)
+            totals.messageBytesIn[iter->first] += iter->second;
+        totals.latencies.insert(totals.latencies.end(), stats.latencies.begin(), stats.latencies.end());
+
+        QString client;
+        QTextStream s(&client);
+        s << "    {\n"
+          << "      \"bot\": " << bot->Index() << ",\n"
+          << "      \"state\": \"" << bot->StateName() << "\",\n"
+          << "      \"connectTime\": " << stats.connectTime << ",\n"
+          << "      \"loginTime\": " << stats.loginTime << ",\n"
+          << "      \"roundTripTime\": " << bot->RoundTripTime() << ",\n"
+          << "      \"messagesIn\": " << stats.messagesIn << ",\n"
+          << "      \"messagesOut\": " << stats.messagesOut << ",\n"
+          << "      \"bytesIn\": " << (qulonglong)stats.bytesIn << ",\n"
+          << "      \"bytesOut\": " << (qulonglong)stats.bytesOut << ",\n"
+          << "      \"bytesInPerSecond\": " << stats.bytesIn / duration << ",\n"
+          << "      \"bytesOutPerSecond\": " << stats.bytesOut / duration << ",\n"
+          << "      \"editsSent\": " << stats.editsSent << ",\n"
+          << "      \"editsReceived\": " << stats.editsReceived << ",\n"
+          << "      \"messageCountsIn\": " << MessageMapJson(stats.messageCountsIn) << ",\n"
+          << "      \"messageBytesIn\": " << MessageMapJson(stats.messageBytesIn) << ",\n"
+          << "      \"messageCountsOut\": " << MessageMapJson(stats.messageCountsOut) << ",\n"
+          << "      \"latencyMs\": " << LatencyJson(stats.latencies) << "\n"
+          << "    }";
+        s.flush();
+        clients << client;
+    }
+
+    QString report;
+    QTextStream s(&report);
+    s << "{\n"
+      << "  \"date\": \"" << QDateTime::currentDateTime().toString(Qt::ISODate) << "\",\n"
+      << "  \"server\": \"" << serverAddress_ << ":" << serverPort_ << "\",\n"
+      << "  \"protocol\": \"" << kNet::SocketTransportLayerToString(transport_).c_str() << "\",\n"
+      << "  \"bots\": " << (int)bots_.size() << ",\n"
+      << "  \"botsLoggedIn\": " << numLoggedIn << ",\n"
+      << "  \"duration\": " << duration << ",\n"
+      << "  \"editRate\": " << 1.f / editInterval_ << ",\n"
+      << "  \"totals\": {\n"
+      << "    \"messagesIn\": " << totals.messagesIn << ",\n"
+      << "    \"messagesOut\": " << totals.messagesOut << ",\n"
+      << "    \"bytesIn\": " << (qulonglong)totals.bytesIn << ",\n"
+      << "    \"bytesOut\": " << (qulonglong)totals.bytesOut << ",\n"
+      << "    \"bytesInPerSecond\": " << totals.bytesIn / duration << ",\n"
+      << "    \"bytesOutPerSecond\": " << totals.bytesOut / duration << ",\n"
+      << "    \"editsSent\": " << totals.editsSent << ",\n"
+      << "    \"editsReceived\": " << totals.editsReceived << ",\n"
+      << "    \"messageCountsIn\": " << MessageMapJson(totals.messageCountsIn) << ",\n"
+      << "    \"messageBytesIn\": " << MessageMapJson(totals.messageBytesIn) << ",\n"
+      << "    \"latencyMs\": " << LatencyJson(totals.latencies) << "\n"
+      << "  },\n"
+      << "  \"clients\": [\n"
+      << clients.join(",\n") << "\n"
+      << "  ]\n"
+      << "}\n";
+    s.flush();
+    return report;
+}
+
+void LoadTestPlugin::WriteReport(float duration)
+{
+    QFile file(reportFile_);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        LogError("LoadTestPlugin: Failed to open " + reportFile_ + " for writing the report.");
+        return;
+    }
+    QTextStream stream(&file);
+    stream << Report(duration);
+    LogInfo("LoadTestPlugin: Report written to " + reportFile_);
+}
+
+void LoadTestPlugin::DeleteBots()
+{
+    for(size_t i = 0; i < bots_.size(); ++i)
+        delete bots_[i];
+    bots_.clear();
+}
+
+extern "C"
+{
+    DLLEXPORT void TundraPluginMain(Framework *fw)
+    {
+        Framework::SetInstance(fw); // Inside this DLL, remember the pointer to the global framework object.
+        IModule *module = new LoadTestPlugin();
+        fw->RegisterModule(module);
+    }
+}
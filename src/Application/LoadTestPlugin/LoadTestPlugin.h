@@ -0,0 +1,66 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "IModule.h"
+#include "HighPerfClock.h"
+
+#include <kNet/Network.h>
+
+#include <QString>
+
+#include <vector>
+
+class LoadTestBot;
+
+/// Replication load test harness that connects a number of bot clients to a Tundra server.
+/** Does nothing unless Tundra is started with --loadTest. The bots log in, move their cameras and edit an entity of their own
+    at a fixed rate for the duration of the test, after which a JSON report of the traffic and the update latency of each bot
+    is written and Tundra exits. The harness is meant to be run headless against a local server, for example
+    @code Tundra --headless --config loadtest.xml --loadTest --loadTestBots 50 --loadTestDuration 30 @endcode
+
+    The bots speak the Tundra protocol directly on their own kNet connections and do not use the Client or the scene of the
+    Tundra instance they are running in, so one process can host hundreds of them. */
+class LoadTestPlugin : public IModule
+{
+    Q_OBJECT
+
+public:
+    LoadTestPlugin();
+    ~LoadTestPlugin();
+
+    void Initialize();
+    void Uninitialize();
+    void Update(f64 frametime);
+
+private:
+    /// Reads the test parameters from the command line. Returns false if they are invalid.
+    bool ReadParameters();
+
+    /// Disconnects all the bots, writes the report and exits.
+    void Finish();
+
+    /// Returns the report of the test as a JSON document.
+    QString Report(float duration) const;
+
+    /// Writes the report to reportFile_.
+    void WriteReport(float duration);
+
+    /// Deletes the bots.
+    void DeleteBots();
+
+    bool enabled_;
+    int numBots_;
+    QString serverAddress_;
+    unsigned short serverPort_;
+    kNet::SocketTransportLayer transport_;
+    float duration_; ///< Duration of the test in seconds.
+    float editInterval_; ///< Seconds between the entity edits of each bot.
+    float connectInterval_; ///< Seconds between starting the connections of consecutive bots.
+    QString reportFile_;
+
+    tick_t startTime_;
+    int numStarted_; ///< Number of bots that have started connecting.
+    kNet::Network network_;
+    std::vector<LoadTestBot*> bots_;
+};
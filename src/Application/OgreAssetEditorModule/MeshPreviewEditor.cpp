@@ -166,12 +166,12 @@ void MeshPreviewEditor::Update()
     if (render_texture_ == 0 )
         CreateRenderTexture();
 
+    // Hide the main UI Overlay, because otherwise Ogre will paint the Overlay onto the Mesh preview screen as well,
+    // which is not desired.
+    renderer_->SetUiOverlayHidden(true);
+
     try
     {
-        // Hide the main UI Overlay, because otherwise Ogre will paint the Overlay onto the Mesh preview screen as well,
-        // which is not desired.
-        renderer_->GetRenderWindow()->ShowOverlay(false);
-
         AdjustScene();
 
         render_texture_->update();
@@ -194,14 +194,14 @@ void MeshPreviewEditor::Update()
             label_->setPixmap(QPixmap::fromImage(img));
 
         delete[] pixelData;
-
-        // Remember to re-enable the main UI now we're finished with the Ogre render.
-        renderer_->GetRenderWindow()->ShowOverlay(true);
     }
     catch (const Ogre::Exception &e)
     {
         LogError("MeshPreviewEditor::Update: " + QString(e.what()));
     }
+
+    // Remember to re-enable the main UI now we're finished with the Ogre render. The renderer shows it only if the UI has visible items.
+    renderer_->SetUiOverlayHidden(false);
 }
 
 void MeshPreviewEditor::AdjustScene()
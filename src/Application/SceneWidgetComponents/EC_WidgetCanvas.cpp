@@ -24,6 +24,9 @@
 #include <QPainter>
 #include <QDebug>
 
+#include <algorithm>
+#include <cstring>
+
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
 #ifdef SAFE_DELETE
 #undef SAFE_DELETE
@@ -38,6 +41,23 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+
+/// Size of the tiles in pixels in which the frames are compared to find the changed parts.
+const int cDamageTileSize = 64;
+
+/// If more rectangles than this have changed, their bounding rectangle is uploaded in one go instead.
+const int cMaxUploadRects = 8;
+
+#if defined(DIRECTX_ENABLED) && defined(WIN32)
+/// On Direct3D 9 the texture lives in the default pool and loses its contents with the device,
+/// so the whole texture is uploaded again after this many updates.
+const int cFullUploadInterval = 64;
+#endif
+
+}
+
 EC_WidgetCanvas::EC_WidgetCanvas(Scene *scene) :
     IComponent(scene),
     widget_(0),
@@ -46,7 +66,9 @@ EC_WidgetCanvas::EC_WidgetCanvas(Scene *scene) :
     refresh_timer_(0),
     update_interval_msec_(0),
     material_name_(""),
-    texture_name_("")
+    texture_name_(""),
+    full_upload_(true),
+    updates_since_full_upload_(0)
 {
     if (framework->IsHeadless())
         return;
@@ -295,9 +317,12 @@ void EC_WidgetCanvas::Update(QImage buffer)
             texture->setWidth(buffer.width());
             texture->setHeight(buffer.height());
             texture->createInternalResources();
+            full_upload_ = true;
         }
 
-        Blit(buffer, texture);
+        UploadChanges(buffer, texture);
+        // Shares the data with the caller, which detaches it only if it modifies the image.
+        front_ = buffer;
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -325,13 +350,18 @@ void EC_WidgetCanvas::Update()
         if (texture.isNull())
             return;
 
-        if (buffer_.size() != widget_->size())
-            buffer_ = QImage(widget_->size(), QImage::Format_ARGB32_Premultiplied);
-        if (buffer_.width() <= 0 || buffer_.height() <= 0)
+        // The widget is rendered to the staging image, which is reused, and compared to the previous frame in front_.
+        if (back_.size() != widget_->size() || back_.format() != QImage::Format_ARGB32_Premultiplied)
+            back_ = QImage(widget_->size(), QImage::Format_ARGB32_Premultiplied);
+        if (back_.width() <= 0 || back_.height() <= 0)
             return;
+        // The staging image holds an older frame, so the parts the widget does not paint over must be cleared.
+        if (!widget_->testAttribute(Qt::WA_OpaquePaintEvent) && !widget_->autoFillBackground())
+            back_.fill(0);
 
-        QPainter painter(&buffer_);
+        QPainter painter(&back_);
         widget_->render(&painter);
+        painter.end();
 
         // Set texture to material
         if (update_internals_ && !material_name_.empty())
@@ -345,15 +375,17 @@ void EC_WidgetCanvas::Update()
             update_internals_ = false;
         }
 
-        if ((int)texture->getWidth() != buffer_.width() || (int)texture->getHeight() != buffer_.height())
+        if ((int)texture->getWidth() != back_.width() || (int)texture->getHeight() != back_.height())
         {
             texture->freeInternalResources();
-            texture->setWidth(buffer_.width());
-            texture->setHeight(buffer_.height());
+            texture->setWidth(back_.width());
+            texture->setHeight(back_.height());
             texture->createInternalResources();
+            full_upload_ = true;
         }
 
-        Blit(buffer_, texture);
+        UploadChanges(back_, texture);
+        qSwap(front_, back_);
     }
     catch (Ogre::Exception &e) // inherits std::exception
     {
@@ -365,8 +397,74 @@ void EC_WidgetCanvas::Update()
     }
 }
 
-bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
+void EC_WidgetCanvas::Invalidate()
+{
+    full_upload_ = true;
+}
+
+void EC_WidgetCanvas::UploadChanges(const QImage &source, Ogre::TexturePtr texture)
+{
+#if defined(DIRECTX_ENABLED) && defined(WIN32)
+    if (++updates_since_full_upload_ >= cFullUploadInterval)
+        full_upload_ = true;
+#endif
+
+    QVector<QRect> rects;
+    if (full_upload_ || front_.size() != source.size() || front_.format() != source.format())
+        rects << source.rect();
+    else
+    {
+        QRegion changed = ChangedRegion(front_, source);
+        if (changed.isEmpty())
+            return; // Nothing has changed, so there is nothing to upload.
+        rects = changed.rects();
+        if (rects.size() > cMaxUploadRects)
+            rects = QVector<QRect>() << changed.boundingRect();
+    }
+
+    for(int i = 0; i < rects.size(); ++i)
+        Blit(source, texture, rects[i]);
+    full_upload_ = false;
+    updates_since_full_upload_ = 0;
+}
+
+QRegion EC_WidgetCanvas::ChangedRegion(const QImage &previous, const QImage &current) const
+{
+    QRegion changed;
+    const int width = current.width();
+    const int height = current.height();
+    const int bytesPerPixel = 4;
+
+    for(int tileY = 0; tileY < height; tileY += cDamageTileSize)
+    {
+        const int tileHeight = std::min(cDamageTileSize, height - tileY);
+        // Consecutive changed tiles in a row are added to the region as one rectangle.
+        int runStart = -1;
+        for(int tileX = 0; tileX < width; tileX += cDamageTileSize)
+        {
+            const int tileWidth = std::min(cDamageTileSize, width - tileX);
+            bool tileChanged = false;
+            for(int y = tileY; y < tileY + tileHeight && !tileChanged; ++y)
+                tileChanged = memcmp(previous.constScanLine(y) + tileX * bytesPerPixel, current.constScanLine(y) + tileX * bytesPerPixel,
+                    tileWidth * bytesPerPixel) != 0;
+
+            if (tileChanged && runStart < 0)
+                runStart = tileX;
+            else if (!tileChanged && runStart >= 0)
+            {
+                changed += QRect(runStart, tileY, tileX - runStart, tileHeight);
+                runStart = -1;
+            }
+        }
+        if (runStart >= 0)
+            changed += QRect(runStart, tileY, width - runStart, tileHeight);
+    }
+    return changed;
+}
+
+bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination, const QRect &rect)
 {
+    const int bytesPerPixel = 4; ///\todo Count from Ogre::PixelFormat!
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
     Ogre::HardwarePixelBufferSharedPtr pb = destination->getBuffer();
     Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(pb.get());
@@ -380,17 +478,19 @@ bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
         HRESULT hr = surface->GetDesc(&desc);
         if (SUCCEEDED(hr))
         {
+            // Lock only the rectangle being updated, so that the rest of the surface keeps its contents.
+            RECT lockRect = { rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1 };
             D3DLOCKED_RECT lock;
-            HRESULT hr = surface->LockRect(&lock, 0, 0);
+            HRESULT hr = surface->LockRect(&lock, &lockRect, 0);
             if (SUCCEEDED(hr))
             {
-                const int bytesPerPixel = 4; ///\todo Count from Ogre::PixelFormat!
-                const int sourceStride = bytesPerPixel * source.width();
-                if (lock.Pitch == sourceStride)
-                    memcpy(lock.pBits, source.bits(), sourceStride * source.height());
+                const int rowBytes = bytesPerPixel * rect.width();
+                const u8 *sourceBits = source.constBits() + source.bytesPerLine() * rect.top() + bytesPerPixel * rect.left();
+                if (lock.Pitch == rowBytes && source.bytesPerLine() == rowBytes)
+                    memcpy(lock.pBits, sourceBits, rowBytes * rect.height());
                 else
-                    for(int y = 0; y < source.height(); ++y)
-                        memcpy((u8*)lock.pBits + lock.Pitch * y, source.bits() + sourceStride * y, sourceStride);
+                    for(int y = 0; y < rect.height(); ++y)
+                        memcpy((u8*)lock.pBits + lock.Pitch * y, sourceBits + source.bytesPerLine() * y, rowBytes);
                 surface->UnlockRect();
             }
         }
@@ -398,8 +498,12 @@ bool EC_WidgetCanvas::Blit(const QImage &source, Ogre::TexturePtr destination)
 #else
     if (!destination->getBuffer().isNull())
     {
-        Ogre::Box update_box(0, 0, source.width(), source.height());
-        Ogre::PixelBox pixel_box(update_box, Ogre::PF_A8R8G8B8, (void*)source.bits());
+        // The pixel box points to the first pixel of the rectangle, with the row pitch of the whole source image.
+        Ogre::Box update_box(rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1);
+        Ogre::PixelBox pixel_box(rect.width(), rect.height(), 1, Ogre::PF_A8R8G8B8,
+            (void*)(source.constScanLine(rect.top()) + rect.left() * bytesPerPixel));
+        pixel_box.rowPitch = source.bytesPerLine() / bytesPerPixel;
+        pixel_box.slicePitch = pixel_box.rowPitch * rect.height();
         destination->getBuffer()->blitFromMemory(pixel_box, update_box);
     }
 #endif
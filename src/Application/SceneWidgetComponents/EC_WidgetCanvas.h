@@ -7,6 +7,7 @@
 
 #include <QMap>
 #include <QImage>
+#include <QRegion>
 #include <QPointer>
 #include <QWidget>
 #include <QString>
@@ -30,6 +31,9 @@ they need QWidget painting done to a 3D object.
 Paints UI widgets on to a 3D object surface via EC_Mesh and a submesh index.
 So a EC_Mesh needs to be present on the entity this component is used.
 
+Only the parts of the texture that have changed are uploaded: each new frame is compared
+to the previous one in tiles, and a frame where nothing has changed is not uploaded at all.
+
 Registered by SceneWidgetComponents plugin.
 
 <b>No Attributes</b>
@@ -43,6 +47,7 @@ Registered by SceneWidgetComponents plugin.
 <li>"SetRefreshRate":
 <li>"SetSubmesh":
 <li>"SetSubmeshes":
+<li>"Invalidate":
 </ul>
 
 <b>Reacts on the following actions:</b>
@@ -79,6 +84,9 @@ public slots:
     void SetSubmeshes(const QList<uint> &submeshes);
     void SetSelfIllumination(bool illuminating);
 
+    /// Makes the next update upload the whole texture, even if the content seems unchanged.
+    void Invalidate();
+
     QWidget *GetWidget() const { return widget_; }
     int GetRefreshRate() const { return update_interval_msec_; }
     QList<uint> GetSubMeshes() const { return submeshes_; }
@@ -87,7 +95,6 @@ public slots:
     void UpdateSubmeshes();
 
 private slots:
-    bool Blit(const QImage &source, Ogre::TexturePtr destination);
     void WidgetDestroyed(QObject *obj);
     void MeshMaterialsUpdated(uint index, const QString &material_name);
 
@@ -98,6 +105,15 @@ private slots:
     void ComponentRemoved(IComponent *component, AttributeChange::Type change);
 
 private:
+    /// Uploads the parts of the source image that differ from the current texture contents (front_).
+    void UploadChanges(const QImage &source, Ogre::TexturePtr texture);
+
+    /// Returns the region of tiles where the images differ. The images must be of the same size and format.
+    QRegion ChangedRegion(const QImage &previous, const QImage &current) const;
+
+    /// Copies the given rectangle of the source image to the same place in the texture.
+    bool Blit(const QImage &source, Ogre::TexturePtr destination, const QRect &rect);
+
     QPointer<QWidget> widget_;
     QList<uint> submeshes_;
     QTimer *refresh_timer_;
@@ -109,6 +125,9 @@ private:
     int update_interval_msec_;
     bool update_internals_;
 
-    QImage buffer_;
+    QImage front_; ///< The image the texture currently shows.
+    QImage back_; ///< Staging image the widget is rendered to, swapped with front_ after the upload.
+    bool full_upload_; ///< Must the whole texture be uploaded on the next update.
+    int updates_since_full_upload_;
     bool mesh_hooked_;
 };
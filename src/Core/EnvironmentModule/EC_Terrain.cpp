@@ -6,6 +6,7 @@
 #include "DebugOperatorNew.h"
 
 #include "EC_Terrain.h"
+#include "Heightfield.h"
 #include "CoreException.h"
 #include "BinaryAsset.h"
 #include "Renderer.h"
@@ -23,15 +24,301 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "HighPerfClock.h"
 
 #include <Ogre.h>
 #include <utility>
 
+#include <QRunnable>
+#include <QThreadPool>
+
 #include "MemoryLeakCheck.h"
 
 using namespace std;
 using namespace OgreRenderer;
 
+namespace
+{
+
+/// Number of index buffer levels of detail in each chunk. Level n draws every 2^n:th vertex row and column of the chunk.
+const uint cNumChunkLods = 5;
+
+/// Camera distance, in terrain vertex spacings, at which the chunks switch to the first reduced level of detail. Each further level
+/// starts at twice the distance of the previous one, so the triangles keep roughly the same size on the screen.
+const float cChunkLodDistance = 128.f;
+
+/// The skirts hang down at least this far, so that they also cover the gaps left by rasterization on flat terrain.
+const float cMinSkirtDepth = 1.f;
+
+/// Time that uploading the generated chunk geometry to the GPU may take per frame. At least one chunk is uploaded per frame.
+const double cChunkUploadBudgetMsecs = 4.0;
+
+/// Position, normal, and the diffuse and blend mask UVs.
+const uint cChunkVertexFloats = 3 + 3 + 2 + 2;
+
+/// The borders of a chunk that get a skirt.
+enum ChunkSkirt { SkirtMinY = 0, SkirtMaxY, SkirtMinX, SkirtMaxX, NumChunkSkirts };
+
+/// Returns the vertex coordinates of a chunk row or column that are used at the given step. The last vertex is always included.
+void SampleChunkVertices(uint numVertices, uint step, std::vector<uint> &samples)
+{
+    samples.clear();
+    for(uint i = 0; i + 1 < numVertices; i += step)
+        samples.push_back(i);
+    samples.push_back(numVertices - 1);
+}
+
+/// Adds a skirt quad hanging down from the edge a->b. The quad faces to the left of the edge when looking down on the terrain.
+void AddSkirtQuad(std::vector<u16> &indices, uint a, uint b, uint aSkirt, uint bSkirt)
+{
+    indices.push_back((u16)a);
+    indices.push_back((u16)b);
+    indices.push_back((u16)aSkirt);
+
+    indices.push_back((u16)aSkirt);
+    indices.push_back((u16)b);
+    indices.push_back((u16)bSkirt);
+}
+
+/// Generates the triangle list of a chunk that draws every step:th vertex row and column, and the skirts on the given borders.
+/** The skirt vertices follow the grid vertices in the order of the ChunkSkirt enum, the first two running along X and the last two along Y. */
+void GenerateChunkLodIndices(uint verticesX, uint verticesY, uint step, const bool skirts[NumChunkSkirts], std::vector<u16> &indices)
+{
+    indices.clear();
+    std::vector<uint> xs, ys;
+    SampleChunkVertices(verticesX, step, xs);
+    SampleChunkVertices(verticesY, step, ys);
+
+    for(size_t j = 0; j + 1 < ys.size(); ++j)
+        for(size_t i = 0; i + 1 < xs.size(); ++i)
+        {
+            const uint v00 = ys[j] * verticesX + xs[i];
+            const uint v10 = ys[j] * verticesX + xs[i+1];
+            const uint v01 = ys[j+1] * verticesX + xs[i];
+            const uint v11 = ys[j+1] * verticesX + xs[i+1];
+
+            // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+            indices.push_back((u16)v01);
+            indices.push_back((u16)v10);
+            indices.push_back((u16)v00);
+
+            indices.push_back((u16)v01);
+            indices.push_back((u16)v11);
+            indices.push_back((u16)v10);
+        }
+
+    // Walk each border so that the skirt faces out of the chunk.
+    const uint skirtMinY = verticesX * verticesY;
+    const uint skirtMaxY = skirtMinY + verticesX;
+    const uint skirtMinX = skirtMaxY + verticesX;
+    const uint skirtMaxX = skirtMinX + verticesY;
+    const uint lastRow = (verticesY - 1) * verticesX;
+    for(size_t i = 0; i + 1 < xs.size(); ++i)
+    {
+        if (skirts[SkirtMinY])
+            AddSkirtQuad(indices, xs[i], xs[i+1], skirtMinY + xs[i], skirtMinY + xs[i+1]);
+        if (skirts[SkirtMaxY])
+            AddSkirtQuad(indices, lastRow + xs[i+1], lastRow + xs[i], skirtMaxY + xs[i+1], skirtMaxY + xs[i]);
+    }
+    for(size_t j = 0; j + 1 < ys.size(); ++j)
+    {
+        if (skirts[SkirtMinX])
+            AddSkirtQuad(indices, ys[j+1] * verticesX, ys[j] * verticesX, skirtMinX + ys[j+1], skirtMinX + ys[j]);
+        if (skirts[SkirtMaxX])
+            AddSkirtQuad(indices, ys[j] * verticesX + verticesX - 1, ys[j+1] * verticesX + verticesX - 1, skirtMaxX + ys[j], skirtMaxX + ys[j+1]);
+    }
+}
+
+/// A rectangle of map vertices, inclusive, that grows to cover the rectangles added to it.
+struct DirtyRect
+{
+    DirtyRect() : minX(1), minY(1), maxX(0), maxY(0) {}
+
+    bool IsEmpty() const { return minX > maxX; }
+
+    void Add(uint x0, uint y0, uint x1, uint y1)
+    {
+        if (IsEmpty())
+        {
+            minX = x0; minY = y0; maxX = x1; maxY = y1;
+            return;
+        }
+        minX = min(minX, x0);
+        minY = min(minY, y0);
+        maxX = max(maxX, x1);
+        maxY = max(maxY, y1);
+    }
+
+    uint minX;
+    uint minY;
+    uint maxX;
+    uint maxY;
+};
+
+/// Returns the height value on the given terrain grid point. Outside the terrain, the height values are extrapolated linearly from the edge,
+/// so that the central differences on the edge equal the one-sided differences.
+float ExtrapolatedPoint(const EC_Terrain &terrain, int x, int y)
+{
+    const int width = (int)terrain.VerticesWidth();
+    const int height = (int)terrain.VerticesHeight();
+    if (x < 0)
+        return 2.f * ExtrapolatedPoint(terrain, 0, y) - ExtrapolatedPoint(terrain, 1, y);
+    if (x >= width)
+        return 2.f * ExtrapolatedPoint(terrain, width - 1, y) - ExtrapolatedPoint(terrain, width - 2, y);
+    if (y < 0)
+        return 2.f * ExtrapolatedPoint(terrain, x, 0) - ExtrapolatedPoint(terrain, x, 1);
+    if (y >= height)
+        return 2.f * ExtrapolatedPoint(terrain, x, height - 1) - ExtrapolatedPoint(terrain, x, height - 2);
+    return terrain.GetPoint(x, y);
+}
+
+}
+
+/// CPU-side vertex data of a terrain chunk, generated on a worker thread from a copy of the height values of the chunk.
+struct TerrainChunkGeometry
+{
+    TerrainChunkGeometry() :
+        chunkIndex(0), chunkId(0), fullBuild(false),
+        firstX(0), firstY(0), verticesX(0), verticesY(0),
+        minX(0), minY(0), maxX(0), maxY(0),
+        mapWidth(0), mapHeight(0), uScale(0.f), vScale(0.f),
+        minHeight(0.f), maxHeight(0.f), skirtDepth(0.f)
+    {
+        for(int i = 0; i < NumChunkSkirts; ++i)
+            skirts[i] = false;
+    }
+
+    size_t chunkIndex;
+    u32 chunkId; ///< The ID of the chunk at the time the geometry was requested. The geometry is discarded if the chunk has been destroyed since.
+    bool fullBuild; ///< If true, the chunk mesh is created from this geometry. Otherwise the vertices are written to the existing mesh.
+    bool skirts[NumChunkSkirts]; ///< The borders of the chunk that get a skirt. Only used for full builds.
+
+    uint firstX;
+    uint firstY;
+    uint verticesX;
+    uint verticesY;
+
+    /// The map vertex rectangle to generate, inclusive.
+    uint minX;
+    uint minY;
+    uint maxX;
+    uint maxY;
+
+    uint mapWidth;
+    uint mapHeight;
+    float uScale;
+    float vScale;
+
+    /// The height values of the chunk, with a border of one vertex around it for the normals.
+    std::vector<float> heights;
+
+    std::vector<float> vertices; ///< The grid vertices of the rectangle, row by row.
+    std::vector<float> skirtVertices; ///< All the skirt vertices of the chunk.
+    std::vector<u16> lodIndices[cNumChunkLods]; ///< The triangles of each level of detail. Only generated for full builds.
+    float minHeight;
+    float maxHeight;
+    float skirtDepth;
+
+    QAtomicInt finished;
+
+    bool IsFinished() { return finished.fetchAndAddOrdered(0) != 0; }
+
+    /// Generates the vertices, the skirt vertices and the height range from the height values. Touches nothing but this struct.
+    void Generate()
+    {
+        const int stride = (int)verticesX + 2;
+
+        minHeight = std::numeric_limits<float>::max();
+        maxHeight = -std::numeric_limits<float>::max();
+        for(int y = 1; y <= (int)verticesY; ++y)
+        {
+            const float *row = &heights[y * stride];
+            for(int x = 1; x <= (int)verticesX; ++x)
+            {
+                minHeight = min(minHeight, row[x]);
+                maxHeight = max(maxHeight, row[x]);
+            }
+        }
+        // The crack between two chunks at different levels of detail is never deeper than the height range of the chunk.
+        skirtDepth = max(maxHeight - minHeight, cMinSkirtDepth);
+
+        vertices.resize((maxX - minX + 1) * (maxY - minY + 1) * cChunkVertexFloats);
+        float *dst = &vertices[0];
+        for(uint y = minY; y <= maxY; ++y)
+            for(uint x = minX; x <= maxX; ++x)
+                dst = WriteVertex(dst, x, y, 0.f);
+
+        const uint lastX = firstX + verticesX - 1;
+        const uint lastY = firstY + verticesY - 1;
+        skirtVertices.resize((2 * verticesX + 2 * verticesY) * cChunkVertexFloats);
+        dst = &skirtVertices[0];
+        for(uint x = firstX; x <= lastX; ++x)
+            dst = WriteVertex(dst, x, firstY, -skirtDepth);
+        for(uint x = firstX; x <= lastX; ++x)
+            dst = WriteVertex(dst, x, lastY, -skirtDepth);
+        for(uint y = firstY; y <= lastY; ++y)
+            dst = WriteVertex(dst, firstX, y, -skirtDepth);
+        for(uint y = firstY; y <= lastY; ++y)
+            dst = WriteVertex(dst, lastX, y, -skirtDepth);
+
+        if (fullBuild)
+            for(uint level = 0; level < cNumChunkLods; ++level)
+                GenerateChunkLodIndices(verticesX, verticesY, 1 << level, skirts, lodIndices[level]);
+    }
+
+private:
+    /// Writes the vertex at the given map coordinates, moved down by the given offset, to dst, and returns a pointer past it.
+    float *WriteVertex(float *dst, uint mapX, uint mapY, float heightOffset) const
+    {
+        const int stride = (int)verticesX + 2;
+        const float *h = &heights[(mapY - firstY + 1) * stride + mapX - firstX + 1];
+        const float slopeX = h[-1] - h[1];
+        const float slopeY = h[-stride] - h[stride];
+        const float invLength = 1.f / sqrt(slopeX * slopeX + 4.f + slopeY * slopeY);
+
+        // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
+        // see OpenSimToOgreCoordinateAxes.
+        *dst++ = mapX - (firstX + (verticesX - 1) * 0.5f);
+        *dst++ = *h + heightOffset;
+        *dst++ = mapY - (firstY + (verticesY - 1) * 0.5f);
+
+        // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
+        *dst++ = slopeX * invLength;
+        *dst++ = 2.f * invLength;
+        *dst++ = slopeY * invLength;
+
+        // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
+        *dst++ = mapX * uScale;
+        *dst++ = mapY * vScale;
+
+        // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+        *dst++ = (float)mapX / (mapWidth - 1);
+        *dst++ = (float)mapY / (mapHeight - 1);
+        return dst;
+    }
+};
+
+/// Generates the geometry of a terrain chunk on a worker thread.
+class TerrainChunkGeometryJob : public QRunnable
+{
+public:
+    explicit TerrainChunkGeometryJob(const shared_ptr<TerrainChunkGeometry> &geometry) : geometry_(geometry)
+    {
+    }
+
+    /// QRunnable override.
+    virtual void run()
+    {
+        geometry_->Generate();
+        geometry_->finished.fetchAndStoreOrdered(1);
+    }
+
+private:
+    shared_ptr<TerrainChunkGeometry> geometry_;
+};
+
 EC_Terrain::EC_Terrain(Scene* scene) :
     IComponent(scene),
     INIT_ATTRIBUTE(nodeTransformation, "Transform"),
@@ -43,7 +330,13 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(vScale, "Tex. V scale", 0.13f),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    rootNode(0),
+    heightQuantizationStep(0.f),
+    chunkWidth(0),
+    chunkHeight(0),
+    chunksPatchWidth(0),
+    chunksPatchHeight(0),
+    nextChunkId(1)
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
@@ -51,7 +344,7 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 
     patches.resize(1);
-    MakePatchFlat(0, 0, 0.f);
+    heightfield = MAKE_SHARED(Heightfield, cPatchSize, cPatchSize);
 
     heightMapAsset = MAKE_SHARED(AssetRefListener);
     connect(heightMapAsset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(TerrainAssetLoaded(AssetPtr)));
@@ -76,9 +369,12 @@ void EC_Terrain::UpdateSignals()
 void EC_Terrain::MakePatchFlat(uint x, uint y, float heightValue)
 {
     Patch &patch = GetPatch(x, y);
-    patch.heightData.clear();
-    patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
+    const u32 layoutVersion = heightfield->LayoutVersion();
+    for(uint py = 0; py < cPatchSize; ++py)
+        for(uint px = 0; px < cPatchSize; ++px)
+            heightfield->Set(x * cPatchSize + px, y * cPatchSize + py, heightValue);
     patch.patch_geometry_dirty = true;
+    CheckHeightfieldLayout(layoutVersion);
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
@@ -118,28 +414,21 @@ void EC_Terrain::ResizeTerrain(uint newPatchWidth, uint newPatchHeight)
         for(uint y = 0; y < patchHeight; ++y)
             DestroyPatch(x, y);
 
-    // Now create the new terrain patch storage and copy the old height values over.
+    // Now create the new terrain patch storage and copy the old height values over. Any new patches are flat planes with the given fixed height.
+    const float initialPatchHeight = 0.f;
+
     std::vector<Patch> newPatches(newPatchWidth * newPatchHeight);
     for(uint y = 0; y < min(patchHeight, newPatchHeight); ++y)
         for(uint x = 0; x < min(patchWidth, newPatchWidth); ++x)
             newPatches[y * newPatchWidth + x] = GetPatch(x, y);
-    patches = newPatches;
-    uint oldPatchWidth = patchWidth;
-    uint oldPatchHeight = patchHeight;
+    patches.swap(newPatches);
+
+    shared_ptr<Heightfield> newHeightfield = MAKE_SHARED(Heightfield, newPatchWidth * cPatchSize, newPatchHeight * cPatchSize, initialPatchHeight, heightQuantizationStep);
+    newHeightfield->Copy(*heightfield, 0, 0, 0, 0, VerticesWidth(), VerticesHeight());
+    heightfield = newHeightfield;
     patchWidth = newPatchWidth;
     patchHeight = newPatchHeight;
 
-    // Init any new patches to flat planes with the given fixed height.
-
-    const float initialPatchHeight = 0.f;
-
-    for(uint y = oldPatchHeight; y < newPatchHeight; ++y)
-        for(uint x = 0; x < patchWidth; ++x)
-            MakePatchFlat(x, y, initialPatchHeight);
-    for(uint x = oldPatchWidth; x < newPatchWidth; ++x) // We have some overlap here with above, but it's ok since DestroyPatch is benign.
-        for(uint y = 0; y < patchHeight; ++y)
-            MakePatchFlat(x, y, initialPatchHeight);
-
     // Tell each patch which coordinate in the grid they lie in.
     for(uint y = 0; y < patchHeight; ++y)
         for(uint x = 0; x < patchWidth; ++x)
@@ -168,7 +457,12 @@ void EC_Terrain::AttributesChanged()
     if (needIncrementalRecreate)
         RegenerateDirtyTerrainPatches();
     if (nodeTransformation.ValueChanged())
+    {
         UpdateRootNodeTransform();
+        for(size_t i = 0; i < chunks.size(); ++i)
+            if (chunks[i].entity)
+                UpdateChunkLodDistances(chunks[i].entity->getMesh().get());
+    }
     if (material.ValueChanged())
     {
         AssetTransferPtr transfer = GetFramework()->Asset()->RequestAsset(material.Get());
@@ -195,10 +489,9 @@ void EC_Terrain::MaterialAssetLoaded(AssetPtr asset_)
 
     currentMaterial = ogreMaterial->ogreAssetName;
 
-    // Also, we need to update each geometry patch to use the new material.
-    for(uint y = 0; y < patchHeight; ++y)
-        for(uint x = 0; x < patchWidth; ++x)
-            UpdateTerrainPatchMaterial(x, y);
+    // Also, we need to update each geometry chunk to use the new material.
+    for(size_t i = 0; i < chunks.size(); ++i)
+        UpdateTerrainChunkMaterial(chunks[i]);
 }
 
 void EC_Terrain::TerrainAssetLoaded(AssetPtr asset_)
@@ -242,6 +535,29 @@ void EC_Terrain::DestroyPatch(uint x, uint y)
     if (x >= patchWidth || y >= patchHeight)
         return;
 
+    const uint chunkX = x / cChunkSize;
+    const uint chunkY = y / cChunkSize;
+    if (chunkX >= chunkWidth || chunkY >= chunkHeight)
+        return;
+
+    DestroyChunk(GetChunk(chunkX, chunkY));
+
+    // The other patches of the chunk lost their GPU geometry as well.
+    for(uint py = chunkY * cChunkSize; py < min(patchHeight, (chunkY + 1) * cChunkSize); ++py)
+        for(uint px = chunkX * cChunkSize; px < min(patchWidth, (chunkX + 1) * cChunkSize); ++px)
+        {
+            EC_Terrain::Patch &patch = GetPatch(px, py);
+            patch.node = 0;
+            patch.entity = 0;
+            patch.patch_geometry_dirty = true;
+        }
+}
+
+void EC_Terrain::DestroyChunk(Chunk &chunk)
+{
+    // Any geometry that is still being generated for the chunk is discarded when it finishes.
+    chunk.id = 0;
+
     assert(GetFramework());
     if (!GetFramework())
         return;
@@ -250,39 +566,47 @@ void EC_Terrain::DestroyPatch(uint x, uint y)
         return;
 
     Ogre::SceneManager *sceneMgr = world_.lock()->OgreSceneManager();
-    
-    EC_Terrain::Patch &patch = GetPatch(x, y);
 
-    if (patch.node)
+    if (chunk.node)
     {
-        sceneMgr->getRootSceneNode()->removeChild(patch.node);
-        patch.node->detachAllObjects();
-        sceneMgr->destroySceneNode(patch.node);
-        patch.node = 0;
+        if (chunk.node->getParentSceneNode())
+            chunk.node->getParentSceneNode()->removeChild(chunk.node);
+        chunk.node->detachAllObjects();
+        sceneMgr->destroySceneNode(chunk.node);
+        chunk.node = 0;
     }
-    if (patch.entity)
+    if (chunk.entity)
     {
-        sceneMgr->destroyEntity(patch.entity);
-        patch.entity = 0;
+        sceneMgr->destroyEntity(chunk.entity);
+        chunk.entity = 0;
     }
 
     // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+    if (chunk.meshGeometryName.length() > 0)
     {
         try
         {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            Ogre::MeshManager::getSingleton().remove(chunk.meshGeometryName);
         }
         catch(...) {}
-        patch.meshGeometryName = "";
+        chunk.meshGeometryName = "";
     }
 }
 
 void EC_Terrain::Destroy()
 {
-    for(uint y = 0; y < patchHeight; ++y)
-        for(uint x = 0; x < patchWidth; ++x)
-            DestroyPatch(x, y);
+    for(size_t i = 0; i < chunks.size(); ++i)
+        DestroyChunk(chunks[i]);
+    chunks.clear();
+    pendingChunkGeometry.clear();
+    chunkWidth = chunkHeight = 0;
+    chunksPatchWidth = chunksPatchHeight = 0;
+
+    for(size_t i = 0; i < patches.size(); ++i)
+    {
+        patches[i].node = 0;
+        patches[i].entity = 0;
+    }
 
     if (!GetFramework())
         return;
@@ -305,7 +629,7 @@ float EC_Terrain::GetPoint(uint x, uint y) const
     if (y >= cPatchSize * patchHeight)
         y = cPatchSize * patchHeight - 1;
 
-    return GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
+    return heightfield->Get(x, y);
 }
 
 void EC_Terrain::SetPointHeight(uint x, uint y, float height)
@@ -313,7 +637,16 @@ void EC_Terrain::SetPointHeight(uint x, uint y, float height)
     if (x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    const u32 layoutVersion = heightfield->LayoutVersion();
+    heightfield->Set(x, y, height);
+    CheckHeightfieldLayout(layoutVersion);
+}
+
+void EC_Terrain::CheckHeightfieldLayout(u32 previousLayoutVersion)
+{
+    // The readers of the raw values, e.g. the physics heightfield shape, must stop using the old ones before anything reads them again.
+    if (heightfield->LayoutVersion() != previousLayoutVersion)
+        emit HeightfieldLayoutChanged();
 }
 
 float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
@@ -528,20 +861,12 @@ float3 EC_Terrain::GetInterpolatedNormal(float x, float y) const
 
 float3 EC_Terrain::CalculateNormal(uint x, uint y, uint xinside, uint yinside) const
 {
-    uint px = x * cPatchSize + xinside;
-    uint py = y * cPatchSize + yinside;
-
-    uint xNext = Clamp(px+1, 0U, patchWidth * cPatchSize - 1);
-    uint yNext = Clamp(py+1, 0U, patchHeight * cPatchSize - 1);
-    uint xPrev = Clamp(px-1, 0U, patchWidth * cPatchSize - 1);
-    uint yPrev = Clamp(py-1, 0U, patchHeight * cPatchSize - 1);
+    int px = x * cPatchSize + xinside;
+    int py = y * cPatchSize + yinside;
 
-    float x_slope = GetPoint(xPrev, py) - GetPoint(xNext, py);
-    if ((px <= 0) || (px >= patchWidth * cPatchSize))
-        x_slope *= 2;
-    float y_slope = GetPoint(px, yPrev) - GetPoint(px, yNext);
-    if ((py <= 0) || (py >= patchHeight * cPatchSize))
-        y_slope *= 2;
+    // Uses the same differences as the vertex normals of the chunk geometry.
+    float x_slope = ExtrapolatedPoint(*this, px-1, py) - ExtrapolatedPoint(*this, px+1, py);
+    float y_slope = ExtrapolatedPoint(*this, px, py-1) - ExtrapolatedPoint(*this, px, py+1);
 
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
     return float3(x_slope, 2.0, y_slope).Normalized();
@@ -569,13 +894,17 @@ bool EC_Terrain::SaveToFile(QString filename)
 
     assert(sizeof(float) == 4);
 
-    for(u32 i = 0; i < xPatches*yPatches; ++i)
-    {
-        if (patches[i].heightData.size() < cPatchSize*cPatchSize)
-            patches[i].heightData.resize(cPatchSize*cPatchSize);
+    // The file stores the height values patch by patch.
+    float patchData[cPatchSize*cPatchSize];
+    for(u32 py = 0; py < yPatches; ++py)
+        for(u32 px = 0; px < xPatches; ++px)
+        {
+            for(uint y = 0; y < cPatchSize; ++y)
+                for(uint x = 0; x < cPatchSize; ++x)
+                    patchData[y*cPatchSize+x] = heightfield->Get(px*cPatchSize+x, py*cPatchSize+y);
 
-        fwrite(&patches[i].heightData[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
-    }
+            fwrite(patchData, sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
+        }
     fflush(handle);
     if (ferror(handle))
     LogError("Write error in SaveToFile");
@@ -616,36 +945,50 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     u32 xPatches = ReadU32(data, numBytes, offset);
     u32 yPatches = ReadU32(data, numBytes, offset);
 
-    // Load all the data from the file to an intermediate buffer first, so that we can first see
-    // if the file is not broken, and reject it without losing the old terrain.
-    std::vector<Patch> newPatches(xPatches*yPatches);
-
-    // Initialize the new height data structure.
-    for(u32 y = 0; y < yPatches; ++y)
-        for(u32 x = 0; x < xPatches; ++x)
-        {
-            newPatches[y*xPatches+x].x = x;
-            newPatches[y*xPatches+x].y = y;
-        }
-
     assert(sizeof(float) == 4);
 
-    // Load the new data.
-    for(size_t i = 0; i < newPatches.size(); ++i)
-    {
-        newPatches[i].heightData.resize(cPatchSize*cPatchSize);
-        newPatches[i].patch_geometry_dirty = true;
-        if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
-            throw Exception("Not enough bytes to deserialize!");
+    // Check that the file is not broken before touching the old terrain, so that it can be rejected without losing the old terrain.
+    const size_t numValues = (size_t)xPatches*yPatches*cPatchSize*cPatchSize;
+    if (offset + numValues*sizeof(float) > numBytes)
+        throw Exception("Not enough bytes to deserialize!");
 
-        memcpy(&newPatches[i].heightData[0], data + offset, cPatchSize*cPatchSize*sizeof(float));
-        offset += cPatchSize*cPatchSize*sizeof(float);
+    // The height values are stored patch by patch. They are read straight to the new heightfield. The heightfield is centered on the range
+    // of the values, so that its quantization window does not need to move while they are being read.
+    float minHeight = std::numeric_limits<float>::max();
+    float maxHeight = -std::numeric_limits<float>::max();
+    for(size_t i = 0; i < numValues; ++i)
+    {
+        float value;
+        memcpy(&value, data + offset + i*sizeof(float), sizeof(float));
+        minHeight = min(minHeight, value);
+        maxHeight = max(maxHeight, value);
     }
 
+    shared_ptr<Heightfield> newHeightfield = MAKE_SHARED(Heightfield, xPatches*cPatchSize, yPatches*cPatchSize,
+        numValues > 0 ? (minHeight + maxHeight) * 0.5f : 0.f, heightQuantizationStep);
+    for(u32 py = 0; py < yPatches; ++py)
+        for(u32 px = 0; px < xPatches; ++px)
+            for(uint y = 0; y < cPatchSize; ++y)
+                for(uint x = 0; x < cPatchSize; ++x)
+                {
+                    float value;
+                    memcpy(&value, data + offset, sizeof(float));
+                    offset += sizeof(float);
+                    newHeightfield->Set(px*cPatchSize+x, py*cPatchSize+y, value);
+                }
+
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
     Destroy();
 
-    patches = newPatches;
+    patches.clear();
+    patches.resize(xPatches*yPatches);
+    for(u32 y = 0; y < yPatches; ++y)
+        for(u32 x = 0; x < xPatches; ++x)
+        {
+            patches[y*xPatches+x].x = x;
+            patches[y*xPatches+x].y = y;
+        }
+    heightfield = newHeightfield;
     patchWidth = xPatches;
     patchHeight = yPatches;
 
@@ -1112,16 +1455,14 @@ void EC_Terrain::SetTerrainMaterialTexture(uint index, const QString &textureNam
 //        LogWarning("Ogre material " + std::string(terrainMaterialName) + " not found!");
 }
 
-void EC_Terrain::UpdateTerrainPatchMaterial(uint patchX, uint patchY)
+void EC_Terrain::UpdateTerrainChunkMaterial(Chunk &chunk)
 {
-    Patch &patch = GetPatch(patchX, patchY);
-
-    if (!patch.entity)
+    if (!chunk.entity)
         return;
 
-    for(uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
+    for(uint i = 0; i < chunk.entity->getNumSubEntities(); ++i)
     {
-        Ogre::SubEntity *sub = patch.entity->getSubEntity(i);
+        Ogre::SubEntity *sub = chunk.entity->getSubEntity(i);
         if (sub)
             sub->setMaterialName(currentMaterial.toStdString().c_str());
     }
@@ -1171,166 +1512,240 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY)
+void EC_Terrain::UpdateChunkLayout()
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    if (chunksPatchWidth == patchWidth && chunksPatchHeight == patchHeight)
+        return;
 
-    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+    // The chunks at the edges change shape, and the blend mask UVs of all vertices depend on the terrain size, so the whole terrain is regenerated.
+    for(size_t i = 0; i < chunks.size(); ++i)
+        DestroyChunk(chunks[i]);
 
-    if (!ViewEnabled())
-        return;
-    if (world_.expired())
-        return;
-    OgreWorldPtr world = world_.lock();
-    Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
+    chunkWidth = (patchWidth + cChunkSize - 1) / cChunkSize;
+    chunkHeight = (patchHeight + cChunkSize - 1) / cChunkSize;
+    chunks.clear();
+    chunks.resize(chunkWidth * chunkHeight);
+    chunksPatchWidth = patchWidth;
+    chunksPatchHeight = patchHeight;
 
-    Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
-    if (!node)
+    for(size_t i = 0; i < patches.size(); ++i)
     {
-        CreateOgreTerrainPatchNode(node, patch.x, patch.y);
-        patch.node = node;
+        patches[i].node = 0;
+        patches[i].entity = 0;
+        patches[i].patch_geometry_dirty = true;
     }
-    assert(node);
+}
 
-    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
-    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
-        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+void EC_Terrain::ScheduleChunkGeometry(uint chunkX, uint chunkY, bool fullBuild, uint minX, uint minY, uint maxX, uint maxY)
+{
+    Chunk &chunk = GetChunk(chunkX, chunkY);
+
+    shared_ptr<TerrainChunkGeometry> geometry = MAKE_SHARED(TerrainChunkGeometry);
+    geometry->chunkIndex = chunkY * chunkWidth + chunkX;
+    geometry->chunkId = chunk.id;
+    geometry->fullBuild = fullBuild;
+    geometry->skirts[SkirtMinY] = chunkY > 0;
+    geometry->skirts[SkirtMaxY] = chunkY + 1 < chunkHeight;
+    geometry->skirts[SkirtMinX] = chunkX > 0;
+    geometry->skirts[SkirtMaxX] = chunkX + 1 < chunkWidth;
+    geometry->firstX = chunk.firstX;
+    geometry->firstY = chunk.firstY;
+    geometry->verticesX = chunk.verticesX;
+    geometry->verticesY = chunk.verticesY;
+    geometry->minX = max(minX, chunk.firstX);
+    geometry->minY = max(minY, chunk.firstY);
+    geometry->maxX = min(maxX, chunk.firstX + chunk.verticesX - 1);
+    geometry->maxY = min(maxY, chunk.firstY + chunk.verticesY - 1);
+    geometry->mapWidth = VerticesWidth();
+    geometry->mapHeight = VerticesHeight();
+    geometry->uScale = uScale.Get();
+    geometry->vScale = vScale.Get();
+
+    // Copy the height values, so that the worker thread does not race with the edits done to the terrain while it runs.
+    const int stride = (int)chunk.verticesX + 2;
+    geometry->heights.resize(stride * (chunk.verticesY + 2));
+    for(int y = -1; y <= (int)chunk.verticesY; ++y)
+        for(int x = -1; x <= (int)chunk.verticesX; ++x)
+            geometry->heights[(y + 1) * stride + x + 1] = ExtrapolatedPoint(*this, (int)chunk.firstX + x, (int)chunk.firstY + y);
+
+    pendingChunkGeometry.push_back(geometry);
+    QThreadPool::globalInstance()->start(new TerrainChunkGeometryJob(geometry));
+}
 
-    Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
-    manual->setCastShadows(false);
+void EC_Terrain::ApplyChunkGeometry()
+{
+    PROFILE(EC_Terrain_ApplyChunkGeometry);
 
-    manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+    const tick_t start = GetCurrentClockTime();
+    const tick_t budget = (tick_t)(cChunkUploadBudgetMsecs * GetCurrentClockFreq() / 1000.0);
+    bool chunksCreated = false;
+    int numApplied = 0;
 
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, 0.f, patch.y * patchSpacingY);
-// Opensim:    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
+    // The geometry is applied in the order it was requested, since the later partial updates of a chunk build on the earlier ones.
+    while(!pendingChunkGeometry.empty() && pendingChunkGeometry.front()->IsFinished())
+    {
+        if (numApplied > 0 && GetCurrentClockTime() - start >= budget)
+            break;
 
-    int curIndex = 0;
+        shared_ptr<TerrainChunkGeometry> geometry = pendingChunkGeometry.front();
+        pendingChunkGeometry.pop_front();
+        ++numApplied;
 
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
+        if (geometry->chunkIndex >= chunks.size() || chunks[geometry->chunkIndex].id != geometry->chunkId)
+            continue; // The chunk has been destroyed or the terrain resized since the geometry was requested.
+        Chunk &chunk = chunks[geometry->chunkIndex];
+        if (geometry->fullBuild)
+        {
+            CreateChunkMesh(geometry->chunkIndex % chunkWidth, geometry->chunkIndex / chunkWidth, *geometry);
+            chunksCreated = true;
+        }
+        else if (chunk.entity)
+            UploadChunkGeometry(chunk, chunk.entity->getMesh().get(), *geometry);
+    }
 
-    const float uScale = this->uScale.Get();
-    const float vScale = this->vScale.Get();
+    // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
+    // we need to hide all newly created geometry.
+    if (chunksCreated)
+        AttachTerrainRootNode();
 
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
-        {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
-
-            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
-            // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-            pos.x = vertexSpacingX * x;
-            pos.z = vertexSpacingY * y;
-// Opensim:             pos.x = vertexSpacingX * x;
-// Opensim              pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
-            {
-                thisPatch = &patch;
+    if (pendingChunkGeometry.empty())
+        disconnect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(ApplyChunkGeometry()));
+}
 
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex);
-
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+1);
-                }
-            }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
-            }
-            else if (x == cPatchVertexWidth)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
-            }
-            else // (y == patchHeight)
-            {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
-            }
+void EC_Terrain::UploadChunkGeometry(Chunk &chunk, Ogre::Mesh *mesh, const TerrainChunkGeometry &geometry)
+{
+    Ogre::HardwareVertexBufferSharedPtr vbuf = mesh->sharedVertexData->vertexBufferBinding->getBuffer(0);
+    const size_t vertexSize = vbuf->getVertexSize();
+    const size_t rowVertices = geometry.maxX - geometry.minX + 1;
+    const size_t numRows = geometry.maxY - geometry.minY + 1;
+
+    // Lock the span from the first to the last vertex of the rectangle. The shadow buffer keeps the vertices in between intact,
+    // and only the locked span is uploaded to the GPU.
+    const size_t first = (geometry.minY - chunk.firstY) * chunk.verticesX + geometry.minX - chunk.firstX;
+    const size_t last = (geometry.maxY - chunk.firstY) * chunk.verticesX + geometry.maxX - chunk.firstX;
+    char *data = static_cast<char*>(vbuf->lock(first * vertexSize, (last - first + 1) * vertexSize, Ogre::HardwareBuffer::HBL_NORMAL));
+    for(size_t y = 0; y < numRows; ++y)
+        memcpy(data + y * chunk.verticesX * vertexSize, &geometry.vertices[y * rowVertices * cChunkVertexFloats], rowVertices * vertexSize);
+    vbuf->unlock();
+
+    vbuf->writeData(chunk.verticesX * chunk.verticesY * vertexSize, geometry.skirtVertices.size() * sizeof(float), &geometry.skirtVertices[0]);
+
+    const float halfX = (chunk.verticesX - 1) * 0.5f;
+    const float halfY = (chunk.verticesY - 1) * 0.5f;
+    const float bottom = geometry.minHeight - geometry.skirtDepth;
+    const float maxAbsHeight = max(fabs(bottom), fabs(geometry.maxHeight));
+    mesh->_setBounds(Ogre::AxisAlignedBox(-halfX, bottom, -halfY, halfX, geometry.maxHeight, halfY), false);
+    mesh->_setBoundingSphereRadius(sqrt(halfX*halfX + maxAbsHeight*maxAbsHeight + halfY*halfY));
+
+    // Let the raycast caches of the mesh know that the geometry has changed, and Ogre to recompute the bounds of the node.
+    mesh->_dirtyState();
+    if (chunk.node)
+        chunk.node->needUpdate();
+}
 
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
+void EC_Terrain::UpdateChunkLodDistances(Ogre::Mesh *mesh)
+{
+    const float3 scale = nodeTransformation.Get().scale;
+    const float vertexSpacing = max(fabs(scale.x), fabs(scale.z));
 
-            manual->position(pos);
-            manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
+    for(uint level = 1; level < cNumChunkLods; ++level)
+    {
+        Ogre::MeshLodUsage usage;
+        usage.userValue = cChunkLodDistance * (1 << (level - 1)) * vertexSpacing;
+        usage.value = mesh->getLodStrategy()->transformUserValue(usage.userValue);
+        usage.edgeData = 0;
+        mesh->_setLodUsage((unsigned short)level, usage);
+    }
+}
 
-            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-// Opensim:             manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
+void EC_Terrain::CreateChunkMesh(uint chunkX, uint chunkY, const TerrainChunkGeometry &geometry)
+{
+    PROFILE(EC_Terrain_CreateChunkMesh);
 
-            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
+    if (!ViewEnabled())
+        return;
+    if (world_.expired())
+        return;
+    OgreWorldPtr world = world_.lock();
+    Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
 
-            ++curIndex;
-        }
+    EC_Terrain::Chunk &chunk = GetChunk(chunkX, chunkY);
+    assert(!chunk.entity);
 
-    manual->end();
+    CreateOgreTerrainChunkNode(chunk.node, chunkX, chunkY);
+    if (!chunk.node)
+        return;
 
-    // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+
+    chunk.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_chunkmesh");
+    Ogre::MeshPtr terrainMesh = Ogre::MeshManager::getSingleton().createManual(chunk.meshGeometryName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+
+    const size_t numVertices = chunk.verticesX * chunk.verticesY + 2 * chunk.verticesX + 2 * chunk.verticesY;
+    terrainMesh->sharedVertexData = OGRE_NEW Ogre::VertexData();
+    terrainMesh->sharedVertexData->vertexCount = numVertices;
+    Ogre::VertexDeclaration *decl = terrainMesh->sharedVertexData->vertexDeclaration;
+    size_t offset = 0;
+    decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+    offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+    decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL);
+    offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+    decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0);
+    offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT2);
+    decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1);
+    assert(decl->getVertexSize(0) == cChunkVertexFloats * sizeof(float));
+
+    // The shadow buffer allows rewriting the vertices of single patches in place, and reading the geometry back for raycasts.
+    Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        decl->getVertexSize(0), numVertices, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    terrainMesh->sharedVertexData->vertexBufferBinding->setBinding(0, vbuf);
+
+    UploadChunkGeometry(chunk, terrainMesh.get(), geometry);
+
+    Ogre::SubMesh *subMesh = terrainMesh->createSubMesh();
+    subMesh->useSharedVertices = true;
+    subMesh->setMaterialName(terrainMaterial->getName());
+
+#if OGRE_VERSION_MAJOR <= 1 && OGRE_VERSION_MINOR < 9
+    terrainMesh->_setLodInfo(cNumChunkLods, false);
+#else
+    terrainMesh->_setLodInfo(cNumChunkLods);
+#endif
+    UpdateChunkLodDistances(terrainMesh.get());
+
+    for(uint level = 0; level < cNumChunkLods; ++level)
     {
-        try
-        {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
-        }
-        catch(...) {}
+        const std::vector<u16> &indices = geometry.lodIndices[level];
+        Ogre::IndexData *indexData = (level == 0) ? subMesh->indexData : OGRE_NEW Ogre::IndexData();
+        // Raycasts read the full detail level, so it gets a shadow buffer.
+        indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+            Ogre::HardwareIndexBuffer::IT_16BIT, indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, level == 0);
+        indexData->indexBuffer->writeData(0, indices.size() * sizeof(u16), &indices[0], true);
+        indexData->indexStart = 0;
+        indexData->indexCount = indices.size();
+        if (level > 0)
+            terrainMesh->_setSubMeshLodFaceList(0, (unsigned short)level, indexData);
     }
 
-    patch.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_patchmesh");
-    Ogre::MeshPtr terrainMesh = manual->convertToMesh(patch.meshGeometryName);
-
-    // Odd: destroyManualObject seems to leave behind a memory leak if we don't call manualObject->clear first.
-    manual->clear();
-    sceneMgr->destroyManualObject(manual);
+    terrainMesh->load();
 
-    patch.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
-    patch.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
-    patch.entity->setCastShadows(false);
+    chunk.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_chunkentity"), chunk.meshGeometryName);
+    chunk.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
+    chunk.entity->setCastShadows(false);
     // Set UserAny also on subentities
-    for(uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
-        patch.entity->getSubEntity(i)->setUserAny(patch.entity->getUserAny());
+    for(uint i = 0; i < chunk.entity->getNumSubEntities(); ++i)
+        chunk.entity->getSubEntity(i)->setUserAny(chunk.entity->getUserAny());
 
-    // Explicitly destroy all attached MovableObjects previously bound to this terrain node.
-    Ogre::SceneNode::ObjectIterator iter = node->getAttachedObjectIterator();
-    while(iter.hasMoreElements())
-    {
-        Ogre::MovableObject *obj = iter.getNext();
-        sceneMgr->destroyMovableObject(obj);
-    }
-    node->detachAllObjects();
-    // Now attach the new built terrain mesh.
-    node->attachObject(patch.entity);
+    chunk.node->attachObject(chunk.entity);
 
-    patch.patch_geometry_dirty = false;
+    for(uint py = chunkY * cChunkSize; py < min(patchHeight, (chunkY + 1) * cChunkSize); ++py)
+        for(uint px = chunkX * cChunkSize; px < min(patchWidth, (chunkX + 1) * cChunkSize); ++px)
+        {
+            GetPatch(px, py).node = chunk.node;
+            GetPatch(px, py).entity = chunk.entity;
+        }
 }
 
 void EC_Terrain::CreateRootNode()
@@ -1352,7 +1767,7 @@ void EC_Terrain::CreateRootNode()
     UpdateRootNodeTransform();
 }
 
-void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, uint patchX, uint patchY)
+void EC_Terrain::CreateOgreTerrainChunkNode(Ogre::SceneNode *&node, uint chunkX, uint chunkY)
 {
     if (world_.expired())
         return;
@@ -1365,7 +1780,7 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, uint patchX,
     if (!rootNode)
         CreateRootNode();
 
-    QString name = QString("EC_Terrain_Patch_") + QString::number(patchX) + "_" + QString::number(patchY);
+    QString name = QString("EC_Terrain_Chunk_") + QString::number(chunkX) + "_" + QString::number(chunkY);
     node = sceneMgr->createSceneNode(world->GetUniqueObjectName(name.toStdString()));
     if (!node)
         return;
@@ -1374,46 +1789,40 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, uint patchX,
         rootNode->addChild(node);
     else // Just as a safety check, if for some odd reason we did not get the root node.
         sceneMgr->getRootSceneNode()->addChild(node);
-    
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = 16 * vertexSpacingX;
-    const float patchSpacingY = 16 * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patchX * patchSpacingX, 0.f, patchY * patchSpacingY);
 
-    node->setPosition(patchOrigin);
+    // The chunk geometry is centered on the node, so that the bounding sphere, and thus the distance-based level of detail, fits the chunk tightly.
+    const Chunk &chunk = GetChunk(chunkX, chunkY);
+    node->setPosition(chunk.CenterX(), 0.f, chunk.CenterY());
 }
 
 float EC_Terrain::GetTerrainMinHeight() const
 {
-    float minHeight = std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            minHeight = min(minHeight, patches[i].heightData[j]);
-
+    float minHeight, maxHeight;
+    heightfield->GetRange(minHeight, maxHeight);
     return minHeight;
 }
 
 float EC_Terrain::GetTerrainMaxHeight() const
 {
-    float maxHeight = -std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            maxHeight = max(maxHeight, patches[i].heightData[j]);
-
+    float minHeight, maxHeight;
+    heightfield->GetRange(minHeight, maxHeight);
     return maxHeight;
 }
 
 void EC_Terrain::Resize(uint newWidth, uint newHeight, uint oldPatchStartX, uint oldPatchStartY)
 {
     std::vector<Patch> newPatches(newWidth * newHeight);
-    for(uint y = 0; y < newHeight && y + oldPatchStartY < yPatches.Get(); ++y)
-        for(uint x = 0; x < newWidth && x + oldPatchStartX < xPatches.Get(); ++x)
-            newPatches[y * newWidth + x] = patches[(y + oldPatchStartY) * xPatches.Get() + x + oldPatchStartX];
+    for(uint y = 0; y < newHeight; ++y)
+        for(uint x = 0; x < newWidth; ++x)
+        {
+            newPatches[y * newWidth + x].x = x;
+            newPatches[y * newWidth + x].y = y;
+        }
+    patches.swap(newPatches);
 
-    patches = newPatches;
+    shared_ptr<Heightfield> newHeightfield = MAKE_SHARED(Heightfield, newWidth * cPatchSize, newHeight * cPatchSize, 0.f, heightQuantizationStep);
+    newHeightfield->Copy(*heightfield, oldPatchStartX * cPatchSize, oldPatchStartY * cPatchSize, 0, 0, newWidth * cPatchSize, newHeight * cPatchSize);
+    heightfield = newHeightfield;
     xPatches.Set(newWidth, AttributeChange::Disconnected);
     yPatches.Set(newHeight, AttributeChange::Disconnected);
     patchWidth = newWidth;
@@ -1434,6 +1843,20 @@ void EC_Terrain::DirtyAllTerrainPatches()
         patches[i].patch_geometry_dirty = true;
 }
 
+void EC_Terrain::SetHeightQuantizationStep(float step)
+{
+    heightQuantizationStep = max(0.f, step);
+    const u32 layoutVersion = heightfield->LayoutVersion();
+    if (!heightfield->SetQuantizationStep(heightQuantizationStep))
+        LogWarning("EC_Terrain::SetHeightQuantizationStep: The height range of the terrain does not fit in 16 bits with the step " +
+            QString::number(heightQuantizationStep) + ". Storing the height values as floats.");
+    CheckHeightfieldLayout(layoutVersion);
+
+    // Quantizing the values rounds them, so the geometry is regenerated to match the stored values.
+    DirtyAllTerrainPatches();
+    RegenerateDirtyTerrainPatches();
+}
+
 void EC_Terrain::RegenerateDirtyTerrainPatches()
 {
     PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
@@ -1442,40 +1865,91 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
     if (!parentEntity)
         return;
     EC_Placeable *position = parentEntity->GetComponent<EC_Placeable>().get();
-    if (!GetFramework()->IsHeadless() && (!position || position->visible.Get())) // Only need to create GPU resources if the placeable itself is visible.
+
+    // Edits that temporarily widen the height range, e.g. overwriting the whole terrain, may have made the heightfield fall back to floats.
+    // Quantizing the values again rounds them, so all the geometry is regenerated.
+    if (heightQuantizationStep > 0.f && !heightfield->IsQuantized())
     {
+        const u32 layoutVersion = heightfield->LayoutVersion();
+        if (heightfield->SetQuantizationStep(heightQuantizationStep))
+            DirtyAllTerrainPatches();
+        CheckHeightfieldLayout(layoutVersion);
+    }
+
+    if (!GetFramework()->IsHeadless() && ViewEnabled() && (!position || position->visible.Get())) // Only need to create GPU resources if the placeable itself is visible.
+    {
+        UpdateChunkLayout();
+
+        // First request the whole geometry of the chunks that have none yet.
+        std::vector<bool> fullBuild(chunks.size(), false);
+        for(uint y = 0; y < chunkHeight; ++y)
+            for(uint x = 0; x < chunkWidth; ++x)
+            {
+                Chunk &chunk = GetChunk(x, y);
+                if (chunk.id != 0)
+                    continue;
+
+                bool dirty = false;
+                for(uint py = y * cChunkSize; py < min(patchHeight, (y + 1) * cChunkSize); ++py)
+                    for(uint px = x * cChunkSize; px < min(patchWidth, (x + 1) * cChunkSize); ++px)
+                        dirty = dirty || GetPatch(px, py).patch_geometry_dirty;
+
+                if (dirty)
+                {
+                    // If we assume each patch is 16x16 vertices, then all the internal chunks will get a 65x65 grid, since we need to connect seams.
+                    // But, the outermost chunk row and column at the terrain edge will not have this, since they do not need to connect to a next chunk.
+                    chunk.firstX = x * cChunkSize * cPatchSize;
+                    chunk.firstY = y * cChunkSize * cPatchSize;
+                    chunk.verticesX = min(chunk.firstX + cChunkSize * cPatchSize, VerticesWidth() - 1) - chunk.firstX + 1;
+                    chunk.verticesY = min(chunk.firstY + cChunkSize * cPatchSize, VerticesHeight() - 1) - chunk.firstY + 1;
+                    chunk.id = nextChunkId++;
+                    if (nextChunkId == 0)
+                        nextChunkId = 1;
+                    ScheduleChunkGeometry(x, y, true, chunk.firstX, chunk.firstY, chunk.firstX + chunk.verticesX - 1, chunk.firstY + chunk.verticesY - 1);
+                    fullBuild[y * chunkWidth + x] = true;
+                }
+            }
+
+        // Then gather the vertices of the remaining dirty patches to a rectangle per chunk, to be rewritten in place. The normals next to a patch
+        // depend on its height values, and each chunk shares its border vertices with the next one, so the vertices one step around the patch are included.
+        std::vector<DirtyRect> dirtyRects(chunks.size());
         for(uint y = 0; y < patchHeight; ++y)
             for(uint x = 0; x < patchWidth; ++x)
             {
                 EC_Terrain::Patch &scenePatch = GetPatch(x, y);
-                if (!scenePatch.patch_geometry_dirty || scenePatch.heightData.size() == 0)
+                if (!scenePatch.patch_geometry_dirty)
                     continue;
 
-                bool neighborsLoaded = true;
-
-                const int neighbors[8][2] = 
-                { 
-                    { -1, -1 }, { -1, 0 }, { -1, 1 },
-                    {  0, -1 },            {  0, 1 },
-                    {  1, -1 }, {  1, 0 }, {  1, 1 }
-                };
+                const Chunk &ownChunk = GetChunk(x / cChunkSize, y / cChunkSize);
+                if (ownChunk.id == 0)
+                    continue;
 
-                for(uint i = 0; i < 8; ++i)
-                {
-                    uint nX = x + neighbors[i][0];
-                    uint nY = y + neighbors[i][1];
-                    if (nX >= 0 && nX < patchWidth &&
-                        nY >= 0 && nY < patchHeight &&
-                        GetPatch(nX, nY).heightData.size() == 0)
-                    {
-                        neighborsLoaded = false;
-                        break;
-                    }
-                }
+                const uint minX = (x > 0) ? x * cPatchSize - 1 : 0;
+                const uint minY = (y > 0) ? y * cPatchSize - 1 : 0;
+                const uint maxX = min((x + 1) * cPatchSize, VerticesWidth() - 1);
+                const uint maxY = min((y + 1) * cPatchSize, VerticesHeight() - 1);
+                const uint chunkVertices = cChunkSize * cPatchSize;
+                for(uint cy = (minY > 0 ? minY - 1 : 0) / chunkVertices; cy <= min(maxY / chunkVertices, chunkHeight - 1); ++cy)
+                    for(uint cx = (minX > 0 ? minX - 1 : 0) / chunkVertices; cx <= min(maxX / chunkVertices, chunkWidth - 1); ++cx)
+                        if (GetChunk(cx, cy).id != 0 && !fullBuild[cy * chunkWidth + cx])
+                            dirtyRects[cy * chunkWidth + cx].Add(minX, minY, maxX, maxY);
+
+                // The chunk mesh may still be on its way, in which case the patch gets its node and entity when the mesh is created.
+                scenePatch.node = ownChunk.node;
+                scenePatch.entity = ownChunk.entity;
+                scenePatch.patch_geometry_dirty = false;
+            }
 
-                if (neighborsLoaded)
-                    GenerateTerrainGeometryForOnePatch(x, y);
+        for(uint y = 0; y < chunkHeight; ++y)
+            for(uint x = 0; x < chunkWidth; ++x)
+            {
+                const DirtyRect &rect = dirtyRects[y * chunkWidth + x];
+                if (!rect.IsEmpty())
+                    ScheduleChunkGeometry(x, y, false, rect.minX, rect.minY, rect.maxX, rect.maxY);
             }
+
+        if (!pendingChunkGeometry.empty())
+            connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(ApplyChunkGeometry()), Qt::UniqueConnection);
     }
     
     // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
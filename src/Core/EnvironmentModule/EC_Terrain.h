@@ -11,7 +11,11 @@
 #include "AssetRefListener.h"
 #include "OgreModuleFwd.h"
 
+#include <list>
+
 namespace Ogre { class Matrix4; }
+struct TerrainChunkGeometry;
+class Heightfield;
 
 /// Adds a heightmap-based terrain to the scene.
 /** <table class="header">
@@ -20,7 +24,8 @@ namespace Ogre { class Matrix4; }
     <td>
     <h2>Terrain</h2>
     Adds a heightmap-based terrain to the scene. A Terrain is composed of a rectangular grid of adjacent "patches".
-    Each patch is a fixed-size 16x16 height map.
+    Each patch is a fixed-size 16x16 part of the height map, which is stored in a single Heightfield. For rendering, the patches are grouped to square chunks of cChunkSize x cChunkSize patches.
+    Each chunk is drawn as a single mesh, which Ogre draws with fewer triangles the further away the chunk is from the camera.
 
     Registered by EnvironmentComponents plugin.
 
@@ -96,12 +101,13 @@ public:
     /// Each patch is a square containing this many vertices per side.
     static const uint cPatchSize = 16;
 
+    /// Each render chunk is a square containing this many patches per side. The chunks at the right and bottom edges of the terrain may be smaller.
+    static const uint cChunkSize = 4;
+
     /// Describes a single patch that is present in the scene.
-    /** A patch can be in one of the following three states:
-        - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
-        - heightmap data loaded. The heightData vector contains the heightmap data, but the visible GPU vertex data itself has not been generated yet, due to the neighbors
-          of this patch not being present yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
-        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
+    /** The height values of the patch are stored in the Heightfield of the terrain. A patch can be in one of the following two states:
+        - heightmap data loaded, but the visible GPU vertex data itself has not been generated yet. node == entity == 0. patch_geometry_dirty == true.
+        - fully loaded. The GPU data is also loaded and the node and entity fields specify the GPU resources of the render chunk that contains the patch. */
     struct Patch
     {
         Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
@@ -112,26 +118,16 @@ public:
         /// Y-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchHeight()].
         uint y;
 
-        /// Typically this will be a 16x16 array of height values in world coordinates.
-        /// If the length is zero, this patch hasn't been loaded in yet.
-        std::vector<float> heightData;
-
-        /// Ogre -specific: Store a reference to the actual render hierarchy node.
+        /// Ogre -specific: Store a reference to the render hierarchy node of the chunk this patch is part of.
+        /// All the patches of a chunk share the same node.
         Ogre::SceneNode *node;
 
         /// Ogre -specific: Store a reference to the entity that is attached to the above SceneNode.
         Ogre::Entity *entity;
 
-        /// The name of the Ogre Mesh resource that contains the GPU geometry data for this patch.
-        std::string meshGeometryName;
-
         /// If true, the CPU-side heightmap data has changed, but we haven't yet updated
-        /// the GPU-side geometry resources since the neighboring patches haven't been loaded
-        /// in yet.
+        /// the GPU-side geometry resources.
         bool patch_geometry_dirty;
-
-        /// Call only when you've checked that this patch has been loaded in.
-        float GetHeightValue(uint x, uint y) const { return heightData[y*cPatchSize+x]; }
     };
     
     /// @return The patch at given (x,y) coordinates. Pass in values in range [0, PatchWidth()/PatchHeight[.
@@ -163,6 +159,12 @@ public:
 
     float3 CalculateNormal(uint mapX, uint mapY) const { return CalculateNormal( (uint) mapX / cPatchSize, (uint) mapY / cPatchSize, mapX % cPatchSize, mapY % cPatchSize); }
 
+    /// Returns the storage of the height values, VerticesWidth() x VerticesHeight() of them.
+    /** The terrain replaces the heightfield with a new one when it is resized or loaded, and emits TerrainRegenerated when the regenerated
+        geometry has been requested. A holder of the returned pointer keeps the old values alive, but does not see the new ones.
+        If an edit changes the layout of the raw values of the current heightfield, HeightfieldLayoutChanged is emitted right away. */
+    const shared_ptr<Heightfield> &GetHeightfield() const { return heightfield; }
+
 public slots:
     /// Returns true if the given patch exists, i.e. whether the given coordinates are within the current terrain patch dimensions.
     /** This function does not tell whether the data for the patch is actually loaded on the CPU or the GPU. */
@@ -171,12 +173,12 @@ public slots:
         return patchX >= 0 && patchY >= 0 && patchX < patchWidth && patchY < patchHeight && patchY * patchWidth + patchX < (int)patches.size();
     }
 
-    /// Returns true if all the patches on the terrain are loaded on the CPU, i.e. if all the terrain height data has been streamed in from the server side.
+    /// Returns true if the GPU geometry of all the patches on the terrain has been created.
     bool AllPatchesLoaded() const
     {
         for(uint y = 0; y < patchHeight; ++y)
             for(uint x = 0; x < patchWidth; ++x)
-                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || GetPatch(x,y).node == 0)
+                if (!PatchExists(x,y) || GetPatch(x,y).node == 0)
                     return false;
 
         return true;
@@ -256,7 +258,8 @@ public slots:
     /// Removes all stored terrain patches and the associated Ogre scene nodes.
     void Destroy();
 
-    /// Releases all GPU resources used for the given patch.
+    /// Releases the GPU resources of the render chunk that contains the given patch.
+    /** All the patches of the chunk are dirtied, so that the chunk is regenerated on the next call to RegenerateDirtyTerrainPatches(). */
     void DestroyPatch(uint patchX, uint patchY);
 
     /// Makes all the vertices of the given patch flat with the given height value.
@@ -348,6 +351,19 @@ public slots:
     /// Marks all terrain patches dirty.
     void DirtyAllTerrainPatches();
 
+    /// Sets how the height values are stored.
+    /** @param step If greater than zero, the height values are stored as 16-bit integers in steps of this size, which halves the memory the
+        heightfield takes, at the cost of an error of up to half a step. If zero, the values are stored as floats. The setting persists when the
+        terrain is resized or reloaded. */
+    void SetHeightQuantizationStep(float step);
+
+    /// Returns the step the height values are stored in, or zero if they are stored as floats.
+    float HeightQuantizationStep() const { return heightQuantizationStep; }
+
+    /// Regenerates the GPU geometry of the dirty patches.
+    /** The chunks that have no GPU geometry yet are created as a whole. For the others, only the vertices of the dirty patches
+        and their immediate neighbors are rewritten in place. The vertices are generated on worker threads from a copy of the height values,
+        and uploaded to the GPU during the following frames, within a time budget per frame. */
     void RegenerateDirtyTerrainPatches();
 
     /// Returns the minimum height value in the whole terrain.
@@ -367,6 +383,10 @@ signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted right after an edit has moved the raw values of the heightfield, or changed how they are stored.
+    /** The pointers to the old values of Heightfield::Data() are invalid, and must not be read once this signal has been handled. */
+    void HeightfieldLayoutChanged();
+
 private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
@@ -378,17 +398,52 @@ private slots:
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
+    /// Uploads the chunk geometry that the worker threads have finished to the GPU, until the time budget of the frame runs out.
+    void ApplyChunkGeometry();
+
 private:
+    /// A square of patches that is drawn as a single Ogre mesh.
+    /** The vertices of the chunk cover the map vertices [firstX, firstX+verticesX[ x [firstY, firstY+verticesY[, so each chunk
+        shares its right and bottom vertex row with the next chunk. After the grid vertices, the vertex buffer holds the skirt
+        vertices, which are copies of the border vertices moved down. The mesh has an index buffer for each level of detail,
+        and Ogre chooses between them by the distance of the chunk to the camera. The skirts hide the cracks between adjacent
+        chunks drawn at different levels of detail. */
+    struct Chunk
+    {
+        Chunk():node(0), entity(0), firstX(0), firstY(0), verticesX(0), verticesY(0), id(0) {}
+
+        Ogre::SceneNode *node;
+        Ogre::Entity *entity;
+
+        /// The name of the Ogre Mesh resource that contains the GPU geometry data for this chunk.
+        std::string meshGeometryName;
+
+        uint firstX;
+        uint firstY;
+        uint verticesX;
+        uint verticesY;
+
+        /// Identifies the geometry requested for the chunk. Zero if none has been requested since the chunk was last destroyed.
+        /// The geometry that finishes for an earlier ID is discarded.
+        u32 id;
+
+        /// The map coordinates of the chunk center, which is the origin of the chunk node.
+        float CenterX() const { return firstX + (verticesX - 1) * 0.5f; }
+        float CenterY() const { return firstY + (verticesY - 1) * 0.5f; }
+    };
+
+    Chunk &GetChunk(uint chunkX, uint chunkY) { return chunks[chunkY * chunkWidth + chunkX]; }
+
     void AttributesChanged();
 
     /// Creates the patch parent/root node if it does not exist.
     /** After this function returns, the 'root' member node will exist, unless Ogre rendering subsystem fails. */
     void CreateRootNode();
 
-    void CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, uint patchX, uint patchY);
+    void CreateOgreTerrainChunkNode(Ogre::SceneNode *&node, uint chunkX, uint chunkY);
 
-    /// Sets the given patch to use the currently set material and textures.
-    void UpdateTerrainPatchMaterial(uint patchX, uint patchY);
+    /// Sets the given chunk to use the currently set material and textures.
+    void UpdateTerrainChunkMaterial(Chunk &chunk);
 
     /// Updates the root node transform from the current attribute values, if the root node exists.
     void UpdateRootNodeTransform();
@@ -403,9 +458,27 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(uint index, const QString &textureName);
 
-    /// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
-    /// patch if the associated Ogre resources already exist.
-    void GenerateTerrainGeometryForOnePatch(uint patchX, uint patchY);
+    /// Recreates the chunk grid if the terrain has been resized since the chunks were laid out. Dirties all the patches if so.
+    void UpdateChunkLayout();
+
+    /// Releases all GPU resources used for the given chunk.
+    void DestroyChunk(Chunk &chunk);
+
+    /// Emits HeightfieldLayoutChanged if the layout version of the heightfield differs from the given one.
+    void CheckHeightfieldLayout(u32 previousLayoutVersion);
+
+    /// Starts generating the vertices of the given chunk that lie in the given map vertex rectangle, inclusive, on a worker thread.
+    /** @param fullBuild If true, the chunk mesh is created once the geometry is ready. The rectangle must then cover the whole chunk. */
+    void ScheduleChunkGeometry(uint chunkX, uint chunkY, bool fullBuild, uint minX, uint minY, uint maxX, uint maxY);
+
+    /// Creates the Ogre mesh, entity and node of the given chunk from the generated geometry.
+    void CreateChunkMesh(uint chunkX, uint chunkY, const TerrainChunkGeometry &geometry);
+
+    /// Writes the generated vertices, the skirt vertices and the bounds to the mesh of the given chunk.
+    void UploadChunkGeometry(Chunk &chunk, Ogre::Mesh *mesh, const TerrainChunkGeometry &geometry);
+
+    /// Sets the camera distances at which the given chunk mesh switches its level of detail, scaled by the terrain transform.
+    void UpdateChunkLodDistances(Ogre::Mesh *mesh);
 
     shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -424,6 +497,25 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    /// The height values of all the patches.
+    shared_ptr<Heightfield> heightfield;
+
+    /// The quantization step of the height values, or zero if they are stored as floats.
+    float heightQuantizationStep;
+
+    /// Stores the render chunks, chunkWidth x chunkHeight of them.
+    std::vector<Chunk> chunks;
+    uint chunkWidth;
+    uint chunkHeight;
+
+    /// The terrain size in patches that the chunks were laid out for.
+    uint chunksPatchWidth;
+    uint chunksPatchHeight;
+
+    /// The geometry being generated on the worker threads, in the order it was requested.
+    std::list<shared_ptr<TerrainChunkGeometry> > pendingChunkGeometry;
+    u32 nextChunkId;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
@@ -0,0 +1,213 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "Heightfield.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// The quantized values are signed, so that the window is centered on the quantization offset.
+const int cMinQuantizedValue = -32768;
+const int cMaxQuantizedValue = 32767;
+
+}
+
+Heightfield::Heightfield(uint width_, uint height_, float initialHeight, float quantizationStep_) :
+    width(width_),
+    height(height_),
+    quantizationStep(0.f),
+    quantizationOffset(0.f),
+    minBound(initialHeight),
+    maxBound(initialHeight),
+    layoutVersion(0)
+{
+    if (quantizationStep_ > 0.f)
+    {
+        quantizationStep = quantizationStep_;
+        quantizationOffset = initialHeight;
+        quantizedValues.resize(width * height, 0);
+    }
+    else
+        floatValues.resize(width * height, initialHeight);
+}
+
+void Heightfield::Set(uint x, uint y, float value)
+{
+    const uint i = y * width + x;
+    if (quantizationStep > 0.f && !InQuantizationWindow(value))
+        Requantize(value, value);
+
+    if (quantizationStep > 0.f)
+        quantizedValues[i] = QuantizedValue(value);
+    else
+        floatValues[i] = value;
+
+    const float stored = Get(x, y);
+    minBound = std::min(minBound, stored);
+    maxBound = std::max(maxBound, stored);
+}
+
+void Heightfield::Fill(float value)
+{
+    if (quantizationStep > 0.f)
+    {
+        std::fill(quantizedValues.begin(), quantizedValues.end(), (s16)0);
+        if (quantizationOffset != value)
+        {
+            quantizationOffset = value;
+            ++layoutVersion;
+        }
+    }
+    else
+        std::fill(floatValues.begin(), floatValues.end(), value);
+
+    minBound = maxBound = value;
+}
+
+void Heightfield::Copy(const Heightfield &source, uint sourceX, uint sourceY, uint destX, uint destY, uint copyWidth, uint copyHeight)
+{
+    if (sourceX >= source.width || sourceY >= source.height || destX >= width || destY >= height)
+        return;
+    copyWidth = std::min(copyWidth, std::min(source.width - sourceX, width - destX));
+    copyHeight = std::min(copyHeight, std::min(source.height - sourceY, height - destY));
+
+    // Move the quantization window once for the whole copy, instead of every time a value falls outside it.
+    float sourceMin, sourceMax;
+    source.GetBounds(sourceMin, sourceMax);
+    if (quantizationStep > 0.f && (!InQuantizationWindow(sourceMin) || !InQuantizationWindow(sourceMax)))
+        Requantize(sourceMin, sourceMax);
+
+    for(uint y = 0; y < copyHeight; ++y)
+        for(uint x = 0; x < copyWidth; ++x)
+            Set(destX + x, destY + y, source.Get(sourceX + x, sourceY + y));
+}
+
+bool Heightfield::SetQuantizationStep(float step)
+{
+    if (step < 0.f)
+        step = 0.f;
+    if (step == quantizationStep)
+        return true;
+
+    std::vector<float> values(width * height);
+    for(uint y = 0; y < height; ++y)
+        for(uint x = 0; x < width; ++x)
+            values[y * width + x] = Get(x, y);
+
+    float minHeight, maxHeight;
+    GetRange(minHeight, maxHeight);
+
+    const bool fits = step == 0.f || (maxHeight - minHeight) * 0.5f <= cMaxQuantizedValue * step;
+    if (!fits)
+    {
+        step = 0.f;
+        if (quantizationStep == 0.f)
+            return false;
+    }
+
+    quantizationStep = step;
+    if (step > 0.f)
+        Quantize(values, minHeight, maxHeight);
+    else
+    {
+        quantizationOffset = 0.f;
+        floatValues.swap(values);
+        std::vector<s16>().swap(quantizedValues);
+    }
+    minBound = minHeight;
+    maxBound = maxHeight;
+    ++layoutVersion;
+    return fits;
+}
+
+const void *Heightfield::Data() const
+{
+    if (quantizationStep > 0.f)
+        return quantizedValues.empty() ? 0 : &quantizedValues[0];
+    else
+        return floatValues.empty() ? 0 : &floatValues[0];
+}
+
+void Heightfield::GetRange(float &minHeight, float &maxHeight) const
+{
+    minHeight = std::numeric_limits<float>::max();
+    maxHeight = -std::numeric_limits<float>::max();
+
+    if (quantizationStep > 0.f)
+    {
+        int minValue = cMaxQuantizedValue;
+        int maxValue = cMinQuantizedValue;
+        for(size_t i = 0; i < quantizedValues.size(); ++i)
+        {
+            minValue = std::min(minValue, (int)quantizedValues[i]);
+            maxValue = std::max(maxValue, (int)quantizedValues[i]);
+        }
+        if (!quantizedValues.empty())
+        {
+            minHeight = quantizationOffset + minValue * quantizationStep;
+            maxHeight = quantizationOffset + maxValue * quantizationStep;
+        }
+    }
+    else
+        for(size_t i = 0; i < floatValues.size(); ++i)
+        {
+            minHeight = std::min(minHeight, floatValues[i]);
+            maxHeight = std::max(maxHeight, floatValues[i]);
+        }
+}
+
+void Heightfield::Requantize(float extraMin, float extraMax)
+{
+    std::vector<float> values(width * height);
+    for(uint y = 0; y < height; ++y)
+        for(uint x = 0; x < width; ++x)
+            values[y * width + x] = Get(x, y);
+
+    float minHeight, maxHeight;
+    GetRange(minHeight, maxHeight);
+    minHeight = std::min(minHeight, extraMin);
+    maxHeight = std::max(maxHeight, extraMax);
+
+    if ((maxHeight - minHeight) * 0.5f > cMaxQuantizedValue * quantizationStep)
+    {
+        quantizationStep = 0.f;
+        quantizationOffset = 0.f;
+        floatValues.swap(values);
+        std::vector<s16>().swap(quantizedValues);
+    }
+    else
+        Quantize(values, minHeight, maxHeight);
+
+    minBound = minHeight;
+    maxBound = maxHeight;
+    ++layoutVersion;
+}
+
+void Heightfield::Quantize(const std::vector<float> &values, float minHeight, float maxHeight)
+{
+    quantizationOffset = (minHeight + maxHeight) * 0.5f;
+    quantizedValues.resize(values.size());
+    for(size_t i = 0; i < values.size(); ++i)
+        quantizedValues[i] = QuantizedValue(values[i]);
+    std::vector<float>().swap(floatValues);
+}
+
+bool Heightfield::InQuantizationWindow(float value) const
+{
+    const float s = floor((value - quantizationOffset) / quantizationStep + 0.5f);
+    return s >= (float)cMinQuantizedValue && s <= (float)cMaxQuantizedValue;
+}
+
+s16 Heightfield::QuantizedValue(float value) const
+{
+    const int s = (int)floor((value - quantizationOffset) / quantizationStep + 0.5f);
+    return (s16)std::max(cMinQuantizedValue, std::min(cMaxQuantizedValue, s));
+}
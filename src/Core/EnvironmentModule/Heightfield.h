@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "EnvironmentModuleApi.h"
+#include "CoreTypes.h"
+
+#include <vector>
+
+/// Contiguous storage of the height values of a terrain.
+/** The values are stored row by row, Width() x Height() of them. EC_Terrain keeps its height values here, and the physics heightfield
+    shape reads them directly from Data(), so that the same memory serves the rendering, the height queries and the collisions.
+
+    The values are stored either as floats, or quantized to signed 16-bit integers, in which case each value is
+    QuantizationOffset() + s * QuantizationStep() and is off by at most half a step. The quantized values cover 65535 steps. If a value
+    outside that window is set, the window is moved to cover all the values, and if they do not fit in it, the storage falls back to floats
+    until SetQuantizationStep() is called again.
+    Whenever the data pointer, the storage format or the quantization window changes, LayoutVersion() is incremented, and the values must
+    not be read through the previous Data() pointer any more. EC_Terrain signals this with HeightfieldLayoutChanged. */
+class ENVIRONMENT_MODULE_API Heightfield
+{
+public:
+    /// Creates a heightfield of the given size with all the values set to initialHeight.
+    /** @param quantizationStep If greater than zero, the values are stored quantized to this step. Otherwise they are stored as floats. */
+    Heightfield(uint width, uint height, float initialHeight = 0.f, float quantizationStep = 0.f);
+
+    uint Width() const { return width; }
+    uint Height() const { return height; }
+
+    /// Returns the height value at the given vertex. The coordinates must be within the heightfield.
+    float Get(uint x, uint y) const
+    {
+        const uint i = y * width + x;
+        return quantizationStep > 0.f ? quantizationOffset + quantizedValues[i] * quantizationStep : floatValues[i];
+    }
+
+    /// Sets the height value at the given vertex. The coordinates must be within the heightfield.
+    void Set(uint x, uint y, float value);
+
+    /// Sets all the height values to the given value.
+    void Fill(float value);
+
+    /// Copies the given rectangle of height values from another heightfield to the given position in this one. The rectangle is clipped to both heightfields.
+    void Copy(const Heightfield &source, uint sourceX, uint sourceY, uint destX, uint destY, uint copyWidth, uint copyHeight);
+
+    /// Sets how the values are stored. If the step is greater than zero, the values are quantized to it. Otherwise they are stored as floats.
+    /** @return False if the values do not fit in 16 bits with the given step, in which case they are stored as floats. */
+    bool SetQuantizationStep(float step);
+
+    /// Returns true if the values are stored as 16-bit integers, false if as floats.
+    bool IsQuantized() const { return quantizationStep > 0.f; }
+
+    /// Returns the height difference of two consecutive quantized values, or zero if the values are stored as floats.
+    float QuantizationStep() const { return quantizationStep; }
+
+    /// Returns the height of the quantized value zero, or zero if the values are stored as floats.
+    float QuantizationOffset() const { return quantizationOffset; }
+
+    /// Returns the raw values, Width() x Height() of them, row by row. These are floats, or s16 if IsQuantized().
+    const void *Data() const;
+
+    /// Returns the range that all the height values lie within. The range is exact after the values have been filled or requantized,
+    /// but the edits only ever expand it, so it may be larger than the actual range of the values.
+    void GetBounds(float &minHeight, float &maxHeight) const { minHeight = minBound; maxHeight = maxBound; }
+
+    /// Returns the exact range of the height values. Iterates through all the values.
+    void GetRange(float &minHeight, float &maxHeight) const;
+
+    /// Returns a number that changes whenever the raw values would have to be read differently, or from a different address.
+    u32 LayoutVersion() const { return layoutVersion; }
+
+private:
+    /// Rewrites the quantized values to a window that covers the current values and the given extra range, or falls back to floats if they do not fit in one.
+    void Requantize(float extraMin, float extraMax);
+
+    /// Returns true if the given height can be stored with the current quantization window.
+    bool InQuantizationWindow(float value) const;
+
+    /// Stores the values quantized with the current step, to a window centered on the given range. The values must fit in the window.
+    void Quantize(const std::vector<float> &values, float minHeight, float maxHeight);
+
+    /// Returns the quantized value of the given height. The height must lie within the window.
+    s16 QuantizedValue(float value) const;
+
+    uint width;
+    uint height;
+    float quantizationStep;
+    float quantizationOffset;
+    std::vector<float> floatValues;
+    std::vector<s16> quantizedValues;
+    float minBound;
+    float maxBound;
+    u32 layoutVersion;
+};
@@ -29,6 +29,8 @@
 #include "AABB.h"
 #include "Ray.h"
 
+#include <vector>
+
 MATH_BEGIN_NAMESPACE
 
 enum CardinalAxis
@@ -94,6 +96,17 @@ public:
 	/// having called AddObjects/Build to build a previous tree.
 	void Clear();
 
+	/// Appends the structure of the built tree, i.e. the nodes and the object buckets, to the given byte array.
+	/** The objects themselves are not serialized. To restore the tree, add the same objects in the same order to an
+		empty tree with AddObjects(), and call DeserializeStructure() instead of Build(). The data is in the native
+		byte order, so it is meant for caching on the local machine and not as an interchange format. */
+	void SerializeStructure(std::vector<u8> &data) const;
+
+	/// Restores the tree structure that was serialized with SerializeStructure(). Call this instead of Build().
+	/** The data is validated against the objects of this tree, so that corrupted or stale data cannot cause out of bounds accesses.
+		@return True on success. On failure, the tree has no structure, and Build() needs to be called before queries. */
+	bool DeserializeStructure(const u8 *data, size_t numBytes);
+
 	/// Returns an object bucket by the given bucket index.
 	/// An object bucket is a contiguous C array of object indices, terminated with a sentinel value BUCKET_SENTINEL.
 	/// To fetch the actual object based on an object index, call the Object() method.
@@ -182,6 +195,7 @@ public:
 private:
 	static const int maxNodes = 256 * 1024;
 	static const int maxTreeDepth = 30;
+	static const u32 structureMagic = 0x3154444B; // "KDT1" in little-endian byte order.
 
 	std::vector<KdTreeNode> nodes;
 	std::vector<T> objects;
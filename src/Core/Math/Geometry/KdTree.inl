@@ -21,6 +21,8 @@
 #include "Math/MathFunc.h"
 #include "assume.h"
 
+#include <string.h>
+
 MATH_BEGIN_NAMESPACE
 
 template<typename T>
@@ -286,10 +288,121 @@ void KdTree<T>::Clear()
 {
 	nodes.clear();
 	objects.clear();
-	buckets.clear();
+	FreeBuckets();
+#ifdef _DEBUG
+	needsBuilding = false;
+#endif
+}
+
+template<typename T>
+void KdTree<T>::SerializeStructure(std::vector<u8> &data) const
+{
+	std::vector<u32> words;
+	words.push_back((u32)structureMagic);
+	words.push_back((u32)objects.size());
+	words.push_back((u32)nodes.size());
+	words.push_back((u32)buckets.size());
+
+	float aabb[6] = { rootAABB.minPoint.x, rootAABB.minPoint.y, rootAABB.minPoint.z, rootAABB.maxPoint.x, rootAABB.maxPoint.y, rootAABB.maxPoint.z };
+	u32 aabbWords[6];
+	memcpy(aabbWords, aabb, sizeof(aabb));
+	words.insert(words.end(), aabbWords, aabbWords + 6);
+
+	for(size_t i = 0; i < nodes.size(); ++i)
+	{
+		words.push_back(nodes[i].splitAxis);
+		words.push_back(nodes[i].childIndex);
+		words.push_back(nodes[i].bucketIndex); // For inner nodes, this is the bit pattern of splitPos.
+	}
+
+	// Bucket 0 is the null bucket of empty leaves, and is not stored.
+	for(size_t i = 1; i < buckets.size(); ++i)
+	{
+		const u32 *bucket = buckets[i];
+		while(*bucket != BUCKET_SENTINEL)
+			words.push_back(*bucket++);
+		words.push_back((u32)BUCKET_SENTINEL);
+	}
+
+	const size_t offset = data.size();
+	data.resize(offset + words.size() * sizeof(u32));
+	memcpy(&data[offset], &words[0], words.size() * sizeof(u32));
+}
+
+template<typename T>
+bool KdTree<T>::DeserializeStructure(const u8 *data, size_t numBytes)
+{
+	nodes.clear();
+	FreeBuckets();
+
+	const size_t cHeaderWords = 10;
+	if (!data || numBytes % sizeof(u32) != 0 || numBytes < cHeaderWords * sizeof(u32))
+		return false;
+	const size_t numWords = numBytes / sizeof(u32);
+	// The data may come from an unaligned buffer, so read the words through memcpy.
+	std::vector<u32> words(numWords);
+	memcpy(&words[0], data, numBytes);
+
+	const u32 numObjects = words[1];
+	const u32 numNodes = words[2];
+	const u32 numBuckets = words[3];
+	if (words[0] != structureMagic || numObjects != objects.size() || numNodes < 2 || numBuckets < 2
+		|| numWords < cHeaderWords + (size_t)numNodes * 3)
+		return false;
+
+	float aabb[6];
+	memcpy(aabb, &words[4], sizeof(aabb));
+
+	size_t w = cHeaderWords;
+	nodes.resize(numNodes);
+	for(u32 i = 0; i < numNodes; ++i, w += 3)
+	{
+		KdTreeNode &node = nodes[i];
+		node.splitAxis = words[w];
+		node.childIndex = words[w+1];
+		node.bucketIndex = words[w+2];
+		bool valid = (words[w] <= AxisNone && node.childIndex == words[w+1]);
+		if (valid && node.IsLeaf())
+			valid = (node.bucketIndex < numBuckets);
+		else if (valid) // Children are always allocated after their parent, which rules out cycles.
+			valid = (node.childIndex > i && node.childIndex + 1 < numNodes);
+		if (!valid)
+		{
+			nodes.clear();
+			return false;
+		}
+	}
+
+	buckets.push_back(0);
+	for(u32 i = 1; i < numBuckets; ++i)
+	{
+		size_t end = w;
+		while(end < numWords && words[end] != BUCKET_SENTINEL && words[end] < numObjects)
+			++end;
+		if (end >= numWords || words[end] != BUCKET_SENTINEL)
+		{
+			nodes.clear();
+			FreeBuckets();
+			return false;
+		}
+		u32 *bucket = new u32[end - w + 1];
+		memcpy(bucket, &words[w], (end - w + 1) * sizeof(u32));
+		buckets.push_back(bucket);
+		w = end + 1;
+	}
+
+	if (w != numWords)
+	{
+		nodes.clear();
+		FreeBuckets();
+		return false;
+	}
+
+	rootAABB = AABB(float3(aabb[0], aabb[1], aabb[2]), float3(aabb[3], aabb[4], aabb[5]));
 #ifdef _DEBUG
 	needsBuilding = false;
 #endif
+	return true;
 }
 
 template<typename T>
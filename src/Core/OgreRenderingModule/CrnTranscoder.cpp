@@ -0,0 +1,216 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "CrnTranscoder.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <crn_decomp.h>
+#include <dds_defs.h>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Marks the DDS headers that carry the content hash of their CRN data.
+const crn_uint32 cContentHashTag = CRNLIB_PIXEL_FMT_FOURCC('M', 'D', '5', ' ');
+/// The hash is stored in the two unused color keys of the header.
+const int cContentHashSize = 16;
+const size_t cDdsHeaderSize = sizeof(crnlib::cDDSFileSignature) + sizeof(crnlib::DDSURFACEDESC2);
+
+}
+
+/// Transcodes one level of a CrnTranscoder in a worker thread.
+class CrnLevelJob : public QRunnable
+{
+public:
+    CrnLevelJob(const shared_ptr<CrnTranscoder> &transcoder, uint level) : transcoder_(transcoder), level_(level)
+    {
+    }
+
+    /// QRunnable override.
+    virtual void run()
+    {
+        transcoder_->LevelDone(transcoder_->TranscodeLevel(level_));
+    }
+
+private:
+    shared_ptr<CrnTranscoder> transcoder_;
+    uint level_;
+};
+
+CrnTranscoder::CrnTranscoder(const u8 *crnData_, size_t crnNumBytes) :
+    numLevels(0),
+    numFaces(0),
+    remainingLevels(0),
+    failed(0)
+{
+    if (!crnData_ || crnNumBytes == 0)
+        return;
+    crnData.insert(crnData.end(), crnData_, crnData_ + crnNumBytes);
+    contentHash = ContentHash(crnData_, crnNumBytes);
+
+    // Texture data
+    crnd::crn_texture_info textureInfo;
+    if (!crnd::crnd_get_texture_info(&crnData[0], (crnd::uint32)crnData.size(), &textureInfo) || textureInfo.m_levels == 0 ||
+        (textureInfo.m_faces != 1 && textureInfo.m_faces != 6))
+        return;
+    numLevels = textureInfo.m_levels;
+    numFaces = textureInfo.m_faces;
+
+    // DDS header
+    crnlib::DDSURFACEDESC2 header;
+    memset(&header, 0, sizeof(header));
+    header.dwSize = sizeof(header);
+    // - Size and flags
+    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((numLevels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
+    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
+    header.dwWidth = textureInfo.m_width;
+    header.dwHeight = textureInfo.m_height;
+    // - Pixelformat
+    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
+    header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
+    crn_format fundamentalFormat = crnd::crnd_get_fundamental_dxt_format(textureInfo.m_format);
+    header.ddpfPixelFormat.dwFourCC = crnd::crnd_crn_format_to_fourcc(fundamentalFormat);
+    if (fundamentalFormat != textureInfo.m_format)
+        header.ddpfPixelFormat.dwRGBBitCount = crnd::crnd_crn_format_to_fourcc(textureInfo.m_format);
+    // - Mipmaps
+    header.dwMipMapCount = (numLevels > 1) ? numLevels : 0;
+    if (numLevels > 1)
+        header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
+    // - Cubemap with 6 faces
+    if (numFaces == 6)
+    {
+        header.ddsCaps.dwCaps2 = crnlib::DDSCAPS2_CUBEMAP |
+            crnlib::DDSCAPS2_CUBEMAP_POSITIVEX | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEX | crnlib::DDSCAPS2_CUBEMAP_POSITIVEY |
+            crnlib::DDSCAPS2_CUBEMAP_NEGATIVEY | crnlib::DDSCAPS2_CUBEMAP_POSITIVEZ | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEZ;
+    }
+
+    // Set pitch/linear size field (some DDS readers require this field to be non-zero).
+    int bits_per_pixel = crnd::crnd_get_crn_format_bits_per_texel(textureInfo.m_format);
+    header.lPitch = (((header.dwWidth + 3) & ~3) * ((header.dwHeight + 3) & ~3) * bits_per_pixel) >> 3;
+    header.dwFlags |= crnlib::DDSD_LINEARSIZE;
+
+    // - Content hash of the CRN data, in the reserved fields.
+    header.dwUnused0 = cContentHashTag;
+    memcpy(&header.unused0, contentHash.constData(), cContentHashSize / 2);
+    memcpy(&header.unused1, contentHash.constData() + cContentHashSize / 2, cContentHashSize / 2);
+
+    // Lay out the levels. A DDS file stores all the levels of the first face, then all the levels of the next face, and so on.
+    size_t faceSize = 0;
+    for(uint level = 0; level < numLevels; ++level)
+    {
+        // Compute the face's width, height, number of DXT blocks per row/col, etc.
+        const crn_uint32 width = std::max(1U, textureInfo.m_width >> level);
+        const crn_uint32 height = std::max(1U, textureInfo.m_height >> level);
+        const crn_uint32 blocksX = std::max(1U, (width + 3) >> 2);
+        const crn_uint32 blocksY = std::max(1U, (height + 3) >> 2);
+        const crn_uint32 rowPitch = blocksX * crnd::crnd_get_bytes_per_dxt_block(textureInfo.m_format);
+        rowPitches.push_back(rowPitch);
+        levelSizes.push_back(rowPitch * blocksY);
+        faceSize += rowPitch * blocksY;
+    }
+    for(uint face = 0; face < numFaces; ++face)
+    {
+        size_t offset = cDdsHeaderSize + face * faceSize;
+        for(uint level = 0; level < numLevels; ++level)
+        {
+            levelOffsets.push_back(offset);
+            offset += levelSizes[level];
+        }
+    }
+
+    // Write signature. Note: Not endian safe.
+    ddsData.resize(cDdsHeaderSize + numFaces * faceSize);
+    memcpy(&ddsData[0], &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
+    // Write header
+    memcpy(&ddsData[sizeof(crnlib::cDDSFileSignature)], &header, sizeof(header));
+
+    remainingLevels = numLevels;
+}
+
+void CrnTranscoder::Start(const shared_ptr<CrnTranscoder> &transcoder)
+{
+    // The largest levels are started first, as they take the longest.
+    for(uint level = 0; level < transcoder->numLevels; ++level)
+        QThreadPool::globalInstance()->start(new CrnLevelJob(transcoder, level));
+}
+
+bool CrnTranscoder::Transcode(const shared_ptr<CrnTranscoder> &transcoder)
+{
+    if (!transcoder->IsValid())
+        return false;
+    Start(transcoder);
+    transcoder->levelsDone.acquire(transcoder->numLevels);
+    return transcoder->Succeeded();
+}
+
+bool CrnTranscoder::TranscodeSerially()
+{
+    for(uint level = 0; level < numLevels; ++level)
+        LevelDone(TranscodeLevel(level));
+    return Succeeded();
+}
+
+bool CrnTranscoder::TranscodeLevel(uint level)
+{
+    if (!IsValid() || level >= numLevels)
+        return false;
+
+    // Begin unpack
+    crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin(&crnData[0], (crnd::uint32)crnData.size());
+    if (!crnContext)
+        return false;
+
+    // Transcode the level of each face to raw DXTn.
+    void *faces[6];
+    for(uint face = 0; face < numFaces; ++face)
+        faces[face] = &ddsData[levelOffsets[face * numLevels + level]];
+    const bool success = crnd::crnd_unpack_level(crnContext, faces, levelSizes[level], rowPitches[level], level);
+
+    crnd::crnd_unpack_end(crnContext);
+    return success;
+}
+
+void CrnTranscoder::LevelDone(bool success)
+{
+    if (!success)
+        failed.fetchAndStoreOrdered(1);
+    const bool last = !remainingLevels.deref();
+    if (last)
+        emit Finished();
+    levelsDone.release();
+}
+
+QByteArray CrnTranscoder::ContentHash(const u8 *crnData, size_t crnNumBytes)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData((const char *)crnData, (int)crnNumBytes), QCryptographicHash::Md5);
+}
+
+QByteArray CrnTranscoder::CachedContentHash(const QString &ddsFilename)
+{
+    QFile file(ddsFilename);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QByteArray head = file.read(cDdsHeaderSize);
+    if ((size_t)head.size() < cDdsHeaderSize)
+        return QByteArray();
+
+    crnlib::DDSURFACEDESC2 header;
+    memcpy(&header, head.constData() + sizeof(crnlib::cDDSFileSignature), sizeof(header));
+    if (header.dwUnused0 != cContentHashTag)
+        return QByteArray();
+
+    QByteArray hash(cContentHashSize, 0);
+    memcpy(hash.data(), &header.unused0, cContentHashSize / 2);
+    memcpy(hash.data() + cContentHashSize / 2, &header.unused1, cContentHashSize / 2);
+    return hash;
+}
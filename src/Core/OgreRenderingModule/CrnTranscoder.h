@@ -0,0 +1,87 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+#include <vector>
+
+/// Transcodes a crunch library CRN texture to a DDS file, each mipmap level in a worker thread of QThreadPool.
+/** The content hash of the CRN data is written to the reserved fields of the DDS header, so that a DDS file stored to the asset cache
+    can be checked against the CRN data with CachedContentHash(), and the transcoding skipped if the CRN data has not changed.
+    @note Each level is transcoded with an unpack context of its own, as the crunch contexts cannot be shared between threads. */
+class OGRE_MODULE_API CrnTranscoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Reads the texture info of the CRN data and lays out the DDS file. The CRN data is copied.
+    CrnTranscoder(const u8 *crnData, size_t crnNumBytes);
+
+    /// Returns true if the CRN data is valid and can be transcoded.
+    bool IsValid() const { return !ddsData.empty(); }
+
+    /// Starts transcoding the levels in the worker threads. Finished() is emitted when all of them are done.
+    static void Start(const shared_ptr<CrnTranscoder> &transcoder);
+
+    /// Transcodes the levels in the worker threads and waits for them to finish. Do not call from a worker thread of QThreadPool.
+    /** @return True if all the levels were transcoded. */
+    static bool Transcode(const shared_ptr<CrnTranscoder> &transcoder);
+
+    /// Transcodes the levels one by one in the calling thread.
+    bool TranscodeSerially();
+
+    /// Returns true once all the levels have been transcoded.
+    bool IsFinished() const { return remainingLevels == 0; }
+
+    /// Returns true if all the levels have been transcoded successfully.
+    bool Succeeded() const { return IsFinished() && failed == 0; }
+
+    /// Returns the DDS file.
+    std::vector<u8> &DdsData() { return ddsData; }
+
+    /// Returns the content hash of the CRN data.
+    const QByteArray &ContentHash() const { return contentHash; }
+
+    /// Returns the content hash of the given CRN data.
+    static QByteArray ContentHash(const u8 *crnData, size_t crnNumBytes);
+
+    /// Returns the content hash of the CRN data that the given DDS file was transcoded from, or an empty array if it is not known.
+    static QByteArray CachedContentHash(const QString &ddsFilename);
+
+signals:
+    /// Emitted from a worker thread when the last level has been transcoded.
+    /** @note Connect your slot with Qt::QueuedConnection so you will receive the callback in your thread. */
+    void Finished();
+
+private:
+    friend class CrnLevelJob;
+
+    /// Transcodes one level of all the faces. Can be called from any thread.
+    bool TranscodeLevel(uint level);
+
+    /// Marks a level done, and emits Finished() if it was the last one.
+    void LevelDone(bool success);
+
+    std::vector<u8> crnData;
+    std::vector<u8> ddsData;
+    QByteArray contentHash;
+
+    uint numLevels;
+    uint numFaces;
+    /// Offsets of the levels in ddsData, per face and level.
+    std::vector<size_t> levelOffsets;
+    std::vector<uint> levelSizes;
+    std::vector<uint> rowPitches;
+
+    QAtomicInt remainingLevels;
+    QAtomicInt failed;
+    /// Released once per transcoded level, for Transcode().
+    QSemaphore levelsDone;
+};
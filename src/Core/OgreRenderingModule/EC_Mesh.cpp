@@ -13,6 +13,7 @@
 #include "OgreSkeletonAsset.h"
 #include "OgreMeshAsset.h"
 #include "OgreMaterialAsset.h"
+#include "MeshRaycastCache.h"
 #include "IAssetTransfer.h"
 #include "AssetAPI.h"
 #include "AttributeMetadata.h"
@@ -45,6 +46,9 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     INIT_ATTRIBUTE_VALUE(castShadows, "Cast shadows", false),
     INIT_ATTRIBUTE_VALUE(useInstancing, "Use instancing", false),
     entity_(0),
+    raycastCacheMeshHandle_(0),
+    raycastCacheStateCount_(0),
+    raycastCacheSkinned_(false),
     instancedEntity_(0),
     adjustmentNode_(0),
     attached_(false)
@@ -376,6 +380,8 @@ bool EC_Mesh::SetMeshWithSkeleton(const std::string& mesh_name, const std::strin
 
 void EC_Mesh::RemoveMesh()
 {
+    raycastCache_.reset();
+
     if (entity_ || instancedEntity_)
     {
         emit MeshAboutToBeDestroyed();
@@ -1624,6 +1630,42 @@ bool EC_Mesh::Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance,
     return closestDistance >= 0.0f;
 }
 
+MeshRaycastCachePtr EC_Mesh::RaycastCache()
+{
+    if (!entity_)
+        return MeshRaycastCachePtr();
+
+    // The mesh may have been reloaded, or a skeleton attached to it, since the cache was created.
+    Ogre::Mesh *mesh = entity_->getMesh().get();
+    if (raycastCache_ && (mesh->getHandle() != raycastCacheMeshHandle_ || mesh->getStateCount() != raycastCacheStateCount_ ||
+        entity_->hasSkeleton() != raycastCacheSkinned_))
+        raycastCache_.reset();
+
+    if (!raycastCache_)
+    {
+        // Share the bind pose geometry with the asset if the entity uses the asset's mesh as is, otherwise with the world.
+        MeshRaycastCachePtr bindPose;
+        OgreMeshAssetPtr asset = MeshAsset();
+        if (asset && asset->ogreMesh.get() == entity_->getMesh().get())
+            bindPose = asset->RaycastCache();
+        // The asset cache may have been created before a skeleton was attached to the mesh.
+        if ((!bindPose || (entity_->hasSkeleton() && !bindPose->Geometry()->IsSkinned())) && !world_.expired())
+            bindPose = world_.lock()->MeshRaycastCacheFor(entity_->getMesh().get());
+        if (!bindPose)
+            return MeshRaycastCachePtr();
+
+        // A skinned instance gets its own copy of the cache, as its vertices follow the skeleton of this entity.
+        raycastCache_ = entity_->hasSkeleton() ? MAKE_SHARED(MeshRaycastCache, *bindPose) : bindPose;
+        raycastCacheMeshHandle_ = mesh->getHandle();
+        raycastCacheStateCount_ = mesh->getStateCount();
+        raycastCacheSkinned_ = entity_->hasSkeleton();
+    }
+
+    if (entity_->hasSkeleton())
+        raycastCache_->UpdatePose(entity_);
+    return raycastCache_;
+}
+
 Ogre::Entity* EC_Mesh::OgreEntity() const
 {
     return entity_;
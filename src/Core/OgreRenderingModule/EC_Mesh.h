@@ -156,6 +156,11 @@ public:
     static bool Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance = 0, unsigned* subMeshIndex = 0,
         unsigned* triangleIndex = 0, float3* hitPosition = 0, float3* normal = 0, float2* uv = 0);
 
+    /// Returns a CPU-side raycast acceleration structure for the mesh entity of this component, or null if there is no mesh entity.
+    /** For skinned meshes the returned cache is private to this component and has been updated to the current skeleton pose.
+        Raycasts against the returned cache do not access the Ogre hardware buffers. */
+    MeshRaycastCachePtr RaycastCache();
+
     // DEPRECATED
     Ogre::Entity* GetEntity() const { return OgreEntity(); } /**< @deprecated use OgreEntity instead. @todo Add warning print. */
     Ogre::Bone* GetBone(const QString& boneName) const { return OgreBone(boneName); } /**< @deprecated use OgreBone instead. @todo Add warning print. */
@@ -467,6 +472,15 @@ private:
     /// Ogre mesh entity
     Ogre::Entity* entity_;
 
+    /// Raycast cache for entity_, created on first use.
+    MeshRaycastCachePtr raycastCache_;
+
+    /// The mesh of entity_ when raycastCache_ was created: its Ogre resource handle, state count and whether it had a skeleton.
+    /// The cache is recreated if any of these have changed, like OgreWorld::MeshRaycastCacheFor does for its caches.
+    unsigned long long raycastCacheMeshHandle_;
+    size_t raycastCacheStateCount_;
+    bool raycastCacheSkinned_;
+
     /// Ogre instanced mesh entity.
     Ogre::InstancedEntity *instancedEntity_;
 
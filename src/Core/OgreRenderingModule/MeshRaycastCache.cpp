@@ -0,0 +1,436 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "MeshRaycastCache.h"
+#include "Profiler.h"
+#include "Geometry/Ray.h"
+#include "Geometry/Triangle.h"
+
+#include <Ogre.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+/// Maximum number of triangles in a BVH leaf.
+const u32 cMaxTrianglesPerLeaf = 4;
+
+/// Locks the vertex buffer that holds the given element for reading for the lifetime of the object.
+/** Only one element should be locked at a time, as several elements may share the same buffer. */
+struct LockedVertexElement
+{
+    LockedVertexElement(Ogre::VertexData *vertexData, Ogre::VertexElementSemantic semantic) :
+        element(vertexData->vertexDeclaration->findElementBySemantic(semantic)),
+        data(0),
+        stride(0)
+    {
+        if (!element)
+            return;
+        buffer = vertexData->vertexBufferBinding->getBuffer(element->getSource());
+        stride = buffer->getVertexSize();
+        data = static_cast<const u8 *>(buffer->lock(Ogre::HardwareBuffer::HBL_READ_ONLY)) + element->getOffset() + vertexData->vertexStart * stride;
+    }
+
+    ~LockedVertexElement()
+    {
+        if (data)
+            buffer->unlock();
+    }
+
+    /// Returns pointer to the element data of the given vertex, relative to VertexData::vertexStart.
+    const u8 *Vertex(size_t index) const { return data + index * stride; }
+
+    const Ogre::VertexElement *element;
+    Ogre::HardwareVertexBufferSharedPtr buffer;
+    const u8 *data;
+    size_t stride;
+};
+
+/// Sorts triangle indices by the centroid coordinate on one axis.
+struct CentroidAxisLess
+{
+    CentroidAxisLess(const std::vector<float3> &centroids_, int axis_) : centroids(centroids_), axis(axis_) {}
+    bool operator()(u32 a, u32 b) const { return centroids[a][axis] < centroids[b][axis]; }
+    const std::vector<float3> &centroids;
+    int axis;
+};
+
+/// Converts an Ogre 4x4 affine matrix to a float3x4.
+float3x4 ToFloat3x4(const Ogre::Matrix4 &m)
+{
+    return float3x4(m[0][0], m[0][1], m[0][2], m[0][3],
+                    m[1][0], m[1][1], m[1][2], m[1][3],
+                    m[2][0], m[2][1], m[2][2], m[2][3]);
+}
+}
+
+MeshRaycastGeometry::MeshRaycastGeometry(Ogre::Mesh *mesh)
+{
+    PROFILE(MeshRaycastGeometry_Create);
+
+    if (!mesh)
+        return;
+
+    const bool skinned = mesh->hasSkeleton();
+    bool sharedVerticesRead = false;
+    u32 sharedBase = 0;
+
+    for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh *submesh = mesh->getSubMesh(i);
+        Ogre::VertexData *vertexData = submesh->useSharedVertices ? mesh->sharedVertexData : submesh->vertexData;
+        if (!vertexData || !vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION))
+        {
+            subMeshTriangleCounts.push_back(0); // No position element. Ignore this submesh.
+            continue;
+        }
+
+        u32 base;
+        if (submesh->useSharedVertices)
+        {
+            // The shared vertices are read only once, no matter how many submeshes refer to them.
+            if (!sharedVerticesRead)
+            {
+                sharedBase = AppendVertexData(vertexData, mesh->sharedBlendIndexToBoneIndexMap, skinned);
+                sharedVerticesRead = true;
+            }
+            base = sharedBase;
+        }
+        else
+            base = AppendVertexData(vertexData, submesh->blendIndexToBoneIndexMap, skinned);
+
+        Ogre::IndexData *indexData = submesh->indexData;
+        Ogre::HardwareIndexBufferSharedPtr ibuf = indexData->indexBuffer;
+        if (ibuf.isNull())
+        {
+            subMeshTriangleCounts.push_back(0);
+            continue;
+        }
+
+        const size_t numTriangles = indexData->indexCount / 3;
+        const bool use32BitIndices = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
+        const u8 *indexBuffer = static_cast<const u8 *>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY)) + indexData->indexStart * ibuf->getIndexSize();
+        indices.reserve(indices.size() + numTriangles * 3);
+        if (use32BitIndices)
+        {
+            const u32 *pLong = reinterpret_cast<const u32 *>(indexBuffer);
+            for(size_t j = 0; j < numTriangles * 3; ++j)
+                indices.push_back(base + pLong[j]);
+        }
+        else
+        {
+            const u16 *pShort = reinterpret_cast<const u16 *>(indexBuffer);
+            for(size_t j = 0; j < numTriangles * 3; ++j)
+                indices.push_back(base + pShort[j]);
+        }
+        ibuf->unlock();
+
+        subMeshTriangleCounts.push_back((int)numTriangles);
+    }
+}
+
+u32 MeshRaycastGeometry::AppendVertexData(Ogre::VertexData *vertexData, const std::vector<unsigned short> &blendIndexToBoneIndexMap, bool skinned)
+{
+    const u32 base = (u32)positions.size();
+    const size_t count = vertexData->vertexCount;
+
+    {
+        LockedVertexElement pos(vertexData, Ogre::VES_POSITION);
+        positions.reserve(base + count);
+        for(size_t i = 0; i < count; ++i)
+            positions.push_back(*reinterpret_cast<const float3 *>(pos.Vertex(i)));
+    }
+
+    // Texcoord element is not mandatory. Keep the UV array indexed like the positions if any submesh has UVs.
+    {
+        LockedVertexElement tex(vertexData, Ogre::VES_TEXTURE_COORDINATES);
+        if (tex.element || !uvs.empty())
+            uvs.resize(base, float2::zero);
+        for(size_t i = 0; i < count && tex.element; ++i)
+            uvs.push_back(*reinterpret_cast<const float2 *>(tex.Vertex(i)));
+        if (!uvs.empty())
+            uvs.resize(base + count, float2::zero);
+    }
+
+    if (!skinned)
+        return base;
+
+    // Vertices without blend data (if any) stay in bind pose: their weights are left at zero.
+    blendBones.resize((base + count) * cMaxBlendWeights, 0);
+    blendWeights.resize((base + count) * cMaxBlendWeights, 0.f);
+
+    size_t numWeights = 0;
+    {
+        LockedVertexElement weights(vertexData, Ogre::VES_BLEND_WEIGHTS);
+        if (weights.element)
+        {
+            numWeights = std::min<size_t>(Ogre::VertexElement::getTypeCount(weights.element->getType()), cMaxBlendWeights);
+            for(size_t i = 0; i < count; ++i)
+            {
+                const float *w = reinterpret_cast<const float *>(weights.Vertex(i));
+                for(size_t k = 0; k < numWeights; ++k)
+                    blendWeights[(base + i) * cMaxBlendWeights + k] = w[k];
+            }
+        }
+    }
+    {
+        LockedVertexElement bones(vertexData, Ogre::VES_BLEND_INDICES);
+        if (bones.element)
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                const u8 *b = bones.Vertex(i);
+                for(size_t k = 0; k < numWeights; ++k)
+                    blendBones[(base + i) * cMaxBlendWeights + k] = b[k] < blendIndexToBoneIndexMap.size() ? blendIndexToBoneIndexMap[b[k]] : 0;
+            }
+        }
+        else
+        {
+            // Without blend indices the weights can not be applied.
+            std::fill(blendWeights.begin() + base * cMaxBlendWeights, blendWeights.end(), 0.f);
+        }
+    }
+
+    return base;
+}
+
+void MeshRaycastGeometry::SubmeshTriangle(unsigned triangleIndex, unsigned &submeshIndex, unsigned &submeshTriangleIndex) const
+{
+    for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+    {
+        if (triangleIndex < (unsigned)subMeshTriangleCounts[i])
+        {
+            submeshIndex = (unsigned)i;
+            submeshTriangleIndex = triangleIndex;
+            return;
+        }
+        triangleIndex -= (unsigned)subMeshTriangleCounts[i];
+    }
+    submeshIndex = (unsigned)-1;
+    submeshTriangleIndex = (unsigned)-1;
+}
+
+void TriangleBvh::Build(const std::vector<float3> &positions, const std::vector<u32> &indices)
+{
+    PROFILE(TriangleBvh_Build);
+
+    nodes.clear();
+    triangles.clear();
+
+    const u32 numTriangles = (u32)(indices.size() / 3);
+    if (numTriangles == 0)
+        return;
+
+    std::vector<float3> centroids(numTriangles);
+    triangles.resize(numTriangles);
+    for(u32 i = 0; i < numTriangles; ++i)
+    {
+        triangles[i] = i;
+        centroids[i] = (positions[indices[i*3]] + positions[indices[i*3+1]] + positions[indices[i*3+2]]) / 3.f;
+    }
+
+    nodes.reserve(2 * numTriangles / cMaxTrianglesPerLeaf + 1);
+    Node root;
+    root.first = 0;
+    root.count = numTriangles;
+    nodes.push_back(root);
+    Split(0, centroids);
+
+    Refit(positions, indices);
+}
+
+void TriangleBvh::Split(u32 nodeIndex, const std::vector<float3> &centroids)
+{
+    const u32 first = nodes[nodeIndex].first;
+    const u32 count = nodes[nodeIndex].count;
+    if (count <= cMaxTrianglesPerLeaf)
+        return;
+
+    // Split at the median of the centroids along the longest axis of the centroid bounds.
+    AABB centroidBounds;
+    centroidBounds.SetNegativeInfinity();
+    for(u32 i = first; i < first + count; ++i)
+        centroidBounds.Enclose(centroids[triangles[i]]);
+    const float3 size = centroidBounds.Size();
+    const int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+
+    const u32 half = count / 2;
+    std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count, CentroidAxisLess(centroids, axis));
+
+    const u32 left = (u32)nodes.size();
+    Node child;
+    child.first = first;
+    child.count = half;
+    nodes.push_back(child);
+    child.first = first + half;
+    child.count = count - half;
+    nodes.push_back(child);
+
+    nodes[nodeIndex].first = left;
+    nodes[nodeIndex].count = 0;
+
+    Split(left, centroids);
+    Split(left + 1, centroids);
+}
+
+AABB TriangleBvh::LeafBounds(const Node &node, const std::vector<float3> &positions, const std::vector<u32> &indices) const
+{
+    AABB bounds;
+    bounds.SetNegativeInfinity();
+    for(u32 i = node.first; i < node.first + node.count; ++i)
+    {
+        const u32 tri = triangles[i];
+        bounds.Enclose(positions[indices[tri*3]]);
+        bounds.Enclose(positions[indices[tri*3+1]]);
+        bounds.Enclose(positions[indices[tri*3+2]]);
+    }
+    return bounds;
+}
+
+void TriangleBvh::Refit(const std::vector<float3> &positions, const std::vector<u32> &indices)
+{
+    PROFILE(TriangleBvh_Refit);
+
+    // Children are always stored after their parent, so a reverse pass visits the children before the parent.
+    for(size_t i = nodes.size() - 1; i < nodes.size(); --i)
+    {
+        Node &node = nodes[i];
+        if (node.count > 0)
+            node.bounds = LeafBounds(node, positions, indices);
+        else
+        {
+            node.bounds = nodes[node.first].bounds;
+            node.bounds.Enclose(nodes[node.first + 1].bounds);
+        }
+    }
+}
+
+int TriangleBvh::RayQuery(const Ray &ray, const std::vector<float3> &positions, const std::vector<u32> &indices, float &t, float &u, float &v) const
+{
+    int hitTriangle = -1;
+    t = std::numeric_limits<float>::infinity();
+    if (nodes.empty())
+        return hitTriangle;
+
+    u32 stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0)
+    {
+        const Node &node = nodes[stack[--stackSize]];
+        float tNear = 0.f;
+        float tFar = t;
+        if (!node.bounds.IntersectLineAABB(ray.pos, ray.dir, tNear, tFar))
+            continue;
+
+        if (node.count > 0)
+        {
+            for(u32 i = node.first; i < node.first + node.count; ++i)
+            {
+                const u32 tri = triangles[i];
+                float triU, triV;
+                const float triT = Triangle::IntersectLineTri(ray.pos, ray.dir, positions[indices[tri*3]], positions[indices[tri*3+1]], positions[indices[tri*3+2]], triU, triV);
+                if (triT >= 0.f && triT < t)
+                {
+                    t = triT;
+                    u = triU;
+                    v = triV;
+                    hitTriangle = (int)tri;
+                }
+            }
+        }
+        else if (stackSize + 2 <= 64)
+        {
+            // Visit the nearer child first so that the farther one can be culled by the closest hit found so far.
+            const Node &left = nodes[node.first];
+            const Node &right = nodes[node.first + 1];
+            const bool leftFirst = left.bounds.CenterPoint().DistanceSq(ray.pos) <= right.bounds.CenterPoint().DistanceSq(ray.pos);
+            stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+            stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+        }
+    }
+    return hitTriangle;
+}
+
+MeshRaycastCache::MeshRaycastCache(const MeshRaycastGeometryPtr &geometry_) :
+    geometry(geometry_)
+{
+    bvh.Build(geometry->positions, geometry->indices);
+}
+
+void MeshRaycastCache::UpdatePose(Ogre::Entity *meshEntity)
+{
+    if (!meshEntity || !meshEntity->hasSkeleton() || !geometry->IsSkinned())
+        return;
+
+    Ogre::SkeletonInstance *skeleton = meshEntity->getSkeleton();
+    const unsigned short numBones = skeleton->getNumBones();
+    std::vector<Ogre::Matrix4> boneMatrices(numBones);
+    skeleton->_getBoneMatrices(&boneMatrices[0]);
+
+    // Only re-skin when the pose has changed since the last update.
+    bool changed = (bonePalette.size() != numBones);
+    bonePalette.resize(numBones);
+    for(unsigned short i = 0; i < numBones; ++i)
+    {
+        const float3x4 m = ToFloat3x4(boneMatrices[i]);
+        if (!changed && !m.Equals(bonePalette[i], 1e-6f))
+            changed = true;
+        bonePalette[i] = m;
+    }
+    if (!changed)
+        return;
+
+    PROFILE(MeshRaycastCache_UpdatePose);
+
+    const std::vector<float3> &bindPositions = geometry->positions;
+    const size_t numVertices = bindPositions.size();
+    skinnedPositions.resize(numVertices);
+    for(size_t i = 0; i < numVertices; ++i)
+    {
+        const float *weights = &geometry->blendWeights[i * MeshRaycastGeometry::cMaxBlendWeights];
+        const u16 *bones = &geometry->blendBones[i * MeshRaycastGeometry::cMaxBlendWeights];
+        float3 pos = float3::zero;
+        float totalWeight = 0.f;
+        for(int k = 0; k < MeshRaycastGeometry::cMaxBlendWeights; ++k)
+            if (weights[k] > 0.f && bones[k] < numBones)
+            {
+                pos += weights[k] * bonePalette[bones[k]].MulPos(bindPositions[i]);
+                totalWeight += weights[k];
+            }
+        skinnedPositions[i] = totalWeight > 0.f ? pos : bindPositions[i];
+    }
+
+    bvh.Refit(skinnedPositions, geometry->indices);
+}
+
+RayQueryResult MeshRaycastCache::Raycast(const Ray &localRay) const
+{
+    PROFILE(MeshRaycastCache_Raycast);
+
+    RayQueryResult result;
+    result.t = std::numeric_limits<float>::infinity();
+
+    const std::vector<float3> &positions = Positions();
+    float t, u, v;
+    const int tri = bvh.RayQuery(localRay, positions, geometry->indices, t, u, v);
+    if (tri < 0)
+        return result;
+
+    const u32 i0 = geometry->indices[tri*3];
+    const u32 i1 = geometry->indices[tri*3+1];
+    const u32 i2 = geometry->indices[tri*3+2];
+
+    result.t = t;
+    result.pos = localRay.GetPoint(t);
+    result.barycentricUV = float2(u, v);
+    result.normal = (positions[i1] - positions[i0]).Cross(positions[i2] - positions[i0]);
+    result.normal.Normalize();
+    result.uv = geometry->uvs.empty() ? float2(-1, -1) : (1.f - u - v) * geometry->uvs[i0] + u * geometry->uvs[i1] + v * geometry->uvs[i2];
+    geometry->SubmeshTriangle((unsigned)tri, result.submeshIndex, result.triangleIndex);
+    return result;
+}
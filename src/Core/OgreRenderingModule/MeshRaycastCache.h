@@ -0,0 +1,118 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "IRenderer.h"
+#include "Math/MathFwd.h"
+#include "Math/float2.h"
+#include "Math/float3.h"
+#include "Math/float3x4.h"
+#include "Geometry/AABB.h"
+
+#include <vector>
+
+/// CPU-side copy of the geometry of an Ogre mesh, for raycasting purposes.
+/** Holds the bind pose vertex positions, the UVs, the triangle indices and, for skinned meshes, the vertex blend data of all submeshes.
+    The data is read from the Ogre vertex and index buffers once when the geometry is created. After that it is immutable,
+    so it can be shared between all instances of the mesh. */
+struct OGRE_MODULE_API MeshRaycastGeometry
+{
+    /// Maximum number of bone weights per vertex that are taken into account in software skinning.
+    static const int cMaxBlendWeights = 4;
+
+    /// Reads the geometry of the mesh. Locks the vertex and index buffers of the mesh for reading.
+    explicit MeshRaycastGeometry(Ogre::Mesh *mesh);
+
+    /// Returns the number of triangles in all submeshes.
+    size_t NumTriangles() const { return indices.size() / 3; }
+
+    /// Returns whether the geometry has vertex blend data for software skinning.
+    bool IsSkinned() const { return !blendWeights.empty(); }
+
+    /// Converts an index to the triangles of all submeshes to a submesh index and a triangle index within that submesh.
+    void SubmeshTriangle(unsigned triangleIndex, unsigned &submeshIndex, unsigned &submeshTriangleIndex) const;
+
+    std::vector<float3> positions; ///< Bind pose vertex positions of all submeshes.
+    std::vector<float2> uvs; ///< Vertex UVs, indexed like positions. Empty if the mesh has no texture coordinates.
+    std::vector<u32> indices; ///< Three indices to positions per triangle. Triangles of all submeshes concatenated in submesh order.
+    std::vector<int> subMeshTriangleCounts; ///< Triangle counts per submesh.
+    std::vector<u16> blendBones; ///< cMaxBlendWeights skeleton bone indices per vertex. Empty if the mesh is not skinned.
+    std::vector<float> blendWeights; ///< cMaxBlendWeights blend weights per vertex. Empty if the mesh is not skinned.
+
+private:
+    /// Appends the vertices of vertexData to the vertex arrays and returns the index of the first appended vertex.
+    u32 AppendVertexData(Ogre::VertexData *vertexData, const std::vector<unsigned short> &blendIndexToBoneIndexMap, bool skinned);
+};
+
+/// Bounding volume hierarchy over the triangles of an indexed triangle list.
+/** The hierarchy is built once for the topology of the mesh. When the vertices move, for example due to skeletal animation,
+    the node bounds can be refitted in linear time without rebuilding the hierarchy. */
+class OGRE_MODULE_API TriangleBvh
+{
+public:
+    TriangleBvh() {}
+
+    /// Builds the hierarchy for the given triangles.
+    void Build(const std::vector<float3> &positions, const std::vector<u32> &indices);
+
+    /// Recomputes the bounds of all nodes for new vertex positions. The triangle topology must be the same that was used in Build.
+    void Refit(const std::vector<float3> &positions, const std::vector<u32> &indices);
+
+    /// Returns the nearest triangle hit by the ray, or -1 if nothing was hit.
+    /** @param t [out] Distance along the ray to the hit point.
+        @param u [out] Barycentric U of the hit point.
+        @param v [out] Barycentric V of the hit point. */
+    int RayQuery(const Ray &ray, const std::vector<float3> &positions, const std::vector<u32> &indices, float &t, float &u, float &v) const;
+
+    /// Returns whether the hierarchy has been built.
+    bool IsEmpty() const { return nodes.empty(); }
+
+private:
+    struct Node
+    {
+        AABB bounds;
+        u32 first; ///< For leaves, the index of the first triangle in the triangles array. For interior nodes, the index of the left child. The right child follows it.
+        u32 count; ///< Number of triangles in a leaf, 0 for interior nodes.
+    };
+
+    /// Recursively splits the given node.
+    void Split(u32 nodeIndex, const std::vector<float3> &centroids);
+
+    /// Computes the bounds of a leaf from the triangles it contains.
+    AABB LeafBounds(const Node &node, const std::vector<float3> &positions, const std::vector<u32> &indices) const;
+
+    std::vector<Node> nodes; ///< The root is at index 0. Children are always stored after their parent.
+    std::vector<u32> triangles; ///< Triangle indices, ordered so that each leaf refers to a contiguous range.
+};
+
+/// Accelerated raycasting against an Ogre mesh, without accessing the GPU buffers after creation.
+/** For static meshes the cache can be shared between all entities that use the mesh. For skinned meshes each entity
+    needs its own copy of the cache, which is updated with UpdatePose to follow the skeleton of the entity. */
+class OGRE_MODULE_API MeshRaycastCache
+{
+public:
+    /// Creates the cache for the bind pose of the geometry.
+    explicit MeshRaycastCache(const MeshRaycastGeometryPtr &geometry);
+
+    /// Skins the vertices to match the current skeleton pose of the entity and refits the hierarchy, if the pose has changed since the last update.
+    /** Does nothing if the geometry is not skinned or the entity has no skeleton. */
+    void UpdatePose(Ogre::Entity *meshEntity);
+
+    /// Raycasts the cached geometry using a ray in the local space of the mesh.
+    /** @return The result in the local space of the mesh. RayQueryResult::t is infinity if nothing was hit. */
+    RayQueryResult Raycast(const Ray &localRay) const;
+
+    /// Returns the shared geometry of the cache.
+    const MeshRaycastGeometryPtr &Geometry() const { return geometry; }
+
+private:
+    /// Returns the vertex positions in the current pose.
+    const std::vector<float3> &Positions() const { return skinnedPositions.empty() ? geometry->positions : skinnedPositions; }
+
+    MeshRaycastGeometryPtr geometry;
+    TriangleBvh bvh;
+    std::vector<float3> skinnedPositions; ///< Vertex positions in the current pose. Empty when in bind pose.
+    std::vector<float3x4> bonePalette; ///< Bone matrices of the pose the skinned positions were computed for.
+};
@@ -5,11 +5,13 @@
 #include "DebugOperatorNew.h"
 #include "OgreMeshAsset.h"
 #include "OgreRenderingModule.h"
+#include "MeshRaycastCache.h"
 #include "AssetAPI.h"
 #include "AssetCache.h"
 #include "Profiler.h"
 #include "Geometry/Ray.h"
 
+#include <QCryptographicHash>
 #include <QFile>
 #include <QFileInfo>
 #include <Ogre.h>
@@ -214,6 +216,15 @@ RayQueryResult OgreMeshAsset::Raycast(const Ray &ray)
     return visitor.result;
 }
 
+MeshRaycastCachePtr OgreMeshAsset::RaycastCache()
+{
+    if (!ogreMesh.get())
+        return MeshRaycastCachePtr();
+    if (!raycastCache)
+        raycastCache = MAKE_SHARED(MeshRaycastCache, MAKE_SHARED(MeshRaycastGeometry, ogreMesh.get()));
+    return raycastCache;
+}
+
 Triangle OgreMeshAsset::Tri(int submeshIndex, int triangleIndex)
 {
     if (subMeshTriangleCounts.size() == 0)
@@ -346,10 +357,100 @@ void OgreMeshAsset::CreateKdTree()
         ibuf->unlock();
     }
 
+    BuildKdTree();
+}
+
+QString OgreMeshAsset::KdTreeCacheName() const
+{
+    QByteArray triangleData = QByteArray::fromRawData((const char*)&meshData.Object(0), meshData.NumObjects() * sizeof(Triangle));
+    return QCryptographicHash::hash(triangleData, QCryptographicHash::Md5).toHex() + ".kdtree";
+}
+
+void OgreMeshAsset::BuildKdTree()
+{
+    AssetCache *cache = assetAPI->GetAssetCache();
+    if (!cache || meshData.NumObjects() == 0)
+    {
+        PROFILE(OgreMeshAsset_KdTree_Build);
+        meshData.Build();
+        return;
+    }
+
+    const QString cacheName = KdTreeCacheName();
+    const QString cacheFile = cache->FindInCache(cacheName);
+    if (!cacheFile.isEmpty())
+    {
+        PROFILE(OgreMeshAsset_KdTree_LoadFromCache);
+        QFile file(cacheFile);
+        if (file.open(QIODevice::ReadOnly))
+        {
+            bool success = false;
+            uchar *mapped = file.map(0, file.size());
+            if (mapped)
+            {
+                success = meshData.DeserializeStructure(mapped, (size_t)file.size());
+                file.unmap(mapped);
+            }
+            else
+            {
+                QByteArray data = file.readAll();
+                success = meshData.DeserializeStructure((const u8*)data.constData(), (size_t)data.size());
+            }
+            file.close();
+            if (success)
+                return;
+        }
+        LogWarning("OgreMeshAsset::BuildKdTree: Discarding invalid kD-tree cache file " + cacheFile + " for mesh " + Name() + ".");
+        cache->DeleteAsset(cacheName);
+    }
+
     {
         PROFILE(OgreMeshAsset_KdTree_Build);
         meshData.Build();
     }
+    std::vector<u8> data;
+    meshData.SerializeStructure(data);
+    if (cache->StoreAsset(&data[0], data.size(), cacheName).isEmpty())
+        LogWarning("OgreMeshAsset::BuildKdTree: Failed to store the kD-tree of mesh " + Name() + " to the asset cache.");
+}
+
+namespace
+{
+
+/// Returns whether a vertex element is needed by a headless server: for the bounds, raycasts, collision shapes and skeletons.
+bool IsHeadlessVertexElement(Ogre::VertexElementSemantic semantic)
+{
+    return semantic == Ogre::VES_POSITION || semantic == Ogre::VES_BLEND_INDICES || semantic == Ogre::VES_BLEND_WEIGHTS;
+}
+
+/// Repacks vertex data into a single buffer of only the elements a headless server needs, dropping the normals, texture coordinates, colors and tangents.
+void StripRenderOnlyVertexElements(Ogre::VertexData *vertexData)
+{
+    if (!vertexData || !vertexData->vertexDeclaration)
+        return;
+
+    const Ogre::VertexDeclaration::VertexElementList &elements = vertexData->vertexDeclaration->getElements();
+    Ogre::VertexDeclaration *newDeclaration = Ogre::HardwareBufferManager::getSingleton().createVertexDeclaration();
+    size_t offset = 0;
+    for(Ogre::VertexDeclaration::VertexElementList::const_iterator iter = elements.begin(); iter != elements.end(); ++iter)
+        if (IsHeadlessVertexElement(iter->getSemantic()))
+        {
+            newDeclaration->addElement(0, offset, iter->getType(), iter->getSemantic(), iter->getIndex());
+            offset += iter->getSize();
+        }
+
+    if (newDeclaration->getElementCount() == elements.size() || newDeclaration->getElementCount() == 0)
+    {
+        Ogre::HardwareBufferManager::getSingleton().destroyVertexDeclaration(newDeclaration);
+        return;
+    }
+
+    // The positions are read back for the raycasts and collision shapes, so the buffer must not be write-only.
+    Ogre::BufferUsageList bufferUsages;
+    bufferUsages.push_back(Ogre::HardwareBuffer::HBU_STATIC);
+    vertexData->reorganiseBuffers(newDeclaration, bufferUsages); // Takes ownership of newDeclaration.
+}
+
 }
 
 bool OgreMeshAsset::GenerateMeshData()
@@ -359,36 +460,67 @@ bool OgreMeshAsset::GenerateMeshData()
        DeserializeFromData - see https://github.com/realXtend/naali/blob/1806ea04057d447263dbd7cf66d5731c36f4d4a3/src/Core/OgreRenderingModule/OgreMeshAsset.cpp#L89
     */
     
-    // Generate tangents to mesh
-    try
+    // Tangents and submesh extremity points are only used for rendering (normal mapping and transparency sorting),
+    // so a headless server skips generating them and keeps only the geometry needed for bounds, raycasts and collision.
+    const bool headless = assetAPI->GetFramework()->IsHeadless();
+
+    // A headless server never renders the mesh, so keep only the positions and skinning data. The bounds were read from the
+    // mesh file, and the raycasts and collision shapes only read the positions. Raycasts then report no texture coordinates.
+    if (headless)
     {
-        unsigned short src, dest;
-        ///\bug Crashes if called for a mesh that has null or zero vertices in the vertex buffer, or null or zero indices in the index buffer.
-        if (!ogreMesh->suggestTangentVectorBuildParams(Ogre::VES_TANGENT, src, dest))
-            ogreMesh->buildTangentVectors(Ogre::VES_TANGENT, src, dest);
+        try
+        {
+            StripRenderOnlyVertexElements(ogreMesh->sharedVertexData);
+            for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+            {
+                Ogre::SubMesh *submesh = ogreMesh->getSubMesh(i);
+                if (submesh && !submesh->useSharedVertices)
+                    StripRenderOnlyVertexElements(submesh->vertexData);
+            }
+            ogreMesh->removeLodLevels();
+        }
+        catch(const Ogre::Exception &e)
+        {
+            LogError("OgreMeshAsset::GenerateMeshData: Failed to strip the render-only vertex data of mesh " + this->Name() + ": " + QString(e.what()));
+        }
     }
-    catch(const Ogre::Exception &e)
+
+    // Generate tangents to mesh
+    if (!headless)
     {
-        QString what(e.what());
-        // "Cannot locate an appropriate 2D texture coordinate set" is benign, see OgreLogListener::messageLogged
-        bool hideBenignOgreMessages = assetAPI->GetFramework()->HasCommandLineParameter("--hide_benign_ogre_messages");
-        if (!hideBenignOgreMessages || (hideBenignOgreMessages && !what.contains("Cannot locate an appropriate 2D texture coordinate set")))
-            LogError("OgreMeshAsset::GenerateMeshData: Failed to build tangents for mesh " + this->Name() + ": " + what);
+        try
+        {
+            unsigned short src, dest;
+            ///\bug Crashes if called for a mesh that has null or zero vertices in the vertex buffer, or null or zero indices in the index buffer.
+            if (!ogreMesh->suggestTangentVectorBuildParams(Ogre::VES_TANGENT, src, dest))
+                ogreMesh->buildTangentVectors(Ogre::VES_TANGENT, src, dest);
+        }
+        catch(const Ogre::Exception &e)
+        {
+            QString what(e.what());
+            // "Cannot locate an appropriate 2D texture coordinate set" is benign, see OgreLogListener::messageLogged
+            bool hideBenignOgreMessages = assetAPI->GetFramework()->HasCommandLineParameter("--hide_benign_ogre_messages");
+            if (!hideBenignOgreMessages || (hideBenignOgreMessages && !what.contains("Cannot locate an appropriate 2D texture coordinate set")))
+                LogError("OgreMeshAsset::GenerateMeshData: Failed to build tangents for mesh " + this->Name() + ": " + what);
+        }
     }
 
     // Generate extremity points to submeshes, 1 should be enough
-    try
+    if (!headless)
     {
-        for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+        try
         {
-            Ogre::SubMesh *smesh = ogreMesh->getSubMesh(i);
-            if (smesh)
-                smesh->generateExtremes(1);
+            for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+            {
+                Ogre::SubMesh *smesh = ogreMesh->getSubMesh(i);
+                if (smesh)
+                    smesh->generateExtremes(1);
+            }
+        }
+        catch(const Ogre::Exception &e)
+        {
+            LogError("OgreMeshAsset::GenerateMeshData: Failed to generate extremity points to submeshes for mesh " + this->Name() + ": " + QString(e.what()));
         }
-    }
-    catch(const Ogre::Exception &e)
-    {
-        LogError("OgreMeshAsset::GenerateMeshData: Failed to generate extremity points to submeshes for mesh " + this->Name() + ": " + QString(e.what()));
     }
 
     try
@@ -457,6 +589,8 @@ void OgreMeshAsset::DoUnload()
         loadTicket_ = 0;
     }
     
+    raycastCache.reset();
+
     if (ogreMesh.isNull())
         return;
 
@@ -5,6 +5,7 @@
 #include "Math/MathNamespace.h"
 #include "IAsset.h"
 #include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
 
 #include <OgreMesh.h>
 #include <OgreResourceBackgroundQueue.h>
@@ -36,6 +37,11 @@ public:
     /// Ogre threaded load listener. Ogre::ResourceBackgroundQueue::Listener override.
     virtual void operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result);
 
+    /// Returns a raycast cache for the bind pose of this mesh, creating it on first use.
+    /** The cache is shared by all users of the asset. For skinned meshes, copy the returned cache before posing it.
+        Returns null if the mesh is not loaded. */
+    MeshRaycastCachePtr RaycastCache();
+
     /// Loaded Ogre mesh asset, null if not loaded.
     Ogre::MeshPtr ogreMesh;
 
@@ -65,6 +71,12 @@ private:
     /// Precomputes a kD-tree for the triangle data of this mesh.
     void CreateKdTree();
 
+    /// Builds the kD-tree structure for the triangles in meshData, or loads it from the asset cache if the same geometry has been built before.
+    void BuildKdTree();
+
+    /// Returns the asset cache name for the kD-tree structure of the triangles in meshData. The name is derived from a hash of the triangle data.
+    QString KdTreeCacheName() const;
+
     /// Process mesh data after loading to create tangents and such.
     bool GenerateMeshData();
 
@@ -92,6 +104,9 @@ private:
     /// Triangle counts per submesh.
     std::vector<int> subMeshTriangleCounts;
 
+    /// CPU-side geometry and bounding volume hierarchy of the bind pose, for raycasting skinned instances of this mesh.
+    MeshRaycastCachePtr raycastCache;
+
 #ifdef ASSIMP_ENABLED
     OpenAssetImport *importer;
 
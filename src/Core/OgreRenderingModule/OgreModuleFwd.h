@@ -33,6 +33,7 @@ namespace Ogre
     class Bone;
     class InstancedEntity;
     class InstanceManager;
+    class VertexData;
 }
 
 typedef shared_ptr<Ogre::Root> OgreRootPtr;
@@ -68,6 +69,12 @@ typedef shared_ptr<OgreMaterialAsset> OgreMaterialAssetPtr;
 typedef shared_ptr<OgreSkeletonAsset> OgreSkeletonAssetPtr;
 typedef shared_ptr<OgreParticleAsset> OgreParticleAssetPtr;
 
+struct MeshRaycastGeometry;
+class MeshRaycastCache;
+
+typedef shared_ptr<MeshRaycastGeometry> MeshRaycastGeometryPtr;
+typedef shared_ptr<MeshRaycastCache> MeshRaycastCachePtr;
+
 class EC_AnimationController;
 class EC_Camera;
 class EC_Light;
@@ -16,8 +16,7 @@
 #include "OgreBulletCollisionsDebugLines.h"
 #include "OgreMaterialAsset.h"
 #include "OgreMeshAsset.h"
-
-#include "OgreMeshAsset.h"
+#include "MeshRaycastCache.h"
 #include "Entity.h"
 #include "Scene/Scene.h"
 #include "Profiler.h"
@@ -629,40 +628,43 @@ void OgreWorld::RaycastInternal(unsigned layerMask, float maxDistance, bool getA
         if (meshEntity)
         {
             RayQueryResult r;
-            bool hit;
+            bool hit = false;
 
-            if (meshEntity->hasSkeleton())
-                hit = EC_Mesh::Raycast(meshEntity, ray, &r.t, &r.submeshIndex, &r.triangleIndex, &r.pos, &r.normal, &r.uv);
-            else
-            {
-                Ogre::SceneNode *node = meshEntity->getParentSceneNode();
-                if (!node)
-                    continue;
+            Ogre::SceneNode *node = meshEntity->getParentSceneNode();
+            if (!node)
+                continue;
 
+            // Static meshes with an asset use the asset's kD-tree. Skinned meshes and meshes without an asset use
+            // a cached bounding volume hierarchy, which follows the skeleton pose of skinned meshes.
+            EC_Mesh *mesh = entity->GetComponent<EC_Mesh>().get();
+            shared_ptr<OgreMeshAsset> ogreMeshAsset = mesh ? mesh->MeshAsset() : shared_ptr<OgreMeshAsset>();
+            MeshRaycastCachePtr raycastCache;
+            if (mesh && mesh->OgreEntity() == meshEntity && (meshEntity->hasSkeleton() || !ogreMeshAsset))
+                raycastCache = mesh->RaycastCache();
+            else if (!meshEntity->hasSkeleton() && !ogreMeshAsset)
+                raycastCache = MeshRaycastCacheFor(meshEntity->getMesh().get());
+
+            if (raycastCache || (ogreMeshAsset && !meshEntity->hasSkeleton()))
+            {
                 assume(!float3(node->_getDerivedScale()).IsZero());
                 float3x4 localToWorld = float3x4::FromTRS(node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
                 assume(localToWorld.IsColOrthogonal());
                 float3x4 worldToLocal = localToWorld.Inverted();
 
-                EC_Mesh *mesh = entity->GetComponent<EC_Mesh>().get();
-                shared_ptr<OgreMeshAsset> ogreMeshAsset = mesh ? mesh->MeshAsset() : shared_ptr<OgreMeshAsset>();
-                if (ogreMeshAsset)
-                {
-                    Ray localRay = worldToLocal * ray;
-                    float oldLength = localRay.dir.Normalize();
-                    if (oldLength == 0)
-                        continue;
-                    r = ogreMeshAsset->Raycast(localRay);
-                    hit = r.t < std::numeric_limits<float>::infinity();
-                    r.pos = localToWorld.MulPos(r.pos);
-                    r.normal = localToWorld.MulDir(r.normal);
-                    r.t = r.pos.Distance(ray.pos); ///\todo Can optimize out a sqrt.
-                }
-                else
-                {
-                    // No mesh asset available, probably hit terrain? EC_Mesh::Raycast still applicable.
-                    hit = EC_Mesh::Raycast(meshEntity, ray, &r.t, &r.submeshIndex, &r.triangleIndex, &r.pos, &r.normal, &r.uv);
-                }
+                Ray localRay = worldToLocal * ray;
+                float oldLength = localRay.dir.Normalize();
+                if (oldLength == 0)
+                    continue;
+                r = raycastCache ? raycastCache->Raycast(localRay) : ogreMeshAsset->Raycast(localRay);
+                hit = r.t < std::numeric_limits<float>::infinity();
+                r.pos = localToWorld.MulPos(r.pos);
+                r.normal = localToWorld.MulDir(r.normal);
+                r.t = r.pos.Distance(ray.pos); ///\todo Can optimize out a sqrt.
+            }
+            else
+            {
+                // Skinned mesh entity not owned by EC_Mesh, EC_Mesh::Raycast still applicable.
+                hit = EC_Mesh::Raycast(meshEntity, ray, &r.t, &r.submeshIndex, &r.triangleIndex, &r.pos, &r.normal, &r.uv);
             }
 
             if (hit && r.t < maxDistance && (getAllResults || (closestDistance < 0.0f || r.t < closestDistance)))
@@ -790,6 +792,31 @@ RaycastResult* OgreWorld::GetOrCreateRaycastResult(size_t index)
     return rayResults_[index];
 }
 
+MeshRaycastCachePtr OgreWorld::MeshRaycastCacheFor(Ogre::Mesh *mesh)
+{
+    if (!mesh)
+        return MeshRaycastCachePtr();
+
+    std::map<unsigned long long, MeshRaycastCacheEntry>::iterator iter = meshRaycastCaches_.find(mesh->getHandle());
+    if (iter != meshRaycastCaches_.end() && iter->second.stateCount == mesh->getStateCount())
+        return iter->second.cache;
+
+    // Drop the caches of meshes that have been destroyed since the last time a cache was created.
+    Ogre::MeshManager &meshManager = Ogre::MeshManager::getSingleton();
+    for(std::map<unsigned long long, MeshRaycastCacheEntry>::iterator i = meshRaycastCaches_.begin(); i != meshRaycastCaches_.end();)
+    {
+        if (meshManager.getByHandle(i->first).isNull())
+            meshRaycastCaches_.erase(i++);
+        else
+            ++i;
+    }
+
+    MeshRaycastCacheEntry &entry = meshRaycastCaches_[mesh->getHandle()];
+    entry.stateCount = mesh->getStateCount();
+    entry.cache = MAKE_SHARED(MeshRaycastCache, MAKE_SHARED(MeshRaycastGeometry, mesh));
+    return entry.cache;
+}
+
 void OgreWorld::ClearRaycastResults()
 {
     // In case of returning only a single result, make sure its entity & component are cleared in case of no hit
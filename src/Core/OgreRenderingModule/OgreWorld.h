@@ -17,6 +17,7 @@
 #include <QHash>
 
 #include <set>
+#include <map>
 
 class Framework;
 class DebugLines;
@@ -87,6 +88,10 @@ public:
         @param Instanced entity to destroy. */
     void DestroyInstance(Ogre::InstancedEntity* instance);
 
+    /// Returns a raycast cache for the bind pose of an Ogre mesh that is not owned by a mesh asset, creating it on first use.
+    /** The cache is shared by all users of the mesh, and is recreated if the mesh is reloaded. */
+    MeshRaycastCachePtr MeshRaycastCacheFor(Ogre::Mesh *mesh);
+
     std::string GetUniqueObjectName(const std::string &prefix) { return GenerateUniqueObjectName(prefix); } /**< @deprecated Use GenerateUniqueObjectName @todo Add warning print */
 
 public slots:
@@ -301,6 +306,16 @@ private:
     
     /// Ray query results which contain a hit (RaycastAll only)
     QList<RaycastResult*> rayHits_;
+
+    /// Cached raycast data of a mesh that has no mesh asset.
+    struct MeshRaycastCacheEntry
+    {
+        size_t stateCount; ///< Ogre::Resource::getStateCount of the mesh when the cache was created.
+        MeshRaycastCachePtr cache;
+    };
+
+    /// Raycast caches of meshes that have no mesh asset, keyed by Ogre resource handle.
+    std::map<unsigned long long, MeshRaycastCacheEntry> meshRaycastCaches_;
     
     /// Soft shadow gaussian listeners
     std::list<GaussianListener *> gaussianListeners_;
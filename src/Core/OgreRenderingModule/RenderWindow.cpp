@@ -276,6 +276,29 @@ void RenderWindow::UpdateOverlayImage(const QImage &src)
     texture->getBuffer()->blitFromMemory(bufbox);
 }
 
+void RenderWindow::UpdateOverlayImage(const QImage &src, const QRect &rect)
+{
+    if (!overlay)
+        return;
+
+    QRect r = rect & src.rect();
+    if (r.isEmpty())
+        return;
+
+    PROFILE(RenderWindow_UpdateOverlayImage_Rect);
+
+    // The pixel box points to the rectangle in place in the source image, so only the damaged rows are read.
+    Ogre::PixelBox bufbox(r.width(), r.height(), 1, Ogre::PF_A8R8G8B8, (void *)(src.constScanLine(r.top()) + r.left() * 4));
+    bufbox.rowPitch = src.bytesPerLine() / 4;
+    bufbox.slicePitch = bufbox.rowPitch * r.height();
+    Ogre::Box bounds(r.left(), r.top(), r.right() + 1, r.bottom() + 1);
+
+    Ogre::TextureManager &mgr = Ogre::TextureManager::getSingleton();
+    Ogre::TexturePtr texture = mgr.getByName(rttTextureName);
+    assert(texture.get());
+    texture->getBuffer()->blitFromMemory(bufbox, bounds);
+}
+
 void RenderWindow::ShowOverlay(bool visible)
 {
     if (overlayContainer)
@@ -17,6 +17,7 @@ namespace Ogre
 }
 
 class QImage;
+class QRect;
 
 /// Stores the main Ogre::RenderWindow that is created by the Renderer.
 class OGRE_MODULE_API RenderWindow : public QObject
@@ -48,7 +49,13 @@ public slots:
     /// Fully repaints the Ogre 2D Overlay from the given source image.
     void UpdateOverlayImage(const QImage &src);
 
+    /// Repaints the given rectangle of the Ogre 2D Overlay from the same rectangle of the given source image.
+    /** The source image must be the size of the overlay. */
+    void UpdateOverlayImage(const QImage &src, const QRect &rect);
+
     /// Shows or hides whether the 2D Ogre Overlay is visible or not.
+    /** @note The Renderer shows the overlay only while the UI has visible items. To hide it temporarily, use Renderer::SetUiOverlayHidden
+        instead, so that the overlay is not shown again when the UI is empty. */
     void ShowOverlay(bool visible);
 
     int Width() const;
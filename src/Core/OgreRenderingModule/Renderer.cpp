@@ -63,6 +63,11 @@ Q_DECLARE_METATYPE(OgreParticleAssetPtr)
 // Clamp elapsed frame time to avoid Ogre controllers going crazy
 static const float MAX_FRAME_TIME = 0.1f;
 
+// The UI overlay is repainted and uploaded in tiles of this size around the dirty areas reported by the UiGraphicsView.
+static const int UI_TILE_SIZE = 128;
+// If the dirty tiles cover more than this fraction of the view, the whole UI is redrawn at once instead.
+static const float UI_FULL_REDRAW_FRACTION = 0.5f;
+
 #if defined(DIRECTX_ENABLED) && !defined(WIN32)
 #undef DIRECTX_ENABLED
 #endif
@@ -259,6 +264,8 @@ namespace OgreRenderer
         lastWidth(0),
         lastHeight(0),
         resizedDirty(0),
+        uiOverlayVisible(true),
+        uiOverlayHidden(false),
         viewDistance(500.0f),
         shadowQuality(Shadows_High),
         textureQuality(Texture_Normal)
@@ -544,6 +551,15 @@ namespace OgreRenderer
             framework->Ui()->MainWindow()->showNormal();
     }
 
+    void Renderer::SetUiOverlayHidden(bool hidden)
+    {
+        if (hidden == uiOverlayHidden)
+            return;
+        uiOverlayHidden = hidden;
+        if (renderWindow)
+            renderWindow->ShowOverlay(uiOverlayVisible && !uiOverlayHidden);
+    }
+
     bool Renderer::IsFullScreen() const
     {
         if (!framework->IsHeadless())
@@ -771,6 +787,63 @@ namespace OgreRenderer
         renderWindow->UpdateOverlayImage(*backBuffer);
     }
 
+    void Renderer::RedrawDirtyUI()
+    {
+        if (resizedDirty > 0 || !renderWindow->OgreOverlay())
+        {
+            DoFullUIRedraw();
+            return;
+        }
+
+        UiGraphicsView *view = framework->Ui()->GraphicsView();
+        QImage *backBuffer = view->BackBuffer();
+        if (!backBuffer)
+        {
+            LogWarning("Renderer::RedrawDirtyUI: UiGraphicsView does not have a backbuffer initialized!");
+            return;
+        }
+
+        PROFILE(Renderer_RedrawDirtyUI);
+
+        // Snap the dirty areas to the tile grid, so that small nearby changes are repainted and uploaded together.
+        const QRect viewRect = backBuffer->rect();
+        QRegion tiles;
+        foreach(const QRect &dirty, view->DirtyRegion().rects())
+        {
+            const int left = dirty.left() / UI_TILE_SIZE * UI_TILE_SIZE;
+            const int top = dirty.top() / UI_TILE_SIZE * UI_TILE_SIZE;
+            const int right = (dirty.right() / UI_TILE_SIZE + 1) * UI_TILE_SIZE - 1;
+            const int bottom = (dirty.bottom() / UI_TILE_SIZE + 1) * UI_TILE_SIZE - 1;
+            tiles += QRect(QPoint(left, top), QPoint(right, bottom)) & viewRect;
+        }
+        if (tiles.isEmpty())
+            return;
+
+        const QVector<QRect> tileRects = tiles.rects();
+        int tileArea = 0;
+        for(int i = 0; i < tileRects.size(); ++i)
+            tileArea += tileRects[i].width() * tileRects[i].height();
+        if (tileArea > UI_FULL_REDRAW_FRACTION * viewRect.width() * viewRect.height())
+        {
+            DoFullUIRedraw();
+            return;
+        }
+
+        // Paint the dirty tiles of the ui view into the buffer. The rest of the buffer keeps the previous frame.
+        {
+            PROFILE(Renderer_RedrawDirtyUI_GraphicsViewPaint);
+            QPainter painter(backBuffer);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            for(int i = 0; i < tileRects.size(); ++i)
+                painter.fillRect(tileRects[i], Qt::transparent);
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            view->viewport()->render(&painter, tiles.boundingRect().topLeft(), tiles, QWidget::DrawChildren);
+        }
+
+        for(int i = 0; i < tileRects.size(); ++i)
+            renderWindow->UpdateOverlayImage(*backBuffer, tileRects[i]);
+    }
+
     RaycastResult* Renderer::Raycast(int x, int y)
     {
         OgreWorldPtr world = GetActiveOgreWorld();
@@ -808,24 +881,11 @@ namespace OgreRenderer
 #ifdef UNIX
         Ogre::WindowEventUtilities::messagePump();
 #endif
-        // If we are headless, only update the scenegraphs of all Ogre worlds
+        // If we are headless, there is nothing to render. The scene graphs are not updated either: nothing in headless mode
+        // reads the cached world bounds (there are no ray scene queries or cameras), and Ogre brings the derived node transforms
+        // up to date lazily whenever they are queried, so walking every scene node each frame would be wasted work.
         if (framework->IsHeadless())
-        {
-            for (std::map<Scene*, OgreWorldPtr>::const_iterator i = ogreWorlds.begin(); i != ogreWorlds.end(); ++i)
-            {
-                OgreWorld* world = i->second.get();
-                if (world)
-                {
-                    Ogre::SceneManager* mgr = world->OgreSceneManager();
-                    if (mgr)
-                    {
-                        PROFILE(Ogre_SceneManager_updateSceneGraph);
-                        mgr->_updateSceneGraph(0);
-                    }
-                }
-            }
             return;
-        }
         
         // If rendering into different size window, dirty the UI view for now & next frame
         if (lastWidth != WindowWidth() || lastHeight != WindowHeight())
@@ -842,13 +902,34 @@ namespace OgreRenderer
         UiGraphicsView *view = framework->Ui()->GraphicsView();
         assert(view);
 
+        // When no UI widgets are shown, hide the overlay so that the scene is not blended with an empty overlay every frame,
+        // and skip the UI compositing altogether. The visibility can only change when the view is dirtied.
+        if (view->IsViewDirty() || resizedDirty)
+        {
+            const bool visible = view->HasVisibleItems();
+            if (visible != uiOverlayVisible)
+            {
+                uiOverlayVisible = visible;
+                renderWindow->ShowOverlay(visible && !uiOverlayHidden);
+                // The overlay texture was not updated while hidden.
+                if (visible)
+                    resizedDirty = max(resizedDirty, 1);
+            }
+        }
+
 #ifdef DIRECTX_ENABLED
         if (!view->BackBuffer())
         {
             LogError("UI compositing failed! Null backbuffer!");
             return;
         }
-        if (view->IsViewDirty() || resizedDirty)
+        Ogre::D3D9RenderWindow *d3d9rw = dynamic_cast<Ogre::D3D9RenderWindow*>(renderWindow->OgreRenderWindow());
+        if (!d3d9rw) // We're not using D3D9.
+        {
+            if (uiOverlayVisible && (view->IsViewDirty() || resizedDirty))
+                RedrawDirtyUI();
+        }
+        else if (uiOverlayVisible && (view->IsViewDirty() || resizedDirty))
         {
             PROFILE(Renderer_Render_QtBlit);
 
@@ -879,12 +960,6 @@ namespace OgreRenderer
                 view->viewport()->render(&painter, QPoint((int)dirtyRectangle.left(), (int)dirtyRectangle.top()), QRegion(dirty), QWidget::DrawChildren);
             }
 
-            Ogre::D3D9RenderWindow *d3d9rw = dynamic_cast<Ogre::D3D9RenderWindow*>(renderWindow->OgreRenderWindow());
-            if (!d3d9rw) // We're not using D3D9.
-            {
-                DoFullUIRedraw();
-            }
-            else
             {
                 Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().getByName(renderWindow->OverlayTextureName());
                 Ogre::HardwarePixelBufferSharedPtr pb = texture->getBuffer();
@@ -979,11 +1054,9 @@ namespace OgreRenderer
                 }
             }
         }
-#else // Not using the subrectangle blit - just do a full UI blit.
-        if (view->IsViewDirty() || resizedDirty)
-        {
-            DoFullUIRedraw();
-        }
+#else // Not using the D3D9 surface blit - repaint and upload the dirty tiles of the UI.
+        if (uiOverlayVisible && (view->IsViewDirty() || resizedDirty))
+            RedrawDirtyUI();
 #endif
 
         if (resizedDirty > 0)
@@ -122,6 +122,11 @@ namespace OgreRenderer
         /// Is window fullscreen?
         bool IsFullScreen() const;
 
+        /// Hides the UI overlay regardless of the UI contents, e.g. while rendering into a texture that the overlay must not be drawn into.
+        /** When unhidden, the overlay is shown again only if the UI has visible items. Use this instead of RenderWindow::ShowOverlay,
+            which would bypass the overlay visibility the renderer keeps track of. */
+        void SetUiOverlayHidden(bool hidden);
+
         /// Sets shadow quality.
         /** @note Changes need application restart to take effect due to Ogre resource system */
         void SetShadowQuality(ShadowQualitySetting newquality);
@@ -202,6 +207,9 @@ namespace OgreRenderer
         /// Sleeps the main thread to throttle the main loop execution speed.
         void DoFrameTimeLimiting();
 
+        /// Repaints the dirty areas of the UI with Qt and uploads them to the overlay texture, or does a full UI redraw if most of the UI is dirty.
+        void RedrawDirtyUI();
+
         /// Loads Ogre plugins in a manner which allows individual plugin loading to fail
         /** @param pluginFilename Absolute path to the Ogre plugins file.
             @return Successfully loaded plugin names. */
@@ -283,6 +291,8 @@ namespace OgreRenderer
         int lastHeight; ///< Last render window height
         int lastWidth; ///< Last render window width
         int resizedDirty; ///< Resized dirty count
+        bool uiOverlayVisible; ///< Does the UI have visible items, i.e. is the UI overlay shown unless hidden with SetUiOverlayHidden.
+        bool uiOverlayHidden; ///< Is the UI overlay hidden regardless of the UI contents, see SetUiOverlayHidden.
         ShadowQualitySetting shadowQuality; ///< Shadow quality setting.
         TextureQualitySetting textureQuality; ///< Texture quality setting.
 
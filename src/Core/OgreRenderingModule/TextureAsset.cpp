@@ -4,6 +4,8 @@
 #include "DebugOperatorNew.h"
 
 #include "TextureAsset.h"
+#include "TextureProcessing.h"
+#include "CrnTranscoder.h"
 #include "OgreRenderingModule.h"
 
 #include "Profiler.h"
@@ -15,16 +17,10 @@
 #include <QFontMetrics>
 #include <QPainter>
 #include <QFileInfo>
+#include <QThreadPool>
 
 #include <Ogre.h>
 
-#include <crn_decomp.h>
-#include <dds_defs.h>
-
-#ifdef WIN32
-#include <squish.h>
-#endif
-
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
 #ifdef SAFE_DELETE
 #undef SAFE_DELETE
@@ -76,12 +72,23 @@ QString TextureAsset::NameInternal() const
 
 QString TextureAsset::NameInternal(const QString &textureRef)
 {
+    // The processed textures are stored as .dds, and the processing options are part of the name, so that changing them invalidates the cached results.
+    const TextureProcessingOptions &options = ProcessingOptions();
+    if (options.Enabled())
+        return textureRef + "." + options.Tag() + ".dds";
+
     // .crn -> .dds
     if (textureRef.endsWith(".crn", Qt::CaseInsensitive))
         return textureRef.left(textureRef.lastIndexOf(".")+1) + "dds";
     return textureRef;
 }
 
+const TextureProcessingOptions &TextureAsset::ProcessingOptions()
+{
+    static const TextureProcessingOptions options = TextureProcessingOptions::FromCommandLine(Framework::Instance());
+    return options;
+}
+
 QString TextureAsset::NameSuffix() const
 {
     QString checkName = name;
@@ -94,99 +101,19 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
 {
     PROFILE(TextureAsset_DeserializeFromData_CRN_Uncompress);
     ddsData.clear();
-    
-    // Texture data
-    crnd::crn_texture_info textureInfo;
-    if (!crnd::crnd_get_texture_info((void*)crnData, (crnd::uint32)crnNumBytes, &textureInfo))
+
+    shared_ptr<CrnTranscoder> transcoder = MAKE_SHARED(CrnTranscoder, crnData, crnNumBytes);
+    if (!transcoder->IsValid())
     {
         LogError("CRN texture info parsing failed, invalid input data.");
         return false;
     }
-    // Begin unpack
-    crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin((void*)crnData, (crnd::uint32)crnNumBytes);
-    if (!crnContext)
-    {
-        LogError("CRN texture data unpacking failed, invalid input data.");
-        return false;
-    }
-    
-    // DDS header
-    crnlib::DDSURFACEDESC2 header;
-    memset(&header, 0, sizeof(header));
-    header.dwSize = sizeof(header);
-    // - Size and flags
-    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT | ((textureInfo.m_levels > 1) ? crnlib::DDSD_MIPMAPCOUNT : 0);
-    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
-    header.dwWidth = textureInfo.m_width;
-    header.dwHeight = textureInfo.m_height;
-    // - Pixelformat
-    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
-    header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
-    crn_format fundamentalFormat = crnd::crnd_get_fundamental_dxt_format(textureInfo.m_format);
-    header.ddpfPixelFormat.dwFourCC = crnd::crnd_crn_format_to_fourcc(fundamentalFormat);
-    if (fundamentalFormat != textureInfo.m_format)
-        header.ddpfPixelFormat.dwRGBBitCount = crnd::crnd_crn_format_to_fourcc(textureInfo.m_format);
-    // - Mipmaps
-    header.dwMipMapCount = (textureInfo.m_levels > 1) ? textureInfo.m_levels : 0;
-    if (textureInfo.m_levels > 1)
-        header.ddsCaps.dwCaps |= (crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP);
-    // - Cubemap with 6 faces
-    if (textureInfo.m_faces == 6)
-    {
-        header.ddsCaps.dwCaps2 = crnlib::DDSCAPS2_CUBEMAP | 
-            crnlib::DDSCAPS2_CUBEMAP_POSITIVEX | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEX | crnlib::DDSCAPS2_CUBEMAP_POSITIVEY | 
-            crnlib::DDSCAPS2_CUBEMAP_NEGATIVEY | crnlib::DDSCAPS2_CUBEMAP_POSITIVEZ | crnlib::DDSCAPS2_CUBEMAP_NEGATIVEZ;
-    }
-    
-    // Set pitch/linear size field (some DDS readers require this field to be non-zero).
-    int bits_per_pixel = crnd::crnd_get_crn_format_bits_per_texel(textureInfo.m_format);
-    header.lPitch = (((header.dwWidth + 3) & ~3) * ((header.dwHeight + 3) & ~3) * bits_per_pixel) >> 3;
-    header.dwFlags |= crnlib::DDSD_LINEARSIZE;
-          
-    // Prepare output data
-    uint totalSize = sizeof(crnlib::cDDSFileSignature) + header.dwSize;
-    uint writePos = 0;
-    ddsData.resize(totalSize);
-
-    // Write signature. Note: Not endian safe.
-    memcpy(&ddsData[0] + writePos, &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
-    writePos += sizeof(crnlib::cDDSFileSignature);
-
-    // Write header
-    memcpy(&ddsData[0] + writePos, &header, header.dwSize);
-    writePos += header.dwSize;
-    
-    // Now transcode all face and mipmap levels into memory, one mip level at a time.    
-    for (crn_uint32 iLevel = 0; iLevel < textureInfo.m_levels; iLevel++)
-    {
-        // Compute the face's width, height, number of DXT blocks per row/col, etc.
-        const crn_uint32 width = std::max(1U, textureInfo.m_width >> iLevel);
-        const crn_uint32 height = std::max(1U, textureInfo.m_height >> iLevel);
-        const crn_uint32 blocksX = std::max(1U, (width + 3) >> 2);
-        const crn_uint32 blocksY = std::max(1U, (height + 3) >> 2);
-        const crn_uint32 rowPitch = blocksX * crnd::crnd_get_bytes_per_dxt_block(textureInfo.m_format);
-        const crn_uint32 faceSize = rowPitch * blocksY;
-
-        totalSize += faceSize;
-        if (ddsData.size() < totalSize)
-            ddsData.resize(totalSize);
-    
-        // Now transcode the level to raw DXTn
-        void *dest = (void*)(&ddsData[0] + writePos);
-        if (!crnd::crnd_unpack_level(crnContext, &dest, faceSize, rowPitch, iLevel))
-        {
-            ddsData.clear();
-            break;
-        }
-        writePos += faceSize;
-    }
-    crnd::crnd_unpack_end(crnContext);
-    
-    if (ddsData.size() == 0)
+    if (!CrnTranscoder::Transcode(transcoder))
     {
         LogError("CRN uncompression failed!");
         return false;
     }
+    ddsData.swap(transcoder->DdsData());
     return true;
 }
 
@@ -217,23 +144,29 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
             allowAsynchronous = false;
     }
 
+    if (ProcessingOptions().Enabled())
+        return DeserializeProcessed(data, numBytes, allowAsynchronous);
+
     // Check if this is a crunch library CRN file and we need to decompress to DDS.
     std::vector<u8> crnUncompressData;
     if (NameSuffix() == "crn")
     {
         /** If asynchronous loading is allowed we want to store the decompressed DDS data to the asset cache.
             This way below threaded loading can be done on the DDS disk source. If saving to disk fails, it is not
-            fatal, we can still continue with async loading withe data ptr and len. Checking for allowAsynchronous
+            fatal, we can still continue with loading from the decompressed data. Checking for allowAsynchronous
             also filters out any local:// etc. refs that are not meant to be loaded from asynch from asset cache.
 
             - Do not rewrite dds to disk if the source type for this asset is cache and the dds already exists. 
               Otherwise we would save the potentially big dds disk file every time this .crn loads!
+            - Do not decompress a new download of the .crn either, if the cached dds was decompressed from the same data.
+              The dds records the content hash of its .crn, see CrnTranscoder.
             - If async loading is allowed and we have a valid disk source, don't do in memory decompression.
               Its a waste of resources as our disk source is up to date and we are allowed to use it to load
               into Ogre. 
         */
+        AssetCache *cache = assetAPI->GetAssetCache();
         QString nameInternal = NameInternal();
-        cacheDiskSource = assetAPI->GetAssetCache()->FindInCache(nameInternal);
+        cacheDiskSource = cache ? cache->FindInCache(nameInternal) : QString();
         if (allowAsynchronous)
         {
             // Only decompress and store dds if the data is new or not in cache.
@@ -250,35 +183,44 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
                     data = &fileData[0];
                     numBytes = fileData.size();
                 }
-                if (!DecompressCRNtoDDS(data, numBytes, crnUncompressData))
-                    return false;
-                if (crnUncompressData.size() == 0)
-                    return false;
-                PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
-                cacheDiskSource = assetAPI->GetAssetCache()->StoreAsset(&crnUncompressData[0], crnUncompressData.size(), nameInternal);
-                fileData.clear();
-                ELIFORP(TextureAsset_DeserializeFromData_CRN_CacheStore);
+                if (cacheDiskSource.isEmpty() || CrnTranscoder::CachedContentHash(cacheDiskSource) != CrnTranscoder::ContentHash(data, numBytes))
+                {
+                    shared_ptr<CrnTranscoder> transcoder = MAKE_SHARED(CrnTranscoder, data, numBytes);
+                    if (!transcoder->IsValid())
+                    {
+                        LogError("CRN texture info parsing failed, invalid input data.");
+                        return false;
+                    }
+                    // The mip levels are decompressed in worker threads, and the loading continues in OnCrnTranscoded.
+                    crnTranscoder_ = transcoder;
+                    connect(transcoder.get(), SIGNAL(Finished()), this, SLOT(OnCrnTranscoded()), Qt::QueuedConnection);
+                    CrnTranscoder::Start(transcoder);
+                    return true;
+                }
             }
-            allowAsynchronous = !cacheDiskSource.isEmpty();
-            if (!allowAsynchronous)
-                LogWarning("TextureAsset::DeserializeFromData: Could not store decompressed CRN to asset cache, threaded loading disabled.");
         }
-        if (!allowAsynchronous)
+        else
         {
             // We are doing a synchronous loading, ddsData memory is released once its loaded to ogre.
-            if (crnUncompressData.size() == 0)
+            // Load the cached dds instead of decompressing if it was decompressed from the same data.
+            const bool cachedDdsValid = data && numBytes > 0 && !cacheDiskSource.isEmpty() &&
+                CrnTranscoder::CachedContentHash(cacheDiskSource) == CrnTranscoder::ContentHash(data, numBytes) &&
+                LoadFileToVector(cacheDiskSource, crnUncompressData) && !crnUncompressData.empty();
+            if (!cachedDdsValid)
+            {
                 if (!DecompressCRNtoDDS(data, numBytes, crnUncompressData))
                     return false;
-            if (crnUncompressData.size() == 0)
-                return false;
+                // Store the dds for the next load, but only for the .crn files that come through the asset cache, as in the asynchronous loading.
+                if (cache && !cache->FindInCache(Name()).isEmpty())
+                {
+                    PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
+                    if (cache->StoreAsset(&crnUncompressData[0], crnUncompressData.size(), nameInternal).isEmpty())
+                        LogWarning("TextureAsset::DeserializeFromData: Could not store decompressed CRN to asset cache.");
+                }
+            }
             data = (const u8*)&crnUncompressData[0];
             numBytes = crnUncompressData.size();
         }
-        else
-        {
-            // We are bound to do threaded loading from disk.
-            crnUncompressData.clear();
-        }
     }
     
     // Asynchronous loading
@@ -286,16 +228,7 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
     // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
     // 3. The Ogre we are building against has thread support.
     if (allowAsynchronous)
-    {
-        // We can only do threaded loading from disk, and not any disk location but only from asset cache.
-        // local:// refs will return empty string here and those will fall back to the non-threaded loading.
-        // Do not change this to do DiskCache() as that directory for local:// refs will not be a known resource location for ogre.
-        QFileInfo fileInfo(cacheDiskSource);
-        std::string sanitatedAssetRef = fileInfo.fileName().toStdString();
-        loadTicket_ = Ogre::ResourceBackgroundQueue::getSingleton().load(Ogre::TextureManager::getSingleton().getResourceType(),
-                          sanitatedAssetRef, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
-        return true;
-    }
+        return LoadAsynchronously(cacheDiskSource);
 
     if (!data)
     {
@@ -309,6 +242,57 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
     }
 
     // Synchronous loading
+    return LoadFromMemory(data, numBytes);
+}
+
+bool TextureAsset::LoadAsynchronously(const QString &cacheDiskSource)
+{
+    // We can only do threaded loading from disk, and not any disk location but only from asset cache.
+    // local:// refs will return empty string here and those will fall back to the non-threaded loading.
+    // Do not change this to do DiskCache() as that directory for local:// refs will not be a known resource location for ogre.
+    QFileInfo fileInfo(cacheDiskSource);
+    std::string sanitatedAssetRef = fileInfo.fileName().toStdString();
+    loadTicket_ = Ogre::ResourceBackgroundQueue::getSingleton().load(Ogre::TextureManager::getSingleton().getResourceType(),
+                      sanitatedAssetRef, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
+    return true;
+}
+
+void TextureAsset::OnCrnTranscoded()
+{
+    // The texture may have been unloaded, or reloaded, while decompressing. The results of the earlier loads are ignored.
+    if (!crnTranscoder_ || !crnTranscoder_->IsFinished())
+        return;
+
+    shared_ptr<CrnTranscoder> transcoder = crnTranscoder_;
+    crnTranscoder_.reset();
+    if (!transcoder->Succeeded())
+    {
+        LogError("CRN uncompression failed for " + Name() + "!");
+        DoUnload();
+        assetAPI->AssetLoadFailed(Name());
+        return;
+    }
+
+    std::vector<u8> &ddsData = transcoder->DdsData();
+    PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
+    QString cacheDiskSource = assetAPI->GetAssetCache()->StoreAsset(&ddsData[0], ddsData.size(), NameInternal());
+    ELIFORP(TextureAsset_DeserializeFromData_CRN_CacheStore);
+    if (!cacheDiskSource.isEmpty())
+    {
+        LoadAsynchronously(cacheDiskSource);
+        return;
+    }
+
+    LogWarning("TextureAsset::DeserializeFromData: Could not store decompressed CRN to asset cache, threaded loading disabled.");
+    if (!LoadFromMemory(&ddsData[0], ddsData.size()))
+    {
+        DoUnload();
+        assetAPI->AssetLoadFailed(Name());
+    }
+}
+
+bool TextureAsset::LoadFromMemory(const u8 *data, size_t numBytes)
+{
     try
     {
         // Convert the data into Ogre's own DataStream format.
@@ -320,8 +304,22 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
         Ogre::Image image;
         image.load(stream);
 
+        const bool isDds = numBytes >= 4 && memcmp(data, "DDS ", 4) == 0;
+        return CreateFromImage(image, !isDds);
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogError("TextureAsset::DeserializeFromData: Failed to create texture " + Name().toStdString() + ": " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool TextureAsset::CreateFromImage(Ogre::Image &image, bool allowMipmapGeneration)
+{
+    try
+    {
         // Internal name that will be passed to Ogre for creating and loading the texture.
-        // This differs from Name() only if the data was pre-processed above, eg. CRN files.
+        // This differs from Name() only if the data was pre-processed, eg. CRN files.
         const QString nameInternal = NameInternal();
 
         // If we are submitting a .dds file which did not contain mip maps, don't have Ogre generating them either.
@@ -331,7 +329,7 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
         // 3. If the texture is updated dynamically, we might not afford to regenerate mips at each update.
         size_t numMipmapsInImage = image.getNumMipmaps(); // Note: This is actually numMipmaps - 1: Ogre doesn't think the first level is a mipmap.
         int numMipmapsToUseOnGPU = (int)Ogre::MIP_DEFAULT;
-        if (numMipmapsInImage == 0 && nameInternal.endsWith(".dds", Qt::CaseInsensitive))
+        if (numMipmapsInImage == 0 && !allowMipmapGeneration)
             numMipmapsToUseOnGPU = 0;
 
         if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
@@ -378,11 +376,6 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
             ogreTexture->createInternalResources();
         }
 
-        if (NameSuffix() == "crn" && crnUncompressData.size() > 0)
-            crnUncompressData.clear();
-
-        PostProcessTexture();
-        
         // We did a synchronous load and must call AssetLoadCompleted here.
         // This is done with Name() that is tracked by AssetAPI and is the ref
         // we are showing outside this object, even if the input data was pre-processed 
@@ -411,8 +404,6 @@ void TextureAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, cons
         ogreTexture = Ogre::TextureManager::getSingleton().getByName(ogreAssetName.toStdString(), OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP);
         if (!ogreTexture.isNull())
         {
-            PostProcessTexture();
-            
             assetAPI->AssetLoadCompleted(Name());
             return;
         }
@@ -491,6 +482,9 @@ void TextureAsset::DoUnload()
         Ogre::ResourceBackgroundQueue::getSingleton().abortRequest(loadTicket_);
         loadTicket_ = 0;
     }
+    // A texture being processed or decompressed in worker threads is dropped when the work finishes.
+    processingTask_.reset();
+    crnTranscoder_.reset();
     
     if (!ogreTexture.isNull())
         ogreAssetName = ogreTexture->getName().c_str();
@@ -693,369 +687,90 @@ void TextureAsset::SetContentsDrawText(int newWidth, int newHeight, QString text
     SetContents(newWidth, newHeight, image.bits(), image.byteCount(), Ogre::PF_A8R8G8B8, generateMipmaps, dynamic, false);
 }
 
-void TextureAsset::PostProcessTexture()
-{
-    if (assetAPI->GetFramework()->HasCommandLineParameter("--autodxtcompress"))
-        CompressTexture();
-    if (assetAPI->GetFramework()->HasCommandLineParameter("--maxtexturesize"))
-        ReduceTextureSize();
-}
-
-void TextureAsset::CompressTexture()
+bool TextureAsset::DeserializeProcessed(const u8 *data, size_t numBytes, bool allowAsynchronous)
 {
-#if defined(DIRECTX_ENABLED) && defined(WIN32)
-    if (ogreTexture.isNull())
-        return;
-    
-    QStringList sizeParam = assetAPI->GetFramework()->CommandLineParameters("--maxtexturesize");
-    size_t maxTextureSize = 0;
-    if (sizeParam.size() > 0)
-    {
-        int size = sizeParam.first().toInt();
-        if (size > 0)
-            maxTextureSize = size;
-    }
-    
-    Ogre::PixelFormat sourceFormat = ogreTexture->getFormat();
-    if (sourceFormat >= Ogre::PF_DXT1 && sourceFormat <= Ogre::PF_DXT5)
-        return; // Already compressed, do nothing
-    if ((sourceFormat >= Ogre::PF_L8 && sourceFormat <= Ogre::PF_BYTE_LA) || sourceFormat == Ogre::PF_R8)
-        return; // 1 or 2 byte format, leave alone
-    
-    PROFILE(TextureAsset_CompressTexture);
-    
-    // Ogre will crash on OpenGL if it tries to get texture data. Therefore perform a no-op on OpenGL
-    /// \todo Fix the crash
-    // (note: on OpenGL memory use of the Tundra process is less critical anyway, as the system memory copy
-    // of the texture is contained by the display driver)
-    if (Ogre::Root::getSingletonPtr()->getRenderSystem()->getName() == "OpenGL Rendering Subsystem")
+    // The processed texture is reused from the asset cache, unless the source has been changed since it was processed.
+    // As with the CRN files below, the results are cached only when asynchronous loading is allowed, which filters out local:// etc. refs.
+    AssetCache *cache = assetAPI->GetAssetCache();
+    if (allowAsynchronous && diskSourceType != IAsset::Original)
     {
-        LogWarning("Skipping CompressTexture on OpenGL as it is prone to crash");
-        return;
+        QString processedDiskSource = cache->FindInCache(NameInternal());
+        if (!processedDiskSource.isEmpty())
+            return LoadAsynchronously(processedDiskSource);
     }
-    
-    // Get original texture data
-    std::vector<unsigned char*> imageData;
-    std::vector<Ogre::PixelBox> imageBoxes;
-    
-    size_t numMipmaps = ogreTexture->getNumMipmaps();
-    
-    for (size_t level = 0; level <= numMipmaps; ++level)
+
+    shared_ptr<TextureProcessingTask> task = MAKE_SHARED(TextureProcessingTask);
+    task->options = ProcessingOptions();
+    if (data && numBytes > 0)
+        task->sourceData.insert(task->sourceData.end(), data, data + numBytes);
+    else if (!allowAsynchronous || !LoadFileToVector(cache->FindInCache(Name()), task->sourceData))
     {
-        try
-        {
-            Ogre::HardwarePixelBufferSharedPtr buf = ogreTexture->getBuffer(0, level);
-            
-            // If a max texture size is set, and mipmaps are present in the source texture, reject those larger than acceptable texture size, however ensure at least 1 mipmap
-            if (maxTextureSize > 0 && numMipmaps > 0)
-            {
-                if (level < numMipmaps && imageBoxes.size() == 0 && (buf->getWidth() > maxTextureSize || buf->getHeight() > maxTextureSize))
-                    continue;
-            }
-            
-            unsigned char* levelData = new unsigned char[buf->getWidth() * buf->getHeight() * 4];
-            imageData.push_back(levelData);
-            Ogre::PixelBox levelBox(Ogre::Box(0, 0, buf->getWidth(), buf->getHeight()), Ogre::PF_A8B8G8R8, levelData);
-            buf->blitToMemory(levelBox);
-            imageBoxes.push_back(levelBox);
-        }
-        catch (std::exception& e)
-        {
-            LogError("TextureAsset::CompressTexture: Caught exception " + QString(e.what()) + " while handling miplevel " + QString::number(level) + ", aborting.");
-            break;
-        }
+        LogError("TextureAsset::DeserializeFromData failed: No data to deserialize!");
+        return false;
     }
-    
-    // If we only have 1 mipmap, and it is too large, resample it now
-    if (maxTextureSize > 0 && imageBoxes.size() == 1 && (imageBoxes[0].right > maxTextureSize || imageBoxes[0].bottom > maxTextureSize))
+
+    // In a worker thread, the CRN data is decompressed by the task itself, one level after another.
+    if (NameSuffix() == "crn")
     {
-        size_t targetWidth = imageBoxes[0].right;
-        size_t targetHeight = imageBoxes[0].bottom;
-        while (targetWidth > maxTextureSize || targetHeight > maxTextureSize)
+        if (allowAsynchronous)
+            task->sourceIsCrn = true;
+        else
         {
-            targetWidth >>= 1;
-            targetHeight >>= 1;
+            std::vector<u8> ddsData;
+            if (!DecompressCRNtoDDS(&task->sourceData[0], task->sourceData.size(), ddsData))
+                return false;
+            task->sourceData.swap(ddsData);
         }
-        if (!targetWidth)
-            targetWidth = 1;
-        if (!targetHeight)
-            targetHeight = 1;
-        
-        unsigned char* scaledPixelData = new unsigned char[targetWidth * targetHeight * 4];
-        Ogre::PixelBox targetBox(Ogre::Box(0, 0, targetWidth, targetHeight), Ogre::PF_A8B8G8R8, scaledPixelData);
-        Ogre::Image::scale(imageBoxes[0], targetBox);
-        
-        // Delete the unscaled original data and replace the original pixelbox
-        delete[] imageData[0];
-        imageData[0] = scaledPixelData;
-        imageBoxes[0] = targetBox;
-    }
-    
-    // Determine format
-    int flags = squish::kColourRangeFit; // Lowest quality, but fastest
-    size_t bytesPerBlock = 8;
-    Ogre::PixelFormat newFormat = Ogre::PF_DXT1;
-    if (ogreTexture->hasAlpha())
-    {
-        LogDebug("CompressTexture " + Name() + " image format " + QString::number(sourceFormat) + ", compressing as DXT5");
-        newFormat = Ogre::PF_DXT5;
-        bytesPerBlock = 16;
-        flags |= squish::kDxt5;
     }
-    else
-    {
-        LogDebug("CompressTexture " + Name() + " image format " + QString::number(sourceFormat) + ", compressing as DXT1");
-        flags |= squish::kDxt1;
-    }
-    
-    // Compress original texture data
-    std::vector<unsigned char*> compressedImageData;
-    
-    for (size_t level = 0; level < imageBoxes.size(); ++level)
-    {
-        int compressedSize = squish::GetStorageRequirements((int)imageBoxes[level].right, (int)imageBoxes[level].bottom, flags);
-        LogDebug("Compressing level " + QString::number(level) + " " + QString::number(imageBoxes[level].right) + "x" + QString::number(imageBoxes[level].bottom) + " into " + QString::number(compressedSize) + " bytes");
-        unsigned char* compressedData = new unsigned char[compressedSize];
-        squish::CompressImage((squish::u8*)imageData[level], (int)imageBoxes[level].right, (int)imageBoxes[level].bottom, compressedData, flags);
-        compressedImageData.push_back(compressedData);
-    }
-    
-    // Change Ogre texture format
-    ogreTexture->freeInternalResources();
-    ogreTexture->setWidth(imageBoxes[0].right);
-    ogreTexture->setHeight(imageBoxes[0].bottom);
-    ogreTexture->setFormat(newFormat);
-    ogreTexture->setNumMipmaps(imageBoxes.size() - 1);
-    ogreTexture->createInternalResources();
-    
-    // Upload compressed texture data
-    for (size_t level = 0; level < imageBoxes.size(); ++level)
+
+    if (allowAsynchronous)
     {
-        try
-        {
-            Ogre::HardwarePixelBufferSharedPtr buf = ogreTexture->getBuffer(0, level);
-            
-            // Ogre does not load the texture data properly if the miplevel width is not divisible by 4, so we write manual code for Direct3D9
-            /// \todo Fix bug in ogre-safe-nocrashes branch. It also affects Ogre's loading of already compressed DDS files
-            
-            size_t numRows = (buf->getHeight() + 3) / 4;
-            size_t sourceStride = (buf->getWidth() + 3) / 4 * bytesPerBlock;
-            unsigned char* src = compressedImageData[level];
-            
-            Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(buf.get());
-            assert(pixelBuffer);
-            LPDIRECT3DSURFACE9 surface = pixelBuffer->getSurface(Ogre::D3D9RenderSystem::getActiveD3D9Device());
-            if (surface)
-            {
-                D3DLOCKED_RECT lock;
-                HRESULT hr = surface->LockRect(&lock, 0, 0);
-                if (SUCCEEDED(hr))
-                {
-                    if (lock.Pitch == sourceStride)
-                        memcpy(lock.pBits, src, sourceStride * numRows);
-                    else
-                        for(size_t y = 0; y < numRows; ++y)
-                            memcpy((u8*)lock.pBits + lock.Pitch * y, src + sourceStride * y, sourceStride);
-                    surface->UnlockRect();
-                }
-            }
-        }
-        catch (std::exception& e)
-        {
-            LogError("TextureAsset::CompressTexture: Caught exception " + QString(e.what()) + " while handling miplevel " + QString::number(level) + ", aborting.");
-            break;
-        }
+        processingTask_ = task;
+        // TextureProcessingJob is a QRunnable we can pass to QThreadPool, it will handle scheduling it and deletes it when done.
+        TextureProcessingJob *job = new TextureProcessingJob(task);
+        connect(job, SIGNAL(Finished()), this, SLOT(OnProcessingFinished()), Qt::QueuedConnection);
+        QThreadPool::globalInstance()->start(job);
+        return true;
     }
-    
-    // Delete CPU-side temp image data
-    for (size_t i = 0; i < imageData.size(); ++i)
-        delete[] imageData[i];
-    for (size_t i = 0; i < compressedImageData.size(); ++i)
-        delete[] compressedImageData[i];
-#endif
+
+    PROFILE(TextureAsset_ProcessTexture);
+    task->Process();
+    return LoadProcessed(*task, false);
 }
 
-void TextureAsset::ReduceTextureSize()
+void TextureAsset::OnProcessingFinished()
 {
-#if defined(DIRECTX_ENABLED) && defined(WIN32)
-    if (ogreTexture.isNull())
+    // The texture may have been unloaded, or reloaded, while processing. The results of the earlier loads are ignored.
+    if (!processingTask_ || !processingTask_->IsFinished())
         return;
-    
-    QStringList sizeParam = assetAPI->GetFramework()->CommandLineParameters("--maxtexturesize");
-    size_t maxTextureSize = 0;
-    if (sizeParam.size() > 0)
-    {
-        int size = sizeParam.first().toInt();
-        if (size > 0)
-            maxTextureSize = size;
-    }
-    if (!maxTextureSize)
-        return;
-    
-    if (ogreTexture->getWidth() <= maxTextureSize && ogreTexture->getHeight() <= maxTextureSize)
-        return; // Texture OK, no reduction needed
-    
-    PROFILE(TextureAsset_ReduceTextureSize);
-    
-    size_t origWidth = ogreTexture->getWidth();
-    size_t origHeight = ogreTexture->getHeight();
-    
-    if (Ogre::Root::getSingletonPtr()->getRenderSystem()->getName() == "OpenGL Rendering Subsystem")
-    {
-        LogWarning("Skipping ReduceTextureSize on OpenGL as it is prone to crash");
-        return;
-    }
-    
-    Ogre::PixelFormat sourceFormat = ogreTexture->getFormat();
-    
-    // Get original texture data
-    std::vector<unsigned char*> imageData;
-    std::vector<Ogre::PixelBox> imageBoxes;
-    
-    size_t numMipmaps = ogreTexture->getNumMipmaps();
-    
-    // If mipmaps are present in the source texture, reject those larger than acceptable texture size, however ensure at least 1 mipmap
-    for (size_t level = 0; level <= numMipmaps; ++level)
+
+    shared_ptr<TextureProcessingTask> task = processingTask_;
+    processingTask_.reset();
+    if (!LoadProcessed(*task, true))
     {
-        try
-        {
-            Ogre::HardwarePixelBufferSharedPtr buf = ogreTexture->getBuffer(0, level);
-            
-            if (numMipmaps > 0 && level < numMipmaps && imageBoxes.size() == 0 && (buf->getWidth() > maxTextureSize || buf->getHeight() > maxTextureSize))
-                continue;
-            
-            unsigned char* levelData = new unsigned char[Ogre::PixelUtil::getMemorySize(buf->getWidth(), buf->getHeight(), 1, buf->getFormat())];
-            imageData.push_back(levelData);
-            Ogre::PixelBox levelBox(Ogre::Box(0, 0, buf->getWidth(), buf->getHeight()), buf->getFormat(), levelData);
-            
-            if (sourceFormat >= Ogre::PF_DXT1 && sourceFormat <= Ogre::PF_DXT5)
-            {
-                // Ogre does not retrieve the texture data properly if the miplevel width is not divisible by 4, so we write manual code for Direct3D9
-                /// \todo Fix bug in ogre-safe-nocrashes branch
-                size_t bytesPerBlock = sourceFormat == Ogre::PF_DXT1 ? 8 : 16;
-                size_t numRows = (buf->getHeight() + 3) / 4;
-                size_t destStride = (buf->getWidth() + 3) / 4 * bytesPerBlock;
-                unsigned char* dest = levelData;
-                
-                Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(buf.get());
-                assert(pixelBuffer);
-                LPDIRECT3DSURFACE9 surface = pixelBuffer->getSurface(Ogre::D3D9RenderSystem::getActiveD3D9Device());
-                if (surface)
-                {
-                    D3DLOCKED_RECT lock;
-                    HRESULT hr = surface->LockRect(&lock, 0, 0);
-                    if (SUCCEEDED(hr))
-                    {
-                        if (lock.Pitch == destStride)
-                            memcpy(dest, lock.pBits, destStride * numRows);
-                        else
-                            for(size_t y = 0; y < numRows; ++y)
-                                memcpy(dest + destStride * y, (u8*)lock.pBits + lock.Pitch * y, destStride);
-                        surface->UnlockRect();
-                    }
-                }
-            }
-            else
-                buf->blitToMemory(levelBox);
-            
-            imageBoxes.push_back(levelBox);
-        }
-        catch (std::exception& e)
-        {
-            LogError("TextureAsset::ReduceTextureSize: Caught exception " + QString(e.what()) + " while handling miplevel " + QString::number(level) + ", aborting.");
-            break;
-        }
+        DoUnload();
+        assetAPI->AssetLoadFailed(Name());
     }
-    
-    // If only one level, resize it. But do not attempt this for textures which already are DXT compressed
-    if (imageBoxes.size() == 1 && (imageBoxes[0].right > maxTextureSize || imageBoxes[0].bottom > maxTextureSize))
+}
+
+bool TextureAsset::LoadProcessed(TextureProcessingTask &task, bool storeToCache)
+{
+    if (task.status == TextureProcessingTask::Failed)
     {
-        if (sourceFormat >= Ogre::PF_DXT1 && sourceFormat <= Ogre::PF_DXT5)
-        {
-            LogWarning("TextureAsset::ReduceTextureSize: not resizing already DDS compressed texture " + Name());
-            for (size_t i = 0; i < imageData.size(); ++i)
-                delete[] imageData[i];
-            return;
-        }
-        
-        size_t targetWidth = imageBoxes[0].right;
-        size_t targetHeight = imageBoxes[0].bottom;
-        while (targetWidth > maxTextureSize || targetHeight > maxTextureSize)
-        {
-            targetWidth >>= 1;
-            targetHeight >>= 1;
-        }
-        if (!targetWidth)
-            targetWidth = 1;
-        if (!targetHeight)
-            targetHeight = 1;
-        
-        unsigned char* scaledPixelData = new unsigned char[Ogre::PixelUtil::getMemorySize(targetWidth, targetHeight, 1, sourceFormat)];
-        Ogre::PixelBox targetBox(Ogre::Box(0, 0, targetWidth, targetHeight), sourceFormat, scaledPixelData);
-        Ogre::Image::scale(imageBoxes[0], targetBox);
-        
-        // Delete the unscaled original data and replace the original pixelbox
-        delete[] imageData[0];
-        imageData[0] = scaledPixelData;
-        imageBoxes[0] = targetBox;
+        LogError("TextureAsset: Failed to load texture " + Name() + ": " + task.message);
+        return false;
     }
-    
-    // Change texture parameters
-    ogreTexture->freeInternalResources();
-    ogreTexture->setWidth(imageBoxes[0].right);
-    ogreTexture->setHeight(imageBoxes[0].bottom);
-    ogreTexture->setNumMipmaps(imageBoxes.size() - 1);
-    ogreTexture->createInternalResources();
-    
-    // Upload new texture data
-    for (size_t level = 0; level < imageBoxes.size(); ++level)
+    if (!task.message.isEmpty())
+        LogWarning("TextureAsset: " + Name() + ": " + task.message);
+
+    if (task.status == TextureProcessingTask::Unchanged)
+        return CreateFromImage(task.image, !task.sourceIsDds);
+
+    if (storeToCache)
     {
-        try
-        {
-            Ogre::HardwarePixelBufferSharedPtr buf = ogreTexture->getBuffer(0, level);
-            
-            if (sourceFormat >= Ogre::PF_DXT1 && sourceFormat <= Ogre::PF_DXT5)
-            {
-                // Ogre does not load the texture data properly if the miplevel width is not divisible by 4, so we write manual code for Direct3D9
-                /// \todo Fix bug in ogre-safe-nocrashes branch. It also affects Ogre's loading of already compressed DDS files
-                size_t bytesPerBlock = sourceFormat == Ogre::PF_DXT1 ? 8 : 16;
-                size_t numRows = (buf->getHeight() + 3) / 4;
-                size_t sourceStride = (buf->getWidth() + 3) / 4 * bytesPerBlock;
-                unsigned char* src = imageData[level];
-                
-                Ogre::D3D9HardwarePixelBuffer *pixelBuffer = dynamic_cast<Ogre::D3D9HardwarePixelBuffer*>(buf.get());
-                assert(pixelBuffer);
-                LPDIRECT3DSURFACE9 surface = pixelBuffer->getSurface(Ogre::D3D9RenderSystem::getActiveD3D9Device());
-                if (surface)
-                {
-                    D3DLOCKED_RECT lock;
-                    HRESULT hr = surface->LockRect(&lock, 0, 0);
-                    if (SUCCEEDED(hr))
-                    {
-                        if (lock.Pitch == sourceStride)
-                            memcpy(lock.pBits, src, sourceStride * numRows);
-                        else
-                            for(size_t y = 0; y < numRows; ++y)
-                                memcpy((u8*)lock.pBits + lock.Pitch * y, src + sourceStride * y, sourceStride);
-                        surface->UnlockRect();
-                    }
-                }
-            }
-            else
-                buf->blitFromMemory(imageBoxes[level]);
-        }
-        catch (std::exception& e)
-        {
-            LogError("TextureAsset::ReduceTextureSize: Caught exception " + QString(e.what()) + " while handling miplevel " + QString::number(level) + ", aborting.");
-            break;
-        }
+        PROFILE(TextureAsset_ProcessTexture_CacheStore);
+        if (assetAPI->GetAssetCache()->StoreAsset(&task.ddsData[0], task.ddsData.size(), NameInternal()).isEmpty())
+            LogWarning("TextureAsset: Could not store processed texture " + Name() + " to asset cache.");
     }
-    
-    // Delete CPU-side temp image data
-    for (size_t i = 0; i < imageData.size(); ++i)
-        delete[] imageData[i];
-    
-    LogDebug("TextureAsset::ReduceTextureSize: asset " + Name() + " reduced from " + QString::number(origWidth) + "x" + QString::number(origHeight) + " to " + QString::number(ogreTexture->getWidth()) + "x" + QString::number(ogreTexture->getHeight()));
-#endif
+    return LoadFromMemory(&task.ddsData[0], task.ddsData.size());
 }
-
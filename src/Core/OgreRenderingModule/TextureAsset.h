@@ -11,7 +11,14 @@
 #include <OgreTexture.h>
 #include <OgreResourceBackgroundQueue.h>
 
+struct TextureProcessingOptions;
+struct TextureProcessingTask;
+class CrnTranscoder;
+
 /// Represents a texture on the GPU.
+/** If --autoDxtCompress or --maxTextureSize is given, the loaded textures are compressed and downscaled on the CPU before they are
+    uploaded to the GPU, see TextureProcessingTask. The textures are processed in the worker threads of QThreadPool when loaded
+    asynchronously, and the results are cached to the asset cache as .dds files under NameInternal(). */
 class OGRE_MODULE_API TextureAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
@@ -61,15 +68,9 @@ public:
 
     //void RegenerateAllMipLevels();
 
-    /// Perform post-processing after loading (DXT compression and size reduction) according to command line options
-    void PostProcessTexture();
-    
-    /// Compress texture to suitable DXT format. Also, if applicable, reduce texture size at the same time.
-    void CompressTexture();
+    /// Returns the texture processing options given on the command line.
+    static const TextureProcessingOptions &ProcessingOptions();
 
-    /// Reduce texture size only according to command line options
-    void ReduceTextureSize();
-    
     /// This points to the loaded texture asset, if it is present.
     Ogre::TexturePtr ogreTexture;
 
@@ -84,18 +85,19 @@ public:
 
     /** This function is used internally to convert our name into Ogre form.
         Meaning we swap file suffixes that Ogre does not support to ones it supports
-        and handle conversion before passing to Ogre in DeserializeFrom. */
+        and handle conversion before passing to Ogre in DeserializeFrom.
+        If the textures are processed, the processing options are added to the name, and the name ends in .dds. */
     QString NameInternal() const;
 
     /// Same as NameInternal but static and takes the textureRef as a parameter.
     static QString NameInternal(const QString &textureRef);
 
     /// Decompresses any CRN input data to DDS.
-    /** @param crnData Ptr to compressed crn data.
-     ** @param crnNumBytes Size of crn data in bytes.
-     ** @param outDdsNumByte Size of decompressed dds data in bytes is assigned to this parameter.
-     ** @return void* to the uncompressed DDS data. It is the callers responsibility to free the 
-     ** data with crn_free_block when done with it. */
+    /** The mip levels are decompressed in parallel in the worker threads of QThreadPool, and this function waits for them.
+        @param crnData Ptr to compressed crn data.
+        @param crnNumBytes Size of crn data in bytes.
+        @param ddsData The decompressed DDS data is assigned to this parameter.
+        @return True if the decompression succeeded. */
     bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData);
 
 public slots:
@@ -111,7 +113,37 @@ public slots:
     /// Texture extension.
     QString NameSuffix() const;
 
+private slots:
+    /// Called when the texture has been processed in a worker thread.
+    void OnProcessingFinished();
+
+    /// Called when the CRN texture has been decompressed in the worker threads.
+    void OnCrnTranscoded();
+
 private:
     /// Unload texture from ogre
     virtual void DoUnload();
+
+    /// Starts a threaded load of the texture from a file in the asset cache.
+    bool LoadAsynchronously(const QString &cacheDiskSource);
+
+    /// Loads the texture from the given file data, in any format Ogre supports.
+    bool LoadFromMemory(const u8 *data, size_t numBytes);
+
+    /// Creates the texture from a decoded image.
+    /** @param allowMipmapGeneration If false, and the image has no mipmaps, the texture is created without mipmaps. */
+    bool CreateFromImage(Ogre::Image &image, bool allowMipmapGeneration);
+
+    /// Processes the texture data according to ProcessingOptions(), or loads an already processed texture from the asset cache.
+    bool DeserializeProcessed(const u8 *data, size_t numBytes, bool allowAsynchronous);
+
+    /// Loads the texture from the result of its processing.
+    /** @param storeToCache Whether the processed texture is stored to the asset cache. */
+    bool LoadProcessed(TextureProcessingTask &task, bool storeToCache);
+
+    /// The processing task that is run in a worker thread, if any.
+    shared_ptr<TextureProcessingTask> processingTask_;
+
+    /// The decompression of the CRN texture that is run in the worker threads, if any.
+    shared_ptr<CrnTranscoder> crnTranscoder_;
 };
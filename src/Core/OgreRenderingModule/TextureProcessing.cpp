@@ -0,0 +1,296 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureProcessing.h"
+#include "CrnTranscoder.h"
+#include "Framework.h"
+
+#include <QStringList>
+
+#include <OgreDataStream.h>
+#include <OgrePixelFormat.h>
+
+#include <squish.h>
+#include <dds_defs.h>
+
+#include <algorithm>
+#include <climits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+typedef std::vector<std::vector<u8> > LevelList;
+
+uint LevelSize(uint size, size_t level)
+{
+    return std::max(1U, size >> level);
+}
+
+/// Returns whether the pixels of the format can be converted to 8-bit RGBA without losing precision.
+bool IsByteColourFormat(Ogre::PixelFormat format)
+{
+    return !Ogre::PixelUtil::isCompressed(format) && Ogre::PixelUtil::getComponentType(format) == Ogre::PCT_BYTE &&
+        Ogre::PixelUtil::getComponentCount(format) >= 3;
+}
+
+u32 DxtFourCC(Ogre::PixelFormat format)
+{
+    switch(format)
+    {
+    case Ogre::PF_DXT1: return crnlib::PIXEL_FMT_DXT1;
+    case Ogre::PF_DXT2: return crnlib::PIXEL_FMT_DXT2;
+    case Ogre::PF_DXT3: return crnlib::PIXEL_FMT_DXT3;
+    case Ogre::PF_DXT4: return crnlib::PIXEL_FMT_DXT4;
+    default: return crnlib::PIXEL_FMT_DXT5;
+    }
+}
+
+/// Writes a .dds file of a 2D texture from the data of its mipmap levels.
+/** @param fourCC The DXT format of the data, or 0 if the data is uncompressed 8-bit RGBA. */
+void WriteDds(uint width, uint height, u32 fourCC, const LevelList &levels, std::vector<u8> &dds)
+{
+    crnlib::DDSURFACEDESC2 header;
+    memset(&header, 0, sizeof(header));
+    header.dwSize = sizeof(header);
+    header.dwFlags = crnlib::DDSD_CAPS | crnlib::DDSD_HEIGHT | crnlib::DDSD_WIDTH | crnlib::DDSD_PIXELFORMAT;
+    header.ddsCaps.dwCaps = crnlib::DDSCAPS_TEXTURE;
+    header.dwWidth = width;
+    header.dwHeight = height;
+    if (levels.size() > 1)
+    {
+        header.dwFlags |= crnlib::DDSD_MIPMAPCOUNT;
+        header.dwMipMapCount = (crn_uint32)levels.size();
+        header.ddsCaps.dwCaps |= crnlib::DDSCAPS_COMPLEX | crnlib::DDSCAPS_MIPMAP;
+    }
+
+    header.ddpfPixelFormat.dwSize = sizeof(crnlib::DDPIXELFORMAT);
+    if (fourCC)
+    {
+        header.dwFlags |= crnlib::DDSD_LINEARSIZE;
+        header.dwLinearSize = (crn_uint32)levels[0].size();
+        header.ddpfPixelFormat.dwFlags = crnlib::DDPF_FOURCC;
+        header.ddpfPixelFormat.dwFourCC = fourCC;
+    }
+    else
+    {
+        header.dwFlags |= crnlib::DDSD_PITCH;
+        header.lPitch = width * 4;
+        header.ddpfPixelFormat.dwFlags = crnlib::DDPF_RGB | crnlib::DDPF_ALPHAPIXELS;
+        header.ddpfPixelFormat.dwRGBBitCount = 32;
+        header.ddpfPixelFormat.dwRBitMask = 0x000000FF;
+        header.ddpfPixelFormat.dwGBitMask = 0x0000FF00;
+        header.ddpfPixelFormat.dwBBitMask = 0x00FF0000;
+        header.ddpfPixelFormat.dwRGBAlphaBitMask = 0xFF000000;
+    }
+
+    size_t totalSize = sizeof(crnlib::cDDSFileSignature) + sizeof(header);
+    for(size_t i = 0; i < levels.size(); ++i)
+        totalSize += levels[i].size();
+    dds.resize(totalSize);
+
+    // Note: Not endian safe, like the CRN to DDS conversion in TextureAsset.
+    size_t writePos = 0;
+    memcpy(&dds[writePos], &crnlib::cDDSFileSignature, sizeof(crnlib::cDDSFileSignature));
+    writePos += sizeof(crnlib::cDDSFileSignature);
+    memcpy(&dds[writePos], &header, sizeof(header));
+    writePos += sizeof(header);
+    for(size_t i = 0; i < levels.size(); ++i)
+    {
+        memcpy(&dds[writePos], &levels[i][0], levels[i].size());
+        writePos += levels[i].size();
+    }
+}
+
+}
+
+QString TextureProcessingOptions::Tag() const
+{
+    QString tag;
+    if (compress)
+        tag = "dxt";
+    if (maxSize > 0)
+        tag += (tag.isEmpty() ? "max" : "_max") + QString::number(maxSize);
+    return tag;
+}
+
+TextureProcessingOptions TextureProcessingOptions::FromCommandLine(Framework *framework)
+{
+    TextureProcessingOptions options;
+    if (!framework || framework->IsHeadless())
+        return options;
+
+    options.compress = framework->HasCommandLineParameter("--autodxtcompress");
+    QStringList sizeParam = framework->CommandLineParameters("--maxtexturesize");
+    if (sizeParam.size() > 0)
+    {
+        int size = sizeParam.first().toInt();
+        if (size > 0)
+            options.maxSize = size;
+    }
+    return options;
+}
+
+void TextureProcessingTask::Process()
+{
+    status = Failed;
+    ddsData.clear();
+    if (sourceData.empty())
+    {
+        message = "No texture data.";
+        return;
+    }
+    if (sourceIsCrn)
+    {
+        CrnTranscoder transcoder(&sourceData[0], sourceData.size());
+        if (!transcoder.IsValid() || !transcoder.TranscodeSerially())
+        {
+            message = "CRN uncompression failed.";
+            return;
+        }
+        sourceData.swap(transcoder.DdsData());
+    }
+    sourceIsDds = sourceData.size() >= 4 && memcmp(&sourceData[0], "DDS ", 4) == 0;
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&sourceData[0], sourceData.size(), false));
+#include "EnableMemoryLeakCheck.h"
+        image.load(stream);
+    }
+    catch(Ogre::Exception &e)
+    {
+        message = "Failed to decode the texture: " + QString(e.what());
+        return;
+    }
+    // The decoded image is all that is needed from now on.
+    std::vector<u8>().swap(sourceData);
+
+    status = Unchanged;
+    if (image.getNumFaces() > 1 || image.getDepth() > 1)
+        return; // Cube maps and volume textures are left as they are.
+
+    const Ogre::PixelFormat format = image.getFormat();
+    const size_t numLevels = image.getNumMipmaps() + 1; // Ogre doesn't count the first level as a mipmap.
+    const uint width = (uint)image.getWidth();
+    const uint height = (uint)image.getHeight();
+    const uint maxSize = options.maxSize > 0 ? options.maxSize : UINT_MAX;
+
+    // Skip the mipmap levels that are larger than the maximum size, but keep at least the smallest level.
+    size_t firstLevel = 0;
+    while(firstLevel + 1 < numLevels && (LevelSize(width, firstLevel) > maxSize || LevelSize(height, firstLevel) > maxSize))
+        ++firstLevel;
+    uint topWidth = LevelSize(width, firstLevel);
+    uint topHeight = LevelSize(height, firstLevel);
+    const bool tooLarge = topWidth > maxSize || topHeight > maxSize;
+
+    try
+    {
+        if (format >= Ogre::PF_DXT1 && format <= Ogre::PF_DXT5)
+        {
+            // Already compressed textures can only be made smaller by dropping their largest mipmap levels.
+            if (tooLarge)
+                message = "Not resizing an already DXT compressed texture that has no mipmaps small enough.";
+            if (firstLevel == 0)
+                return;
+
+            LevelList levels;
+            for(size_t level = firstLevel; level < numLevels; ++level)
+            {
+                Ogre::PixelBox box = image.getPixelBox(0, level);
+                const u8 *data = (const u8 *)box.data;
+                levels.push_back(std::vector<u8>(data, data + box.getConsecutiveSize()));
+            }
+            WriteDds(topWidth, topHeight, DxtFourCC(format), levels, ddsData);
+            status = Processed;
+            image = Ogre::Image();
+            return;
+        }
+
+        if (!IsByteColourFormat(format))
+        {
+            if (tooLarge)
+                message = "Not resizing a texture of pixel format " + QString(Ogre::PixelUtil::getFormatName(format).c_str()) + ".";
+            return;
+        }
+        if (!options.compress && firstLevel == 0 && !tooLarge)
+            return;
+
+        // Convert the top level to RGBA, which is what squish reads.
+        LevelList levels(1, std::vector<u8>(topWidth * topHeight * 4));
+        Ogre::PixelBox top(topWidth, topHeight, 1, Ogre::PF_BYTE_RGBA, &levels[0][0]);
+        Ogre::PixelUtil::bulkPixelConversion(image.getPixelBox(0, firstLevel), top);
+
+        // If even the smallest level was too large, halve it until it fits.
+        while(topWidth > maxSize || topHeight > maxSize)
+        {
+            topWidth = std::max(1U, topWidth / 2);
+            topHeight = std::max(1U, topHeight / 2);
+            std::vector<u8> scaled(topWidth * topHeight * 4);
+            Ogre::PixelBox scaledBox(topWidth, topHeight, 1, Ogre::PF_BYTE_RGBA, &scaled[0]);
+            Ogre::Image::scale(top, scaledBox, Ogre::Image::FILTER_BILINEAR);
+            levels[0].swap(scaled);
+            top = scaledBox;
+        }
+
+        // Generate the mipmap chain from the top level, unless the source is a .dds file that has no mipmaps.
+        if (numLevels > 1 || !sourceIsDds)
+        {
+            uint w = topWidth, h = topHeight;
+            while(w > 1 || h > 1)
+            {
+                const uint nextWidth = std::max(1U, w / 2);
+                const uint nextHeight = std::max(1U, h / 2);
+                levels.push_back(std::vector<u8>(nextWidth * nextHeight * 4));
+                Ogre::PixelBox previous(w, h, 1, Ogre::PF_BYTE_RGBA, &levels[levels.size() - 2][0]);
+                Ogre::PixelBox next(nextWidth, nextHeight, 1, Ogre::PF_BYTE_RGBA, &levels.back()[0]);
+                Ogre::Image::scale(previous, next, Ogre::Image::FILTER_BILINEAR);
+                w = nextWidth;
+                h = nextHeight;
+            }
+        }
+
+        u32 fourCC = 0;
+        if (options.compress)
+        {
+            const bool hasAlpha = Ogre::PixelUtil::hasAlpha(format);
+            const int flags = squish::kColourRangeFit | (hasAlpha ? squish::kDxt5 : squish::kDxt1); // Lowest quality, but fastest
+            fourCC = hasAlpha ? crnlib::PIXEL_FMT_DXT5 : crnlib::PIXEL_FMT_DXT1;
+            for(size_t level = 0; level < levels.size(); ++level)
+            {
+                const int levelWidth = (int)LevelSize(topWidth, level);
+                const int levelHeight = (int)LevelSize(topHeight, level);
+                std::vector<u8> compressed(squish::GetStorageRequirements(levelWidth, levelHeight, flags));
+                squish::CompressImage(&levels[level][0], levelWidth, levelHeight, &compressed[0], flags);
+                levels[level].swap(compressed);
+            }
+        }
+
+        WriteDds(topWidth, topHeight, fourCC, levels, ddsData);
+        status = Processed;
+        image = Ogre::Image();
+    }
+    catch(Ogre::Exception &e)
+    {
+        // The decoded texture can still be used as is.
+        message = "Failed to process the texture: " + QString(e.what());
+        ddsData.clear();
+        status = Unchanged;
+    }
+}
+
+TextureProcessingJob::TextureProcessingJob(const shared_ptr<TextureProcessingTask> &task) :
+    task_(task)
+{
+}
+
+void TextureProcessingJob::run()
+{
+    task_->Process();
+    task_->finished.fetchAndStoreOrdered(1);
+    emit Finished();
+}
@@ -0,0 +1,97 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <QAtomicInt>
+
+#include <OgreImage.h>
+
+#include <vector>
+
+class Framework;
+
+/// Options of the texture processing that is done on the CPU before the textures are uploaded to the GPU.
+struct OGRE_MODULE_API TextureProcessingOptions
+{
+    TextureProcessingOptions() : compress(false), maxSize(0) {}
+
+    /// Compress the uncompressed textures to DXT1, or to DXT5 if they have alpha (--autoDxtCompress).
+    bool compress;
+    /// Maximum width and height of the textures, or 0 if the size is not limited (--maxTextureSize).
+    uint maxSize;
+
+    /// Returns whether the textures are processed at all.
+    bool Enabled() const { return compress || maxSize > 0; }
+
+    /// Returns the tag added to the names of the processed textures, so that the results of different options are cached separately.
+    QString Tag() const;
+
+    /// Reads the options from the command line of the framework.
+    static TextureProcessingOptions FromCommandLine(Framework *framework);
+};
+
+/// Downscales and DXT compresses one texture on the CPU.
+/** The result is a .dds file with a full mipmap chain, which can be cached and uploaded to the GPU as is.
+    Process() does not touch the GPU or the other Tundra systems, so that it can be run in a worker thread. */
+struct OGRE_MODULE_API TextureProcessingTask
+{
+    enum Status
+    {
+        Processed, ///< The processed texture is in ddsData.
+        Unchanged, ///< The texture needs no processing, or it cannot be processed. The decoded texture is in image.
+        Failed ///< The source data could not be decoded.
+    };
+
+    TextureProcessingTask() : sourceIsCrn(false), status(Failed), sourceIsDds(false) {}
+
+    /// Processes sourceData according to options.
+    void Process();
+
+    /// Returns true once the task has been run by a TextureProcessingJob.
+    bool IsFinished() const { return finished != 0; }
+
+    TextureProcessingOptions options;
+    /// The encoded source texture, in any format Ogre can load, or CRN.
+    std::vector<u8> sourceData;
+    /// Is the source texture a CRN file, which is decompressed to DDS first.
+    bool sourceIsCrn;
+
+    Status status;
+    /// The processed texture as a .dds file, if processed.
+    std::vector<u8> ddsData;
+    /// The decoded source texture, if not processed.
+    Ogre::Image image;
+    /// Is the source texture a .dds file. The mipmaps of .dds files are not generated if the file has none.
+    bool sourceIsDds;
+    /// Describes why the texture was not processed, or the error if decoding it failed.
+    QString message;
+
+    /// Set by TextureProcessingJob when the task has been run.
+    QAtomicInt finished;
+};
+
+/// Runs a TextureProcessingTask in a worker thread. Start it in QThreadPool.
+class TextureProcessingJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    explicit TextureProcessingJob(const shared_ptr<TextureProcessingTask> &task);
+
+    /// QRunnable override.
+    virtual void run();
+
+signals:
+    /// Emitted from the worker thread when the task has been run.
+    /** @note Connect your slot with Qt::QueuedConnection so you will receive the callback in your thread. */
+    void Finished();
+
+private:
+    shared_ptr<TextureProcessingTask> task_;
+};
@@ -18,6 +18,7 @@
 #include "EC_Mesh.h"
 #include "EC_Placeable.h"
 #include "EC_Terrain.h"
+#include "Heightfield.h"
 #include "AssetAPI.h"
 #include "IAssetTransfer.h"
 #include "AttributeMetadata.h"
@@ -63,6 +64,9 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     shape_(0),
     childShape_(0),
     heightField_(0),
+    heightfieldLayoutVersion_(0),
+    heightfieldMinY_(0.f),
+    heightfieldMaxY_(0.f),
     disconnected_(false),
     cachedShapeType_(-1),
     cachedSize_(float3::zero),
@@ -284,6 +288,8 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         {
             terrain_ = terrain;
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
+            // The heightfield shape reads the raw height values, so it must be recreated before Bullet reads them again when they are moved.
+            connect(terrain.get(), SIGNAL(HeightfieldLayoutChanged()), this, SLOT(OnTerrainRegenerated()), Qt::DirectConnection);
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
     }
@@ -361,6 +367,7 @@ void EC_RigidBody::RemoveCollisionShape()
         delete heightField_;
         heightField_ = 0;
     }
+    heightfieldData_.reset();
 }
 
 void EC_RigidBody::CreateBody()
@@ -510,8 +517,22 @@ void EC_RigidBody::SetClientExtrapolating(bool isClientExtrapolating)
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
-        CreateCollisionShape();
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+
+    // The heightfield shape reads the height values straight from the terrain, so the edits are already visible to it,
+    // unless the terrain has replaced its heightfield, the values have been moved, or the heights have grown out of the bounds of the shape.
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (terrain && heightField_ && heightfieldData_ && heightfieldData_ == terrain->GetHeightfield() &&
+        heightfieldData_->LayoutVersion() == heightfieldLayoutVersion_)
+    {
+        float minY, maxY;
+        heightfieldData_->GetBounds(minY, maxY);
+        if (minY >= heightfieldMinY_ && maxY <= heightfieldMaxY_)
+            return;
+    }
+
+    CreateCollisionShape();
 }
 
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
@@ -871,34 +892,41 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     if (!terrain)
         return;
     
-    int width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    int height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
+    heightfieldData_ = terrain->GetHeightfield();
+    if (!heightfieldData_)
+        return;
+    int width = heightfieldData_->Width();
+    int height = heightfieldData_->Height();
     if (!width || !height)
+    {
+        heightfieldData_.reset();
         return;
+    }
     
-    heightValues_.resize(width * height);
-    
+    // Share the height values of the terrain instead of copying them. The bounds of the values may be wider than their exact range,
+    // which only makes the bounding box of the shape a bit larger.
     float xzSpacing = 1.0f;
-    float ySpacing = 1.0f;
-    float minY = 1000000000;
-    float maxY = -1000000000;
-    for(uint z = 0; z < (uint)height; ++z)
-        for(uint x = 0; x < (uint)width; ++x)
-        {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            heightValues_[z * width + x] = value;
-        }
+    float minY, maxY;
+    heightfieldData_->GetBounds(minY, maxY);
+    heightfieldLayoutVersion_ = heightfieldData_->LayoutVersion();
+    heightfieldMinY_ = minY;
+    heightfieldMaxY_ = maxY;
 
     float3 scale = terrain->nodeTransformation.Get().scale;
     float3 bbMin(0, minY, 0);
     float3 bbMax(xzSpacing * (width - 1), maxY, xzSpacing * (height - 1));
     float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
     
-    heightField_ = new btHeightfieldTerrainShape(width, height, &heightValues_[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
+    // Bullet centers the shape on the middle of the raw height range. The quantized values are relative to the quantization offset,
+    // so their raw range is offset too, but the center of the shape still needs to end up at bbCenter.
+    if (heightfieldData_->IsQuantized())
+    {
+        const float offset = heightfieldData_->QuantizationOffset();
+        heightField_ = new btHeightfieldTerrainShape(width, height, const_cast<void*>(heightfieldData_->Data()), heightfieldData_->QuantizationStep(),
+            minY - offset, maxY - offset, 1, PHY_SHORT, false);
+    }
+    else
+        heightField_ = new btHeightfieldTerrainShape(width, height, const_cast<void*>(heightfieldData_->Data()), 1.0f, minY, maxY, 1, PHY_FLOAT, false);
     
     /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
         the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
@@ -14,6 +14,7 @@
 
 class EC_Placeable;
 class EC_Terrain;
+class Heightfield;
 
 /// Physics rigid body entity-component
 /** <table class="header">
@@ -325,7 +326,8 @@ private slots:
     /// Check for placeable & terrain components and connect to their signals
     void CheckForPlaceableAndTerrain();
     
-    /// Called when EC_Terrain has been regenerated
+    /// Called when EC_Terrain has been regenerated, or the layout of its height values has changed.
+    /** Recreates the heightfield shape if it can no longer read the height values as it is. */
     void OnTerrainRegenerated();
 
     /// Called when collision mesh has been downloaded.
@@ -418,6 +420,12 @@ private:
     /// Bullet heightfield shape. Note: this is always put inside a compound shape (shape_)
     btHeightfieldTerrainShape* heightField_;
     
-    /// Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues_;
+    /// The height values of the terrain, which heightField_ reads directly, for the case the shape is a heightfield.
+    shared_ptr<Heightfield> heightfieldData_;
+
+    /// The layout version of heightfieldData_ and its height range when heightField_ was created.
+    /// As long as the layout stays the same and the heights stay within the range, the terrain edits need no new shape.
+    u32 heightfieldLayoutVersion_;
+    float heightfieldMinY_;
+    float heightfieldMaxY_;
 };
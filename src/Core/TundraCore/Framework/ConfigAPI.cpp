@@ -9,6 +9,7 @@
 
 #include <QSettings>
 #include <QDir>
+#include <QRunnable>
 
 QString ConfigAPI::FILE_FRAMEWORK = "tundra";
 QString ConfigAPI::SECTION_FRAMEWORK = "framework";
@@ -18,14 +19,103 @@ QString ConfigAPI::SECTION_RENDERING = "rendering";
 QString ConfigAPI::SECTION_UI = "ui";
 QString ConfigAPI::SECTION_SOUND = "sound";
 
+/// Writes a snapshot of the values of a config file to disk in a worker thread.
+/** QSettings is reentrant, so the job uses a QSettings object of its own. The main thread does not keep QSettings objects
+    with unwritten changes, as those would write to disk from the main thread's event loop. */
+class ConfigFileWriteJob : public QRunnable
+{
+public:
+    ConfigFileWriteJob(ConfigAPI *owner, const QString &filePath, const QVariantMap &values) :
+        owner_(owner), filePath_(filePath), values_(values)
+    {
+    }
+
+    /// QRunnable override.
+    virtual void run()
+    {
+        QSettings config(filePath_, QSettings::IniFormat);
+        config.clear();
+        for(QVariantMap::const_iterator iter = values_.begin(); iter != values_.end(); ++iter)
+            config.setValue(iter.key(), iter.value());
+        config.sync();
+        // The owner waits for the jobs to finish before it is deleted, and a queued call to a deleted object is discarded.
+        QMetaObject::invokeMethod(owner_, "OnFileWritten", Qt::QueuedConnection, Q_ARG(QString, filePath_), Q_ARG(bool, config.status() == QSettings::NoError));
+    }
+
+private:
+    ConfigAPI *owner_;
+    QString filePath_;
+    QVariantMap values_;
+};
+
 ConfigAPI::ConfigAPI(Framework *framework) :
     QObject(framework),
     framework_(framework)
 {
+    flushTimer_.setSingleShot(true);
+    flushTimer_.setInterval(1000);
+    connect(&flushTimer_, SIGNAL(timeout()), this, SLOT(WriteChangedFiles()));
+    writePool_.setMaxThreadCount(1);
+}
+
+ConfigAPI::~ConfigAPI()
+{
+    Flush();
+    files_.clear();
+}
+
+void ConfigAPI::Flush()
+{
+    WriteChangedFiles();
+    writePool_.waitForDone();
+}
+
+void ConfigAPI::WriteChangedFiles()
+{
+    flushTimer_.stop();
+    for(QHash<QString, ConfigFile>::iterator iter = files_.begin(); iter != files_.end(); ++iter)
+    {
+        ConfigFile &configFile = iter.value();
+        if (!configFile.dirty)
+            continue;
+        configFile.dirty = false;
+        writePool_.start(new ConfigFileWriteJob(this, iter.key(), configFile.values));
+    }
+}
+
+void ConfigAPI::OnFileWritten(const QString &filePath, bool success)
+{
+    if (!success)
+        LogError("ConfigAPI::Flush: Failed to write config file \"" + filePath + "\".");
+}
+
+void ConfigAPI::SetFlushDelay(int msecs)
+{
+    flushTimer_.setInterval(qMax(msecs, 0));
+}
+
+ConfigAPI::ConfigFile &ConfigAPI::File(const QString &file) const
+{
+    const QString filePath = GetFilePath(file);
+    QHash<QString, ConfigFile>::iterator iter = files_.find(filePath);
+    if (iter != files_.end())
+        return iter.value();
+
+    // Read the whole file once. The QSettings object has no changes, so it does not write to the file when destroyed.
+    ConfigFile &configFile = files_[filePath];
+    QSettings config(filePath, QSettings::IniFormat);
+    foreach(const QString &key, config.allKeys())
+        configFile.values[key] = config.value(key);
+    configFile.writable = config.isWritable();
+    return configFile;
 }
 
 void ConfigAPI::PrepareDataFolder(QString configFolder)
 {
+    // Write out anything that was written against the previous folder before switching.
+    Flush();
+    files_.clear();
+
     QDir config = QDir(Application::ParseWildCardFilename(configFolder.trimmed()));
     if (!config.exists())
     {
@@ -118,10 +208,9 @@ bool ConfigAPI::HasKey(QString file, QString section, QString key) const
     if (!IsFilePathSecure(file))
         return false;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
     if (!section.isEmpty())
         key = section + "/" + key;
-    return config.allKeys().contains(key);
+    return File(file).values.contains(key);
 }
 
 QVariant ConfigAPI::Read(const ConfigData &data) const
@@ -164,11 +253,8 @@ QVariant ConfigAPI::Read(QString file, QString section, QString key, const QVari
     if (!IsFilePathSecure(file))
         return QVariant();
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (section.isEmpty())
-        return config.value(key, defaultValue);
-    else
-        return config.value(section + "/" + key, defaultValue);
+    const QVariantMap &values = File(file).values;
+    return values.value(section.isEmpty() ? key : section + "/" + key, defaultValue);
 }
 
 void ConfigAPI::Write(const ConfigData &data)
@@ -206,14 +292,16 @@ void ConfigAPI::Write(QString file, QString section, QString key, const QVariant
     if (!IsFilePathSecure(file))
         return;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (!config.isWritable())
+    ConfigFile &configFile = File(file);
+    if (!configFile.writable)
         return;
-    if (section.isEmpty())
-        config.setValue(key, value);
-    else
-        config.setValue(section + "/" + key, value);
-    config.sync();
+    configFile.values[section.isEmpty() ? key : section + "/" + key] = value;
+
+    // Delay the actual disk write so that consecutive writes get batched together.
+    configFile.dirty = true;
+    flushTimer_.start();
+
+    emit ConfigChanged(file, section, key, value);
 }
 
 QVariant ConfigAPI::DeclareSetting(const QString &file, const QString &section, const QString &key, const QVariant &defaultValue)
@@ -7,6 +7,9 @@
 #include <QObject>
 #include <QVariant>
 #include <QString>
+#include <QHash>
+#include <QTimer>
+#include <QThreadPool>
 
 class Framework;
 
@@ -69,7 +72,12 @@ Q_DECLARE_METATYPE(ConfigData*)
     @endcode
 
     @note All file, key and section parameters are case-insensitive. This means all of them are transformed to 
-    lower case before any accessing files. "MyKey" will get and set you same value as "mykey". */
+    lower case before any accessing files. "MyKey" will get and set you same value as "mykey".
+
+    @note Each config file is read only once and its values are kept in memory for the lifetime of the ConfigAPI. Writes are
+    applied to the in-memory values immediately. After a short delay, a snapshot of the values of each changed file is written
+    to disk in a worker thread, so that bursts of writes result in a single disk write, and the main thread does not wait for the writes.
+    The files are written one at a time, in the order of the snapshots. Call Flush if you need the data to hit the disk immediately. */
 class TUNDRACORE_API ConfigAPI : public QObject
 {
     Q_OBJECT
@@ -141,11 +149,52 @@ public slots:
     bool HasValue(const ConfigData &data, QString key) const { return HasKey(data, key); } /**< @deprecated Use HasKey. @todo Add warning print @todo Remove */
     QString GetConfigFolder() const { return ConfigFolder(); } /**< @deprecated Use ConfigFolder. @todo Add warning print @todo Remove */
     /// @endcond
+
+    /// Writes all pending changes of the in-memory config files to disk, and waits until they have been written.
+    void Flush();
+
+    /// Sets the delay in milliseconds after the last Write before the pending changes are written to disk.
+    /** @param msecs Delay in milliseconds. Pass 0 to start writing changes to disk in the worker thread on the next main loop iteration. */
+    void SetFlushDelay(int msecs);
+
+    /// Returns the delay in milliseconds after the last Write before the pending changes are written to disk.
+    int FlushDelay() const { return flushTimer_.interval(); }
+
+signals:
+    /// Emitted when a value has been written to a config.
+    /** @param file Name of the file, without the .ini extension.
+        @param section The section in the config where key is.
+        @param key Key that value was changed.
+        @param value The new value of the key. */
+    void ConfigChanged(const QString &file, const QString &section, const QString &key, const QVariant &value);
+
+private slots:
+    /// Starts writing the changed config files to disk in the worker thread.
+    void WriteChangedFiles();
+
+    /// Called from the worker thread when a config file has been written.
+    void OnFileWritten(const QString &filePath, bool success);
+
 private:
     friend class Framework;
 
+    /// The values of a config file, keyed like in QSettings, e.g. "section/key".
+    struct ConfigFile
+    {
+        ConfigFile() : writable(false), dirty(false) {}
+
+        QVariantMap values; ///< Implicitly shared, so a snapshot for writing the file is cheap to take.
+        bool writable; ///< Can the file be written.
+        bool dirty; ///< Are there changes that have not been passed to the worker thread for writing.
+    };
+
     /// @note Framework takes ownership of the object.
     explicit ConfigAPI(Framework *framework);
+    ~ConfigAPI();
+
+    /// Returns the in-memory values of the file, reading the file on first access.
+    /** @param file Prepared and validated file name. */
+    ConfigFile &File(const QString &file) const;
 
     /// Get absolute file path for file. Guarantees that it ends with .ini.
     QString GetFilePath(const QString &file) const;
@@ -165,4 +214,7 @@ private:
 
     Framework *framework_;
     QString configFolder_; ///< Absolute path to the folder where to store the config files.
+    mutable QHash<QString, ConfigFile> files_; ///< Read config files, keyed by absolute file path.
+    QTimer flushTimer_; ///< Single-shot timer used to delay writing changes to disk.
+    QThreadPool writePool_; ///< Has a single thread, so that the snapshots of a file are written in order.
 };
@@ -167,8 +167,17 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--server"] = "Starts Tundra as server."; // TundraLogicModule
     cmdLineDescs.commands["--port"] = "Specifies the Tundra server port."; // TundraLogicModule
     cmdLineDescs.commands["--protocol"] = "Specifies the Tundra server protocol. Options: '--protocol tcp' and '--protocol udp'. Defaults to udp if no protocol is specified."; // KristalliProtocolModule
+    cmdLineDescs.commands["--recordNetwork"] = "Records all received network messages to the given binary file, for replaying them with --replayNetwork. Usage: '--recordNetwork <file>'."; // KristalliProtocolModule
+    cmdLineDescs.commands["--replayNetwork"] = "Replays a recording made with --recordNetwork to the server message handlers as fast as possible without sockets, prints the time spent per message ID and exits. Use with --server and the scene the recording was made with. Usage: '--replayNetwork <file>'."; // KristalliProtocolModule
+    cmdLineDescs.commands["--inboundBudget"] = "Time in milliseconds the server may spend per frame handling the messages of the clients. The rest wait for the next frame. 0 for no limit. Default: 10."; // KristalliProtocolModule
+    cmdLineDescs.commands["--clientMessageRate"] = "Maximum number of messages per second the server handles from each client. 0 for no limit, which is the default. See also the inboundStats console command."; // KristalliProtocolModule
+    cmdLineDescs.commands["--maxInboundQueue"] = "Number of unhandled messages after which the server disconnects a client. Default: 10000."; // KristalliProtocolModule
     cmdLineDescs.commands["--fpsLimit"] = "Specifies the FPS cap to use in rendering. Default: 60. Pass in 0 to disable."; // Framework
     cmdLineDescs.commands["--run"] = "Runs script on startup"; // JavaScriptModule
+    cmdLineDescs.commands["--sharedScriptEngine"] = "Runs the trusted scripts in a single shared script engine, each in a scope of its own, instead of creating an engine with all the bindings for each script."; // JavaScriptModule
+    cmdLineDescs.commands["--scriptProfiling"] = "Measures the time each script spends executing. Print the results with the JsProfile console command."; // JavaScriptModule
+    cmdLineDescs.commands["--scriptSoftBudget"] = "Logs a warning when a single call into a script takes longer than the given number of milliseconds. Enables --scriptProfiling."; // JavaScriptModule
+    cmdLineDescs.commands["--scriptHardBudget"] = "Aborts a call into a script that runs longer than the given number of milliseconds. Enables --scriptProfiling."; // JavaScriptModule
     cmdLineDescs.commands["--file"] = "Specifies a startup scene file. Multiple files supported. Accepts absolute and relative paths, local:// and http:// are accepted and fetched via the AssetAPI."; // TundraLogicModule & AssetModule
     cmdLineDescs.commands["--storage"] = "Adds the given directory as a local storage directory on startup."; // AssetModule
     cmdLineDescs.commands["--config"] = "Specifies a startup configuration file to use. Multiple config files are supported, f.ex. '--config plugins.xml --config MyCustomAddons.xml'."; // Framework & PluginAPI
@@ -178,6 +187,7 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--noAssetCache"] = "Disable asset cache."; // Framework
     cmdLineDescs.commands["--assetCacheDir"] = "Specify asset cache directory to use."; // Framework
     cmdLineDescs.commands["--clear-asset-cache"] = "At the start of Tundra, remove all data and metadata files from asset cache."; // AssetCache
+    cmdLineDescs.commands["--extractZipBundles"] = "Extracts the files of zip asset bundles to the asset cache and loads the sub assets from there, instead of reading them from the archive when requested. Use if some sub assets need to be files on disk."; // ArchivePlugin
     cmdLineDescs.commands["--logLevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'."; // ConsoleAPI
     cmdLineDescs.commands["--logFile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt'."; // ConsoleAPI
     cmdLineDescs.commands["--physicsRate"] = "Specifies the number of physics simulation steps per second. Default: 60."; // PhysicsModule
@@ -189,8 +199,8 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--antialias"] = "Sets full screen antialiasing factor. Usage '--antialias <number>'."; // OgreRenderingModule
     cmdLineDescs.commands["--hide_benign_ogre_messages"] = "Sets some uninformative Ogre log messages to be ignored from the log output."; // OgreRenderingModule
     cmdLineDescs.commands["--no_async_asset_load"] = "Disables threaded loading of Ogre assets."; // OgreRenderingModule
-    cmdLineDescs.commands["--autoDxtCompress"] = "Compress uncompressed texture assets to DXT1/DXT5 format on load to save memory."; // OgreRenderingModule
-    cmdLineDescs.commands["--maxTextureSize"] = "Resize texture assets that are larger than this. Default: no resizing."; // OgreRenderingModule
+    cmdLineDescs.commands["--autoDxtCompress"] = "Compress uncompressed texture assets to DXT1/DXT5 format on load to save memory. The compressed textures are cached."; // OgreRenderingModule
+    cmdLineDescs.commands["--maxTextureSize"] = "Resize texture assets that are larger than this. The resized textures are cached. Default: no resizing."; // OgreRenderingModule
     cmdLineDescs.commands["--variablePhysicsStep"] = "Use variable physics timestep to avoid taking multiple physics substeps during one frame."; // PhysicsModule
     cmdLineDescs.commands["--opengl"] = "Use Ogre with \"OpenGL Rendering Subsystem\" for rendering, overrides the option that was set in config.";
     cmdLineDescs.commands["--nullRenderer"] = "Disables all Ogre rendering operations."; // OgreRenderingModule
@@ -201,7 +211,14 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--noCentralWidget"] = "Disables the usage of QMainWindow's central widget."; // Framework
     cmdLineDescs.commands["--noMenuBar"] = "Disables showing of the application menu bar automatically."; // Framework
     cmdLineDescs.commands["--clientExtrapolationTime"] = "Rigid body extrapolation time on client in milliseconds. Default 66."; // TundraProtocolModule
+    cmdLineDescs.commands["--clientinterpolationdelay"] = "Delay in milliseconds by which the client lags behind the received entity transforms to smooth out network jitter. Default: 1.5 network update periods."; // TundraProtocolModule
     cmdLineDescs.commands["--noClientPhysics"] = "Disables rigid body handoff to client simulation after no movement packets received from server."; // TundraProtocolModule
+    cmdLineDescs.commands["--loadTest"] = "Runs a replication load test: connects bot clients to a Tundra server and writes a JSON report of their traffic and update latency. Exits when done."; // LoadTestPlugin
+    cmdLineDescs.commands["--loadTestBots"] = "Specifies the number of load test bots. Default: 10."; // LoadTestPlugin
+    cmdLineDescs.commands["--loadTestServer"] = "Specifies the server the load test bots connect to. Usage: '--loadTestServer host[:port]'. Default: 127.0.0.1:2345. The protocol is given with --protocol."; // LoadTestPlugin
+    cmdLineDescs.commands["--loadTestDuration"] = "Specifies the duration of the load test in seconds. Default: 60."; // LoadTestPlugin
+    cmdLineDescs.commands["--loadTestEditRate"] = "Specifies the number of entity edits each load test bot sends per second. Default: 10."; // LoadTestPlugin
+    cmdLineDescs.commands["--loadTestReport"] = "Specifies the file the load test report is written to. Default: loadtest.json."; // LoadTestPlugin
     cmdLineDescs.commands["--dumpProfiler"] = "Dump profiling blocks to console every 5 seconds."; // DebugStatsModule
 
     if (HasCommandLineParameter("--help"))
@@ -306,6 +323,7 @@ Framework::~Framework()
     SAFE_DELETE(scene);
     SAFE_DELETE(frame);
     SAFE_DELETE(ui);
+    SAFE_DELETE(config);
 
     // This delete must be the last one in Framework since application derives QApplication.
     // When we delete QApplication, we must have ensured that all QObjects have been deleted.
@@ -413,6 +431,7 @@ void Framework::Go()
     input->Reset();
     audio->SaveSoundSettingsToConfig();
     audio->Reset();
+    config->Flush();
 
     for(size_t i = 0; i < modules.size(); ++i)
     {
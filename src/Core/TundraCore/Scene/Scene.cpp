@@ -1349,6 +1349,97 @@ float3 Scene::ForwardVector() const
     return -float3::unitZ;
 }
 
+namespace
+{
+/// Computes the interpolated values for all entries that have a non-negative interpolation factor.
+void InterpolateValues(const std::vector<float> &starts, const std::vector<float> &ends, const std::vector<float> &factors, std::vector<float> &values)
+{
+    // Written as a branchless loop over plain arrays so that the compiler can vectorize it.
+    const size_t count = values.size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        const float t = factors[i] > 0.0f ? factors[i] : 0.0f;
+        values[i] = starts[i] + (ends[i] - starts[i]) * t;
+    }
+}
+
+void InterpolateValues(const std::vector<float3> &starts, const std::vector<float3> &ends, const std::vector<float> &factors, std::vector<float3> &values)
+{
+    const size_t count = values.size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        const float t = factors[i] > 0.0f ? factors[i] : 0.0f;
+        values[i] = starts[i] + (ends[i] - starts[i]) * t;
+    }
+}
+
+void InterpolateValues(const std::vector<Quat> &starts, const std::vector<Quat> &ends, const std::vector<float> &factors, std::vector<Quat> &values)
+{
+    const size_t count = values.size();
+    for(size_t i = 0; i < count; ++i)
+        if (factors[i] >= 0.0f)
+            values[i] = Slerp(starts[i], ends[i], factors[i]);
+}
+
+void InterpolateValues(const std::vector<Transform> &starts, const std::vector<Transform> &ends, const std::vector<float> &factors, std::vector<Transform> &values)
+{
+    const size_t count = values.size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        const float t = factors[i];
+        if (t < 0.0f)
+            continue;
+        const Transform &startValue = starts[i];
+        const Transform &endValue = ends[i];
+        Transform &newTrans = values[i];
+        newTrans.pos = Lerp(startValue.pos, endValue.pos, t);
+        newTrans.SetOrientation(Slerp(startValue.Orientation(), endValue.Orientation(), t));
+        newTrans.scale = Lerp(startValue.scale, endValue.scale, t);
+    }
+}
+}
+
+template<typename T>
+bool Scene::StartPooledInterpolation(AttributeInterpolationPool<T> &pool, u32 type, IComponent *comp, IAttribute *attr, IAttribute *endvalue, float length)
+{
+    Attribute<T> *endAttr = dynamic_cast<Attribute<T> *>(endvalue);
+    if (!endAttr)
+    {
+        delete endvalue;
+        return false;
+    }
+    const T endValue = endAttr->Get();
+    delete endvalue;
+
+    // The type ID guarantees the concrete attribute type.
+    Attribute<T> *dest = static_cast<Attribute<T> *>(attr);
+
+    // Continuous update: restart the existing interpolation in place from the current value.
+    QHash<IAttribute *, AttributeInterpolationHandle>::const_iterator iter = interpolationLookup_.find(attr);
+    if (iter != interpolationLookup_.end() && iter->type == type && !pool.owners[iter->index].expired())
+    {
+        const size_t index = iter->index;
+        pool.starts[index] = dest->Get();
+        pool.ends[index] = endValue;
+        pool.times[index] = 0.0f;
+        pool.lengths[index] = length;
+        return true;
+    }
+
+    // End previous interpolation if existed
+    bool previous = EndAttributeInterpolation(attr);
+
+    // If previous interpolation does not exist, perform a direct snapping to the end value
+    // but still start an interpolation period, so that on the next update we detect that an interpolation is going on,
+    // and will interpolate normally
+    if (!previous)
+        dest->Set(endValue, AttributeChange::LocalOnly);
+
+    interpolationLookup_[attr] = AttributeInterpolationHandle(type, pool.Size());
+    pool.Add(comp->shared_from_this(), dest, dest->Get(), endValue, length);
+    return true;
+}
+
 bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue, float length)
 {
     if (!endvalue)
@@ -1365,6 +1456,21 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
         return false;
     }
     
+    // The most commonly interpolated types have dedicated pools that store the values inline.
+    switch(attr->TypeId())
+    {
+    case cAttributeTransform:
+        return StartPooledInterpolation(transformInterpolations_, cAttributeTransform, comp, attr, endvalue, length);
+    case cAttributeFloat3:
+        return StartPooledInterpolation(float3Interpolations_, cAttributeFloat3, comp, attr, endvalue, length);
+    case cAttributeQuat:
+        return StartPooledInterpolation(quatInterpolations_, cAttributeQuat, comp, attr, endvalue, length);
+    case cAttributeReal:
+        return StartPooledInterpolation(floatInterpolations_, cAttributeReal, comp, attr, endvalue, length);
+    default:
+        break;
+    }
+
     // End previous interpolation if existed
     bool previous = EndAttributeInterpolation(attr);
     
@@ -1380,24 +1486,63 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
     newInterp.end = AttributeWeakPtr(comp->shared_from_this(), endvalue);
     newInterp.length = length;
     
+    interpolationLookup_[attr] = AttributeInterpolationHandle(cAttributeNone, interpolations_.size());
     interpolations_.push_back(newInterp);
     return true;
 }
 
-bool Scene::EndAttributeInterpolation(IAttribute* attr)
+template<typename T>
+void Scene::RemoveFromPool(AttributeInterpolationPool<T> &pool, u32 type, size_t index)
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
+    interpolationLookup_.remove(pool.dests[index]);
+    pool.RemoveSwap(index);
+    if (index < pool.Size())
+        interpolationLookup_[pool.dests[index]] = AttributeInterpolationHandle(type, index);
+}
+
+void Scene::RemoveInterpolation(const AttributeInterpolationHandle &handle)
+{
+    switch(handle.type)
     {
-        AttributeInterpolation& interp = interpolations_[i];
-        if (interp.dest.Get() == attr)
+    case cAttributeTransform:
+        RemoveFromPool(transformInterpolations_, handle.type, handle.index);
+        break;
+    case cAttributeFloat3:
+        RemoveFromPool(float3Interpolations_, handle.type, handle.index);
+        break;
+    case cAttributeQuat:
+        RemoveFromPool(quatInterpolations_, handle.type, handle.index);
+        break;
+    case cAttributeReal:
+        RemoveFromPool(floatInterpolations_, handle.type, handle.index);
+        break;
+    default:
+    {
+        // The start/end values are standalone clones, so they can be deleted even if the owner component has expired.
+        AttributeInterpolation& interp = interpolations_[handle.index];
+        interpolationLookup_.remove(interp.dest.attribute);
+        delete interp.start.attribute;
+        delete interp.end.attribute;
+        if (handle.index != interpolations_.size() - 1)
         {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-            return true;
+            interp = interpolations_.back();
+            interpolationLookup_[interp.dest.attribute] = AttributeInterpolationHandle(cAttributeNone, handle.index);
         }
+        interpolations_.pop_back();
+        break;
+    }
     }
-    return false;
+}
+
+bool Scene::EndAttributeInterpolation(IAttribute* attr)
+{
+    QHash<IAttribute *, AttributeInterpolationHandle>::const_iterator iter = interpolationLookup_.find(attr);
+    if (iter == interpolationLookup_.end())
+        return false;
+    // Copy the handle, as the lookup entry is removed along with the interpolation.
+    const AttributeInterpolationHandle handle = *iter;
+    RemoveInterpolation(handle);
+    return true;
 }
 
 void Scene::EndAllAttributeInterpolations()
@@ -1405,11 +1550,48 @@ void Scene::EndAllAttributeInterpolations()
     for(uint i = 0; i < interpolations_.size(); ++i)
     {
         AttributeInterpolation& interp = interpolations_[i];
-        delete interp.start.Get();
-        delete interp.end.Get();
+        delete interp.start.attribute;
+        delete interp.end.attribute;
     }
     
     interpolations_.clear();
+    transformInterpolations_.Clear();
+    float3Interpolations_.Clear();
+    quatInterpolations_.Clear();
+    floatInterpolations_.Clear();
+    interpolationLookup_.clear();
+}
+
+template<typename T>
+void Scene::UpdateInterpolationPool(AttributeInterpolationPool<T> &pool, u32 type, float frametime)
+{
+    if (pool.Size() == 0)
+        return;
+
+    // Advance the time of all interpolations. Allow an interpolation to persist for 2x time, though we are no longer setting the value.
+    // This is for the continuous/discontinuous update detection in StartAttributeInterpolation(). Negative factor marks such entries.
+    const size_t count = pool.Size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        const float time = pool.times[i];
+        const float length = pool.lengths[i];
+        const float t = (time + frametime) / length;
+        pool.factors[i] = time <= length ? (t > 1.0f ? 1.0f : t) : -1.0f;
+        pool.times[i] = time + frametime;
+    }
+
+    InterpolateValues(pool.starts, pool.ends, pool.factors, pool.values);
+
+    // Apply the new values only after all of them have been computed, so that the change notifications go out in one batch.
+    // Signal handlers may end or start interpolations, so re-check the size on every iteration.
+    for(size_t i = 0; i < pool.Size(); ++i)
+        if (pool.factors[i] >= 0.0f && !pool.owners[i].expired())
+            pool.dests[i]->Set(pool.values[i], AttributeChange::LocalOnly);
+
+    // Remove interpolations that are done or whose component has expired.
+    for(size_t i = pool.Size() - 1; i < pool.Size(); --i)
+        if (pool.owners[i].expired() || (pool.factors[i] < 0.0f && pool.times[i] >= pool.lengths[i] * 2.0f))
+            RemoveFromPool(pool, type, i);
 }
 
 void Scene::UpdateAttributeInterpolations(float frametime)
@@ -1417,6 +1599,11 @@ void Scene::UpdateAttributeInterpolations(float frametime)
     PROFILE(Scene_UpdateInterpolation);
     
     interpolating_ = true;
+
+    UpdateInterpolationPool(transformInterpolations_, cAttributeTransform, frametime);
+    UpdateInterpolationPool(float3Interpolations_, cAttributeFloat3, frametime);
+    UpdateInterpolationPool(quatInterpolations_, cAttributeQuat, frametime);
+    UpdateInterpolationPool(floatInterpolations_, cAttributeReal, frametime);
     
     for(size_t i = interpolations_.size() - 1; i < interpolations_.size(); --i)
     {
@@ -1448,11 +1635,7 @@ void Scene::UpdateAttributeInterpolations(float frametime)
         
         // Remove interpolation (& delete start/endpoints) when done
         if (finished)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-        }
+            RemoveInterpolation(AttributeInterpolationHandle(cAttributeNone, i));
     }
 
     interpolating_ = false;
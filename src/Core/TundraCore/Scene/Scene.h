@@ -9,11 +9,14 @@
 #include "EntityAction.h"
 #include "UniqueIdGenerator.h"
 #include "Math/float3.h"
+#include "Math/Quat.h"
+#include "Transform.h"
 #include "SceneDesc.h"
 #include "Entity.h"
 
 #include <QObject>
 #include <QVariant>
+#include <QHash>
 
 #include <map>
 
@@ -488,6 +491,98 @@ private:
         float length;
     };
 
+    /// Structure-of-arrays storage for ongoing interpolations of a single attribute type.
+    /** Used for the commonly interpolated attribute types (Transform, float3, Quat and float) so that the
+        start/end values are stored by value and the interpolation math can be run in tight loops,
+        without virtual calls or dynamic casts per attribute. */
+    template<typename T>
+    struct AttributeInterpolationPool
+    {
+        std::vector<ComponentWeakPtr> owners;
+        std::vector<Attribute<T> *> dests;
+        std::vector<T> starts;
+        std::vector<T> ends;
+        std::vector<T> values; ///< Interpolated values of the current frame.
+        std::vector<float> times;
+        std::vector<float> lengths;
+        std::vector<float> factors; ///< Interpolation factors of the current frame, negative if the value is not to be set.
+
+        size_t Size() const { return dests.size(); }
+
+        void Add(const ComponentPtr &owner, Attribute<T> *dest, const T &start, const T &end, float length)
+        {
+            owners.push_back(owner);
+            dests.push_back(dest);
+            starts.push_back(start);
+            ends.push_back(end);
+            values.push_back(start);
+            times.push_back(0.0f);
+            lengths.push_back(length);
+            factors.push_back(-1.0f);
+        }
+
+        /// Removes the interpolation at index by moving the last interpolation to its place.
+        void RemoveSwap(size_t index)
+        {
+            const size_t last = dests.size() - 1;
+            if (index != last)
+            {
+                owners[index] = owners[last];
+                dests[index] = dests[last];
+                starts[index] = starts[last];
+                ends[index] = ends[last];
+                values[index] = values[last];
+                times[index] = times[last];
+                lengths[index] = lengths[last];
+                factors[index] = factors[last];
+            }
+            owners.pop_back();
+            dests.pop_back();
+            starts.pop_back();
+            ends.pop_back();
+            values.pop_back();
+            times.pop_back();
+            lengths.pop_back();
+            factors.pop_back();
+        }
+
+        void Clear()
+        {
+            owners.clear();
+            dests.clear();
+            starts.clear();
+            ends.clear();
+            values.clear();
+            times.clear();
+            lengths.clear();
+            factors.clear();
+        }
+    };
+
+    /// Identifies the storage of an ongoing attribute interpolation.
+    struct AttributeInterpolationHandle
+    {
+        AttributeInterpolationHandle() : type(cAttributeNone), index(0) {}
+        AttributeInterpolationHandle(u32 type_, size_t index_) : type(type_), index(index_) {}
+        u32 type; ///< Attribute type ID of the pool holding the interpolation, or cAttributeNone for the generic storage.
+        size_t index; ///< Index into the pool.
+    };
+
+    /// Starts or restarts an interpolation in a typed pool. Takes ownership of endvalue.
+    template<typename T>
+    bool StartPooledInterpolation(AttributeInterpolationPool<T> &pool, u32 type, IComponent *comp, IAttribute *attr, IAttribute *endvalue, float length);
+
+    /// Advances the interpolations of a typed pool and applies the interpolated values to the attributes.
+    template<typename T>
+    void UpdateInterpolationPool(AttributeInterpolationPool<T> &pool, u32 type, float frametime);
+
+    /// Removes an interpolation from a typed pool and keeps the index lookup in sync.
+    template<typename T>
+    void RemoveFromPool(AttributeInterpolationPool<T> &pool, u32 type, size_t index);
+
+    /// Removes an interpolation from the storage and keeps the index lookup in sync.
+    void RemoveInterpolation(const AttributeInterpolationHandle &handle);
+
     UniqueIdGenerator idGenerator_; ///< Entity ID generator
     EntityMap entities_; ///< All entities in the scene.
     Framework *framework_; ///< Parent framework.
@@ -495,7 +590,12 @@ private:
     bool viewEnabled_; ///< View enabled -flag.
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
-    std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations of types that do not have a dedicated pool.
+    AttributeInterpolationPool<Transform> transformInterpolations_; ///< Running Transform attribute interpolations.
+    AttributeInterpolationPool<float3> float3Interpolations_; ///< Running float3 attribute interpolations.
+    AttributeInterpolationPool<Quat> quatInterpolations_; ///< Running Quat attribute interpolations.
+    AttributeInterpolationPool<float> floatInterpolations_; ///< Running float attribute interpolations.
+    QHash<IAttribute *, AttributeInterpolationHandle> interpolationLookup_; ///< Maps the interpolated attributes to their interpolation storage.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
 };
 
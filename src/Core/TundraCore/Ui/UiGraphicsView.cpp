@@ -13,6 +13,7 @@
 #include <QEvent>
 #include <QResizeEvent>
 #include <QGraphicsItem>
+#include <QGraphicsScene>
 #include <QMainWindow>
 #include <QMenuBar>
 
@@ -51,6 +52,7 @@ QImage *UiGraphicsView::BackBuffer() const
 void UiGraphicsView::MarkViewUndirty()
 {
     dirtyRectangle = QRectF(-1, -1, -1, -1);
+    dirtyRegion = QRegion();
 }
 
 bool UiGraphicsView::IsViewDirty() const
@@ -63,6 +65,21 @@ QRectF UiGraphicsView::DirtyRectangle() const
     return dirtyRectangle;
 }
 
+QRegion UiGraphicsView::DirtyRegion() const
+{
+    return dirtyRegion;
+}
+
+bool UiGraphicsView::HasVisibleItems() const
+{
+    if (!scene())
+        return false;
+    foreach(QGraphicsItem *item, scene()->items())
+        if (!item->parentItem() && item->isVisible())
+            return true;
+    return false;
+}
+
 void UiGraphicsView::drawBackground(QPainter *painter, const QRectF &rect)
 {
     // Default backgroudBrush for QGraphicsScene and QGraphicsView is NoBrush,
@@ -102,6 +119,7 @@ void UiGraphicsView::Resize(int newWidth, int newHeight)
         viewport()->setGeometry(0, 0, newWidth, newHeight);
         scene()->setSceneRect(viewport()->rect());
         dirtyRectangle = QRectF(0, 0, newWidth, newHeight);
+        dirtyRegion = QRegion(0, 0, newWidth, newHeight);
 
         delete backBuffer;
         backBuffer = new QImage(newWidth, newHeight, QImage::Format_ARGB32);
@@ -178,6 +196,7 @@ void UiGraphicsView::resizeEvent(QResizeEvent *e)
     viewport()->setGeometry(0, 0, width(), height());
     scene()->setSceneRect(viewport()->rect());          
     dirtyRectangle = QRectF(0, 0, width(), height());
+    dirtyRegion = QRegion(0, 0, width(), height());
 
     delete backBuffer;
     backBuffer = new QImage(newWidth, newHeight, QImage::Format_ARGB32);
@@ -196,7 +215,10 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
     // We received an unknown-sized scene change message. Mark everything dirty! (I've no idea what Qt
     // means when it sends a message saying 'nothing changed').
     if (rectangles.size() == 0)
+    {
         dirtyRectangle = QRectF(0, 0, width(), height());
+        dirtyRegion = QRegion(0, 0, width(), height());
+    }
 #endif
 
     if (!IsViewDirty() && rectangles.size() > 0)
@@ -204,6 +226,7 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
 
     // Include an extra guardband pixel to avoid graphical artifacts from occurring when redrawing.
     const int guardbandWidth = 5;
+    const QRect viewRect(0, 0, width(), height());
 
     for(int i = 0; i < rectangles.size(); ++i)
     {
@@ -211,6 +234,8 @@ void UiGraphicsView::HandleSceneChanged(const QList<QRectF> &rectangles)
         dirtyRectangle.setTop(min(dirtyRectangle.top(), rectangles[i].top()-guardbandWidth));
         dirtyRectangle.setRight(max(dirtyRectangle.right(), rectangles[i].right()+guardbandWidth));
         dirtyRectangle.setBottom(max(dirtyRectangle.bottom(), rectangles[i].bottom()+guardbandWidth));
+
+        dirtyRegion += rectangles[i].toAlignedRect().adjusted(-guardbandWidth, -guardbandWidth, guardbandWidth, guardbandWidth) & viewRect;
     }
     dirtyRectangle.setLeft(max<int>(dirtyRectangle.left(), 0));
     dirtyRectangle.setTop(max<int>(dirtyRectangle.top(), 0));
@@ -6,6 +6,7 @@
 #include "TundraCoreApi.h"
 
 #include <QGraphicsView>
+#include <QRegion>
 
 class QDropEvent;
 class QDragEnterEvent;
@@ -37,6 +38,12 @@ public:
     /// Returns the rectangle that represents the dirty area of the screen, pending a Qt repaint.
     QRectF DirtyRectangle() const;
 
+    /// Returns the dirty areas of the screen, pending a Qt repaint. Unlike DirtyRectangle(), this does not join the separate areas into one rectangle.
+    QRegion DirtyRegion() const;
+
+    /// Returns true if any of the top-level items in the UI scene is visible.
+    bool HasVisibleItems() const;
+
 public slots:
     /// Returns the topmost visible QGraphicsItem in the given application main window coordinates.
     QGraphicsItem *VisibleItemAtCoords(int x, int y) const;
@@ -73,6 +80,7 @@ private:
     Framework* framework;
     QImage *backBuffer;
     QRectF dirtyRectangle;
+    QRegion dirtyRegion;
 
     /// This virtual function is overridden from the QGraphicsView original to disable any background drawing functionality.
     /// The main QGraphicsView background displays the 3D scene rendered using Ogre.
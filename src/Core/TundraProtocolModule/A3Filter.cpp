@@ -9,12 +9,12 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
-A3Filter::A3Filter(InterestManager *im, int criticalrange, int maxrange, int updateinterval, bool enabled) :
+A3Filter::A3Filter(InterestManager *im, int criticalrange, int maxrange, bool enabled) :
     im_(im),
     MessageFilter(A3, enabled)
 {
     euclideandistance_ = new EuclideanDistanceFilter(im, criticalrange, true);
-    relevance_ = new RelevanceFilter(im, maxrange, criticalrange, updateinterval, true);
+    relevance_ = new RelevanceFilter(im, maxrange, criticalrange, true);
 }
 
 A3Filter::~A3Filter()
@@ -37,7 +37,7 @@ bool A3Filter::Filter(const IMParameters& params)
 
         if(params.dot <= 0)
         {
-            im_->UpdateRelevance(params.connection, params.changed_entity->Id(), 0);
+            im_->UpdateRelevance(0);
             return false;
         }
 
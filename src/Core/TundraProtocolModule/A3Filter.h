@@ -11,7 +11,7 @@ class A3Filter : public MessageFilter
 
 public:
 
-    A3Filter(InterestManager *im, int criticalrange, int maxrange, int updateinterval, bool enabled);
+    A3Filter(InterestManager *im, int criticalrange, int maxrange, bool enabled);
 
     ~A3Filter();
 
@@ -10,13 +10,13 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
-EA3Filter::EA3Filter(InterestManager *im, int criticalrange, int maxrange, int raycastinterval, int updateinterval, bool enabled) :
+EA3Filter::EA3Filter(InterestManager *im, int criticalrange, int maxrange, int raycastinterval, bool enabled) :
     im_(im),
     MessageFilter(EA3, enabled)
 {
     euclideandistance_ = new EuclideanDistanceFilter(im, criticalrange, true);
     rayvisibility_ = new RayVisibilityFilter(im, maxrange, raycastinterval, true);
-    relevance_ = new RelevanceFilter(im, maxrange, criticalrange, updateinterval, true);
+    relevance_ = new RelevanceFilter(im, maxrange, criticalrange, true);
 }
 
 EA3Filter::~EA3Filter()
@@ -41,7 +41,7 @@ bool EA3Filter::Filter(const IMParameters& params)
         if(params.dot <= 0) //If the entity is behind the client
         {
             im_->UpdateEntityVisibility(params.connection, params.changed_entity->Id(), false);
-            im_->UpdateRelevance(params.connection, params.changed_entity->Id(), 0);
+            im_->UpdateRelevance(0);
             return false;
         }
 
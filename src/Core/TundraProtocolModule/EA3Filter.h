@@ -11,7 +11,7 @@ class EA3Filter : public MessageFilter
 
 public:
 
-    EA3Filter(InterestManager *im, int criticalrange, int maxrange, int raycastinterval, int updateinterval, bool enabled);
+    EA3Filter(InterestManager *im, int criticalrange, int maxrange, int raycastinterval, bool enabled);
 
     ~EA3Filter();
 
@@ -9,11 +9,27 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
+#include <algorithm>
+
 InterestManager* InterestManager::thisPointer_ = NULL;
 
+namespace
+{
+
+/// Default interval in milliseconds at which the changes of the least relevant entities are sent.
+const int cDefaultFarUpdateInterval = 2000;
+/// Entities with a relevance factor of at least this are updated in the mid tier.
+const float cMidTierRelevance = 0.5f;
+/// The mid tier entities are updated this many times as often as the far tier entities.
+const int cMidTierRateMultiplier = 4;
+
+}
+
 InterestManager::InterestManager()
 {
     activeFilter_ = 0;
+    relevance_ = 1.f;
+    farUpdateInterval_ = 0;
     timer_ = new QTime();
     timer_->start();
 }
@@ -45,21 +61,26 @@ int InterestManager::ElapsedTime()
     return timer_->elapsed();
 }
 
-bool InterestManager::CheckRelevance(UserConnectionPtr conn, Entity* changed_entity, SceneWeakPtr scene_, bool headless)
+void InterestManager::SetFarUpdateInterval(int msecs)
+{
+    farUpdateInterval_ = msecs;
+}
+
+int InterestManager::UpdateInterval(UserConnectionPtr conn, Entity* changed_entity, SceneWeakPtr scene_, bool headless, float updatePeriod)
 {
     PROFILE(Interest_Management);
 
     ScenePtr scene = scene_.lock();
 
     if (!scene)
-        return true;
+        return 1;
 
     EC_Placeable *entity_location = changed_entity->GetComponent<EC_Placeable>().get();
 
-    if(!conn->syncState->locationInitialized || !entity_location) //If the client hasn't informed the server about the orientation yet, do not proceed
-        return true;
+    if(!conn->syncState->locationInitialized || !entity_location) //If the client hasn't informed the server about the orientation yet, update every tick
+        return 1;
 
-    bool accepted = false;  //By default, we assume that the update will be rejected
+    bool accepted = true;
 
     Quat client_orientation = conn->syncState->clientOrientation.Normalized();
 
@@ -78,21 +99,27 @@ bool InterestManager::CheckRelevance(UserConnectionPtr conn, Entity* changed_ent
     params_.connection = conn;
     params_.relAccepted = false;
 
+    relevance_ = 1.f; //Entities accepted without a relevance factor, such as those in the critical range, are fully relevant
     if(activeFilter_ != 0)
         accepted = activeFilter_->Filter(params_);
 
-    if(accepted)
-        UpdateLastUpdatedEntity(params_.connection, params_.changed_entity->Id());
-    return accepted;
+    //Rejected entities are not dropped, but updated at the far rate, so that the client eventually gets their latest state
+    int farInterval = farUpdateInterval_ > 0 ? farUpdateInterval_ : cDefaultFarUpdateInterval;
+    int farTicks = (int)(farInterval * 0.001f / updatePeriod + 0.5f);
+    if(farTicks > SceneSyncState::cMaxUpdateInterval)
+        farTicks = SceneSyncState::cMaxUpdateInterval;
+
+    if(accepted && relevance_ >= 1.f)
+        return 1;
+    else if(accepted && relevance_ >= cMidTierRelevance)
+        return std::max(1, farTicks / cMidTierRateMultiplier);
+    else
+        return farTicks;
 }
 
-void InterestManager::UpdateRelevance(UserConnectionPtr conn, entity_id_t id, float relevance)
+void InterestManager::UpdateRelevance(float relevance)
 {
-    std::map<entity_id_t, float>::iterator it = conn->syncState->relevanceFactors.find(id);
-    if(it == conn->syncState->relevanceFactors.end()) //Theres no entry with this entity_id
-        conn->syncState->relevanceFactors.insert(std::make_pair(id, relevance));
-    else
-        it->second = relevance;
+    relevance_ = relevance;
 }
 
 void InterestManager::UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t id, bool visible)
@@ -104,24 +131,6 @@ void InterestManager::UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t
         it->second = visible;
 }
 
-void InterestManager::UpdateLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
-{
-    std::map<entity_id_t, float>::iterator it = conn->syncState->lastUpdatedEntitys_.find(id);
-    if(it == conn->syncState->lastUpdatedEntitys_.end())
-        conn->syncState->lastUpdatedEntitys_.insert(std::make_pair(id, (float)ElapsedTime()));
-    else
-        it->second = (float)ElapsedTime();
-}
-
-float InterestManager::FindLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
-{
-    std::map<entity_id_t, float>::iterator it = conn->syncState->lastUpdatedEntitys_.find(id);
-    if(it == conn->syncState->lastUpdatedEntitys_.end())
-        return 0;
-    else
-        return it->second;
-}
-
 void InterestManager::UpdateLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id)
 {
     std::map<entity_id_t, float>::iterator it = conn->syncState->lastRaycastedEntitys_.find(id);
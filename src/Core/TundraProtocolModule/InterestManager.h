@@ -28,26 +28,27 @@ public:
     void AssignFilter(MessageFilter *filter);
 
     /// Main entrance method for the filtering process
-    bool CheckRelevance(UserConnectionPtr userconnection, Entity* changed_entity, SceneWeakPtr scene, bool headless);
+    /** Returns the number of sync ticks between updates of the changed entity to the client. Entities within the critical range
+        are updated every tick, entities with relevance factor of at least 0.5 every few ticks, and the rest at the far update
+        interval. The changes in between are coalesced to one update.
+        @param updatePeriod The SyncManager update period in seconds. */
+    int UpdateInterval(UserConnectionPtr userconnection, Entity* changed_entity, SceneWeakPtr scene, bool headless, float updatePeriod);
+
+    /// Sets the interval in milliseconds at which the changes of the least relevant entities are sent. 0 uses the default of 2000 ms.
+    void SetFarUpdateInterval(int msecs);
 
     /// Returns the current active filtering time in milliseconds
     int ElapsedTime();
 
-    /// Update the relevance factor of a specific entity for future inspection
-    void UpdateRelevance(UserConnectionPtr conn, entity_id_t id, float relevance);
+    /// Reports the relevance factor of the entity that is being filtered. Called by the filters.
+    void UpdateRelevance(float relevance);
 
     /// Updates a specific map which contains a list of entities and their visibilities. (client specific map)
     void UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t id, bool visible);
 
-    /// Updates a map that contains the timestamps that describe when a specific entity was last updated
-    void UpdateLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id);
-
     /// Updates a map that contains the timestamps that describe when a specific entity was last raycasted
     void UpdateLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id);
 
-    /// Utility method for checking when a specific entity has been updated
-    float FindLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id);
-
     /// Utility method for checking when a specific entity has been raycasted
     float FindLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id);
 
@@ -67,4 +68,10 @@ private:
 
     /// Parameters used by the filtering process
     IMParameters params_;
+
+    /// Relevance factor of the entity that is being filtered, as reported by the filters
+    float relevance_;
+
+    /// Interval in milliseconds at which the changes of the least relevant entities are sent
+    int farUpdateInterval_;
 };
@@ -12,11 +12,13 @@
 #include "ConsoleAPI.h"
 #include "LoggingFunctions.h"
 #include "CoreException.h"
+#include "Framework.h"
 
 #include <kNet.h>
 #include <kNet/UDPMessageConnection.h>
 
 #include <algorithm>
+#include <map>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
@@ -82,18 +84,40 @@ namespace
     /// The number of different port choices to try from the list.
     const int cNumPortChoices = sizeof(destinationPorts) / sizeof(destinationPorts[0]);
 */
+
+/// Time spent in the handlers of one message ID during a replay.
+struct ReplayMessageStats
+{
+    ReplayMessageStats() : count(0), bytes(0), ticks(0) {}
+    u32 count;
+    u64 bytes;
+    tick_t ticks;
+};
+
 }
 
 static const int cInitialAttempts = 1;
 static const int cReconnectAttempts = 5;
 
+/// Default time in milliseconds the server may spend per frame handling client messages.
+static const int cDefaultInboundBudget = 10;
+/// Default number of unhandled messages after which a client is disconnected.
+static const int cDefaultMaxInboundQueue = 10000;
+
+/// Port of the closed UDP connections that stand in for the replayed clients. Nothing is ever sent to it.
+static const unsigned short cReplayDiscardPort = 9;
+
 KristalliProtocolModule::KristalliProtocolModule() :
     IModule("KristalliProtocol"),
     serverConnection(0),
     server(0),
     reconnectAttempts(0),
     connectionPending(false),
-    serverPort(0)
+    serverPort(0),
+    inboundBudget(cDefaultInboundBudget / 1000.0),
+    defaultInboundMessageRate(0),
+    maxInboundQueueLength(cDefaultMaxInboundQueue),
+    nextInboundUser(0)
 #ifdef KNET_USE_QT
     ,networkDialog(0)
 #endif
@@ -116,6 +140,7 @@ void KristalliProtocolModule::Load()
 void KristalliProtocolModule::Unload()
 {
     Disconnect();
+    recorder.Close();
 }
 
 void KristalliProtocolModule::Initialize()
@@ -128,14 +153,59 @@ void KristalliProtocolModule::Initialize()
         if (transportLayer != InvalidTransportLayer)
             defaultTransport = transportLayer;
     }
+
+    bool ok = false;
+    cmdLineParams = framework_->CommandLineParameters("--inboundBudget");
+    if (cmdLineParams.size() > 0)
+    {
+        double budget = cmdLineParams.first().toDouble(&ok);
+        if (ok && budget >= 0.0)
+            inboundBudget = budget / 1000.0;
+        else
+            ::LogError("--inboundBudget expects a non-negative number of milliseconds.");
+    }
+    cmdLineParams = framework_->CommandLineParameters("--clientMessageRate");
+    if (cmdLineParams.size() > 0)
+    {
+        int rate = cmdLineParams.first().toInt(&ok);
+        if (ok && rate >= 0)
+            defaultInboundMessageRate = rate;
+        else
+            ::LogError("--clientMessageRate expects a non-negative number of messages per second.");
+    }
+    cmdLineParams = framework_->CommandLineParameters("--maxInboundQueue");
+    if (cmdLineParams.size() > 0)
+    {
+        int length = cmdLineParams.first().toInt(&ok);
+        if (ok && length > 0)
+            maxInboundQueueLength = length;
+        else
+            ::LogError("--maxInboundQueue expects a positive number of messages.");
+    }
+
+    cmdLineParams = framework_->CommandLineParameters("--recordNetwork");
+    if (cmdLineParams.size() > 0)
+        recorder.Open(cmdLineParams.first());
+    cmdLineParams = framework_->CommandLineParameters("--replayNetwork");
+    if (cmdLineParams.size() > 0)
+    {
+        replay = MAKE_SHARED(NetworkMessageRecording);
+        if (!replay->Load(cmdLineParams.first()))
+            replay.reset();
+        else if (!framework_->HasCommandLineParameter("--server"))
+            ::LogWarning("--replayNetwork given without --server. The recording is replayed when a server is started.");
+    }
+
 #ifdef KNET_USE_QT
     framework_->Console()->RegisterCommand("kNet", "Shows the kNet statistics window.", this, SLOT(OpenKNetLogWindow()));
 #endif
+    framework_->Console()->RegisterCommand("inboundStats", "Prints the inbound message statistics of the connected clients.", this, SLOT(PrintInboundStats()));
 }
 
 void KristalliProtocolModule::Uninitialize()
 {
     Disconnect();
+    recorder.Close();
 }
 
 void KristalliProtocolModule::OpenKNetLogWindow()
@@ -152,7 +222,24 @@ void KristalliProtocolModule::OpenKNetLogWindow()
 #endif
 }
 
-void KristalliProtocolModule::Update(f64 /*frametime*/)
+void KristalliProtocolModule::PrintInboundStats()
+{
+    if (!server)
+    {
+        ::LogInfo("inboundStats: Not running a server.");
+        return;
+    }
+    ::LogInfo("  Connection   Received    Handled   Pending   Peak pending   Pending bytes   Rate limit");
+    for(UserConnectionList::const_iterator iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        const UserConnection &user = **iter;
+        ::LogInfo(QString("  %1 %2 %3 %4 %5 %6 %7").arg(user.userID, 10).arg((qulonglong)user.numMessagesReceived, 10)
+            .arg((qulonglong)user.numMessagesHandled, 10).arg((qulonglong)user.inboundQueue.size(), 9).arg((qulonglong)user.peakInboundQueueLength, 14)
+            .arg((qulonglong)user.inboundQueueBytes, 15).arg(user.inboundMessageRate > 0 ? QString::number(user.inboundMessageRate) + "/s" : QString("none"), 12));
+    }
+}
+
+void KristalliProtocolModule::Update(f64 frametime)
 {
     // Pulls all new inbound network messages and calls the message handler we've registered
     // for each of them.
@@ -178,6 +265,8 @@ void KristalliProtocolModule::Update(f64 /*frametime*/)
 
         server->Process();
 
+        ProcessInboundMessages(frametime);
+
         // In Tundra, we *never* keep half-open server->client connections alive. 
         // (the usual case would be to wait for a file transfer to complete, but Tundra messaging mechanism doesn't use that).
         // So, bidirectionally close all half-open connections.
@@ -214,6 +303,9 @@ void KristalliProtocolModule::Update(f64 /*frametime*/)
     // If connection was made, enable a larger number of reconnection attempts in case it gets lost
     if (serverConnection && serverConnection->GetConnectionState() == ConnectionOK)
         reconnectAttempts = cReconnectAttempts;
+
+    if (replay && server)
+        Replay();
 }
 
 void KristalliProtocolModule::Connect(const char *ip, unsigned short port, SocketTransportLayer transport)
@@ -315,6 +407,7 @@ void KristalliProtocolModule::NewConnectionEstablished(kNet::MessageConnection *
     UserConnectionPtr connection = MAKE_SHARED(UserConnection);
     connection->userID = AllocateNewConnectionID();
     connection->connection = source;
+    connection->SetInboundMessageRate(defaultInboundMessageRate);
     connections.push_back(connection);
 
     // For TCP mode sockets, set the TCP_NODELAY option to improve latency for the messages we send.
@@ -323,6 +416,9 @@ void KristalliProtocolModule::NewConnectionEstablished(kNet::MessageConnection *
 
     ::LogInfo(QString("User connected from %1, connection ID %2.").arg(source->RemoteEndPoint().ToString().c_str()).arg(connection->userID));
 
+    if (recorder.IsOpen())
+        recorder.RecordConnected(connection->userID);
+
     emit ClientConnectedEvent(connection.get());
 }
 
@@ -332,6 +428,9 @@ void KristalliProtocolModule::ClientDisconnected(MessageConnection *source)
     for(UserConnectionList::iterator iter = connections.begin(); iter != connections.end(); ++iter)
         if ((*iter)->connection == source)
         {
+            if (recorder.IsOpen())
+                recorder.RecordDisconnected((*iter)->userID);
+
             emit ClientDisconnectedEvent(iter->get());
             
             ::LogInfo("User disconnected, connection ID " + QString::number((*iter)->userID));
@@ -347,6 +446,112 @@ void KristalliProtocolModule::HandleMessage(kNet::MessageConnection *source, kNe
     assert(source);
     assert(data || numBytes == 0);
 
+    UserConnectionPtr user;
+    if (server || recorder.IsOpen())
+        user = GetUserConnection(source);
+
+    if (recorder.IsOpen())
+        recorder.RecordMessage(user ? user->userID : 0, packetId, messageId, data, numBytes);
+
+    // On the server, the messages of the clients are handled in turns within the frame budget, so that a client that bursts
+    // messages cannot stall the server.
+    if (user)
+        QueueInboundMessage(user.get(), packetId, messageId, data, numBytes);
+    else
+        DispatchMessage(source, packetId, messageId, data, numBytes);
+}
+
+void KristalliProtocolModule::QueueInboundMessage(UserConnection *user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    ++user->numMessagesReceived;
+    if (user->inboundQueue.size() >= maxInboundQueueLength)
+    {
+        // Handling the messages of this client cannot keep up with the client sending them. Disconnect the client rather than
+        // grow the queue without bounds, and discard its unhandled messages.
+        if (user->connection->GetConnectionState() != kNet::ConnectionClosed)
+        {
+            ::LogWarning("KristalliProtocolModule: Client " + QString::number(user->userID) + " has " + QString::number(user->inboundQueue.size()) +
+                " unhandled messages, disconnecting it.");
+            user->connection->Disconnect(0);
+            user->connection->Close(0);
+        }
+        user->inboundQueue.clear();
+        user->inboundQueueBytes = 0;
+        return;
+    }
+
+    user->inboundQueue.push_back(UserConnection::InboundMessage());
+    UserConnection::InboundMessage &message = user->inboundQueue.back();
+    message.packetId = packetId;
+    message.messageId = messageId;
+    message.data.assign(data, data + numBytes);
+    user->inboundQueueBytes += numBytes;
+    user->peakInboundQueueLength = std::max(user->peakInboundQueueLength, user->inboundQueue.size());
+}
+
+void KristalliProtocolModule::ProcessInboundMessages(f64 frametime)
+{
+    PROFILE(KristalliProtocolModule_ProcessInboundMessages);
+
+    inboundUsers.clear();
+    for(UserConnectionList::iterator iter = connections.begin(); iter != connections.end(); ++iter)
+    {
+        UserConnection &user = **iter;
+        if (user.inboundMessageRate > 0)
+            user.inboundAllowance = std::min(user.inboundAllowance + (float)(user.inboundMessageRate * frametime), (float)user.inboundMessageRate);
+        if (!user.inboundQueue.empty())
+            inboundUsers.push_back(*iter);
+    }
+    if (inboundUsers.empty())
+        return;
+
+    // Handle one message of each client in turn, so that a client with a long queue does not delay the others. The turns start
+    // from a different client on each frame, so that the same clients are not always the ones left waiting when the budget runs out.
+    const tick_t deadline = GetCurrentClockTime() + (tick_t)(inboundBudget * GetCurrentClockFreq());
+    const size_t first = nextInboundUser++ % inboundUsers.size();
+    std::vector<char> data;
+    bool handledAny = true;
+    while(handledAny)
+    {
+        handledAny = false;
+        for(size_t i = 0; i < inboundUsers.size(); ++i)
+        {
+            UserConnection &user = *inboundUsers[(first + i) % inboundUsers.size()];
+            if (user.inboundQueue.empty() || (user.inboundMessageRate > 0 && user.inboundAllowance < 1.f))
+                continue;
+            if (user.connection->GetConnectionState() == kNet::ConnectionClosed)
+            {
+                // A previous message of this client failed and the connection was closed. Discard the rest.
+                user.inboundQueue.clear();
+                user.inboundQueueBytes = 0;
+                continue;
+            }
+
+            UserConnection::InboundMessage &message = user.inboundQueue.front();
+            const kNet::packet_id_t packetId = message.packetId;
+            const kNet::message_id_t messageId = message.messageId;
+            data.swap(message.data);
+            user.inboundQueue.pop_front();
+            user.inboundQueueBytes -= data.size();
+            if (user.inboundMessageRate > 0)
+                user.inboundAllowance -= 1.f;
+            ++user.numMessagesHandled;
+
+            DispatchMessage(user.connection.ptr(), packetId, messageId, data.empty() ? 0 : &data[0], data.size());
+            handledAny = true;
+
+            if (inboundBudget > 0.0 && GetCurrentClockTime() >= deadline)
+            {
+                inboundUsers.clear();
+                return;
+            }
+        }
+    }
+    inboundUsers.clear();
+}
+
+void KristalliProtocolModule::DispatchMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
     try
     {
         emit NetworkMessageReceived(source, packetId, messageId, data, numBytes);
@@ -365,6 +570,87 @@ void KristalliProtocolModule::HandleMessage(kNet::MessageConnection *source, kNe
     }
 }
 
+void KristalliProtocolModule::Replay()
+{
+    PROFILE(KristalliProtocolModule_Replay);
+
+    shared_ptr<NetworkMessageRecording> recording = replay;
+    replay.reset();
+    ::LogInfo("Replaying " + QString::number(recording->Records().size()) + " network records.");
+
+    std::map<kNet::message_id_t, ReplayMessageStats> stats;
+    std::map<u32, UserConnectionPtr> replayUsers; // Recorded connection ID -> replayed user.
+
+    const tick_t replayStart = GetCurrentClockTime();
+    const std::vector<NetworkMessageRecording::Record> &records = recording->Records();
+    for(size_t i = 0; i < records.size(); ++i)
+    {
+        const NetworkMessageRecording::Record &record = records[i];
+        if (record.type == NetworkRecordConnected)
+        {
+            UserConnectionPtr connection = MAKE_SHARED(UserConnection);
+            connection->userID = AllocateNewConnectionID();
+            connection->connection = CreateReplayConnection();
+            if (!connection->connection)
+            {
+                ::LogError("KristalliProtocolModule: Failed to create a connection for a replayed client, aborting the replay.");
+                break;
+            }
+            connections.push_back(connection);
+            replayUsers[record.connectionId] = connection;
+            emit ClientConnectedEvent(connection.get());
+        }
+        else if (record.type == NetworkRecordDisconnected)
+        {
+            std::map<u32, UserConnectionPtr>::iterator user = replayUsers.find(record.connectionId);
+            if (user != replayUsers.end())
+            {
+                ClientDisconnected(user->second->connection.ptr());
+                replayUsers.erase(user);
+            }
+        }
+        else
+        {
+            std::map<u32, UserConnectionPtr>::iterator user = replayUsers.find(record.connectionId);
+            if (user == replayUsers.end())
+                continue; // The client connected before the recording was started.
+
+            const tick_t start = GetCurrentClockTime();
+            DispatchMessage(user->second->connection.ptr(), record.packetId, record.messageId, recording->Data(record), record.numBytes);
+            ReplayMessageStats &messageStats = stats[record.messageId];
+            messageStats.ticks += GetCurrentClockTime() - start;
+            ++messageStats.count;
+            messageStats.bytes += record.numBytes;
+        }
+    }
+    const f64 replayTime = (f64)(GetCurrentClockTime() - replayStart) / (f64)GetCurrentClockFreq();
+
+    // Disconnect the clients that were still connected at the end of the recording.
+    for(std::map<u32, UserConnectionPtr>::iterator iter = replayUsers.begin(); iter != replayUsers.end(); ++iter)
+        ClientDisconnected(iter->second->connection.ptr());
+
+    ::LogInfo(QString("Replayed %1 records in %2 seconds. Time spent in the message handlers:").arg(records.size()).arg(replayTime, 0, 'f', 3));
+    ::LogInfo("  Message ID      Count        Bytes   Total ms   Avg usecs");
+    for(std::map<kNet::message_id_t, ReplayMessageStats>::const_iterator iter = stats.begin(); iter != stats.end(); ++iter)
+    {
+        const f64 totalMs = (f64)iter->second.ticks * 1000.0 / (f64)GetCurrentClockFreq();
+        ::LogInfo(QString("  %1 %2 %3 %4 %5").arg(iter->first, 10).arg(iter->second.count, 10).arg((qulonglong)iter->second.bytes, 12)
+            .arg(totalMs, 10, 'f', 2).arg(totalMs * 1000.0 / iter->second.count, 11, 'f', 2));
+    }
+
+    framework_->Exit();
+}
+
+Ptr(kNet::MessageConnection) KristalliProtocolModule::CreateReplayConnection()
+{
+    // The handlers look up the clients by their kNet connections and send their replies to them, so each replayed client
+    // needs a connection object of its own. A closed connection discards everything queued to it without touching the network.
+    Ptr(kNet::MessageConnection) connection = network.Connect("127.0.0.1", cReplayDiscardPort, kNet::SocketOverUDP, 0);
+    if (connection)
+        connection->Close(0);
+    return connection;
+}
+
 u32 KristalliProtocolModule::AllocateNewConnectionID() const
 {
     u32 newID = 1;
@@ -5,6 +5,7 @@
 #include "IModule.h"
 #include "TundraProtocolModuleApi.h"
 #include "UserConnection.h"
+#include "NetworkMessageRecording.h"
 
 #include <kNet/IMessageHandler.h>
 #include <kNet/INetworkServerListener.h>
@@ -65,6 +66,9 @@ public:
 
     /// Return whether we are a server
     bool IsServer() const { return server != 0; }
+
+    /// Returns whether a network message recording is being replayed.
+    bool IsReplaying() const { return replay.get() != 0; }
     
     /// Returns all user connections for a server
     UserConnectionList& GetUserConnections() { return connections; }
@@ -79,6 +83,9 @@ public:
 public slots:
     void OpenKNetLogWindow();
 
+    /// Prints the inbound message statistics of the connected clients.
+    void PrintInboundStats();
+
 signals:
     /// Triggered whenever a new message is received rom the network.
     void NetworkMessageReceived(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
@@ -103,6 +110,22 @@ private:
 
     /// Allocate a  connection ID for new connection
     u32 AllocateNewConnectionID() const;
+
+    /// Appends a message received from a client to its inbound queue. Disconnects the client if the queue is full.
+    void QueueInboundMessage(UserConnection *user, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+    /// Handles the queued messages of the clients in round-robin order until the queues are empty or the frame budget is spent.
+    void ProcessInboundMessages(f64 frametime);
+
+    /// Emits NetworkMessageReceived for a message, and disconnects the source if handling the message throws.
+    void DispatchMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+    /// Feeds the recording given with --replayNetwork to the message handlers as fast as possible, prints the time spent in the
+    /// handlers per message ID and exits. Called on the first frame the server is running.
+    void Replay();
+
+    /// Returns a connection for a replayed client, that is closed so that all messages sent to it are discarded.
+    Ptr(kNet::MessageConnection) CreateReplayConnection();
     
     /// If true, the connection attempt we've started has not yet been established, but is waiting
     /// for a transition to OK state. When this happens, the MsgLogin message is sent.
@@ -122,6 +145,22 @@ private:
     
     /// Users that are connected to server
     UserConnectionList connections;
+
+    /// Time in seconds the server may spend per frame handling the messages of the clients, 0 for no limit. Read from "--inboundBudget".
+    f64 inboundBudget;
+    /// Messages per second handled from a newly connected client, 0 for no limit. Read from "--clientMessageRate".
+    int defaultInboundMessageRate;
+    /// Number of unhandled messages after which a client is disconnected. Read from "--maxInboundQueue".
+    size_t maxInboundQueueLength;
+    /// The client whose messages are handled first on the next frame.
+    size_t nextInboundUser;
+    /// The clients with queued messages on the current frame.
+    std::vector<UserConnectionPtr> inboundUsers;
+
+    /// Records the received messages when started with --recordNetwork.
+    NetworkMessageRecorder recorder;
+    /// The recording to replay when started with --replayNetwork. Null when not replaying.
+    shared_ptr<NetworkMessageRecording> replay;
 #ifdef KNET_USE_QT
     QPointer<kNet::NetworkDialog> networkDialog;
 #endif
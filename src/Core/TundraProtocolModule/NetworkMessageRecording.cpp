@@ -0,0 +1,178 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "NetworkMessageRecording.h"
+
+#include "LoggingFunctions.h"
+
+#include <kNet.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+const char cRecordingMagic[4] = { 'T', 'N', 'R', 'C' };
+const u8 cRecordingVersion = 1;
+const size_t cHeaderSize = sizeof(cRecordingMagic) + 1;
+
+/// Largest time delta that fits to a VLE8_16_32.
+const u32 cMaxTimeDelta = (1 << 30) - 1;
+
+/// Maximum size of a record without its payload.
+const size_t cMaxRecordHeaderSize = 32;
+
+}
+
+NetworkMessageRecorder::NetworkMessageRecorder() :
+    lastRecordTime_(0)
+{
+}
+
+NetworkMessageRecorder::~NetworkMessageRecorder()
+{
+    Close();
+}
+
+bool NetworkMessageRecorder::Open(const QString &filename)
+{
+    Close();
+    file_.setFileName(filename);
+    if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("NetworkMessageRecorder: Failed to open " + filename + " for writing.");
+        return false;
+    }
+    file_.write(cRecordingMagic, sizeof(cRecordingMagic));
+    file_.write((const char*)&cRecordingVersion, 1);
+    lastRecordTime_ = GetCurrentClockTime();
+    LogInfo("Recording network messages to " + filename);
+    return true;
+}
+
+void NetworkMessageRecorder::Close()
+{
+    if (file_.isOpen())
+        file_.close();
+}
+
+void NetworkMessageRecorder::RecordConnected(u32 connectionId)
+{
+    WriteRecord(NetworkRecordConnected, connectionId, 0, 0, 0, 0);
+}
+
+void NetworkMessageRecorder::RecordDisconnected(u32 connectionId)
+{
+    WriteRecord(NetworkRecordDisconnected, connectionId, 0, 0, 0, 0);
+    file_.flush(); // Keep the recording complete up to the last disconnect, in case the server is killed.
+}
+
+void NetworkMessageRecorder::RecordMessage(u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    WriteRecord(NetworkRecordMessage, connectionId, packetId, messageId, data, numBytes);
+}
+
+void NetworkMessageRecorder::WriteRecord(NetworkRecordType type, u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes)
+{
+    if (!file_.isOpen())
+        return;
+
+    const tick_t now = GetCurrentClockTime();
+    const f64 delta = (f64)(now - lastRecordTime_) * 1000000.0 / (f64)GetCurrentClockFreq();
+    lastRecordTime_ = now;
+
+    if (buffer_.size() < numBytes + cMaxRecordHeaderSize)
+        buffer_.resize(numBytes + cMaxRecordHeaderSize);
+    kNet::DataSerializer ds(&buffer_[0], buffer_.size());
+    ds.Add<u8>((u8)type);
+    ds.AddVLE<kNet::VLE8_16_32>(connectionId);
+    ds.AddVLE<kNet::VLE8_16_32>((u32)std::min<f64>(delta, (f64)cMaxTimeDelta));
+    if (type == NetworkRecordMessage)
+    {
+        ds.Add<u32>(packetId);
+        ds.AddVLE<kNet::VLE8_16_32>(messageId);
+        ds.AddVLE<kNet::VLE8_16_32>((u32)numBytes);
+        if (numBytes > 0)
+            ds.AddArray<u8>((const u8*)data, (u32)numBytes);
+    }
+    file_.write(&buffer_[0], ds.BytesFilled());
+}
+
+bool NetworkMessageRecording::Load(const QString &filename)
+{
+    records_.clear();
+    payloads_.clear();
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        LogError("NetworkMessageRecording: Failed to open " + filename + " for reading.");
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    if ((size_t)data.size() < cHeaderSize || memcmp(data.constData(), cRecordingMagic, sizeof(cRecordingMagic)) != 0)
+    {
+        LogError("NetworkMessageRecording: " + filename + " is not a network message recording.");
+        return false;
+    }
+    if ((u8)data[(int)sizeof(cRecordingMagic)] != cRecordingVersion)
+    {
+        LogError("NetworkMessageRecording: " + filename + " has unsupported version " + QString::number((u8)data[(int)sizeof(cRecordingMagic)]) + ".");
+        return false;
+    }
+
+    // The payloads take at most as much space as the file.
+    payloads_.resize(data.size());
+    size_t payloadBytes = 0;
+    f64 time = 0.0;
+
+    kNet::DataDeserializer dd(data.constData() + cHeaderSize, data.size() - cHeaderSize);
+    try
+    {
+        while(dd.BitsLeft() >= 8)
+        {
+            Record record;
+            record.type = (NetworkRecordType)dd.Read<u8>();
+            record.connectionId = dd.ReadVLE<kNet::VLE8_16_32>();
+            time += dd.ReadVLE<kNet::VLE8_16_32>() / 1000000.0;
+            record.time = time;
+            record.packetId = 0;
+            record.messageId = 0;
+            record.dataOffset = payloadBytes;
+            record.numBytes = 0;
+            if (record.type == NetworkRecordMessage)
+            {
+                record.packetId = dd.Read<u32>();
+                record.messageId = dd.ReadVLE<kNet::VLE8_16_32>();
+                record.numBytes = dd.ReadVLE<kNet::VLE8_16_32>();
+                if (record.numBytes > payloads_.size() - payloadBytes)
+                {
+                    LogWarning("NetworkMessageRecording: " + filename + " ends with a truncated record, ignoring it.");
+                    break;
+                }
+                if (record.numBytes > 0)
+                    dd.ReadArray<u8>((u8*)&payloads_[payloadBytes], (u32)record.numBytes);
+                payloadBytes += record.numBytes;
+            }
+            else if (record.type != NetworkRecordConnected && record.type != NetworkRecordDisconnected)
+            {
+                LogError("NetworkMessageRecording: Unknown record type " + QString::number(record.type) + " in " + filename + ", ignoring the rest of the recording.");
+                break;
+            }
+            records_.push_back(record);
+        }
+    }
+    catch(kNet::NetException &/*e*/)
+    {
+        LogWarning("NetworkMessageRecording: " + filename + " ends with a truncated record, ignoring it.");
+    }
+    payloads_.resize(payloadBytes);
+
+    LogInfo("Loaded " + QString::number(records_.size()) + " records spanning " + QString::number(time, 'f', 1) + " seconds from " + filename);
+    return true;
+}
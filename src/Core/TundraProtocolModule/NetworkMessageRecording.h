@@ -0,0 +1,83 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <kNet/Types.h>
+
+#include <QFile>
+#include <QString>
+
+#include <vector>
+
+/// Type of a record in a network message recording.
+enum NetworkRecordType
+{
+    NetworkRecordConnected = 0, ///< A client connected.
+    NetworkRecordDisconnected, ///< A client disconnected.
+    NetworkRecordMessage ///< A message was received from a client.
+};
+
+/// Writes the connection events and the messages received by KristalliProtocolModule to a binary file.
+/** The file starts with a header of the magic "TNRC" and a version byte. Each record is a type byte, the connection ID as a VLE,
+    the time since the previous record in microseconds as a VLE, and for messages the packet ID, the message ID as a VLE,
+    the payload size as a VLE and the payload. The records are written as they arrive, so a recording of a crashed server is
+    readable up to the last complete record. */
+class NetworkMessageRecorder
+{
+public:
+    NetworkMessageRecorder();
+    ~NetworkMessageRecorder();
+
+    /// Creates the recording file. Returns false if the file could not be opened for writing.
+    bool Open(const QString &filename);
+
+    /// Flushes and closes the recording file.
+    void Close();
+
+    bool IsOpen() const { return file_.isOpen(); }
+
+    void RecordConnected(u32 connectionId);
+    void RecordDisconnected(u32 connectionId);
+    void RecordMessage(u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+private:
+    /// Writes a record without payload, or the header of a message record.
+    void WriteRecord(NetworkRecordType type, u32 connectionId, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char *data, size_t numBytes);
+
+    QFile file_;
+    tick_t lastRecordTime_;
+    std::vector<char> buffer_;
+};
+
+/// A network message recording loaded to memory for replay.
+class NetworkMessageRecording
+{
+public:
+    /// One connection event or message of the recording.
+    struct Record
+    {
+        NetworkRecordType type;
+        u32 connectionId; ///< The connection ID the server gave to the client at the time of the recording.
+        f64 time; ///< Seconds since the start of the recording.
+        kNet::packet_id_t packetId;
+        kNet::message_id_t messageId;
+        size_t dataOffset; ///< Offset of the payload in the payload buffer.
+        size_t numBytes;
+    };
+
+    /// Reads and parses a recording file. Returns false if the file could not be read or is not a recording.
+    /** A truncated last record is ignored with a warning. */
+    bool Load(const QString &filename);
+
+    const std::vector<Record> &Records() const { return records_; }
+
+    /// Returns the payload of a message record.
+    const char *Data(const Record &record) const { return record.numBytes > 0 ? &payloads_[record.dataOffset] : 0; }
+
+private:
+    std::vector<Record> records_;
+    std::vector<char> payloads_; ///< The payloads of all messages, concatenated.
+};
@@ -88,7 +88,7 @@ bool RayVisibilityFilter::Filter(const IMParameters& params)
                 else
                 {
                     im_->UpdateEntityVisibility(params.connection, params.changed_entity->Id(), false);
-                    im_->UpdateRelevance(params.connection, params.changed_entity->Id(), 0);
+                    im_->UpdateRelevance(0);
                     return false;
                 }
 
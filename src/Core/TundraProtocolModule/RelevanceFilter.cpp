@@ -7,11 +7,10 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
-RelevanceFilter::RelevanceFilter(InterestManager *im, int r, int cr, int interval, bool enabled) :
+RelevanceFilter::RelevanceFilter(InterestManager *im, int r, int cr, bool enabled) :
     im_(im),
     range_(r),
     critical_range_(cr),
-    updateinterval_(interval),
     MessageFilter(RELEVANCE, enabled)
 {
 
@@ -33,21 +32,13 @@ bool RelevanceFilter::Filter(const IMParameters& params)
         if(relevancefactor <= 0)
             relevancefactor = 0;
 
-        im_->UpdateRelevance(params.connection, params.changed_entity->Id(), relevancefactor);
+        im_->UpdateRelevance(relevancefactor);
 
+        //The update rate of the relevant entities is decided by the InterestManager from the relevance factor
         if(relevancefactor == 0)
             return false;
-
         else
-        {
-            float currentTime = im_->ElapsedTime();
-            float lastUpdated = im_->FindLastUpdatedEntity(params.connection, params.changed_entity->Id());
-
-            if(lastUpdated + (updateinterval_ * (1.f - relevancefactor)) < currentTime)
-                return true;
-            else
-                return false;
-        }
+            return true;
     }
     else
         return true;
@@ -11,7 +11,7 @@ class RelevanceFilter : public MessageFilter
 
 public:
 
-    RelevanceFilter(InterestManager *im, int r, int cr, int interval, bool enabled);
+    RelevanceFilter(InterestManager *im, int r, int cr, bool enabled);
 
     ~RelevanceFilter() {}
 
@@ -24,5 +24,4 @@ private:
     InterestManager *im_;
     int critical_range_;
     int range_;
-    int updateinterval_;
 };
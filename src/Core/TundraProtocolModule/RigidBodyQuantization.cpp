@@ -0,0 +1,534 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "RigidBodyQuantization.h"
+
+#include "LoggingFunctions.h"
+#include "Math/MathFunc.h"
+
+#include <kNet.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// The components other than the largest of a normalized quaternion are within [-1/sqrt(2), 1/sqrt(2)].
+const float cSmallestThreeRange = 0.70710678f;
+
+/// Number of bits of the arithmetic encoded encodings of an update.
+const int cEncodingBits = 11;
+
+/// The positions and orientations are not resent for changes smaller than these, even if the profile is more precise.
+const float cMinPositionChange = 0.0316f;
+const float cMinRotationChange = 5e-3f;
+
+float Dequantize(float minRange, float maxRange, int numBits, u32 quantized)
+{
+    return minRange + quantized * (maxRange - minRange) / (float)((1 << numBits) - 1);
+}
+
+/// Writes a value quantized to numBits within [minRange, maxRange] and returns the value the receiver decodes.
+float WriteQuantized(kNet::DataSerializer &ds, float minRange, float maxRange, int numBits, float value)
+{
+    u32 quantized = ds.AddQuantizedFloat(minRange, maxRange, numBits, Clamp(value, minRange, maxRange));
+    return Dequantize(minRange, maxRange, numBits, quantized);
+}
+
+float ReadQuantized(kNet::DataDeserializer &dd, float minRange, float maxRange, int numBits)
+{
+    // Read the quantized float manually, without a call to ReadQuantizedFloat, to decode exactly like WriteQuantized.
+    return Dequantize(minRange, maxRange, numBits, dd.ReadBits(numBits));
+}
+
+/// Returns the largest difference between a value within [minRange, maxRange] and its quantized value.
+float QuantizationError(float minRange, float maxRange, int numBits)
+{
+    return 0.5f * (maxRange - minRange) / (float)((1 << numBits) - 1);
+}
+
+/// Returns the rotation of the given orientation around +y, ignoring its tilt.
+float Yaw(const Quat &rot)
+{
+    // The orientation is the angle of the forward vector around +y.
+    const float3 forward = rot * float3::unitZ;
+    return Atan2(forward.x, forward.z);
+}
+
+/// Returns the encoding of a changed velocity.
+int VelocityEncoding(const float3 &v, float range)
+{
+    if (v.IsZero(1e-4f))
+        return RigidBodyUpdate::VelocityZero;
+    if (Abs(v.x) <= range && Abs(v.y) <= range && Abs(v.z) <= range)
+        return RigidBodyUpdate::VelocityQuantized;
+    return RigidBodyUpdate::VelocityFull;
+}
+
+bool SameEncodings(const RigidBodyUpdate &a, const RigidBodyUpdate &b)
+{
+    return a.posEncoding == b.posEncoding && a.rotEncoding == b.rotEncoding && a.scaleEncoding == b.scaleEncoding &&
+        a.velEncoding == b.velEncoding && a.angVelEncoding == b.angVelEncoding;
+}
+
+int VLE8_16_32Bits(u32 value)
+{
+    if (value < (1 << 7))
+        return 8;
+    if (value < (1 << 14))
+        return 16;
+    return 32;
+}
+
+}
+
+RigidBodyUpdate::RigidBodyUpdate() :
+    posEncoding(PositionNone),
+    rotEncoding(RotationNone),
+    scaleEncoding(ScaleNone),
+    velEncoding(VelocityNone),
+    angVelEncoding(VelocityNone),
+    pos(float3::zero),
+    rot(Quat::identity),
+    scale(float3::one),
+    linearVelocity(float3::zero),
+    angularVelocity(float3::zero)
+{
+}
+
+RigidBodyQuantization::RigidBodyQuantization() :
+    id(0),
+    bounds(float3::FromScalar(-64.f), float3::FromScalar(64.f)),
+    positionPrecision(1.f / 32.f),
+    rotationBits(8),
+    maxLinearVelocity(32.f),
+    linearVelocityBits(8),
+    maxAngularVelocity(720.f),
+    angularVelocityBits(8),
+    linearVelocityTolerance(1.f),
+    angularVelocityTolerance(20.f)
+{
+}
+
+bool RigidBodyQuantization::IsValid() const
+{
+    if (!bounds.IsFinite() || bounds.IsDegenerate())
+    {
+        LogError("RigidBodyQuantization: The world bounds must be finite and have a positive extent on every axis.");
+        return false;
+    }
+    if (!(positionPrecision > 0.f) || !IsFinite(positionPrecision))
+    {
+        LogError("RigidBodyQuantization: The position precision must be positive.");
+        return false;
+    }
+    if (rotationBits < 4 || rotationBits > 14)
+    {
+        LogError("RigidBodyQuantization: The rotation bits must be within [4, 14].");
+        return false;
+    }
+    if (!(maxLinearVelocity > 0.f) || !IsFinite(maxLinearVelocity) || !(maxAngularVelocity > 0.f) || !IsFinite(maxAngularVelocity))
+    {
+        LogError("RigidBodyQuantization: The velocity ranges must be positive.");
+        return false;
+    }
+    if (linearVelocityBits < 2 || linearVelocityBits > 24 || angularVelocityBits < 2 || angularVelocityBits > 24)
+    {
+        LogError("RigidBodyQuantization: The velocity bits must be within [2, 24].");
+        return false;
+    }
+    if (!(linearVelocityTolerance >= 0.f) || !IsFinite(linearVelocityTolerance) || !(angularVelocityTolerance >= 0.f) || !IsFinite(angularVelocityTolerance))
+    {
+        LogError("RigidBodyQuantization: The velocity tolerances must not be negative.");
+        return false;
+    }
+    return true;
+}
+
+int RigidBodyQuantization::PositionBits(int axis) const
+{
+    const float numSteps = (bounds.maxPoint.At(axis) - bounds.minPoint.At(axis)) / positionPrecision;
+    int numBits = 1;
+    while(numBits < 24 && (float)(1 << numBits) < numSteps)
+        ++numBits;
+    return numBits;
+}
+
+float RigidBodyQuantization::MaxPositionError() const
+{
+    float3 error;
+    for(int i = 0; i < 3; ++i)
+        error.At(i) = QuantizationError(bounds.minPoint.At(i), bounds.maxPoint.At(i), PositionBits(i));
+    return error.Length();
+}
+
+float RigidBodyQuantization::MaxRotationError() const
+{
+    // Each of the three sent components is off by at most e. None of them is larger than the largest component, so reconstructing
+    // the largest one adds at most 3e to it. The quaternion is then off by at most sqrt(3e^2 + 9e^2) < 3.5e, and the angle by about twice that.
+    const float e = QuantizationError(-cSmallestThreeRange, cSmallestThreeRange, rotationBits);
+    return 7.f * e;
+}
+
+float RigidBodyQuantization::MaxLinearVelocityError() const
+{
+    return Sqrt(3.f) * QuantizationError(-maxLinearVelocity, maxLinearVelocity, linearVelocityBits);
+}
+
+float RigidBodyQuantization::MaxAngularVelocityError() const
+{
+    return Sqrt(3.f) * QuantizationError(-maxAngularVelocity, maxAngularVelocity, angularVelocityBits);
+}
+
+float RigidBodyQuantization::MinPositionChange() const
+{
+    return Max(MaxPositionError(), cMinPositionChange);
+}
+
+float RigidBodyQuantization::MinRotationChange() const
+{
+    return Max(MaxRotationError(), cMinRotationChange);
+}
+
+float RigidBodyQuantization::MinLinearVelocityChange() const
+{
+    return Max(MaxLinearVelocityError(), linearVelocityTolerance);
+}
+
+float RigidBodyQuantization::MinAngularVelocityChange() const
+{
+    return Max(MaxAngularVelocityError(), angularVelocityTolerance);
+}
+
+void RigidBodyQuantization::ChooseEncodings(RigidBodyUpdate &update, bool posChanged, bool rotChanged, bool scaleChanged, bool velChanged, bool angVelChanged) const
+{
+    if (posChanged)
+        update.posEncoding = bounds.Contains(update.pos) ? RigidBodyUpdate::PositionQuantized : RigidBodyUpdate::PositionFull;
+    else
+        update.posEncoding = RigidBodyUpdate::PositionNone;
+
+    if (rotChanged)
+    {
+        // Only drop the tilt if the decoded yaw stays within the error of the smallest three encoding.
+        const float yawError = QuantizationError(-pi, pi, rotationBits + 2);
+        if (RotationDistance(Quat(float3::unitY, Yaw(update.rot)), update.rot) + yawError <= MaxRotationError())
+            update.rotEncoding = RigidBodyUpdate::RotationYaw; // Looking upright, 1 DOF.
+        else
+        {
+            const float *q = update.rot.ptr();
+            int largest = 0;
+            for(int i = 1; i < 4; ++i)
+                if (Abs(q[i]) > Abs(q[largest]))
+                    largest = i;
+            update.rotEncoding = RigidBodyUpdate::RotationSmallestThreeX + largest;
+        }
+    }
+    else
+        update.rotEncoding = RigidBodyUpdate::RotationNone;
+
+    if (scaleChanged)
+    {
+        const float3 &s = update.scale;
+        if (s.Equals(float3::one, 1e-6f))
+            update.scaleEncoding = RigidBodyUpdate::ScaleOne;
+        else if (s.MaxElement() - s.MinElement() <= 1e-3f)
+            update.scaleEncoding = RigidBodyUpdate::ScaleUniform;
+        else
+            update.scaleEncoding = RigidBodyUpdate::ScaleFull;
+    }
+    else
+        update.scaleEncoding = RigidBodyUpdate::ScaleNone;
+
+    update.velEncoding = velChanged ? VelocityEncoding(update.linearVelocity, maxLinearVelocity) : RigidBodyUpdate::VelocityNone;
+    update.angVelEncoding = angVelChanged ? VelocityEncoding(update.angularVelocity, maxAngularVelocity) : RigidBodyUpdate::VelocityNone;
+}
+
+int RigidBodyQuantization::NumBits(const RigidBodyUpdate &update, const RigidBodyUpdate *previous) const
+{
+    int numBits = 0;
+    if (previous)
+        numBits += SameEncodings(update, *previous) ? 1 : 1 + cEncodingBits;
+    else
+        numBits += cEncodingBits;
+
+    if (update.posEncoding == RigidBodyUpdate::PositionQuantized)
+        numBits += PositionBits(0) + PositionBits(1) + PositionBits(2);
+    else if (update.posEncoding == RigidBodyUpdate::PositionFull)
+        numBits += 96;
+
+    if (update.rotEncoding == RigidBodyUpdate::RotationYaw)
+        numBits += rotationBits + 2;
+    else if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+        numBits += 3 * rotationBits;
+
+    if (update.scaleEncoding == RigidBodyUpdate::ScaleUniform)
+        numBits += 32;
+    else if (update.scaleEncoding == RigidBodyUpdate::ScaleFull)
+        numBits += 96;
+
+    if (update.velEncoding == RigidBodyUpdate::VelocityQuantized)
+        numBits += 3 * linearVelocityBits;
+    else if (update.velEncoding == RigidBodyUpdate::VelocityFull)
+        numBits += 96;
+
+    if (update.angVelEncoding == RigidBodyUpdate::VelocityQuantized)
+        numBits += 3 * angularVelocityBits;
+    else if (update.angVelEncoding == RigidBodyUpdate::VelocityFull)
+        numBits += 96;
+
+    return numBits;
+}
+
+void RigidBodyQuantization::Write(kNet::DataSerializer &ds, RigidBodyUpdate &update, const RigidBodyUpdate *previous) const
+{
+    // Bodies that move alike mostly have the same encodings as the previous body of the message.
+    const bool sameEncodings = previous && SameEncodings(update, *previous);
+    if (previous)
+        ds.AppendBits(sameEncodings ? 1 : 0, 1);
+    if (!sameEncodings)
+        ds.AddArithmeticEncoded(cEncodingBits, update.posEncoding, RigidBodyUpdate::NumPositionEncodings, update.rotEncoding, RigidBodyUpdate::NumRotationEncodings,
+            update.scaleEncoding, RigidBodyUpdate::NumScaleEncodings, update.velEncoding, RigidBodyUpdate::NumVelocityEncodings,
+            update.angVelEncoding, RigidBodyUpdate::NumVelocityEncodings);
+
+    if (update.posEncoding == RigidBodyUpdate::PositionQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.pos.At(i) = WriteQuantized(ds, bounds.minPoint.At(i), bounds.maxPoint.At(i), PositionBits(i), update.pos.At(i));
+    }
+    else if (update.posEncoding == RigidBodyUpdate::PositionFull)
+    {
+        ds.Add<float>(update.pos.x);
+        ds.Add<float>(update.pos.y);
+        ds.Add<float>(update.pos.z);
+    }
+
+    if (update.rotEncoding == RigidBodyUpdate::RotationYaw)
+    {
+        // The +y vector of the transform local space points towards +y in world space, so the orientation is the angle of the forward vector around +y.
+        const float yaw = WriteQuantized(ds, -pi, pi, rotationBits + 2, Yaw(update.rot));
+        update.rot = Quat(float3::unitY, yaw);
+    }
+    else if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+    {
+        const int largest = update.rotEncoding - RigidBodyUpdate::RotationSmallestThreeX;
+        float q[4];
+        const float sign = update.rot.ptr()[largest] < 0.f ? -1.f : 1.f; // Remove the double cover by making the largest component positive.
+        float sumSq = 0.f;
+        for(int i = 0; i < 4; ++i)
+        {
+            if (i == largest)
+                continue;
+            q[i] = WriteQuantized(ds, -cSmallestThreeRange, cSmallestThreeRange, rotationBits, sign * update.rot.ptr()[i]);
+            sumSq += q[i] * q[i];
+        }
+        q[largest] = Sqrt(Max(0.f, 1.f - sumSq));
+        update.rot = Quat(q).Normalized();
+    }
+
+    if (update.scaleEncoding == RigidBodyUpdate::ScaleOne)
+        update.scale = float3::one;
+    else if (update.scaleEncoding == RigidBodyUpdate::ScaleUniform)
+    {
+        ds.Add<float>(update.scale.x);
+        update.scale = float3::FromScalar(update.scale.x);
+    }
+    else if (update.scaleEncoding == RigidBodyUpdate::ScaleFull)
+    {
+        ds.Add<float>(update.scale.x);
+        ds.Add<float>(update.scale.y);
+        ds.Add<float>(update.scale.z);
+    }
+
+    if (update.velEncoding == RigidBodyUpdate::VelocityZero)
+        update.linearVelocity = float3::zero;
+    else if (update.velEncoding == RigidBodyUpdate::VelocityQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.linearVelocity.At(i) = WriteQuantized(ds, -maxLinearVelocity, maxLinearVelocity, linearVelocityBits, update.linearVelocity.At(i));
+    }
+    else if (update.velEncoding == RigidBodyUpdate::VelocityFull)
+    {
+        ds.Add<float>(update.linearVelocity.x);
+        ds.Add<float>(update.linearVelocity.y);
+        ds.Add<float>(update.linearVelocity.z);
+    }
+
+    if (update.angVelEncoding == RigidBodyUpdate::VelocityZero)
+        update.angularVelocity = float3::zero;
+    else if (update.angVelEncoding == RigidBodyUpdate::VelocityQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.angularVelocity.At(i) = WriteQuantized(ds, -maxAngularVelocity, maxAngularVelocity, angularVelocityBits, update.angularVelocity.At(i));
+    }
+    else if (update.angVelEncoding == RigidBodyUpdate::VelocityFull)
+    {
+        ds.Add<float>(update.angularVelocity.x);
+        ds.Add<float>(update.angularVelocity.y);
+        ds.Add<float>(update.angularVelocity.z);
+    }
+}
+
+void RigidBodyQuantization::Read(kNet::DataDeserializer &dd, RigidBodyUpdate &update, const RigidBodyUpdate *previous) const
+{
+    if (previous && dd.ReadBits(1) != 0)
+    {
+        update.posEncoding = previous->posEncoding;
+        update.rotEncoding = previous->rotEncoding;
+        update.scaleEncoding = previous->scaleEncoding;
+        update.velEncoding = previous->velEncoding;
+        update.angVelEncoding = previous->angVelEncoding;
+    }
+    else
+        dd.ReadArithmeticEncoded(cEncodingBits, update.posEncoding, RigidBodyUpdate::NumPositionEncodings, update.rotEncoding, RigidBodyUpdate::NumRotationEncodings,
+            update.scaleEncoding, RigidBodyUpdate::NumScaleEncodings, update.velEncoding, RigidBodyUpdate::NumVelocityEncodings,
+            update.angVelEncoding, RigidBodyUpdate::NumVelocityEncodings);
+
+    if (update.posEncoding == RigidBodyUpdate::PositionQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.pos.At(i) = ReadQuantized(dd, bounds.minPoint.At(i), bounds.maxPoint.At(i), PositionBits(i));
+    }
+    else if (update.posEncoding == RigidBodyUpdate::PositionFull)
+    {
+        update.pos.x = dd.Read<float>();
+        update.pos.y = dd.Read<float>();
+        update.pos.z = dd.Read<float>();
+    }
+
+    if (update.rotEncoding == RigidBodyUpdate::RotationYaw)
+        update.rot = Quat(float3::unitY, ReadQuantized(dd, -pi, pi, rotationBits + 2));
+    else if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+    {
+        const int largest = update.rotEncoding - RigidBodyUpdate::RotationSmallestThreeX;
+        float q[4];
+        float sumSq = 0.f;
+        for(int i = 0; i < 4; ++i)
+        {
+            if (i == largest)
+                continue;
+            q[i] = ReadQuantized(dd, -cSmallestThreeRange, cSmallestThreeRange, rotationBits);
+            sumSq += q[i] * q[i];
+        }
+        q[largest] = Sqrt(Max(0.f, 1.f - sumSq));
+        update.rot = Quat(q).Normalized();
+    }
+
+    if (update.scaleEncoding == RigidBodyUpdate::ScaleOne)
+        update.scale = float3::one;
+    else if (update.scaleEncoding == RigidBodyUpdate::ScaleUniform)
+        update.scale = float3::FromScalar(dd.Read<float>());
+    else if (update.scaleEncoding == RigidBodyUpdate::ScaleFull)
+    {
+        update.scale.x = dd.Read<float>();
+        update.scale.y = dd.Read<float>();
+        update.scale.z = dd.Read<float>();
+    }
+
+    if (update.velEncoding == RigidBodyUpdate::VelocityZero)
+        update.linearVelocity = float3::zero;
+    else if (update.velEncoding == RigidBodyUpdate::VelocityQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.linearVelocity.At(i) = ReadQuantized(dd, -maxLinearVelocity, maxLinearVelocity, linearVelocityBits);
+    }
+    else if (update.velEncoding == RigidBodyUpdate::VelocityFull)
+    {
+        update.linearVelocity.x = dd.Read<float>();
+        update.linearVelocity.y = dd.Read<float>();
+        update.linearVelocity.z = dd.Read<float>();
+    }
+
+    if (update.angVelEncoding == RigidBodyUpdate::VelocityZero)
+        update.angularVelocity = float3::zero;
+    else if (update.angVelEncoding == RigidBodyUpdate::VelocityQuantized)
+    {
+        for(int i = 0; i < 3; ++i)
+            update.angularVelocity.At(i) = ReadQuantized(dd, -maxAngularVelocity, maxAngularVelocity, angularVelocityBits);
+    }
+    else if (update.angVelEncoding == RigidBodyUpdate::VelocityFull)
+    {
+        update.angularVelocity.x = dd.Read<float>();
+        update.angularVelocity.y = dd.Read<float>();
+        update.angularVelocity.z = dd.Read<float>();
+    }
+}
+
+float RigidBodyQuantization::RotationDistance(const Quat &a, const Quat &b)
+{
+    // q and -q are the same orientation, so compare against the closer one of them. Half of the angle between the quaternions as
+    // 4D vectors is atan2(|a - b|, |a + b|), which unlike the arc cosine of their dot product stays precise for small angles.
+    const float sign = a.Dot(b) < 0.f ? -1.f : 1.f;
+    float differenceSq = 0.f;
+    float sumSq = 0.f;
+    for(int i = 0; i < 4; ++i)
+    {
+        const float difference = a.ptr()[i] - sign * b.ptr()[i];
+        const float sum = a.ptr()[i] + sign * b.ptr()[i];
+        differenceSq += difference * difference;
+        sumSq += sum * sum;
+    }
+    return 4.f * Atan2(Sqrt(differenceSq), Sqrt(sumSq));
+}
+
+int RigidBodyQuantization::EntityIdBits(u32 id, u32 previousId)
+{
+    if (previousId != 0 && id == previousId + 1)
+        return 1;
+    return (previousId != 0 ? 1 : 0) + VLE8_16_32Bits(id - previousId);
+}
+
+void RigidBodyQuantization::WriteEntityId(kNet::DataSerializer &ds, u32 id, u32 previousId)
+{
+    // The bodies are written in the order of their IDs, so the IDs of a message often follow each other.
+    if (previousId != 0)
+    {
+        const bool next = (id == previousId + 1);
+        ds.AppendBits(next ? 1 : 0, 1);
+        if (next)
+            return;
+    }
+    ds.AddVLE<kNet::VLE8_16_32>(id - previousId);
+}
+
+u32 RigidBodyQuantization::ReadEntityId(kNet::DataDeserializer &dd, u32 previousId)
+{
+    if (previousId != 0 && dd.ReadBits(1) != 0)
+        return previousId + 1;
+    return previousId + dd.ReadVLE<kNet::VLE8_16_32>();
+}
+
+void RigidBodyQuantization::Serialize(kNet::DataSerializer &ds) const
+{
+    ds.Add<u8>(id);
+    ds.Add<float>(bounds.minPoint.x);
+    ds.Add<float>(bounds.minPoint.y);
+    ds.Add<float>(bounds.minPoint.z);
+    ds.Add<float>(bounds.maxPoint.x);
+    ds.Add<float>(bounds.maxPoint.y);
+    ds.Add<float>(bounds.maxPoint.z);
+    ds.Add<float>(positionPrecision);
+    ds.Add<u8>((u8)rotationBits);
+    ds.Add<float>(maxLinearVelocity);
+    ds.Add<u8>((u8)linearVelocityBits);
+    ds.Add<float>(maxAngularVelocity);
+    ds.Add<u8>((u8)angularVelocityBits);
+}
+
+void RigidBodyQuantization::Deserialize(kNet::DataDeserializer &dd)
+{
+    id = dd.Read<u8>();
+    bounds.minPoint.x = dd.Read<float>();
+    bounds.minPoint.y = dd.Read<float>();
+    bounds.minPoint.z = dd.Read<float>();
+    bounds.maxPoint.x = dd.Read<float>();
+    bounds.maxPoint.y = dd.Read<float>();
+    bounds.maxPoint.z = dd.Read<float>();
+    positionPrecision = dd.Read<float>();
+    rotationBits = dd.Read<u8>();
+    maxLinearVelocity = dd.Read<float>();
+    linearVelocityBits = dd.Read<u8>();
+    maxAngularVelocity = dd.Read<float>();
+    angularVelocityBits = dd.Read<u8>();
+}
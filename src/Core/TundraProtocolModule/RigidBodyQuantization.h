@@ -0,0 +1,130 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+#include "Geometry/AABB.h"
+
+#include <kNetFwd.h>
+
+/// The values of one entity in a compact rigid body update (cRigidBodyUpdateMessage).
+struct RigidBodyUpdate
+{
+    /// How each value is encoded. None means that the value has not changed and is not sent.
+    enum PositionEncoding { PositionNone = 0, PositionQuantized, PositionFull, NumPositionEncodings };
+    /// The smallest three encodings are numbered by the index of the largest quaternion component, which is not sent.
+    enum RotationEncoding { RotationNone = 0, RotationYaw, RotationSmallestThreeX, RotationSmallestThreeY, RotationSmallestThreeZ, RotationSmallestThreeW, NumRotationEncodings };
+    enum ScaleEncoding { ScaleNone = 0, ScaleOne, ScaleUniform, ScaleFull, NumScaleEncodings };
+    /// Zero is not one of the quantized values, so that a body at rest gets a velocity of exactly zero.
+    enum VelocityEncoding { VelocityNone = 0, VelocityZero, VelocityQuantized, VelocityFull, NumVelocityEncodings };
+
+    RigidBodyUpdate();
+
+    int posEncoding;
+    int rotEncoding;
+    int scaleEncoding;
+    int velEncoding;
+    int angVelEncoding;
+
+    float3 pos;
+    Quat rot;
+    float3 scale;
+    float3 linearVelocity;
+    float3 angularVelocity; ///< In degrees per second, as in EC_RigidBody.
+};
+
+/// Quantization profile of the compact rigid body updates.
+/** Positions inside the world bounds are quantized to the position precision, using as many bits per axis as the extent of the
+    bounds requires, and positions outside them are sent as floats. Unless the bounds are set explicitly, the server derives them from
+    the bounding box of the rigid bodies of the scene. Orientations are sent as a yaw angle for objects whose tilt is small enough, and
+    otherwise as the smallest three components of the quaternion. Velocities are quantized per component within their ranges and sent
+    as floats when out of range. A scale of one is not sent at all.
+
+    Write replaces the values of the update with the values the receiver decodes. The server remembers those instead of the exact
+    values, so that the changes are measured against what the client actually has and the quantization error never accumulates.
+    The change thresholds (MinPositionChange etc.) are never below the largest quantization errors, so the error left by the
+    quantization alone never causes a value to be resent.
+
+    Within a message, an update whose entity ID follows the previous one, or whose encodings are the same as in the previous update,
+    spends a single bit on them.
+
+    The server sends its profile to the clients in cRigidBodyQuantizationMessage, and starts each cRigidBodyUpdateMessage with the
+    ID of the profile. The client discards the updates that were encoded with another profile than the one it has. */
+struct RigidBodyQuantization
+{
+    RigidBodyQuantization();
+
+    u8 id; ///< Identifies the profile in the rigid body updates. The server increments it whenever the profile changes.
+    AABB bounds; ///< Positions inside the bounds are quantized.
+    float positionPrecision; ///< Maximum quantization step of the positions, in world units.
+    int rotationBits; ///< Bits per component of the smallest three encoding. The yaw encoding gets two bits more.
+    float maxLinearVelocity; ///< Linear velocities with all components within [-maxLinearVelocity, maxLinearVelocity] are quantized.
+    int linearVelocityBits; ///< Bits per component of a quantized linear velocity.
+    float maxAngularVelocity; ///< Angular velocities with all components within [-maxAngularVelocity, maxAngularVelocity] degrees per second are quantized.
+    int angularVelocityBits; ///< Bits per component of a quantized angular velocity.
+    /// The server resends a linear velocity only when it differs this much from the one the client has. Not sent to the clients.
+    /** The client uses the velocities as the tangents of the interpolation between the snapshots. An error of 1 m/s moves an
+        interpolated position by at most about 1 m/s * 4/27 * the update period, which is below the default position precision. */
+    float linearVelocityTolerance;
+    /// The server resends an angular velocity only when it differs this much, in degrees per second, from the one the client has. Not sent to the clients.
+    float angularVelocityTolerance;
+
+    /// Returns whether the parameters are usable. Logs the reason if not.
+    bool IsValid() const;
+
+    /// Returns the number of bits of a quantized position component on the given axis.
+    int PositionBits(int axis) const;
+
+    /// Returns the largest distance between a position inside the bounds and the decoded position.
+    float MaxPositionError() const;
+    /// Returns the largest angle, in radians as measured by RotationDistance, between an orientation and the decoded orientation.
+    float MaxRotationError() const;
+    /// Returns the largest distance between a linear velocity within the range and the decoded velocity.
+    float MaxLinearVelocityError() const;
+    /// Returns the largest distance between an angular velocity within the range and the decoded velocity, in degrees per second.
+    float MaxAngularVelocityError() const;
+
+    /// Returns the smallest distance from the position the client has that is sent as a change.
+    float MinPositionChange() const;
+    /// Returns the smallest angle, in radians as measured by RotationDistance, from the orientation the client has that is sent as a change.
+    float MinRotationChange() const;
+    /// Returns the smallest difference to the linear velocity the client has that is sent as a change.
+    float MinLinearVelocityChange() const;
+    /// Returns the smallest difference to the angular velocity the client has that is sent as a change, in degrees per second.
+    float MinAngularVelocityChange() const;
+
+    /// Chooses the encodings of the changed values of an update. The unchanged values are not sent.
+    void ChooseEncodings(RigidBodyUpdate &update, bool posChanged, bool rotChanged, bool scaleChanged, bool velChanged, bool angVelChanged) const;
+
+    /// Returns the size of an update in bits, excluding the entity ID.
+    /** @param previous The previous update of the same message, or null if this is the first one. */
+    int NumBits(const RigidBodyUpdate &update, const RigidBodyUpdate *previous) const;
+
+    /// Writes an update and replaces its values with the values the receiver decodes.
+    /** @param previous The previous update of the same message, or null if this is the first one. */
+    void Write(kNet::DataSerializer &ds, RigidBodyUpdate &update, const RigidBodyUpdate *previous) const;
+
+    /// Reads an update. The values that were not sent are left untouched.
+    /** @param previous The previous update read from the same message, or null if this is the first one. */
+    void Read(kNet::DataDeserializer &dd, RigidBodyUpdate &update, const RigidBodyUpdate *previous) const;
+
+    /// Returns the angle in radians between two orientations, regardless of the signs of the quaternions.
+    static float RotationDistance(const Quat &a, const Quat &b);
+
+    /// Returns the size of an entity ID in bits, written with WriteEntityId.
+    static int EntityIdBits(u32 id, u32 previousId);
+    /// Writes the entity ID of an update as the difference to the ID of the previous update of the message, which is zero for the first one.
+    static void WriteEntityId(kNet::DataSerializer &ds, u32 id, u32 previousId);
+    static u32 ReadEntityId(kNet::DataDeserializer &dd, u32 previousId);
+
+    /// Encodes and decodes test updates with the default profile, and checks their sizes and decoding errors.
+    /** Also compares the size of the updates of a scene of falling and spinning bodies to the fixed-point encoding used before
+        the profiles. Logs the results. Run with the checkRigidBodyQuantization console command.
+        @return True if all the checks passed. */
+    static bool RunRoundTripCheck();
+
+    void Serialize(kNet::DataSerializer &ds) const;
+    void Deserialize(kNet::DataDeserializer &dd);
+};
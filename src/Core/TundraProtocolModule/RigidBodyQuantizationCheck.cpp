@@ -0,0 +1,329 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "RigidBodyQuantization.h"
+
+#include "LoggingFunctions.h"
+#include "Math/MathFunc.h"
+#include "Algorithm/Random/LCG.h"
+
+#include <kNet.h>
+
+#include <vector>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// The largest allowed ratio of the sizes of the scene updates to the fixed-point encoding used before the profiles.
+const float cMaxSceneSizeRatio = 0.5f;
+
+/// Tolerance of the floating point rounding in the error checks.
+const float cEpsilon = 1e-5f;
+
+struct TestUpdate
+{
+    u32 id;
+    RigidBodyUpdate original; ///< The values before Write.
+    RigidBodyUpdate sent; ///< The values Write replaced with the decoded ones.
+    int numBits; ///< The size predicted by EntityIdBits and NumBits.
+};
+
+bool CheckError(const char *name, u32 id, float error, float maxError)
+{
+    if (error <= maxError + cEpsilon)
+        return true;
+    LogError(QString("RigidBodyQuantization check: The %1 of entity %2 was decoded with an error of %3, more than the maximum of %4.")
+        .arg(name).arg(id).arg(error).arg(maxError));
+    return false;
+}
+
+bool CheckSame(const char *name, u32 id, float difference)
+{
+    if (difference <= cEpsilon)
+        return true;
+    LogError(QString("RigidBodyQuantization check: The %1 of entity %2 was decoded differently than the server remembers it. Difference: %3.")
+        .arg(name).arg(id).arg(difference));
+    return false;
+}
+
+/// Writes the updates into one message, reads them back and compares the results to the originals.
+bool CheckRoundTrip(const RigidBodyQuantization &profile, std::vector<TestUpdate> &updates)
+{
+    int predictedBits = 0;
+    for(size_t i = 0; i < updates.size(); ++i)
+    {
+        const RigidBodyUpdate *previous = i > 0 ? &updates[i-1].original : 0;
+        updates[i].numBits = RigidBodyQuantization::EntityIdBits(updates[i].id, i > 0 ? updates[i-1].id : 0) +
+            profile.NumBits(updates[i].original, previous);
+        predictedBits += updates[i].numBits;
+    }
+
+    std::vector<char> buffer(predictedBits / 8 + 64, 0);
+    kNet::DataSerializer ds(&buffer[0], buffer.size());
+    bool ok = true;
+    for(size_t i = 0; i < updates.size(); ++i)
+    {
+        const size_t bitsBefore = ds.BitsFilled();
+        updates[i].sent = updates[i].original;
+        RigidBodyQuantization::WriteEntityId(ds, updates[i].id, i > 0 ? updates[i-1].id : 0);
+        profile.Write(ds, updates[i].sent, i > 0 ? &updates[i-1].sent : 0);
+        const int numBits = (int)(ds.BitsFilled() - bitsBefore);
+        if (numBits != updates[i].numBits)
+        {
+            LogError(QString("RigidBodyQuantization check: The update of entity %1 took %2 bits instead of the predicted %3.")
+                .arg(updates[i].id).arg(numBits).arg(updates[i].numBits));
+            ok = false;
+        }
+    }
+
+    kNet::DataDeserializer dd(&buffer[0], ds.BytesFilled());
+    u32 id = 0;
+    RigidBodyUpdate previous;
+    for(size_t i = 0; i < updates.size(); ++i)
+    {
+        const TestUpdate &expected = updates[i];
+        id = RigidBodyQuantization::ReadEntityId(dd, id);
+        RigidBodyUpdate update;
+        profile.Read(dd, update, i > 0 ? &previous : 0);
+        previous = update;
+        if (id != expected.id)
+        {
+            LogError(QString("RigidBodyQuantization check: Read entity ID %1 instead of %2.").arg(id).arg(expected.id));
+            return false;
+        }
+
+        if (update.posEncoding != expected.sent.posEncoding || update.rotEncoding != expected.sent.rotEncoding ||
+            update.scaleEncoding != expected.sent.scaleEncoding || update.velEncoding != expected.sent.velEncoding ||
+            update.angVelEncoding != expected.sent.angVelEncoding)
+        {
+            LogError(QString("RigidBodyQuantization check: The encodings of entity %1 were decoded wrong.").arg(id));
+            return false;
+        }
+
+        // The values that were not sent are left untouched by Read.
+        if (update.posEncoding != RigidBodyUpdate::PositionNone)
+            ok &= CheckSame("position", id, update.pos.Distance(expected.sent.pos));
+        if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+            ok &= CheckSame("orientation", id, RigidBodyQuantization::RotationDistance(update.rot, expected.sent.rot));
+        if (update.scaleEncoding != RigidBodyUpdate::ScaleNone)
+            ok &= CheckSame("scale", id, update.scale.Distance(expected.sent.scale));
+        if (update.velEncoding != RigidBodyUpdate::VelocityNone)
+            ok &= CheckSame("linear velocity", id, update.linearVelocity.Distance(expected.sent.linearVelocity));
+        if (update.angVelEncoding != RigidBodyUpdate::VelocityNone)
+            ok &= CheckSame("angular velocity", id, update.angularVelocity.Distance(expected.sent.angularVelocity));
+
+        if (update.posEncoding == RigidBodyUpdate::PositionQuantized)
+            ok &= CheckError("position", id, update.pos.Distance(expected.original.pos), profile.MaxPositionError());
+        if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+            ok &= CheckError("orientation", id, RigidBodyQuantization::RotationDistance(update.rot, expected.original.rot), profile.MaxRotationError());
+        if (update.velEncoding == RigidBodyUpdate::VelocityQuantized)
+            ok &= CheckError("linear velocity", id, update.linearVelocity.Distance(expected.original.linearVelocity), profile.MaxLinearVelocityError());
+        if (update.angVelEncoding == RigidBodyUpdate::VelocityQuantized)
+            ok &= CheckError("angular velocity", id, update.angularVelocity.Distance(expected.original.angularVelocity), profile.MaxAngularVelocityError());
+    }
+    if (dd.BitsLeft() >= 8)
+    {
+        LogError("RigidBodyQuantization check: Bits were left over after reading all the updates.");
+        ok = false;
+    }
+    return ok;
+}
+
+/// Returns the size of an update in the fixed-point encoding used before the profiles.
+/** The sizes are those of the removed encoding: an 8 bit header, 57 bits for a position, 31 bits for a tumbling orientation,
+    32 bits for a velocity and 31 bits for an angular velocity. */
+int FixedPointUpdateBits(u32 id, bool posChanged, bool rotChanged, bool velChanged, bool angVelChanged)
+{
+    int numBits = (id < (1 << 7) ? 8 : (id < (1 << 14) ? 16 : 32)) + 8;
+    if (posChanged)
+        numBits += 57;
+    if (rotChanged)
+        numBits += 31;
+    if (velChanged)
+        numBits += 32;
+    if (angVelChanged)
+        numBits += 31;
+    return numBits;
+}
+
+struct SimulatedBody
+{
+    u32 id;
+    float3 pos;
+    Quat rot;
+    float3 linearVelocity;
+    float3 angularVelocity; ///< In degrees per second.
+
+    // The values the client has, in the old and the new encoding.
+    float3 oldPos;
+    float3 oldEuler;
+    float3 oldLinearVelocity;
+    float3 oldAngularVelocity;
+    RigidBodyUpdate client;
+};
+
+/// Simulates bodies falling, bouncing and spinning on a 128 x 128 m floor, and compares the sizes of their updates to the fixed-point encoding.
+bool CheckSceneSize(const RigidBodyQuantization &profile)
+{
+    const int numBodies = 40;
+    const int numTicks = 60;
+    const float dt = 0.05f;
+
+    LCG lcg(3);
+    std::vector<SimulatedBody> bodies(numBodies);
+    for(int i = 0; i < numBodies; ++i)
+    {
+        SimulatedBody &b = bodies[i];
+        b.id = 1000 + i;
+        b.pos = float3(lcg.Float(-40.f, 40.f), lcg.Float(2.f, 20.f), lcg.Float(-40.f, 40.f));
+        b.rot = Quat::identity;
+        b.linearVelocity = float3(lcg.Float(-6.f, 6.f), lcg.Float(0.f, 10.f), lcg.Float(-6.f, 6.f));
+        b.angularVelocity = float3::RandomBox(lcg, -180.f, 180.f, -180.f, 180.f, -180.f, 180.f);
+        b.oldPos = b.oldEuler = b.oldLinearVelocity = b.oldAngularVelocity = float3::inf;
+        b.client.pos = float3::inf;
+        b.client.rot = Quat(0.f, 0.f, 0.f, 0.f);
+    }
+
+    int oldBits = 0;
+    int newBits = 0;
+    bool ok = true;
+    for(int tick = 0; tick < numTicks; ++tick)
+    {
+        std::vector<TestUpdate> updates;
+        for(int i = 0; i < numBodies; ++i)
+        {
+            SimulatedBody &b = bodies[i];
+            b.linearVelocity.y -= 9.81f * dt;
+            b.pos += b.linearVelocity * dt;
+            if (b.pos.y < 0.f)
+            {
+                b.pos.y = -b.pos.y;
+                b.linearVelocity.y *= -0.5f;
+            }
+            b.angularVelocity *= 0.98f;
+            const float3 w = DegToRad(b.angularVelocity);
+            if (!w.IsZero())
+                b.rot = (Quat(w.Normalized(), w.Length() * dt) * b.rot).Normalized();
+
+            // The thresholds of the fixed-point encoding.
+            const float3 euler = RadToDeg(b.rot.ToEulerZYX());
+            const bool oldPosChanged = b.pos.DistanceSq(b.oldPos) > 1e-3f;
+            const bool oldRotChanged = euler.DistanceSq(b.oldEuler) > 1e-1f;
+            const bool oldVelChanged = b.linearVelocity.DistanceSq(b.oldLinearVelocity) >= 1e-2f;
+            const bool oldAngVelChanged = b.angularVelocity.DistanceSq(b.oldAngularVelocity) >= 1e-1f;
+            if (oldPosChanged || oldRotChanged || oldVelChanged || oldAngVelChanged)
+                oldBits += FixedPointUpdateBits(b.id, oldPosChanged, oldRotChanged, oldVelChanged, oldAngVelChanged);
+            if (oldPosChanged)
+                b.oldPos = b.pos;
+            if (oldRotChanged)
+                b.oldEuler = euler;
+            if (oldVelChanged)
+                b.oldLinearVelocity = b.linearVelocity;
+            if (oldAngVelChanged)
+                b.oldAngularVelocity = b.angularVelocity;
+
+            // The thresholds SyncManager uses with the profile.
+            const bool posChanged = !(b.pos.Distance(b.client.pos) <= profile.MinPositionChange());
+            const bool rotChanged = !(RigidBodyQuantization::RotationDistance(b.rot, b.client.rot) <= profile.MinRotationChange());
+            const bool velChanged = b.linearVelocity.Distance(b.client.linearVelocity) > profile.MinLinearVelocityChange();
+            const bool angVelChanged = b.angularVelocity.Distance(b.client.angularVelocity) > profile.MinAngularVelocityChange();
+            if (!posChanged && !rotChanged && !velChanged && !angVelChanged)
+                continue;
+
+            TestUpdate update;
+            update.id = b.id;
+            update.original.pos = b.pos;
+            update.original.rot = b.rot;
+            update.original.linearVelocity = b.linearVelocity;
+            update.original.angularVelocity = b.angularVelocity;
+            profile.ChooseEncodings(update.original, posChanged, rotChanged, false, velChanged, angVelChanged);
+            updates.push_back(update);
+        }
+
+        if (updates.empty())
+            continue;
+        ok &= CheckRoundTrip(profile, updates);
+        for(size_t i = 0; i < updates.size(); ++i)
+        {
+            newBits += updates[i].numBits;
+            SimulatedBody &b = bodies[updates[i].id - 1000];
+            const RigidBodyUpdate &sent = updates[i].sent;
+            if (sent.posEncoding != RigidBodyUpdate::PositionNone)
+                b.client.pos = sent.pos;
+            if (sent.rotEncoding != RigidBodyUpdate::RotationNone)
+                b.client.rot = sent.rot;
+            if (sent.velEncoding != RigidBodyUpdate::VelocityNone)
+                b.client.linearVelocity = sent.linearVelocity;
+            if (sent.angVelEncoding != RigidBodyUpdate::VelocityNone)
+                b.client.angularVelocity = sent.angularVelocity;
+        }
+    }
+
+    const float ratio = oldBits > 0 ? (float)newBits / oldBits : 1.f;
+    LogInfo(QString("RigidBodyQuantization check: %1 bodies over %2 updates took %3 bits, the fixed-point encoding %4 bits (ratio %5).")
+        .arg(numBodies).arg(numTicks).arg(newBits).arg(oldBits).arg(ratio));
+    if (ratio > cMaxSceneSizeRatio)
+    {
+        LogError(QString("RigidBodyQuantization check: The updates took more than %1 of the size of the fixed-point encoding.").arg(cMaxSceneSizeRatio));
+        ok = false;
+    }
+    return ok;
+}
+
+}
+
+bool RigidBodyQuantization::RunRoundTripCheck()
+{
+    RigidBodyQuantization profile;
+    if (!profile.IsValid())
+        return false;
+
+    // The default profile must keep a full update of a body inside the bounds well below the 175 bits of the fixed-point encoding.
+    const int maxFullUpdateBits = 120;
+    bool ok = true;
+
+    LCG lcg(1);
+    std::vector<TestUpdate> updates;
+    u32 id = 1;
+    for(int i = 0; i < 500; ++i)
+    {
+        TestUpdate update;
+        id += (i % 3 == 0) ? lcg.Int(1, 20000) : 1;
+        update.id = id;
+
+        RigidBodyUpdate &u = update.original;
+        const bool outside = (i % 25 == 0);
+        u.pos = outside ? profile.bounds.maxPoint + float3::FromScalar(lcg.Float(0.1f, 100.f)) :
+            float3::RandomBox(lcg, profile.bounds.minPoint, profile.bounds.maxPoint);
+        u.rot = (i % 4 == 0) ? Quat(float3::unitY, lcg.Float(-pi, pi)) : Quat::RandomRotation(lcg);
+        u.scale = (i % 10 == 0) ? float3::FromScalar(lcg.Float(0.5f, 2.f)) : float3::one;
+        const float v = profile.maxLinearVelocity;
+        u.linearVelocity = (i % 7 == 0) ? float3::zero : float3::RandomBox(lcg, -v, v, -v, v, -v, v);
+        const float w = profile.maxAngularVelocity;
+        u.angularVelocity = (i % 5 == 0) ? float3::RandomBox(lcg, -2.f * w, 2.f * w, -w, w, -w, w) : float3::RandomBox(lcg, -w, w, -w, w, -w, w);
+        profile.ChooseEncodings(u, true, true, i % 10 == 0, true, true);
+
+        if (u.posEncoding == RigidBodyUpdate::PositionQuantized && u.velEncoding == RigidBodyUpdate::VelocityQuantized &&
+            u.angVelEncoding == RigidBodyUpdate::VelocityQuantized && u.scaleEncoding == RigidBodyUpdate::ScaleOne)
+        {
+            const int numBits = profile.NumBits(u, 0);
+            if (numBits > maxFullUpdateBits)
+            {
+                LogError(QString("RigidBodyQuantization check: A full update takes %1 bits, more than the maximum of %2.").arg(numBits).arg(maxFullUpdateBits));
+                ok = false;
+            }
+        }
+        updates.push_back(update);
+    }
+    ok &= CheckRoundTrip(profile, updates);
+    ok &= CheckSceneSize(profile);
+
+    if (ok)
+        LogInfo(QString("RigidBodyQuantization check: Passed. Maximum errors: position %1, orientation %2 degrees, linear velocity %3, angular velocity %4 degrees/s.")
+            .arg(profile.MaxPositionError()).arg(RadToDeg(profile.MaxRotationError())).arg(profile.MaxLinearVelocityError()).arg(profile.MaxAngularVelocityError()));
+    return ok;
+}
@@ -28,6 +28,9 @@
 
 #include <kNet.h>
 
+#include <QRunnable>
+
+#include <algorithm>
 #include <cstring>
 
 #include "MemoryLeakCheck.h"
@@ -35,6 +38,29 @@
 // This variable is used for the interpolation stop check
 kNet::MessageConnection* currentSender = 0;
 
+namespace
+{
+
+/// Size after which SyncMessageBuilder continues in a new message. Keeps the messages of large entity changes in sizes that kNet fragments efficiently.
+const size_t cMaxSyncMessageSize = 16 * 1024;
+/// Maximum size of a VLE8_16_32.
+const size_t cMaxVLESize = 4;
+/// Maximum size of the length prefix that DataSerializer::AddString writes.
+const size_t cMaxStringPrefixSize = 4;
+/// Initial size of the buffers for encoding attribute data.
+const size_t cInitialAttributeDataSize = 16 * 1024;
+/// Size past which the attribute data of a single component is not grown, to not exhaust memory on a runaway attribute.
+const size_t cMaxAttributeDataSize = 64 * 1024 * 1024;
+/// Largest message data buffer that a SyncStateOutput keeps for reuse. Larger buffers of exceptionally large messages are freed.
+const size_t cMaxFreeBufferSize = 256 * 1024;
+
+/// Interval of checking the bounds of the rigid bodies of the scene for the quantization profile, in seconds.
+const float cRigidBodyBoundsInterval = 1.f;
+/// Smallest padding of the derived rigid body quantization bounds on each side, in world units.
+const float cMinRigidBodyBoundsPadding = 8.f;
+
+}
+
 namespace TundraLogic
 {
 
@@ -48,37 +74,386 @@ void SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::messag
     connection->EndAndQueueMessage(msg);
 }
 
-void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, IComponent *comp, const std::vector<u8> &attrData)
 {
     // Component identification
     ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
     ds.AddVLE<kNet::VLE8_16_32>(comp->TypeId());
     ds.AddString(comp->Name().toStdString());
     
-    // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
-    kNet::DataSerializer attrDs(attrDataBuffer_, 16 * 1024);
+    // Add the attribute array to the main serializer
+    ds.AddVLE<kNet::VLE8_16_32>((u32)attrData.size());
+    if (!attrData.empty())
+        ds.AddArray<u8>(&attrData[0], (u32)attrData.size());
+}
+
+size_t SyncManager::ComponentFullUpdateMaxSize(IComponent *comp, const std::vector<u8> &attrData)
+{
+    // Component ID, type ID and attribute data size VLEs, and the name with its length prefix.
+    return 3 * cMaxVLESize + cMaxStringPrefixSize + 3 * comp->Name().length() + attrData.size();
+}
+
+const char *SyncManager::ReadAttributeData(kNet::DataDeserializer& ds, u32 numBytes)
+{
+    // A corrupt size makes ReadArray throw once the message runs out, so do not grow the buffer past the rest of the message.
+    const size_t numAvailable = std::min<size_t>(numBytes, ds.BitsLeft() / 8);
+    if (attrDataBuffer_.size() < numAvailable)
+        attrDataBuffer_.resize(numAvailable);
+    if (numBytes > 0)
+        ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], numBytes);
+    return &attrDataBuffer_[0];
+}
+
+bool SyncManager::EncodedComponentKey::operator <(const EncodedComponentKey &rhs) const
+{
+    if (entityId != rhs.entityId)
+        return entityId < rhs.entityId;
+    if (componentId != rhs.componentId)
+        return componentId < rhs.componentId;
+    return dirtyAttributes < rhs.dirtyAttributes;
+}
+
+const std::vector<u8> &SyncManager::CacheEncodedComponent(const EncodedComponentKey &key, const char *data, size_t numBytes)
+{
+    QMutexLocker lock(&encodedComponentsMutex_);
+    std::pair<std::map<EncodedComponentKey, std::vector<u8> >::iterator, bool> inserted =
+        encodedComponents_.insert(std::make_pair(key, std::vector<u8>()));
+    if (inserted.second) // Otherwise another thread encoded the same change meanwhile. Its data is identical.
+        inserted.first->second.assign((const u8*)data, (const u8*)data + numBytes);
+    return inserted.first->second;
+}
+
+const std::vector<u8> &SyncManager::EncodeComponentAttributes(SyncScratchBuffers& scratch, entity_id_t entityId, IComponent *comp)
+{
+    EncodedComponentKey key;
+    key.entityId = entityId;
+    key.componentId = comp->Id();
+    {
+        QMutexLocker lock(&encodedComponentsMutex_);
+        std::map<EncodedComponentKey, std::vector<u8> >::iterator iter = encodedComponents_.find(key);
+        if (iter != encodedComponents_.end())
+            return iter->second;
+    }
+
+    // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components.
+    // If the attributes do not fit the buffer, grow it and encode them again.
+    if (scratch.attrData.empty())
+        scratch.attrData.resize(cInitialAttributeDataSize);
+    size_t numBytes = 0;
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer attrDs((char*)&scratch.attrData[0], scratch.attrData.size());
+            
+            // Static-structured attributes
+            unsigned numStaticAttrs = comp->NumStaticAttributes();
+            const AttributeVector& attrs = comp->Attributes();
+            for (uint i = 0; i < numStaticAttrs; ++i)
+                attrs[i]->ToBinary(attrDs);
+            
+            // Dynamic-structured attributes (use EOF to detect so do not need to send their amount)
+            for (unsigned i = numStaticAttrs; i < attrs.size(); ++i)
+            {
+                if (attrs[i] && attrs[i]->IsDynamic())
+                {
+                    attrDs.Add<u8>(i); // Index
+                    attrDs.Add<u8>(attrs[i]->TypeId());
+                    attrDs.AddString(attrs[i]->Name().toStdString());
+                    attrs[i]->ToBinary(attrDs);
+                }
+            }
+            numBytes = attrDs.BytesFilled();
+            break;
+        }
+        catch(kNet::NetException &/*e*/)
+        {
+            if (scratch.attrData.size() >= cMaxAttributeDataSize)
+                throw;
+            scratch.attrData.resize(scratch.attrData.size() * 2);
+        }
+    }
     
-    // Static-structured attributes
-    unsigned numStaticAttrs = comp->NumStaticAttributes();
+    return CacheEncodedComponent(key, (const char*)&scratch.attrData[0], numBytes);
+}
+
+const std::vector<u8> &SyncManager::EncodeAttributeChanges(SyncScratchBuffers& scratch, entity_id_t entityId, IComponent *comp, const u8 *dirtyAttributes, const std::vector<u8> &changedAttributes)
+{
     const AttributeVector& attrs = comp->Attributes();
-    for (uint i = 0; i < numStaticAttrs; ++i)
-        attrs[i]->ToBinary(attrDs);
+    EncodedComponentKey key;
+    key.entityId = entityId;
+    key.componentId = comp->Id();
+    key.dirtyAttributes.assign(dirtyAttributes, dirtyAttributes + ((attrs.size() + 7) >> 3));
+    {
+        QMutexLocker lock(&encodedComponentsMutex_);
+        std::map<EncodedComponentKey, std::vector<u8> >::iterator iter = encodedComponents_.find(key);
+        if (iter != encodedComponents_.end())
+            return iter->second;
+    }
+
+    // Create a nested dataserializer for the actual attribute data, so we can skip components.
+    // If the attributes do not fit the buffer, grow it and encode them again.
+    if (scratch.attrData.empty())
+        scratch.attrData.resize(cInitialAttributeDataSize);
+    size_t numBytes = 0;
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer attrDataDs((char*)&scratch.attrData[0], scratch.attrData.size());
+            
+            // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+            unsigned bitsMethod1 = (unsigned)changedAttributes.size() * 8 + 8;
+            unsigned bitsMethod2 = (unsigned)attrs.size();
+            // Method 1: indices
+            if (bitsMethod1 <= bitsMethod2)
+            {
+                attrDataDs.Add<kNet::bit>(0);
+                attrDataDs.Add<u8>((u8)changedAttributes.size());
+                for (unsigned i = 0; i < changedAttributes.size(); ++i)
+                {
+                    attrDataDs.Add<u8>(changedAttributes[i]);
+                    attrs[changedAttributes[i]]->ToBinary(attrDataDs);
+                }
+            }
+            // Method 2: bitmask
+            else
+            {
+                attrDataDs.Add<kNet::bit>(1);
+                for (unsigned i = 0; i < attrs.size(); ++i)
+                {
+                    if (dirtyAttributes[i >> 3] & (1 << (i & 7)))
+                    {
+                        attrDataDs.Add<kNet::bit>(1);
+                        attrs[i]->ToBinary(attrDataDs);
+                    }
+                    else
+                        attrDataDs.Add<kNet::bit>(0);
+                }
+            }
+            numBytes = attrDataDs.BytesFilled();
+            break;
+        }
+        catch(kNet::NetException &/*e*/)
+        {
+            if (scratch.attrData.size() >= cMaxAttributeDataSize)
+                throw;
+            scratch.attrData.resize(scratch.attrData.size() * 2);
+        }
+    }
     
-    // Dynamic-structured attributes (use EOF to detect so do not need to send their amount)
-    for (unsigned i = numStaticAttrs; i < attrs.size(); ++i)
+    return CacheEncodedComponent(key, (const char*)&scratch.attrData[0], numBytes);
+}
+
+size_t SyncManager::EncodeAttributeValue(SyncScratchBuffers& scratch, IAttribute *attr)
+{
+    if (scratch.attrData.empty())
+        scratch.attrData.resize(cInitialAttributeDataSize);
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer ds((char*)&scratch.attrData[0], scratch.attrData.size());
+            attr->ToBinary(ds);
+            return ds.BytesFilled();
+        }
+        catch(kNet::NetException &/*e*/)
+        {
+            if (scratch.attrData.size() >= cMaxAttributeDataSize)
+                throw;
+            scratch.attrData.resize(scratch.attrData.size() * 2);
+        }
+    }
+}
+
+void SyncManager::SyncStateOutput::AllocateBuffer(std::vector<u8> &buffer, size_t numBytes)
+{
+    if (!freeBuffers.empty())
     {
-        if (attrs[i] && attrs[i]->IsDynamic())
+        buffer.swap(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+    if (buffer.size() < numBytes)
+        buffer.resize(numBytes);
+}
+
+void SyncManager::SyncStateOutput::QueueMessage(kNet::message_id_t id, bool reliable, bool inOrder, std::vector<u8> &buffer, size_t numBytes, bool fixedPriority)
+{
+    messages.push_back(Message());
+    Message &msg = messages.back();
+    msg.id = id;
+    msg.reliable = reliable;
+    msg.inOrder = inOrder;
+    msg.fixedPriority = fixedPriority;
+    msg.data.swap(buffer);
+    msg.numBytes = numBytes;
+}
+
+void SyncManager::SyncStateOutput::Clear()
+{
+    for(size_t i = 0; i < messages.size(); ++i)
+    {
+        if (messages[i].data.size() <= cMaxFreeBufferSize)
         {
-            attrDs.Add<u8>(i); // Index
-            attrDs.Add<u8>(attrs[i]->TypeId());
-            attrDs.AddString(attrs[i]->Name().toStdString());
-            attrs[i]->ToBinary(attrDs);
+            freeBuffers.push_back(std::vector<u8>());
+            freeBuffers.back().swap(messages[i].data);
         }
     }
+    messages.clear();
+    warnings.clear();
+    errors.clear();
+    failed = false;
+}
+
+SyncManager::SyncMessageBuilder::SyncMessageBuilder(SyncStateOutput &output, kNet::message_id_t id, u32 sceneId, entity_id_t entityId) :
+    output_(output),
+    id_(id),
+    sceneId_(sceneId),
+    entityId_(entityId),
+    numBytes_(0)
+{
+}
+
+kNet::DataSerializer SyncManager::SyncMessageBuilder::BeginItem(size_t maxBytes)
+{
+    if (numBytes_ > 0 && numBytes_ + maxBytes > cMaxSyncMessageSize)
+        FinishMessage();
     
-    // Add the attribute array to the main serializer
-    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
-    ds.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDs.BytesFilled());
+    // If first item of the message, write the scene and entity IDs first
+    if (numBytes_ == 0)
+    {
+        output_.AllocateBuffer(buffer_, 2 * cMaxVLESize + maxBytes);
+        kNet::DataSerializer ds((char*)&buffer_[0], buffer_.size());
+        ds.AddVLE<kNet::VLE8_16_32>(sceneId_);
+        ds.AddVLE<kNet::VLE8_16_32>(entityId_ & UniqueIdGenerator::LAST_REPLICATED_ID);
+        numBytes_ = ds.BytesFilled();
+    }
+    if (buffer_.size() < numBytes_ + maxBytes)
+        buffer_.resize(std::max(numBytes_ + maxBytes, 2 * buffer_.size()));
+    
+    return kNet::DataSerializer((char*)&buffer_[numBytes_], maxBytes);
+}
+
+void SyncManager::SyncMessageBuilder::EndItem(const kNet::DataSerializer &ds)
+{
+    numBytes_ += ds.BytesFilled();
+}
+
+void SyncManager::SyncMessageBuilder::FinishMessage()
+{
+    pending_.push_back(SyncStateOutput::Message());
+    SyncStateOutput::Message &msg = pending_.back();
+    msg.id = id_;
+    msg.reliable = true;
+    msg.inOrder = true;
+    msg.fixedPriority = true;
+    msg.data.swap(buffer_);
+    msg.numBytes = numBytes_;
+    numBytes_ = 0;
+}
+
+int SyncManager::SyncMessageBuilder::Flush()
+{
+    if (numBytes_ > 0)
+        FinishMessage();
+    for(size_t i = 0; i < pending_.size(); ++i)
+        output_.QueueMessage(id_, true, true, pending_[i].data, pending_[i].numBytes);
+    int numMessages = (int)pending_.size();
+    pending_.clear();
+    return numMessages;
+}
+
+void SyncManager::SendSyncStateOutput(kNet::MessageConnection* connection, SyncStateOutput& output)
+{
+    foreach(const QString &warning, output.warnings)
+        LogWarning(warning);
+    foreach(const QString &error, output.errors)
+        LogError(error);
+
+    for(size_t i = 0; i < output.messages.size(); ++i)
+    {
+        const SyncStateOutput::Message &m = output.messages[i];
+        // The only copy of the message data. The data can not be serialized into the kNet message directly, as the messages
+        // are crafted on the worker threads and kNet messages are only started on the main thread.
+        kNet::NetworkMessage* msg = connection->StartNewMessage(m.id, m.numBytes);
+        if (m.numBytes > 0)
+            memcpy(msg->data, &m.data[0], m.numBytes);
+        msg->contentID = 0;
+        msg->reliable = m.reliable;
+        msg->inOrder = m.inOrder;
+        if (m.fixedPriority)
+            msg->priority = 100; // Fixed priority as in those defined with xml
+        connection->EndAndQueueMessage(msg, m.numBytes);
+    }
+    output.Clear();
+}
+
+class SyncManager::SyncStateJob : public QRunnable
+{
+public:
+    SyncStateJob(SyncManager *owner, const std::vector<UserConnection*> &users, size_t firstIndex, size_t numJobs, SyncScratchBuffers &scratch) :
+        owner_(owner), users_(users), firstIndex_(firstIndex), numJobs_(numJobs), scratch_(scratch)
+    {
+    }
+
+    /// QRunnable override.
+    virtual void run()
+    {
+        owner_->SerializeUserSyncStates(users_, firstIndex_, numJobs_, scratch_);
+    }
+
+private:
+    SyncManager *owner_;
+    const std::vector<UserConnection*> &users_;
+    size_t firstIndex_;
+    size_t numJobs_;
+    SyncScratchBuffers &scratch_;
+};
+
+void SyncManager::SerializeUserSyncStates(const std::vector<UserConnection*>& users)
+{
+    PROFILE(SyncManager_SerializeUserSyncStates);
+
+    // Below this many connections, the overhead of waking up the worker threads is larger than the gain.
+    const size_t cMinUsersPerJob = 4;
+    size_t numJobs = std::min<size_t>(users.size() / cMinUsersPerJob, (size_t)syncThreadPool_.maxThreadCount() + 1);
+    numJobs = std::max<size_t>(numJobs, 1);
+
+    syncOutputs_.resize(users.size());
+    while(syncScratchBuffers_.size() < numJobs)
+        syncScratchBuffers_.push_back(MAKE_SHARED(SyncScratchBuffers));
+
+    // The connections are interleaved between the jobs, so that the clients that joined at about the same time and
+    // thus often have similar amounts of pending changes spread evenly. The main thread runs the first job itself.
+    for(size_t i = 1; i < numJobs; ++i)
+        syncThreadPool_.start(new SyncStateJob(this, users, i, numJobs, *syncScratchBuffers_[i]));
+    SerializeUserSyncStates(users, 0, numJobs, *syncScratchBuffers_[0]);
+    syncThreadPool_.waitForDone();
+}
+
+void SyncManager::SerializeUserSyncStates(const std::vector<UserConnection*>& users, size_t firstIndex, size_t numJobs, SyncScratchBuffers& scratch)
+{
+    for(size_t i = firstIndex; i < users.size(); i += numJobs)
+    {
+        SceneSyncState *state = users[i]->syncState.get();
+        // The exceptions must not escape a worker thread, nor skip the wait for the workers on the main thread.
+        // They are reported to the main thread through the output of the user instead.
+        try
+        {
+            // Leave out the entities whose update interval for this user has not passed yet.
+            state->AdvanceUpdateWheel();
+            // First send out all changes to rigid bodies.
+            // After processing this function, the bits related to rigid body states have been cleared,
+            // so the generic sync will not double-replicate the rigid body positions and velocities.
+            ReplicateRigidBodyChanges(syncOutputs_[i], scratch, state);
+            ProcessSyncState(syncOutputs_[i], scratch, state);
+        }
+        catch(std::exception &e)
+        {
+            syncOutputs_[i].errors << "SyncManager: Failed to serialize the scene changes for connection " + QString::number(users[i]->ConnectionId()) + ": " + QString(e.what());
+            syncOutputs_[i].failed = true;
+        }
+    }
 }
 
 SyncManager::SyncManager(TundraLogicModule* owner) :
@@ -88,7 +463,14 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
     interestmanager_(0),
     updateAcc_(0.0),
     maxLinExtrapTime_(3.0f),
-    noClientPhysicsHandoff_(false)
+    noClientPhysicsHandoff_(false),
+    interpolationDelay_(1.5f),
+    rigidBodyBoundsFromScene_(true),
+    rigidBodyBoundsDerived_(false),
+    rigidBodyBoundsAcc_(cRigidBodyBoundsInterval),
+    clientTime_(0.0),
+    applyingInterpolation_(false),
+    attrDataBuffer_(cInitialAttributeDataSize)
 {
     KristalliProtocolModule *kristalli = framework_->GetModule<KristalliProtocolModule>();
     connect(kristalli, SIGNAL(NetworkMessageReceived(kNet::MessageConnection *, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)), 
@@ -142,6 +524,7 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
     }
     
     GetClientExtrapolationTime();
+    GetClientInterpolationDelay();
 }
 
 SyncManager::~SyncManager()
@@ -182,9 +565,8 @@ void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ra
                 {
                     SendCameraUpdateRequest((*i), enabled);
                     (*i)->syncState->visibleEntities.clear();
-                    (*i)->syncState->relevanceFactors.clear();
-                    (*i)->syncState->lastUpdatedEntitys_.clear();
                     (*i)->syncState->lastRaycastedEntitys_.clear();
+                    (*i)->syncState->ResetUpdateIntervals();
                 }
         }
 
@@ -204,18 +586,19 @@ void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ra
             if(framework_->IsHeadless())    //If running in headless mode, do not enable EA3. Instead, use A3. Raycasting cannot be done in headless mode at the moment.
             {
                 LogError("[InterestManager] EA3 algorithm cannot be used in headless mode. Fallbacking to A3 algorithm.");
-                filter = new A3Filter(IM, critrange, relrange, updateint, true);
+                filter = new A3Filter(IM, critrange, relrange, true);
             }
             else
-                filter = new EA3Filter(IM, critrange, relrange, raycastint, updateint, true);
+                filter = new EA3Filter(IM, critrange, relrange, raycastint, true);
         }
         else if(eucl && rel && !ray)    //Combination that the A3 uses
-            filter = new A3Filter(IM, critrange, relrange, updateint, true);
+            filter = new A3Filter(IM, critrange, relrange, true);
 
         else                            //As a last resort enable Euclidean Distance Filter
             filter = new EuclideanDistanceFilter(IM, critrange, true);
 
         IM->AssignFilter(filter);
+        IM->SetFarUpdateInterval(updateint);
 
         SetInterestManager(IM);
 
@@ -254,6 +637,130 @@ void SyncManager::SetUpdatePeriod(float period)
     updatePeriod_ = period;
     
     GetClientExtrapolationTime();
+    GetClientInterpolationDelay();
+}
+
+void SyncManager::SetRigidBodyQuantization(const AABB &bounds, float positionPrecision, int rotationBits, float maxLinearVelocity, int linearVelocityBits,
+    float maxAngularVelocity, int angularVelocityBits, float linearVelocityTolerance, float angularVelocityTolerance)
+{
+    if (!owner_->IsServer())
+    {
+        LogError("SyncManager::SetRigidBodyQuantization: The quantization profile can only be set on the server.");
+        return;
+    }
+
+    RigidBodyQuantization profile = rigidBodyQuantization_;
+    const bool fromScene = bounds.IsDegenerate();
+    if (!fromScene)
+        profile.bounds = bounds;
+    profile.positionPrecision = positionPrecision;
+    profile.rotationBits = rotationBits;
+    profile.maxLinearVelocity = maxLinearVelocity;
+    profile.linearVelocityBits = linearVelocityBits;
+    profile.maxAngularVelocity = maxAngularVelocity;
+    profile.angularVelocityBits = angularVelocityBits;
+    profile.linearVelocityTolerance = linearVelocityTolerance;
+    profile.angularVelocityTolerance = angularVelocityTolerance;
+    if (!ApplyRigidBodyQuantization(profile))
+        return;
+
+    rigidBodyBoundsFromScene_ = fromScene;
+    if (fromScene)
+    {
+        // Derive the bounds anew on the next network update.
+        rigidBodyBoundsDerived_ = false;
+        rigidBodyBoundsAcc_ = cRigidBodyBoundsInterval;
+    }
+}
+
+bool SyncManager::ApplyRigidBodyQuantization(RigidBodyQuantization profile)
+{
+    if (!profile.IsValid())
+        return false;
+    profile.id = (u8)(rigidBodyQuantization_.id + 1);
+    rigidBodyQuantization_ = profile;
+
+    KristalliProtocolModule* kristalli = owner_->GetKristalliModule();
+    if (!kristalli)
+        return true;
+    UserConnectionList& users = kristalli->GetUserConnections();
+    for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+        if ((*i)->syncState)
+            SendRigidBodyQuantization((*i)->connection);
+    return true;
+}
+
+void SyncManager::UpdateRigidBodyQuantizationBounds()
+{
+    if (!rigidBodyBoundsFromScene_)
+        return;
+    rigidBodyBoundsAcc_ += updatePeriod_;
+    if (rigidBodyBoundsAcc_ < cRigidBodyBoundsInterval)
+        return;
+    rigidBodyBoundsAcc_ = 0.f;
+
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+
+    PROFILE(SyncManager_UpdateRigidBodyQuantizationBounds);
+    AABB sceneBounds;
+    sceneBounds.SetNegativeInfinity();
+    EntityList bodies = scene->EntitiesWithComponent<EC_RigidBody>();
+    for(EntityList::const_iterator i = bodies.begin(); i != bodies.end(); ++i)
+    {
+        shared_ptr<EC_Placeable> placeable = (*i)->GetComponent<EC_Placeable>();
+        if (placeable)
+            sceneBounds.Enclose(placeable->transform.Get().pos);
+    }
+    if (!sceneBounds.IsFinite())
+        return; // No rigid bodies, keep the current bounds.
+    if (rigidBodyBoundsDerived_ && rigidBodyQuantization_.bounds.Contains(sceneBounds))
+        return;
+
+    // Pad the bounds so that the bodies can move for a while before the bounds need to grow, and only grow them once derived,
+    // so that the profile settles instead of being resent to all the clients whenever the bodies move.
+    const float3 padding = Max(0.25f * sceneBounds.Size(), float3::FromScalar(cMinRigidBodyBoundsPadding));
+    RigidBodyQuantization profile = rigidBodyQuantization_;
+    profile.bounds = AABB(sceneBounds.minPoint - padding, sceneBounds.maxPoint + padding);
+    if (rigidBodyBoundsDerived_)
+        profile.bounds.Enclose(rigidBodyQuantization_.bounds);
+    if (ApplyRigidBodyQuantization(profile))
+    {
+        rigidBodyBoundsDerived_ = true;
+        LogDebug(QString("SyncManager: Quantizing the rigid body positions within %1 to %2 bits.")
+            .arg(profile.bounds.toString()).arg(profile.PositionBits(0) + profile.PositionBits(1) + profile.PositionBits(2)));
+    }
+}
+
+void SyncManager::SendRigidBodyQuantization(kNet::MessageConnection* connection)
+{
+    if (!connection)
+        return;
+    char buffer[64];
+    kNet::DataSerializer ds(buffer, sizeof(buffer));
+    rigidBodyQuantization_.Serialize(ds);
+    QueueMessage(connection, cRigidBodyQuantizationMessage, true, true, ds);
+}
+
+void SyncManager::HandleRigidBodyQuantization(kNet::MessageConnection* source, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager: Ignoring a rigid body quantization profile sent by a client.");
+        return;
+    }
+
+    kNet::DataDeserializer dd(data, numBytes);
+    RigidBodyQuantization profile;
+    profile.Deserialize(dd);
+    if (!profile.IsValid())
+    {
+        LogError("SyncManager: Received an invalid rigid body quantization profile, ignoring it.");
+        return;
+    }
+    previousRigidBodyQuantization_ = rigidBodyQuantization_;
+    rigidBodyQuantization_ = profile;
 }
 
 void SyncManager::GetClientExtrapolationTime()
@@ -271,6 +778,23 @@ void SyncManager::GetClientExtrapolationTime()
     }
 }
 
+void SyncManager::GetClientInterpolationDelay()
+{
+    QStringList delayParam = framework_->CommandLineParameters("--clientinterpolationdelay");
+    if (delayParam.size() > 0)
+    {
+        bool ok;
+        float newDelay = delayParam.first().toFloat(&ok);
+        if (ok && newDelay >= 0.0f)
+        {
+            interpolationDelay_ = newDelay / 1000.0f / updatePeriod_;
+            LogDebug("SyncManager: Using a client interpolation delay of " + QString::number(interpolationDelay_ * updatePeriod_ * 1000.0f) + " ms.");
+        }
+        else
+            LogWarning("SyncManager: Invalid value for --clientinterpolationdelay, using a delay of " + QString::number(interpolationDelay_ * updatePeriod_ * 1000.0f) + " ms.");
+    }
+}
+
 SceneSyncState* SyncManager::SceneState(u32 connectionId) const
 {
     if (!owner_->IsServer())
@@ -295,6 +819,7 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     {
         disconnect(previous.get(), 0, this, 0);
         server_syncstate_.Clear();
+        transformInterpolator_.Clear();
     }
     
     scene_.reset();
@@ -366,6 +891,9 @@ void SyncManager::HandleKristalliMessage(kNet::MessageConnection* source, kNet::
         case cRigidBodyUpdateMessage:
             HandleRigidBodyChanges(source, packetId, data, numBytes);
             break;
+        case cRigidBodyQuantizationMessage:
+            HandleRigidBodyQuantization(source, data, numBytes);
+            break;
         case cEditEntityPropertiesMessage:
             HandleEditEntityProperties(source, data, numBytes);
             break;
@@ -408,7 +936,10 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
         SendCameraUpdateRequest(user, true);
 
     if (owner_->IsServer())
+    {
+        SendRigidBodyQuantization(user->connection);
         emit SceneStateCreated(user.get(), user->syncState.get());
+    }
 
     for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
     {
@@ -437,6 +968,16 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
             if (attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate)
                 // Note: it does not matter if the attribute was not actually interpolating
                 scene->EndAttributeInterpolation(attr);
+
+            // Likewise stop interpolating a placeable's transform if we move it ourselves. Rigid bodies are left alone,
+            // because the local physics writes their transforms also while they are being interpolated.
+            if (!applyingInterpolation_ && comp->TypeId() == EC_Placeable::ComponentTypeId && attr == &static_cast<EC_Placeable*>(comp)->transform &&
+                comp->ParentEntity())
+            {
+                int track = transformInterpolator_.FindTrack(comp->ParentEntity()->Id());
+                if (track >= 0 && !transformInterpolator_.RigidBody(track))
+                    transformInterpolator_.Stop(track);
+            }
         }
     }
     
@@ -457,15 +998,12 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
         {
             if ((*i)->syncState)
             {
-                /// Check here if the attribute should be updated to which client?
-                /// @remarks InterestManager functionality
-                /// \bug The attribute should be marked dirty, but sending should be deferred until entity is relevant
-                /// With this logic, the dirty attributes from the non-relevant period will simply be forgotten
-                if(interestmanager_ && !interestmanager_->CheckRelevance((*i), entity, scene_, framework_->IsHeadless()))
-                    continue;
+                (*i)->syncState->MarkAttributeDirty(entity->Id(), comp->Id(), attr->Index());
 
-                else    //If IM is not available, accept the update
-                    (*i)->syncState->MarkAttributeDirty(entity->Id(), comp->Id(), attr->Index());
+                /// Decide how often the entity's changes are sent to the client. If IM is not available, they are sent on every update.
+                /// @remarks InterestManager functionality
+                if(interestmanager_)
+                    (*i)->syncState->SetUpdateInterval(entity->Id(), interestmanager_->UpdateInterval((*i), entity, scene_, framework_->IsHeadless(), updatePeriod_));
             }
         }
     }
@@ -716,151 +1254,86 @@ void SyncManager::OnEntityPropertiesChanged(Entity* entity, AttributeChange::Typ
     }
 }
 
-/// Interpolates from (pos0, vel0) to (pos1, vel1) with a C1 curve (continuous in position and velocity)
-float3 HermiteInterpolate(const float3 &pos0, const float3 &vel0, const float3 &pos1, const float3 &vel1, float t)
+void SyncManager::InterpolateTransforms(f64 frametime)
 {
-    float tt = t*t;
-    float ttt = tt*t;
-    float h1 = 2*ttt - 3*tt + 1;
-    float h2 = 1 - h1;
-    float h3 = ttt - 2*tt + t;
-    float h4 = ttt - tt;
+    PROFILE(SyncManager_InterpolateTransforms);
 
-    return h1 * pos0 + h2 * pos1 + h3 * vel0 + h4 * vel1;
-}
-
-/// Returns the tangent vector (derivative) of the Hermite curve. Note that the differential is w.r.t. timesteps along the curve from t=[0,1] 
-/// and not in "wallclock" time.
-float3 HermiteDerivative(const float3 &pos0, const float3 &vel0, const float3 &pos1, const float3 &vel1, float t)
-{
-    float tt = t*t;
-    float h1 = 6*(tt - t);
-    float h2 = -h1;
-    float h3 = 3*tt - 4*t + 1;
-    float h4 = 3*tt - 2*t;
+    clientTime_ += frametime;
 
-    return h1 * pos0 + h2 * pos1 + h3 * vel0 + h4 * vel1;
-}
-
-void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
-{
-    ScenePtr scene = scene_.lock();
-    if (!scene)
-        return;
+    // First update period is always interpolation, and extrapolation time is in addition to that.
+    transformInterpolator_.Update(InterpolationRenderTime(), Max(0.0f, maxLinExtrapTime_ - 1.0f) * updatePeriod_);
 
-    for(std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = state->entityInterpolations.begin(); 
-        iter != state->entityInterpolations.end();)
+    applyingInterpolation_ = true;
+    for(int i = 0; i < (int)transformInterpolator_.NumTracks(); ++i)
     {
-        EntityPtr e = scene->GetEntity(iter->first);
-        shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
-        if (!placeable.get())
-        {
-            std::map<entity_id_t, RigidBodyInterpolationState>::iterator del = iter++;
-            state->entityInterpolations.erase(del);
+        TransformInterpolator::TrackState trackState = transformInterpolator_.State(i);
+        if (trackState == TransformInterpolator::Idle)
             continue;
-        }
 
-        shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
-
-        RigidBodyInterpolationState &r = iter->second;
-        if (!r.interpolatorActive)
-        {
-            ++iter;
+        shared_ptr<EC_Placeable> placeable = transformInterpolator_.Placeable(i);
+        if (!placeable)
             continue;
-        }
-
-        const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
-
-        // Test: Uncomment to only interpolate.
-//        r.interpTime = std::min(1.0f, r.interpTime + (float)frametime / interpPeriod);
-        r.interpTime += (float)frametime / interpPeriod;
+        placeable->transform.Set(transformInterpolator_.CurrentTransform(i), AttributeChange::LocalOnly);
 
-        // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
-        const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
-
-        float3 pos;
-        if (r.interpTime < 1.0f) // Interpolating between two messages from server.
-        {
-            if (isNewtonian)
-                pos = HermiteInterpolate(r.interpStart.pos, r.interpStart.vel * interpPeriod, r.interpEnd.pos, r.interpEnd.vel * interpPeriod, r.interpTime);
-            else
-                pos = HermiteInterpolate(r.interpStart.pos, float3::zero, r.interpEnd.pos, float3::zero, r.interpTime);
-        }
-        else // Linear extrapolation if server has not sent an update.
-        {
-            if (isNewtonian && maxLinExtrapTime_ > 1.0f)
-                pos = r.interpEnd.pos + r.interpEnd.vel * (r.interpTime-1.f) * interpPeriod;
-            else
-                pos = r.interpEnd.pos;
-        }
-        ///\todo Orientation is only interpolated, and capped to end result. Also extrapolate orientation.
-        Quat rot = Quat::Slerp(r.interpStart.rot, r.interpEnd.rot, Clamp01(r.interpTime));
-        float3 scale = float3::Lerp(r.interpStart.scale, r.interpEnd.scale, Clamp01(r.interpTime));
-        
-        Transform t;
-        t.SetPos(pos);
-        t.SetOrientation(rot);
-        t.SetScale(scale);
-        placeable->transform.Set(t, AttributeChange::LocalOnly);
+        shared_ptr<EC_RigidBody> rigidBody = transformInterpolator_.RigidBody(i);
+        if (!rigidBody)
+            continue;
 
         // Local simulation steps:
-        // One fixed update interval: interpolate
-        // Two subsequent update intervals: linear extrapolation
-        // All subsequente update intervals: local physics extrapolation.
-        if (r.interpTime >= maxLinExtrapTime_) // Hand-off to client-side physics?
+        // Up to the newest snapshot: interpolate
+        // Until the extrapolation time runs out: linear extrapolation
+        // After that: local physics extrapolation.
+        if (trackState == TransformInterpolator::Finished) // Hand-off to client-side physics?
         {
-            if (rigidBody)
+            if (!noClientPhysicsHandoff_)
             {
-                if (!noClientPhysicsHandoff_)
-                {
-                    bool objectIsInRest = (r.interpEnd.vel.LengthSq() < 1e-4f && r.interpEnd.angVel.LengthSq() < 1e-4f);
-                    // Now the local client-side physics will take over the simulation of this rigid body, but only if the object
-                    // is moving. This is because the client shouldn't wake up the object (locally) if it's stationary, but wait for the
-                    // server-side signal for that event.
-                    rigidBody->SetClientExtrapolating(objectIsInRest == false);
-                    // Give starting parameters for the simulation.
-                    rigidBody->linearVelocity.Set(r.interpEnd.vel, AttributeChange::LocalOnly);
-                    rigidBody->angularVelocity.Set(r.interpEnd.angVel, AttributeChange::LocalOnly);
-                }
+                float3 linearVel = transformInterpolator_.LatestVelocity(i);
+                float3 angularVel = transformInterpolator_.LatestAngularVelocity(i);
+                bool objectIsInRest = (linearVel.LengthSq() < 1e-4f && angularVel.LengthSq() < 1e-4f);
+                // Now the local client-side physics will take over the simulation of this rigid body, but only if the object
+                // is moving. This is because the client shouldn't wake up the object (locally) if it's stationary, but wait for the
+                // server-side signal for that event.
+                rigidBody->SetClientExtrapolating(objectIsInRest == false);
+                // Give starting parameters for the simulation.
+                rigidBody->linearVelocity.Set(linearVel, AttributeChange::LocalOnly);
+                rigidBody->angularVelocity.Set(angularVel, AttributeChange::LocalOnly);
             }
-            r.interpolatorActive = false;
-            ++iter;
-            
-            // Could remove the interpolation structure here, as inter/extrapolation it is no longer active. However, it is currently
-            // used to store most recently received entity position  & velocity data.
-            //iter = state->entityInterpolations.erase(iter); // Finished interpolation.
         }
         else // Interpolation or linear extrapolation.
         {
-            if (rigidBody)
-            {
-                // Ensure that the local side physics is not driving the position of this entity.
-                rigidBody->SetClientExtrapolating(false);
+            // Ensure that the local side physics is not driving the position of this entity.
+            rigidBody->SetClientExtrapolating(false);
 
-                // Setting these is rather redundant, since Bullet doesn't simulate the entity using these variables. However, other
-                // (locally simulated) objects can collide to this entity, in which case it's good to have the proper velocities for bullet,
-                // so that the collision response simulates the appropriate forces/velocities in play.
-                float3 curVel = float3::Lerp(r.interpStart.vel, r.interpEnd.vel, Clamp01(r.interpTime));
-                // Test: To set continous velocity based on the Hermite curve, use the following:
- //               float3 curVel = HermiteDerivative(r.interpStart.pos, r.interpStart.vel*interpPeriod, r.interpEnd.pos, r.interpEnd.vel*interpPeriod, r.interpTime);
-
-                rigidBody->linearVelocity.Set(curVel, AttributeChange::LocalOnly);
-
-                ///\todo Setup angular velocity.
-                rigidBody->angularVelocity.Set(float3::zero, AttributeChange::LocalOnly);
-            }
-            ++iter;
+            // Setting these is rather redundant, since Bullet doesn't simulate the entity using these variables. However, other
+            // (locally simulated) objects can collide to this entity, in which case it's good to have the proper velocities for bullet,
+            // so that the collision response simulates the appropriate forces/velocities in play.
+            rigidBody->linearVelocity.Set(transformInterpolator_.CurrentVelocity(i), AttributeChange::LocalOnly);
+            rigidBody->angularVelocity.Set(transformInterpolator_.CurrentAngularVelocity(i), AttributeChange::LocalOnly);
         }
     }
+    applyingInterpolation_ = false;
+}
+
+void SyncManager::BufferTransformSnapshot(const shared_ptr<EC_Placeable> &placeable, const Transform &transform)
+{
+    Entity *entity = placeable->ParentEntity();
+    if (!entity)
+        return;
+
+    int track = transformInterpolator_.GetOrCreateTrack(entity->Id(), placeable, entity->GetComponent<EC_RigidBody>());
+    const f64 renderTime = InterpolationRenderTime();
+    if (transformInterpolator_.NeedsStartSnapshot(track, renderTime))
+        transformInterpolator_.AddSnapshot(track, renderTime, placeable->transform.Get(), float3::zero, float3::zero, false);
+    transformInterpolator_.AddSnapshot(track, clientTime_, transform, float3::zero, float3::zero, false);
 }
 
 void SyncManager::Update(f64 frametime)
 {
     PROFILE(SyncManager_Update);
 
-    // For the client, smoothly update all rigid bodies by interpolating.
+    // For the client, smoothly update all replicated transforms by interpolating.
     if (!owner_->IsServer())
-        InterpolateRigidBodies(frametime, &server_syncstate_);
+        InterpolateTransforms(frametime);
 
     // Check if it is yet time to perform a network update tick.
     updateAcc_ += (float)frametime;
@@ -877,54 +1350,63 @@ void SyncManager::Update(f64 frametime)
     if (owner_->IsServer())
     {
         // If we are server, process all authenticated users
-
-        // Then send out changes to other attributes via the generic sync mechanism.
+        std::vector<UserConnection*> syncedUsers;
         UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState)
-            {
-                // First send out all changes to rigid bodies.
-                // After processing this function, the bits related to rigid body states have been cleared,
-                // so the generic sync will not double-replicate the rigid body positions and velocities.
-                ReplicateRigidBodyChanges((*i)->connection, (*i)->syncState.get());
+                syncedUsers.push_back(i->get());
+
+        // The profile is only changed here on the main thread, as the sync states are serialized with it.
+        UpdateRigidBodyQuantizationBounds();
 
-                ProcessSyncState((*i)->connection, (*i)->syncState.get());
+        // Serialize the sync states of all users, possibly in parallel. The scene is only read during this.
+        SerializeUserSyncStates(syncedUsers);
+
+        // Hand the crafted messages to kNet on the main thread.
+        for(size_t i = 0; i < syncedUsers.size(); ++i)
+        {
+            if (syncOutputs_[i].failed)
+            {
+                // The changes that were already consumed from the sync state would never reach the client, so it can not be kept in sync any more.
+                foreach(const QString &error, syncOutputs_[i].errors)
+                    LogError(error);
+                LogError("SyncManager: Disconnecting connection " + QString::number(syncedUsers[i]->ConnectionId()) + ".");
+                syncOutputs_[i].Clear();
+                syncedUsers[i]->Disconnect();
+                continue;
             }
+            SendSyncStateOutput(syncedUsers[i]->connection, syncOutputs_[i]);
+        }
+
+        // The encoded changes are only valid for this tick.
+        encodedComponents_.clear();
     }
     else
     {
         // If we are client, process just the server sync state
         kNet::MessageConnection* connection = owner_->GetKristalliModule()->GetMessageConnection();
         if (connection)
-            ProcessSyncState(connection, &server_syncstate_);
+        {
+            if (syncScratchBuffers_.empty())
+                syncScratchBuffers_.push_back(MAKE_SHARED(SyncScratchBuffers));
+            ProcessSyncState(serverSyncOutput_, *syncScratchBuffers_[0], &server_syncstate_);
+            SendSyncStateOutput(connection, serverSyncOutput_);
+        }
+        encodedComponents_.clear();
     }
 }
 
-void SyncManager::ReplicateRigidBodyChanges(kNet::MessageConnection* destination, SceneSyncState* state)
+void SyncManager::ReplicateRigidBodyChanges(SyncStateOutput& output, SyncScratchBuffers& scratch, SceneSyncState* state)
 {
-    PROFILE(SyncManager_ReplicateRigidBodyChanges);
-    
     ScenePtr scene = scene_.lock();
     if (!scene)
         return;
 
-    const int maxMessageSizeBytes = 1400;
-    kNet::NetworkMessage *msg = destination->StartNewMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes);
-    msg->contentID = 0;
-    msg->inOrder = true;
-    msg->reliable = false;
-    kNet::DataSerializer ds(msg->data, maxMessageSizeBytes);
-
+    // Gather the changed rigid bodies first, so that they can be written in the order of their IDs.
+    std::vector<PendingRigidBodyUpdate> &updates = scratch.rigidBodyUpdates;
+    updates.clear();
     for(std::list<EntitySyncState*>::iterator iter = state->dirtyQueue.begin(); iter != state->dirtyQueue.end(); ++iter)
     {
-        const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
-        // If we filled up this message, send it out and start crafting anothero one.
-        if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
-        {
-            destination->EndAndQueueMessage(msg, ds.BytesFilled());
-            msg = destination->StartNewMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes);
-            ds = kNet::DataSerializer(msg->data, maxMessageSizeBytes);
-        }
         EntitySyncState &ess = **iter;
 
         if (ess.isNew || ess.removed)
@@ -949,6 +1431,7 @@ void SyncManager::ReplicateRigidBodyChanges(kNet::MessageConnection* destination
         }
         bool velocityDirty = false;
         bool angularVelocityDirty = false;
+        bool reliable = false;
         
         shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
         if (rigidBody)
@@ -965,20 +1448,20 @@ void SyncManager::ReplicateRigidBodyChanges(kNet::MessageConnection* destination
                     rss.dirtyAttributes[1] &= ~(1 << 5);
                     rss.dirtyAttributes[1] &= ~(1 << 6);
 
-                    velocityDirty = velocityDirty && (rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f);
-                    angularVelocityDirty = angularVelocityDirty && (rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f);
+                    velocityDirty = velocityDirty && rigidBody->linearVelocity.Get().Distance(ess.linearVelocity) > rigidBodyQuantization_.MinLinearVelocityChange();
+                    angularVelocityDirty = angularVelocityDirty && rigidBody->angularVelocity.Get().Distance(ess.angularVelocity) > rigidBodyQuantization_.MinAngularVelocityChange();
 
                     // If the object enters rest, force an update, and force the update to be sent as reliable, so that the client
                     // is guaranteed to receive the message, and will put the object to rest, instead of extrapolating it away indefinitely.
                     if (rigidBody->linearVelocity.Get().IsZero(1e-4f) && !ess.linearVelocity.IsZero(1e-4f))
                     {
                         velocityDirty = true;
-                        msg->reliable = true;
+                        reliable = true;
                     }
                     if (rigidBody->angularVelocity.Get().IsZero(1e-4f) && !ess.angularVelocity.IsZero(1e-4f))
                     {
                         angularVelocityDirty = true;
-                        msg->reliable = true;
+                        reliable = true;
                     }
                 }
             }
@@ -989,167 +1472,81 @@ void SyncManager::ReplicateRigidBodyChanges(kNet::MessageConnection* destination
 
         const Transform &t = placeable->transform.Get();
 
-        float timeSinceLastSend = kNet::Clock::SecondsSinceF(ess.lastNetworkSendTime);
-        const float3 predictedClientSidePosition = ess.transform.pos + timeSinceLastSend * ess.linearVelocity;
-        float error = t.pos.DistanceSq(predictedClientSidePosition);
-        UNREFERENCED_PARAM(error)
-        // TEST: To have the server estimate how far the client has simulated, use this.
-//        bool posChanged = transformDirty && (timeSinceLastSend > 0.2f || t.pos.DistanceSq(/*ess.transform.pos*/ predictedClientSidePosition) > 5e-5f);
-        bool posChanged = transformDirty && t.pos.DistanceSq(ess.transform.pos) > 1e-3f;
-        bool rotChanged = transformDirty && (t.rot.DistanceSq(ess.transform.rot) > 1e-1f);
+        // The sync state holds the values the client has decoded, so the changes are measured against what the client actually has.
+        bool posChanged = transformDirty && t.pos.Distance(ess.transform.pos) > rigidBodyQuantization_.MinPositionChange();
+        bool rotChanged = transformDirty && RigidBodyQuantization::RotationDistance(t.Orientation(), ess.transform.Orientation()) > rigidBodyQuantization_.MinRotationChange();
         bool scaleChanged = transformDirty && (t.scale.DistanceSq(ess.transform.scale) > 1e-3f);
-
-        // Detect whether to send compact or full states for each variable.
-        // 0 - don't send, 1 - send compact, 2 - send full.
-        int posSendType = posChanged ? (t.pos.Abs().MaxElement() >= 1023.f ? 2 : 1) : 0;
-        int rotSendType;
-        int scaleSendType;
-        int velSendType;
-        int angVelSendType;
-
-        float3x3 rot;
-        if (rotChanged)
-        {
-            rot = t.Orientation3x3();
-            float3 fwd = rot.Col(2);
-            float3 up = rot.Col(1);
-            float3 planeNormal = float3::unitY.Cross(rot.Col(2));
-            float d = planeNormal.Dot(rot.Col(1));
-
-            if (up.Dot(float3::unitY) >= 0.999f)
-                rotSendType = 1; // Looking upright, 1 DOF.
-            else if (Abs(d) <= 0.001f && Abs(fwd.Dot(float3::unitY)) < 0.95f && up.Dot(float3::unitY) > 0.f)
-                rotSendType = 2; // No roll, i.e. 2 DOF. Use this only if not looking too close towards the +Y axis, due to precision issues, and only when object +Y is towards world up.
-            else
-                rotSendType = 3; // Full 3 DOF
-        }
-        else
-            rotSendType = 0;
-
-        if (scaleChanged)
-        {
-            float3 s = t.scale.Abs();
-            scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
-        }
-        else
-            scaleSendType = 0;
-
-        const float3 &linearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-        const float3 angVel = rigidBody ? DegToRad(rigidBody->angularVelocity.Get()) : float3::zero;
-
-        velSendType = velocityDirty ? (linearVel.LengthSq() >= 64.f ? 2 : 1) : 0;
-        angVelSendType = angularVelocityDirty ? 1 : 0;
-
-        if (posSendType == 0 && rotSendType == 0 && scaleSendType == 0 && velSendType == 0 && angVelSendType == 0)
+        if (!posChanged && !rotChanged && !scaleChanged && !velocityDirty && !angularVelocityDirty)
             continue;
 
-        size_t bitIdx = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitIdx)
-        ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
-
-        ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2); // Sends fixed 8 bits.
-        if (posSendType == 1) // Sends fixed 57 bits.
-        {
-            ds.AddSignedFixedPoint(11, 8, t.pos.x);
-            ds.AddSignedFixedPoint(11, 8, t.pos.y);
-            ds.AddSignedFixedPoint(11, 8, t.pos.z);
-        }
-        else if (posSendType == 2) // Sends fixed 96 bits.
-        {
-            ds.Add<float>(t.pos.x);
-            ds.Add<float>(t.pos.y);
-            ds.Add<float>(t.pos.z);
-        }        
-
-        if (rotSendType == 1) // Orientation with 1 DOF, only yaw.
-        {
-            // The transform is looking straight forward, i.e. the +y vector of the transform local space points straight towards +y in world space.
-            // Therefore the forward vector has y == 0, so send (x,z) as a 2D vector.
-            ds.AddNormalizedVector2D(rot.Col(2).x, rot.Col(2).z, 8);  // Sends fixed 8 bits.
-        }
-        else if (rotSendType == 2) // Orientation with 2 DOF, yaw and pitch.
-        {
-            float3 forward = rot.Col(2);
-            forward.Normalize();
-            ds.AddNormalizedVector3D(forward.x, forward.y, forward.z, 9, 8); // Sends fixed 17 bits.
-        }
-        else if (rotSendType == 3) // Orientation with 3 DOF, full yaw, pitch and roll.
-        {
-            Quat o = t.Orientation();
-
-            float3 axis;
-            float angle;
-            o.ToAxisAngle(axis, angle);
-            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
-            {
-                axis = -axis;
-                angle = 2.f * 3.141592654f - angle;
-            }
-
-            // Sends 10-31 bits.
-            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-            if (quantizedAngle != 0)
-                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
-        }
-
-        if (scaleSendType == 1) // Sends fixed 32 bytes.
-        {
-            ds.Add<float>(t.scale.x);
-        }
-        else if (scaleSendType == 2) // Sends fixed 96 bits.
+        updates.push_back(PendingRigidBodyUpdate());
+        PendingRigidBodyUpdate &pending = updates.back();
+        pending.state = &ess;
+        pending.reliable = reliable;
+        pending.update.pos = t.pos;
+        pending.update.rot = t.Orientation();
+        pending.update.scale = t.scale;
+        if (rigidBody)
         {
-            ds.Add<float>(t.scale.x);
-            ds.Add<float>(t.scale.y);
-            ds.Add<float>(t.scale.z);
+            pending.update.linearVelocity = rigidBody->linearVelocity.Get();
+            pending.update.angularVelocity = rigidBody->angularVelocity.Get();
         }
+        rigidBodyQuantization_.ChooseEncodings(pending.update, posChanged, rotChanged, scaleChanged, velocityDirty, angularVelocityDirty);
+    }
+    if (updates.empty())
+        return;
+    std::sort(updates.begin(), updates.end());
 
-        if (velSendType == 1) // Sends fixed 32 bits.
-        {
-            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 3, 8);
-            ess.linearVelocity = linearVel;
-        }
-        else if (velSendType == 2) // Sends fixed 39 bits.
-        {
-            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 10, 8);
-            ess.linearVelocity = linearVel;
+    const int maxMessageSizeBytes = 1400;
+    size_t index = 0;
+    while(index < updates.size())
+    {
+        // Find how many updates fit in this message by their exact sizes. The profile ID and the update count take at most 24 bits.
+        int numBits = 8 + 16;
+        size_t end = index;
+        for(; end < updates.size(); ++end)
+        {
+            const bool first = (end == index);
+            const int updateBits = RigidBodyQuantization::EntityIdBits(updates[end].state->id, first ? 0 : updates[end-1].state->id) +
+                rigidBodyQuantization_.NumBits(updates[end].update, first ? 0 : &updates[end-1].update);
+            if (!first && numBits + updateBits > maxMessageSizeBytes * 8)
+                break; // This message is full, continue in the next one.
+            numBits += updateBits;
         }
 
-        if (angVelSendType == 1)
-        {
-            Quat o = Quat::FromEulerZYX(angVel.z, angVel.y, angVel.x);
-
-            float3 axis;
-            float angle;
-            o.ToAxisAngle(axis, angle);
-            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
-            {
-                axis = -axis;
-                angle = 2.f * 3.141592654f - angle;
-            }
-             // Sends at most 31 bits.
-            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-            if (quantizedAngle != 0)
-                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
-
-            ess.angularVelocity = angVel;
+        std::vector<u8> buffer;
+        output.AllocateBuffer(buffer, maxMessageSizeBytes);
+        kNet::DataSerializer ds((char*)&buffer[0], maxMessageSizeBytes);
+        ds.Add<u8>(rigidBodyQuantization_.id);
+        ds.AddVLE<kNet::VLE8_16_32>((u32)(end - index));
+
+        bool reliable = false;
+        for(size_t i = index; i < end; ++i)
+        {
+            PendingRigidBodyUpdate &pending = updates[i];
+            EntitySyncState &ess = *pending.state;
+            const bool first = (i == index);
+            RigidBodyQuantization::WriteEntityId(ds, ess.id, first ? 0 : updates[i-1].state->id);
+            rigidBodyQuantization_.Write(ds, pending.update, first ? 0 : &updates[i-1].update);
+            reliable = reliable || pending.reliable;
+
+            // Write replaced the values with the decoded ones, which are the values the client now has.
+            const RigidBodyUpdate &update = pending.update;
+            if (update.posEncoding != RigidBodyUpdate::PositionNone)
+                ess.transform.pos = update.pos;
+            if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+                ess.transform.SetOrientation(update.rot);
+            if (update.scaleEncoding != RigidBodyUpdate::ScaleNone)
+                ess.transform.scale = update.scale;
+            if (update.velEncoding != RigidBodyUpdate::VelocityNone)
+                ess.linearVelocity = update.linearVelocity;
+            if (update.angVelEncoding != RigidBodyUpdate::VelocityNone)
+                ess.angularVelocity = update.angularVelocity;
+            ess.lastNetworkSendTime = kNet::Clock::Tick();
         }
-        if (posSendType != 0)
-            ess.transform.pos = t.pos;
-        if (rotSendType != 0)
-            ess.transform.rot = t.rot;
-        if (scaleSendType != 0)
-            ess.transform.scale = t.scale;
-
-//        std::cout << "pos: " << posSendType << ", rot: " << rotSendType << ", scale: " << scaleSendType << ", vel: " << velSendType << ", angvel: " << angVelSendType << std::endl;
-
-        size_t bitsEnd = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitsEnd)
-        ess.lastNetworkSendTime = kNet::Clock::Tick();
+        output.QueueMessage(cRigidBodyUpdateMessage, reliable, true, buffer, ds.BytesFilled(), false);
+        index = end;
     }
-    if (ds.BytesFilled() > 0)
-        destination->EndAndQueueMessage(msg, ds.BytesFilled());
-    else
-        destination->FreeMessage(msg);
 }
 
 void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
@@ -1159,176 +1556,85 @@ void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::
         return;
 
     kNet::DataDeserializer dd(data, numBytes);
-    while(dd.BitsLeft() >= 9)
+    const u8 profileId = dd.Read<u8>();
+    // The server may have sent updates with its previous profile before the new one reached us.
+    const RigidBodyQuantization *profile = 0;
+    if (profileId == rigidBodyQuantization_.id)
+        profile = &rigidBodyQuantization_;
+    else if (profileId == previousRigidBodyQuantization_.id)
+        profile = &previousRigidBodyQuantization_;
+    else
+        return; // Encoded with a quantization profile we have not received yet. The next update will carry the changes.
+
+    const u32 numUpdates = dd.ReadVLE<kNet::VLE8_16_32>();
+    u32 entityID = 0;
+    RigidBodyUpdate previousUpdate;
+    for(u32 updateIndex = 0; updateIndex < numUpdates; ++updateIndex)
     {
-        u32 entityID = dd.ReadVLE<kNet::VLE8_16_32>();
+        entityID = RigidBodyQuantization::ReadEntityId(dd, entityID);
         EntityPtr e = scene->GetEntity(entityID);
         shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
         shared_ptr<EC_RigidBody> rigidBody = e ? e->GetComponent<EC_RigidBody>() : shared_ptr<EC_RigidBody>();
         Transform t = e ? placeable->transform.Get() : Transform();
 
         float3 newLinearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-
-        // If the server omitted linear velocity, interpolate towards the last received linear velocity.
-        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = e ? server_syncstate_.entityInterpolations.find(entityID) : server_syncstate_.entityInterpolations.end();
-        if (iter != server_syncstate_.entityInterpolations.end())
-            newLinearVel = iter->second.interpEnd.vel;
-
-        int posSendType;
-        int rotSendType;
-        int scaleSendType;
-        int velSendType;
-        int angVelSendType;
-        dd.ReadArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2);
-
-        if (posSendType == 1)
-        {
-            t.pos.x = dd.ReadSignedFixedPoint(11, 8);
-            t.pos.y = dd.ReadSignedFixedPoint(11, 8);
-            t.pos.z = dd.ReadSignedFixedPoint(11, 8);
-        }
-        else if (posSendType == 2)
-        {
-            t.pos.x = dd.Read<float>();
-            t.pos.y = dd.Read<float>();
-            t.pos.z = dd.Read<float>();
-        }
-
-        if (rotSendType == 1) // 1 DOF
-        {
-            float3 forward;
-            dd.ReadNormalizedVector2D(8, forward.x, forward.z);
-            forward.y = 0.f;
-            float3x3 orientation = float3x3::LookAt(float3::unitZ, forward, float3::unitY, float3::unitY);
-            t.SetOrientation(orientation);
-        }
-        else if (rotSendType == 2)
-        {
-            float3 forward;
-            dd.ReadNormalizedVector3D(9, 8, forward.x, forward.y, forward.z);
-
-            float3x3 orientation = float3x3::LookAt(float3::unitZ, forward, float3::unitY, float3::unitY);
-            t.SetOrientation(orientation);
-
-        }
-        else if (rotSendType == 3)
-        {
-            // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
-	        u32 quantizedAngle = dd.ReadBits(10);
-            if (quantizedAngle != 0)
-            {
-                float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
-                float3 axis;
-                dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
-                t.SetOrientation(Quat(axis, angle));
-            }
-            else
-                t.SetOrientation(Quat::identity);
-        }
-
-        if (scaleSendType == 1)
-            t.scale = float3::FromScalar(dd.Read<float>());
-        else if (scaleSendType == 2)
-        {
-            t.scale.x = dd.Read<float>();
-            t.scale.y = dd.Read<float>();
-            t.scale.z = dd.Read<float>();
-        }
-
-        if (velSendType == 1)
-            dd.ReadVector3D(11, 10, 3, 8, newLinearVel.x, newLinearVel.y, newLinearVel.z);
-        else if (velSendType == 2)
-            dd.ReadVector3D(11, 10, 10, 8, newLinearVel.x, newLinearVel.y, newLinearVel.z);
-
         float3 newAngVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
 
-        if (angVelSendType == 1)
+        // If the server omitted some of the values, they are unchanged since the last received snapshot.
+        int track = e ? transformInterpolator_.FindTrack(entityID) : -1;
+        if (track >= 0 && transformInterpolator_.HasSnapshots(track))
         {
-            // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
-            u32 quantizedAngle = dd.ReadBits(10);
-            if (quantizedAngle != 0)
-            {
-                float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
-                float3 axis;
-                dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
-                Quat q(axis, angle);
-                newAngVel = q.ToEulerZYX();
-                Swap(newAngVel.z, newAngVel.x);
-                newAngVel = RadToDeg(newAngVel);
-            }
+            t = transformInterpolator_.LatestTransform(track);
+            newLinearVel = transformInterpolator_.LatestVelocity(track);
+            newAngVel = transformInterpolator_.LatestAngularVelocity(track);
         }
 
+        RigidBodyUpdate update;
+        update.pos = t.pos;
+        update.scale = t.scale;
+        update.linearVelocity = newLinearVel;
+        update.angularVelocity = newAngVel;
+        profile->Read(dd, update, updateIndex > 0 ? &previousUpdate : 0);
+        previousUpdate = update;
+
+        t.pos = update.pos;
+        if (update.rotEncoding != RigidBodyUpdate::RotationNone)
+            t.SetOrientation(update.rot);
+        t.scale = update.scale;
+        newLinearVel = update.linearVelocity;
+        newAngVel = update.angularVelocity;
+
         if (!e) // Discard this message - we don't have the entity in our scene to which the message applies to.
             continue;
 
         // Did anything change?
-        if (posSendType != 0 || rotSendType != 0 || scaleSendType != 0 || velSendType != 0 || angVelSendType != 0)
+        if (update.posEncoding != RigidBodyUpdate::PositionNone || update.rotEncoding != RigidBodyUpdate::RotationNone ||
+            update.scaleEncoding != RigidBodyUpdate::ScaleNone || update.velEncoding != RigidBodyUpdate::VelocityNone ||
+            update.angVelEncoding != RigidBodyUpdate::VelocityNone)
         {
-            // Create or update the interpolation state.
-            Transform orig = placeable->transform.Get();
-
-            std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = server_syncstate_.entityInterpolations.find(entityID);
-            if (iter != server_syncstate_.entityInterpolations.end())
+            if (track >= 0 && source->GetSocket() && source->GetSocket()->TransportLayer() == kNet::SocketOverUDP)
             {
-                RigidBodyInterpolationState &interp = iter->second;
+                if (kNet::PacketIDIsNewerThan(transformInterpolator_.LastReceivedPacket(track), packetId))
+                    continue; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
+            }
 
-                if (source->GetSocket() && source->GetSocket()->TransportLayer() == kNet::SocketOverUDP)
-                {
-                    if (kNet::PacketIDIsNewerThan(interp.lastReceivedPacketCounter, packetId))
-                        continue; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
-                }
-                
-                interp.lastReceivedPacketCounter = packetId;
+            track = transformInterpolator_.GetOrCreateTrack(entityID, placeable, rigidBody);
+            transformInterpolator_.SetLastReceivedPacket(track, packetId);
 
-                const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
-                float3 curVel;
+            // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
+            const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
 
-                if (interp.interpTime < 1.0f)
-                    curVel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel*interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel*interpPeriod, interp.interpTime);
-                else
-                    curVel = interp.interpEnd.vel;
-                float3 curAngVel = float3::zero; ///\todo
-                interp.interpStart.pos = orig.pos;
-                if (posSendType != 0)
-                    interp.interpEnd.pos = t.pos;
-                interp.interpStart.rot = orig.Orientation();
-                if (rotSendType != 0)
-                    interp.interpEnd.rot = t.Orientation();
-                interp.interpStart.scale = orig.scale;
-                if (scaleSendType != 0)
-                    interp.interpEnd.scale = t.scale;
-                interp.interpStart.vel = curVel;
-                if (velSendType != 0)
-                    interp.interpEnd.vel = newLinearVel;
-                interp.interpStart.angVel = curAngVel;
-                if (angVelSendType != 0)
-                    interp.interpEnd.angVel = newAngVel;
-                interp.interpTime = 0.f;
-                interp.interpolatorActive = true;
-
-                // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
-                const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
-                if (!isNewtonian)
-                    interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
-            }
-            else
+            // If the buffer has run dry, continue from where the entity currently is.
+            const f64 renderTime = InterpolationRenderTime();
+            if (transformInterpolator_.NeedsStartSnapshot(track, renderTime))
             {
-                RigidBodyInterpolationState interp;
-                interp.interpStart.pos = orig.pos;
-                interp.interpEnd.pos = t.pos;
-                interp.interpStart.rot = orig.Orientation();
-                interp.interpEnd.rot = t.Orientation();
-                interp.interpStart.scale = orig.scale;
-                interp.interpEnd.scale = t.scale;
-                interp.interpStart.vel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-                interp.interpEnd.vel = newLinearVel;
-                interp.interpStart.angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
-                interp.interpEnd.angVel = newAngVel;
-                interp.interpTime = 0.f;
-                interp.lastReceivedPacketCounter = packetId;
-                interp.interpolatorActive = true;
-                server_syncstate_.entityInterpolations[entityID] = interp;
+                TransformInterpolator::TrackState trackState = transformInterpolator_.State(track);
+                const bool active = (trackState == TransformInterpolator::Interpolating || trackState == TransformInterpolator::Extrapolating);
+                float3 curVel = active ? transformInterpolator_.CurrentVelocity(track) : (rigidBody ? rigidBody->linearVelocity.Get() : float3::zero);
+                float3 curAngVel = active ? transformInterpolator_.CurrentAngularVelocity(track) : (rigidBody ? rigidBody->angularVelocity.Get() : float3::zero);
+                transformInterpolator_.AddSnapshot(track, renderTime, placeable->transform.Get(), curVel, curAngVel, isNewtonian);
             }
+            transformInterpolator_.AddSnapshot(track, clientTime_, t, newLinearVel, newAngVel, isNewtonian);
         }
     }
 }
@@ -1377,10 +1683,8 @@ void SyncManager::HandleEditEntityProperties(kNet::MessageConnection* source, co
     state->entities[entityID].hasPropertyChanges = false;
 }
 
-void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state)
+void SyncManager::ProcessSyncState(SyncStateOutput& output, SyncScratchBuffers& scratch, SceneSyncState* state)
 {
-    PROFILE(SyncManager_ProcessSyncState);
-    
     unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
     
     ScenePtr scene = scene_.lock();
@@ -1401,7 +1705,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
         if (!entity)
         {
             if (!entityState.removed)
-                LogWarning("Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state");
+                output.warnings << "Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state";
             entityState.isNew = false;
             removeState = true;
         }
@@ -1418,7 +1722,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             // If we have both new & removed flags on the entity, it will probably result in buggy behaviour
             if (entityState.isNew)
             {
-                LogWarning("Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!");
+                output.warnings << "Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!";
                 // The delete has been processed. Do not remember it anymore, but requeue the state for creation
                 entityState.removed = false;
                 removeState = false;
@@ -1428,16 +1732,34 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             else
                 removeState = true;
             
-            kNet::DataSerializer ds(removeEntityBuffer_, 1024);
+            std::vector<u8> buffer;
+            output.AllocateBuffer(buffer, 2 * cMaxVLESize);
+            kNet::DataSerializer ds((char*)&buffer[0], buffer.size());
             ds.AddVLE<kNet::VLE8_16_32>(sceneId);
             ds.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-            QueueMessage(destination, cRemoveEntityMessage, true, true, ds);
+            output.QueueMessage(cRemoveEntityMessage, true, true, buffer, ds.BytesFilled());
             ++numMessagesSent;
         }
         // New entity
         else if (entityState.isNew)
         {
-            kNet::DataSerializer ds(createEntityBuffer_, 64 * 1024);
+            // Encode the replicated components first to know the size of the message. The entity is created in one
+            // message however large it is, so that the receiver gets all of its components at once.
+            const Entity::ComponentMap& components = entity->Components();
+            scratch.componentData.clear();
+            size_t maxBytes = 3 * cMaxVLESize + 1;
+            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+            {
+                if (!i->second->IsReplicated())
+                    continue;
+                const std::vector<u8> &attrData = EncodeComponentAttributes(scratch, entity->Id(), i->second.get());
+                scratch.componentData.push_back(&attrData);
+                maxBytes += ComponentFullUpdateMaxSize(i->second.get(), attrData);
+            }
+            
+            std::vector<u8> buffer;
+            output.AllocateBuffer(buffer, maxBytes);
+            kNet::DataSerializer ds((char*)&buffer[0], maxBytes);
             
             // Entity identification and temporary flag
             ds.AddVLE<kNet::VLE8_16_32>(sceneId);
@@ -1445,28 +1767,21 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             // Do not write the temporary flag as a bit to not desync the byte alignment at this point, as a lot of data potentially follows
             ds.Add<u8>(entity->IsTemporary() ? 1 : 0);
             
-            const Entity::ComponentMap& components = entity->Components();
-            // Count the amount of replicated components
-            uint numReplicatedComponents = 0;
-            for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
-            {
-                if (i->second->IsReplicated())
-                    ++numReplicatedComponents;
-            }
-            ds.AddVLE<kNet::VLE8_16_32>(numReplicatedComponents);
+            ds.AddVLE<kNet::VLE8_16_32>((u32)scratch.componentData.size());
             
             // Serialize each replicated component
+            size_t compIndex = 0;
             for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
             {
                 ComponentPtr comp = i->second;
                 if (!comp->IsReplicated())
                     continue;
-                WriteComponentFullUpdate(ds, comp);
+                WriteComponentFullUpdate(ds, comp.get(), *scratch.componentData[compIndex++]);
                 // Mark the component undirty in the receiver's syncstate
                 state->MarkComponentProcessed(entity->Id(), comp->Id());
             }
             
-            QueueMessage(destination, cCreateEntityMessage, true, true, ds);
+            output.QueueMessage(cCreateEntityMessage, true, true, buffer, ds.BytesFilled());
             ++numMessagesSent;
             
             // The create has been processed fully. Clear dirty flags.
@@ -1476,12 +1791,12 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
         {
             if (!entityState.dirtyQueue.empty())
             {
-                // Components or attributes have been added, changed, or removed. Prepare the dataserializers
-                kNet::DataSerializer removeCompsDs(removeCompsBuffer_, 1024);
-                kNet::DataSerializer removeAttrsDs(removeAttrsBuffer_, 1024);
-                kNet::DataSerializer createCompsDs(createCompsBuffer_, 64 * 1024);
-                kNet::DataSerializer createAttrsDs(createAttrsBuffer_, 16 * 1024);
-                kNet::DataSerializer editAttrsDs(editAttrsBuffer_, 64 * 1024);
+                // Components or attributes have been added, changed, or removed. Prepare the message builders
+                SyncMessageBuilder removeComps(output, cRemoveComponentsMessage, sceneId, entityState.id);
+                SyncMessageBuilder removeAttrs(output, cRemoveAttributesMessage, sceneId, entityState.id);
+                SyncMessageBuilder createComps(output, cCreateComponentsMessage, sceneId, entityState.id);
+                SyncMessageBuilder createAttrs(output, cCreateAttributesMessage, sceneId, entityState.id);
+                SyncMessageBuilder editAttrs(output, cEditAttributesMessage, sceneId, entityState.id);
                 
                 while (!entityState.dirtyQueue.empty())
                 {
@@ -1494,7 +1809,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                     if (!comp)
                     {
                         if (!compState.removed)
-                            LogWarning("Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->");
+                            output.warnings << "Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->";
                         compState.isNew = false;
                         removeCompState = true;
                     }
@@ -1510,26 +1825,17 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                     {
                         removeCompState = true;
                         
-                        // If first component, write the entity ID first
-                        if (!removeCompsDs.BytesFilled())
-                        {
-                            removeCompsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                            removeCompsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                        }
-                        // Then add component ID
+                        kNet::DataSerializer removeCompsDs = removeComps.BeginItem(cMaxVLESize);
                         removeCompsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
+                        removeComps.EndItem(removeCompsDs);
                     }
                     // New component
                     else if (compState.isNew)
                     {
-                        // If first component, write the entity ID first
-                        if (!createCompsDs.BytesFilled())
-                        {
-                            createCompsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                            createCompsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                        }
-                        // Then add the component data
-                        WriteComponentFullUpdate(createCompsDs, comp);
+                        const std::vector<u8> &attrData = EncodeComponentAttributes(scratch, entity->Id(), comp.get());
+                        kNet::DataSerializer createCompsDs = createComps.BeginItem(ComponentFullUpdateMaxSize(comp.get(), attrData));
+                        WriteComponentFullUpdate(createCompsDs, comp.get(), attrData);
+                        createComps.EndItem(createCompsDs);
                         // Mark the component undirty in the receiver's syncstate
                         state->MarkComponentProcessed(entity->Id(), comp->Id());
                     }
@@ -1548,43 +1854,37 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                             {
                                 // Create attribute. Make sure it exists and is dynamic.
                                 if (attrIndex >= attrs.size() || !attrs[attrIndex])
-                                    LogError("CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                    output.errors << "CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.";
                                 else if (!attrs[attrIndex]->IsDynamic())
-                                    LogError("CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                    output.errors << "CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.";
                                 else
                                 {
-                                    // If first attribute, write the entity ID first
-                                    if (!createAttrsDs.BytesFilled())
-                                    {
-                                        createAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                        createAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                                    }
-                                    
+                                    // Encode the value first to know the size of the item
                                     IAttribute* attr = attrs[attrIndex];
+                                    const size_t valueBytes = EncodeAttributeValue(scratch, attr);
+                                    kNet::DataSerializer createAttrsDs = createAttrs.BeginItem(cMaxVLESize + 2 + cMaxStringPrefixSize + 3 * attr->Name().length() + valueBytes);
                                     createAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                                     createAttrsDs.Add<u8>(attrIndex); // Index
                                     createAttrsDs.Add<u8>(attr->TypeId());
                                     createAttrsDs.AddString(attr->Name().toStdString());
-                                    attr->ToBinary(createAttrsDs);
+                                    if (valueBytes > 0)
+                                        createAttrsDs.AddArray<u8>(&scratch.attrData[0], (u32)valueBytes);
+                                    createAttrs.EndItem(createAttrsDs);
                                 }
                             }
                             else
                             {
                                 // Remove attribute
-                                // If first attribute, write the entity ID first
-                                if (!removeAttrsDs.BytesFilled())
-                                {
-                                    removeAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                    removeAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                                }
+                                kNet::DataSerializer removeAttrsDs = removeAttrs.BeginItem(cMaxVLESize + 1);
                                 removeAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                                 removeAttrsDs.Add<u8>(attrIndex);
+                                removeAttrs.EndItem(removeAttrsDs);
                             }
                         }
                         compState.newAndRemovedAttributes.clear();
                         
                         // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
-                        changedAttributes_.clear();
+                        scratch.changedAttributes.clear();
                         unsigned numBytes = ((unsigned)attrs.size() + 7) >> 3;
                         for (unsigned i = 0; i < numBytes; ++i)
                         {
@@ -1597,59 +1897,22 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                                     {
                                         u8 attrIndex = i * 8 + j;
                                         if (attrIndex < attrs.size() && attrs[attrIndex])
-                                            changedAttributes_.push_back(attrIndex);
+                                            scratch.changedAttributes.push_back(attrIndex);
                                         else
-                                            LogError("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                            output.errors << "Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.";
                                     }
                                 }
                             }
                         }
-                        if (changedAttributes_.size())
+                        if (scratch.changedAttributes.size())
                         {
-                            // If first component for which attribute changes are sent, write the entity ID first
-                            if (!editAttrsDs.BytesFilled())
-                            {
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>(sceneId);
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            }
+                            // Add the attribute data array to the message. The data is shared with the other connections that receive the same change.
+                            const std::vector<u8> &attrData = EncodeAttributeChanges(scratch, entity->Id(), comp.get(), compState.dirtyAttributes, scratch.changedAttributes);
+                            kNet::DataSerializer editAttrsDs = editAttrs.BeginItem(2 * cMaxVLESize + attrData.size());
                             editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-                            
-                            // Create a nested dataserializer for the actual attribute data, so we can skip components
-                            kNet::DataSerializer attrDataDs(attrDataBuffer_, 16 * 1024);
-                            
-                            // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                            unsigned bitsMethod1 = (unsigned)changedAttributes_.size() * 8 + 8;
-                            unsigned bitsMethod2 = (unsigned)attrs.size();
-                            // Method 1: indices
-                            if (bitsMethod1 <= bitsMethod2)
-                            {
-                                attrDataDs.Add<kNet::bit>(0);
-                                attrDataDs.Add<u8>((u8)changedAttributes_.size());
-                                for (unsigned i = 0; i < changedAttributes_.size(); ++i)
-                                {
-                                    attrDataDs.Add<u8>(changedAttributes_[i]);
-                                    attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
-                                }
-                            }
-                            // Method 2: bitmask
-                            else
-                            {
-                                attrDataDs.Add<kNet::bit>(1);
-                                for (unsigned i = 0; i < attrs.size(); ++i)
-                                {
-                                    if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
-                                    {
-                                        attrDataDs.Add<kNet::bit>(1);
-                                        attrs[i]->ToBinary(attrDataDs);
-                                    }
-                                    else
-                                        attrDataDs.Add<kNet::bit>(0);
-                                }
-                            }
-                            
-                            // Add the attribute data array to the main serializer
-                            editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
-                            editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDataDs.BytesFilled());
+                            editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrData.size());
+                            editAttrsDs.AddArray<u8>(&attrData[0], (u32)attrData.size());
+                            editAttrs.EndItem(editAttrsDs);
                             
                             // Now zero out all remaining dirty bits
                             for (unsigned i = 0; i < numBytes; ++i)
@@ -1662,41 +1925,23 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 }
                 
                 // Send the messages which have data
-                if (removeCompsDs.BytesFilled())
-                {
-                    QueueMessage(destination, cRemoveComponentsMessage, true, true, removeCompsDs);
-                    ++numMessagesSent;
-                }
-                if (removeAttrsDs.BytesFilled())
-                {
-                    QueueMessage(destination, cRemoveAttributesMessage, true, true, removeAttrsDs);
-                    ++numMessagesSent;
-                }
-                if (createCompsDs.BytesFilled())
-                {
-                    QueueMessage(destination, cCreateComponentsMessage, true, true, createCompsDs);
-                    ++numMessagesSent;
-                }
-                if (createAttrsDs.BytesFilled())
-                {
-                    QueueMessage(destination, cCreateAttributesMessage, true, true, createAttrsDs);
-                    ++numMessagesSent;
-                }
-                if (editAttrsDs.BytesFilled())
-                {
-                    QueueMessage(destination, cEditAttributesMessage, true, true, editAttrsDs);
-                    ++numMessagesSent;
-                }
+                numMessagesSent += removeComps.Flush();
+                numMessagesSent += removeAttrs.Flush();
+                numMessagesSent += createComps.Flush();
+                numMessagesSent += createAttrs.Flush();
+                numMessagesSent += editAttrs.Flush();
             }
             
             // Check if entity has other property changes (temporary flag)
             if (entityState.hasPropertyChanges)
             {
-                kNet::DataSerializer editPropertiesDs(editAttrsBuffer_, 1024);
+                std::vector<u8> buffer;
+                output.AllocateBuffer(buffer, 2 * cMaxVLESize + 1);
+                kNet::DataSerializer editPropertiesDs((char*)&buffer[0], buffer.size());
                 editPropertiesDs.AddVLE<kNet::VLE8_16_32>(sceneId);
                 editPropertiesDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                 editPropertiesDs.Add<u8>(entity->IsTemporary() ? 1 : 0);
-                QueueMessage(destination, cEditEntityPropertiesMessage, true, true, editPropertiesDs);
+                output.QueueMessage(cEditEntityPropertiesMessage, true, true, buffer, editPropertiesDs.BytesFilled());
                 ++numMessagesSent;
             }
             
@@ -1761,6 +2006,21 @@ void SyncManager::HandleCameraOrientation(kNet::MessageConnection* source, const
 
     user->syncState->clientOrientation = orientation;
     user->syncState->clientLocation = clientpos;
+
+    // The entities deferred to a long update interval may have become relevant as the client moved. Reschedule them now,
+    // instead of on their next change, so that they are not left waiting for the far interval.
+    /// @remarks InterestManager functionality
+    if (interestmanager_)
+    {
+        std::vector<entity_id_t> deferred;
+        user->syncState->GetDeferredEntities(deferred);
+        for(size_t i = 0; i < deferred.size(); ++i)
+        {
+            EntityPtr entity = scene->GetEntity(deferred[i]);
+            if (entity)
+                user->syncState->SetUpdateInterval(deferred[i], interestmanager_->UpdateInterval(user, entity.get(), scene_, framework_->IsHeadless(), updatePeriod_));
+        }
+    }
 }
 
 void SyncManager::HandleCreateEntity(kNet::MessageConnection* source, const char* data, size_t numBytes)
@@ -1843,8 +2103,7 @@ void SyncManager::HandleCreateEntity(kNet::MessageConnection* source, const char
             u32 typeID = ds.ReadVLE<kNet::VLE8_16_32>();
             QString name = QString::fromStdString(ds.ReadString());
             unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-            ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-            kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            kNet::DataDeserializer attrDs(ReadAttributeData(ds, attrDataSize), attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->GetComponentById(compID))
@@ -1990,8 +2249,7 @@ void SyncManager::HandleCreateComponents(kNet::MessageConnection* source, const
             u32 typeID = ds.ReadVLE<kNet::VLE8_16_32>();
             QString name = QString::fromStdString(ds.ReadString());
             unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-            ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-            kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+            kNet::DataDeserializer attrDs(ReadAttributeData(ds, attrDataSize), attrDataSize);
             
             // If client gets a component that already exists, destroy it forcibly
             if (!isServer && entity->GetComponentById(compID))
@@ -2380,8 +2638,7 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
     {
         component_id_t compID = ds.ReadVLE<kNet::VLE8_16_32>();
         unsigned attrDataSize = ds.ReadVLE<kNet::VLE8_16_32>();
-        ds.ReadArray<u8>((u8*)&attrDataBuffer_[0], attrDataSize);
-        kNet::DataDeserializer attrDs(attrDataBuffer_, attrDataSize);
+        kNet::DataDeserializer attrDs(ReadAttributeData(ds, attrDataSize), attrDataSize);
 
         ComponentPtr comp = entity->GetComponentById(compID);
         if (!comp)
@@ -2417,6 +2674,13 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
                     attr->FromBinary(attrDs, AttributeChange::Disconnected);
                     changedAttrs.push_back(attr);
                 }
+                else if (comp->TypeId() == EC_Placeable::ComponentTypeId && attr == &static_cast<EC_Placeable*>(comp.get())->transform)
+                {
+                    // Placeable transforms go through the snapshot buffer instead of the scene's attribute interpolation.
+                    Attribute<Transform> endValue(0, "");
+                    endValue.FromBinary(attrDs, AttributeChange::Disconnected);
+                    BufferTransformSnapshot(static_pointer_cast<EC_Placeable>(comp), endValue.Get());
+                }
                 else
                 {
                     IAttribute* endValue = attr->Clone();
@@ -2449,6 +2713,13 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
                         attr->FromBinary(attrDs, AttributeChange::Disconnected);
                         changedAttrs.push_back(attr);
                     }
+                    else if (comp->TypeId() == EC_Placeable::ComponentTypeId && attr == &static_cast<EC_Placeable*>(comp.get())->transform)
+                    {
+                        // Placeable transforms go through the snapshot buffer instead of the scene's attribute interpolation.
+                        Attribute<Transform> endValue(0, "");
+                        endValue.FromBinary(attrDs, AttributeChange::Disconnected);
+                        BufferTransformSnapshot(static_pointer_cast<EC_Placeable>(comp), endValue.Get());
+                    }
                     else
                     {
                         IAttribute* endValue = attr->Clone();
@@ -6,6 +6,8 @@
 #include "TundraProtocolModuleApi.h"
 
 #include "SyncState.h"
+#include "TransformInterpolator.h"
+#include "RigidBodyQuantization.h"
 #include "SceneFwd.h"
 #include "AttributeChangeType.h"
 #include "EntityAction.h"
@@ -16,6 +18,9 @@
 #include <kNet/Types.h>
 
 #include <QObject>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
 
 class Framework;
 
@@ -67,12 +72,26 @@ public slots:
         @param int critrange specifies the radius for the critical area.
         @param int rayrange specifies the radius for the raycasting.
         @param int relrange specifies the radius for the relevance filtering.
-        @param int updateint specifies the update interval for the relevance filtering.
+        @param int updateint specifies the update interval in milliseconds of the least relevant entities. 0 uses the default of 2000 ms.
         @param int raycastint specifies the raycasting interval for the ray visibility filter. */
     void UpdateInterestManagerSettings(bool enabled, bool eucl, bool ray, bool rel, int critrange, int relrange, int updateint, int raycastint);
 
     void SendCameraUpdateRequest(UserConnectionPtr conn, bool enabled);
 
+    /// Sets the quantization profile of the compact rigid body updates and sends it to the clients (server only).
+    /** @param bounds Positions inside the world bounds are quantized. If the bounds are degenerate, they are derived from the
+            bounding box of the rigid bodies of the scene, which is also the default.
+        @param positionPrecision Maximum quantization step of the positions within the bounds.
+        @param rotationBits Bits per quaternion component in the smallest three encoding of the orientations, within [4, 14].
+        @param maxLinearVelocity Range of the quantized linear velocity components.
+        @param linearVelocityBits Bits per quantized linear velocity component.
+        @param maxAngularVelocity Range of the quantized angular velocity components in degrees per second.
+        @param angularVelocityBits Bits per quantized angular velocity component.
+        @param linearVelocityTolerance A linear velocity is resent only when it differs at least this much from the one the client has.
+        @param angularVelocityTolerance An angular velocity is resent only when it differs at least this much, in degrees per second, from the one the client has. */
+    void SetRigidBodyQuantization(const AABB &bounds, float positionPrecision, int rotationBits, float maxLinearVelocity, int linearVelocityBits,
+        float maxAngularVelocity, int angularVelocityBits, float linearVelocityTolerance, float angularVelocityTolerance);
+
 signals:
     /// This signal is emitted when a new user connects and a new SceneSyncState is created for the connection.
     /// @note See signals of the SceneSyncState object to build prioritization logic how the sync state is filled.
@@ -113,10 +132,128 @@ private slots:
     void HandleKristalliMessage(kNet::MessageConnection* source, kNet::packet_id_t, kNet::message_id_t id, const char* data, size_t numBytes);
 
 private:
+    /// Identifies an encoded component change in encodedComponents_.
+    struct EncodedComponentKey
+    {
+        entity_id_t entityId;
+        component_id_t componentId;
+        std::vector<u8> dirtyAttributes; ///< Bitmask of the encoded attributes. Empty for a full update.
+
+        bool operator <(const EncodedComponentKey &rhs) const;
+    };
+
+    /// Messages crafted from one sync state, waiting to be queued to the kNet connection.
+    /** The sync states are serialized into SyncStateOutputs instead of directly to kNet, so that the sync states of
+        the client connections can be serialized in parallel. Only the main thread touches kNet and the log.
+        The messages are serialized in place into data buffers that are recycled from tick to tick, so that a tick
+        in the steady state does not allocate per client connection. Each message is still copied once, into the
+        kNet message that SendSyncStateOutput starts on the main thread, as kNet messages are not created on the workers. */
+    struct SyncStateOutput
+    {
+        SyncStateOutput() : failed(false) {}
+
+        struct Message
+        {
+            kNet::message_id_t id;
+            bool reliable;
+            bool inOrder;
+            bool fixedPriority; ///< If true, the message is sent with the fixed priority of the generic sync messages, otherwise with the kNet default.
+            std::vector<u8> data; ///< Buffer of the message. May be larger than the message.
+            size_t numBytes; ///< Size of the message.
+        };
+
+        std::vector<Message> messages; ///< Messages in the order they are to be queued.
+        std::vector<std::vector<u8> > freeBuffers; ///< Data buffers of the messages of the previous ticks, for reuse.
+        QStringList warnings; ///< Warnings to be logged from the main thread.
+        QStringList errors; ///< Errors to be logged from the main thread.
+        bool failed; ///< Set if the serialization was aborted by an exception. The sync state may then be left half-updated, and the messages incomplete.
+
+        /// Swaps a data buffer of at least numBytes bytes into buffer, reusing a free buffer if there is one.
+        void AllocateBuffer(std::vector<u8> &buffer, size_t numBytes);
+        /// Appends a new message with the first numBytes bytes of buffer as its data. Takes the buffer, leaving buffer empty.
+        void QueueMessage(kNet::message_id_t id, bool reliable, bool inOrder, std::vector<u8> &buffer, size_t numBytes, bool fixedPriority = true);
+        /// Removes all messages and log lines, and clears the failed flag. The data buffers of the messages are kept for reuse.
+        void Clear();
+    };
+
+    /// Crafts the messages of one type for one entity directly into the data buffers of a SyncStateOutput.
+    /** The messages start with the scene and entity IDs, followed by any number of items, for example components or attributes.
+        The buffer grows to fit the items, and when a message would grow past cMaxSyncMessageSize, the rest of the items go to
+        a new message with the same header, so no amount of changes to an entity overflows a message. A single item larger than
+        that is sent in a message of its own, and kNet fragments it. */
+    class SyncMessageBuilder
+    {
+    public:
+        SyncMessageBuilder(SyncStateOutput &output, kNet::message_id_t id, u32 sceneId, entity_id_t entityId);
+
+        /// Returns a serializer for writing an item of at most maxBytes bytes. Pass it to EndItem after writing the item.
+        kNet::DataSerializer BeginItem(size_t maxBytes);
+        /// Commits the item written to ds.
+        void EndItem(const kNet::DataSerializer &ds);
+        /// Appends the crafted messages to the output. Returns the number of messages.
+        int Flush();
+
+    private:
+        /// Moves the message being crafted to pending_.
+        void FinishMessage();
+
+        SyncStateOutput &output_;
+        kNet::message_id_t id_;
+        u32 sceneId_;
+        entity_id_t entityId_;
+        std::vector<u8> buffer_; ///< Data buffer of the message being crafted.
+        size_t numBytes_; ///< Bytes filled in buffer_.
+        /// Finished messages. They are appended to the output only on Flush, so that the messages of the different types for
+        /// an entity are queued in the same order as when each type fitted in one message.
+        std::vector<SyncStateOutput::Message> pending_;
+    };
+
+    /// A rigid body update waiting to be written to a cRigidBodyUpdateMessage.
+    struct PendingRigidBodyUpdate
+    {
+        EntitySyncState *state;
+        RigidBodyUpdate update;
+        bool reliable; ///< The body came to rest, so the update must reach the client.
+
+        bool operator <(const PendingRigidBodyUpdate &rhs) const { return state->id < rhs.state->id; }
+    };
+
+    /// Buffers for crafting sync messages. Each thread that serializes sync states uses its own set.
+    struct SyncScratchBuffers
+    {
+        std::vector<u8> attrData; ///< Encoded attribute data. Grown when the attributes of a component do not fit.
+        std::vector<const std::vector<u8>*> componentData; ///< Encoded attribute data of the components of a new entity.
+        std::vector<u8> changedAttributes;
+        std::vector<PendingRigidBodyUpdate> rigidBodyUpdates;
+    };
+
+    /// Serializes the sync states of every numJobs'th connection starting from firstIndex. Run on the worker threads of syncThreadPool_.
+    class SyncStateJob;
+
     /// Queue a message to the receiver from a given DataSerializer.
     void QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds);
+    /// Queues the messages of output to the connection and prints its log lines. Main thread only.
+    void SendSyncStateOutput(kNet::MessageConnection* connection, SyncStateOutput& output);
+    /// Serializes the sync states of the server's client connections into syncOutputs_, in parallel if there are enough connections.
+    void SerializeUserSyncStates(const std::vector<UserConnection*>& users);
+    /// Serializes the sync states of every numJobs'th user starting from firstIndex into syncOutputs_.
+    void SerializeUserSyncStates(const std::vector<UserConnection*>& users, size_t firstIndex, size_t numJobs, SyncScratchBuffers& scratch);
     /// Craft a component full update, with all static and dynamic attributes.
-    void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    /** @param attrData The encoded attributes of the component, from EncodeComponentAttributes. */
+    void WriteComponentFullUpdate(kNet::DataSerializer& ds, IComponent *comp, const std::vector<u8> &attrData);
+    /// Returns an upper bound for the size of a component full update written by WriteComponentFullUpdate.
+    static size_t ComponentFullUpdateMaxSize(IComponent *comp, const std::vector<u8> &attrData);
+    /// Reads an attribute data array of numBytes bytes from ds to attrDataBuffer_, growing it as needed, and returns the data.
+    const char *ReadAttributeData(kNet::DataDeserializer& ds, u32 numBytes);
+    /// Returns the encoded attribute data of a component full update. Cached for the duration of a network tick.
+    const std::vector<u8> &EncodeComponentAttributes(SyncScratchBuffers& scratch, entity_id_t entityId, IComponent *comp);
+    /// Returns the encoded attribute data of an edit attributes message for the attributes flagged in dirtyAttributes. Cached for the duration of a network tick.
+    /** @param changedAttributes Indices of the valid changed attributes, in ascending order. Must match dirtyAttributes. */
+    const std::vector<u8> &EncodeAttributeChanges(SyncScratchBuffers& scratch, entity_id_t entityId, IComponent *comp, const u8 *dirtyAttributes, const std::vector<u8> &changedAttributes);
+    /// Encodes the value of an attribute to scratch.attrData and returns its size.
+    size_t EncodeAttributeValue(SyncScratchBuffers& scratch, IAttribute *attr);
+    /// Adds an encoded component change to encodedComponents_, unless another thread has already added it, and returns the cached data.
+    const std::vector<u8> &CacheEncodedComponent(const EncodedComponentKey &key, const char *data, size_t numBytes);
     /// Handle entity action message.
     void HandleEntityAction(kNet::MessageConnection* source, MsgEntityAction& msg);
     /// Handle create entity message.
@@ -143,19 +280,45 @@ private:
     void HandleEditEntityProperties(kNet::MessageConnection* source, const char* data, size_t numBytes);
     
     void HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Handle rigid body quantization profile message (client only).
+    void HandleRigidBodyQuantization(kNet::MessageConnection* source, const char* data, size_t numBytes);
+    /// Sends the rigid body quantization profile to a client.
+    void SendRigidBodyQuantization(kNet::MessageConnection* connection);
+    /// Validates a new rigid body quantization profile, takes it into use with the next ID, and sends it to all the clients (server only).
+    bool ApplyRigidBodyQuantization(RigidBodyQuantization profile);
+    /// Grows the bounds of the rigid body quantization profile to contain the rigid bodies of the scene, unless they were set explicitly (server only).
+    /** Checks the scene at most once per second. The bounds are padded, so that they do not need to grow every time a body moves out of them. */
+    void UpdateRigidBodyQuantizationBounds();
     
-    void ReplicateRigidBodyChanges(kNet::MessageConnection* destination, SceneSyncState* state);
+    /// Writes the changed rigid body transforms and velocities of the sync state in the compact rigid body update format.
+    /** The bodies are written in the order of their IDs, which are delta coded, and packed to messages by their exact size in the
+        rigidBodyQuantization_ profile. A value is only sent when it differs from the value the client has by more than the
+        thresholds of the profile, and the decoded values are remembered as the values the client has. Clears the dirty bits of
+        the replicated attributes, so that the generic sync does not replicate them again. Thread-safe with respect to other sync states. */
+    void ReplicateRigidBodyChanges(SyncStateOutput& output, SyncScratchBuffers& scratch, SceneSyncState* state);
 
-    void InterpolateRigidBodies(f64 frametime, SceneSyncState* state);
+    /// Advances the client clock and applies the buffered transform snapshots to the placeables and rigid bodies.
+    void InterpolateTransforms(f64 frametime);
+
+    /// Buffers a transform received in an EditAttributes message for interpolation (client only).
+    void BufferTransformSnapshot(const shared_ptr<EC_Placeable> &placeable, const Transform &transform);
+
+    /// Returns the time at which the buffered transform snapshots are evaluated on the client.
+    f64 InterpolationRenderTime() const { return clientTime_ - interpolationDelay_ * updatePeriod_; }
 
     /// Read client extrapolation time parameter from command line and match it to the current sync period.
     void GetClientExtrapolationTime();
 
+    /// Read client interpolation delay parameter from command line and match it to the current sync period.
+    void GetClientInterpolationDelay();
+
     /// Process one sync state for changes in the scene
     /** \todo For now, sends all changed entities/components. In the future, this shall be subject to interest management
-        @param destination MessageConnection where to send the messages
+        Only reads the scene, so the sync states of different connections can be processed in parallel.
+        @param output Where to write the messages
+        @param scratch Buffers for crafting the messages
         @param state Syncstate to process */
-    void ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state);
+    void ProcessSyncState(SyncStateOutput& output, SyncScratchBuffers& scratch, SceneSyncState* state);
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -187,20 +350,48 @@ private:
     float maxLinExtrapTime_;
     /// Disable client physics handoff -flag
     bool noClientPhysicsHandoff_;
+    /// How far the client renders the replicated transforms behind the newest received snapshots, as number of network update intervals (default 1.5)
+    float interpolationDelay_;
+    /// Quantization profile of the compact rigid body updates. On the client, the latest profile received from the server.
+    RigidBodyQuantization rigidBodyQuantization_;
+    /// The profile the client had before the latest one, for the updates the server sent before it changed the profile (client only)
+    RigidBodyQuantization previousRigidBodyQuantization_;
+    /// Whether the bounds of the rigid body quantization profile follow the scene (server only)
+    bool rigidBodyBoundsFromScene_;
+    /// Whether the bounds of the rigid body quantization profile have been derived from the scene yet (server only)
+    bool rigidBodyBoundsDerived_;
+    /// Time accumulator for checking the bounds of the rigid bodies of the scene (server only)
+    float rigidBodyBoundsAcc_;
+    /// Client clock for timestamping the received transform snapshots, in seconds
+    f64 clientTime_;
+    /// Jitter buffer of the replicated transforms (client only)
+    TransformInterpolator transformInterpolator_;
+    /// True while the interpolated transforms are being applied, to tell them apart from local transform edits
+    bool applyingInterpolation_;
     
     /// Server sync state (client only)
     SceneSyncState server_syncstate_;
     
-    /// Fixed buffers for crafting messages
+    /// Buffers for crafting and parsing messages on the main thread
     char createEntityBuffer_[64 * 1024];
-    char createCompsBuffer_[64 * 1024];
-    char editAttrsBuffer_[64 * 1024];
-    char createAttrsBuffer_[16 * 1024];
-    char attrDataBuffer_[16 * 1024];
-    char removeCompsBuffer_[1024];
-    char removeEntityBuffer_[1024];
-    char removeAttrsBuffer_[1024];
-    std::vector<u8> changedAttributes_;
+    std::vector<char> attrDataBuffer_;
+
+    /// Scratch buffers for serializing sync states, one set per concurrent job. The first set is used by the main thread.
+    std::vector<shared_ptr<SyncScratchBuffers> > syncScratchBuffers_;
+    /// Serialized sync states of the client connections of the current network tick, indexed like the connections.
+    std::vector<SyncStateOutput> syncOutputs_;
+    /// Serialized sync state for the server connection (client only).
+    SyncStateOutput serverSyncOutput_;
+    /// Worker threads for serializing the sync states of the client connections.
+    QThreadPool syncThreadPool_;
+
+    /// Encoded component data of the current network tick.
+    /** The encoding of a component change does not depend on the receiving connection, so when several clients receive the same
+        change during the same tick, the attributes are serialized once and the bytes are copied into each client's message.
+        Cleared after each tick, as the attribute values may change between ticks. */
+    std::map<EncodedComponentKey, std::vector<u8> > encodedComponents_;
+    /// Guards encodedComponents_ while the sync states are serialized in parallel.
+    QMutex encodedComponentsMutex_;
 
     InterestManager *interestmanager_;
 };
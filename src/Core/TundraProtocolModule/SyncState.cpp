@@ -19,6 +19,7 @@ SceneSyncState::SceneSyncState(u32 userConnectionID, bool isServer) :
     userConnectionID_(userConnectionID),
     changeRequest_(userConnectionID),
     isServer_(isServer),
+    currentTick_(0),
     locationInitialized(false),
     clientLocation(float3::nan),
     initialLocation(float3::nan)
@@ -136,6 +137,8 @@ void SceneSyncState::Clear()
     dirtyQueue.clear();
     entities.clear();
     pendingEntities_.clear();
+    updateWheel_.clear();
+    updateWheel_.resize(cMaxUpdateInterval + 1);
     changeRequest_.Reset();
     scene_.reset();
 }
@@ -278,6 +281,90 @@ void SceneSyncState::MarkAttributeRemoved(entity_id_t id, component_id_t compId,
     compState.MarkAttributeRemoved(attrIndex);
 }
 
+void SceneSyncState::SetUpdateInterval(entity_id_t id, int ticks)
+{
+    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
+    if (i == entities.end())
+        return;
+    EntitySyncState &entityState = i->second;
+    if (ticks < 1)
+        ticks = 1;
+    else if (ticks > cMaxUpdateInterval)
+        ticks = cMaxUpdateInterval;
+    if (ticks < entityState.updateInterval && entityState.isInWheel)
+    {
+        // Take the entity out of the wheel, AdvanceUpdateWheel reschedules it with the new interval.
+        entityState.isInWheel = false;
+        if (!entityState.isInQueue)
+        {
+            dirtyQueue.push_back(&entityState);
+            entityState.isInQueue = true;
+        }
+    }
+    entityState.updateInterval = ticks;
+}
+
+void SceneSyncState::ResetUpdateIntervals()
+{
+    for(std::map<entity_id_t, EntitySyncState>::iterator i = entities.begin(); i != entities.end(); ++i)
+        SetUpdateInterval(i->first, 1);
+}
+
+void SceneSyncState::GetDeferredEntities(std::vector<entity_id_t> &ids) const
+{
+    for(size_t i = 0; i < updateWheel_.size(); ++i)
+    {
+        const std::vector<entity_id_t> &slot = updateWheel_[i];
+        for(size_t j = 0; j < slot.size(); ++j)
+        {
+            std::map<entity_id_t, EntitySyncState>::const_iterator k = entities.find(slot[j]);
+            if (k != entities.end() && k->second.isInWheel)
+                ids.push_back(slot[j]);
+        }
+    }
+}
+
+void SceneSyncState::AdvanceUpdateWheel()
+{
+    ++currentTick_;
+
+    // Requeue the entities whose turn has come
+    std::vector<entity_id_t> &slot = updateWheel_[currentTick_ % updateWheel_.size()];
+    for(size_t i = 0; i < slot.size(); ++i)
+    {
+        std::map<entity_id_t, EntitySyncState>::iterator j = entities.find(slot[i]);
+        if (j == entities.end() || !j->second.isInWheel)
+            continue; // Removed or rescheduled since
+        j->second.isInWheel = false;
+        if (!j->second.isInQueue)
+        {
+            dirtyQueue.push_back(&j->second);
+            j->second.isInQueue = true;
+        }
+    }
+    slot.clear();
+
+    // Defer the entities that were updated too recently. The ones that stay in the queue are sent on this tick.
+    for(std::list<EntitySyncState*>::iterator i = dirtyQueue.begin(); i != dirtyQueue.end();)
+    {
+        EntitySyncState &entityState = **i;
+        const u32 ticksSinceUpdate = currentTick_ - entityState.lastUpdateTick;
+        if (entityState.isNew || entityState.removed || ticksSinceUpdate >= (u32)entityState.updateInterval)
+        {
+            entityState.lastUpdateTick = currentTick_;
+            ++i;
+            continue;
+        }
+        if (!entityState.isInWheel)
+        {
+            updateWheel_[(entityState.lastUpdateTick + entityState.updateInterval) % updateWheel_.size()].push_back(entityState.id);
+            entityState.isInWheel = true;
+        }
+        entityState.isInQueue = false;
+        i = dirtyQueue.erase(i);
+    }
+}
+
 // Private
 
 bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
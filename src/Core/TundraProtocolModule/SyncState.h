@@ -18,6 +18,7 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 /// Component's per-user network sync state
 struct ComponentSyncState
@@ -71,8 +72,11 @@ struct EntitySyncState
         isNew(true),
         isInQueue(false),
         hasPropertyChanges(false),
+        isInWheel(false),
         id(0),
-        avgUpdateInterval(0.0f)
+        avgUpdateInterval(0.0f),
+        updateInterval(1),
+        lastUpdateTick(0)
     {
     }
     
@@ -163,10 +167,15 @@ struct EntitySyncState
     bool isNew; ///< The client does not have the entity and it must be serialized in full
     bool isInQueue; ///< The entity is already in the scene's dirty queue
     bool hasPropertyChanges; ///< The entity has changes into its other properties, such as temporary flag
+    bool isInWheel; ///< The entity's changes are deferred in the scene's update wheel
     
     kNet::PolledTimer updateTimer; ///< Last update received timer
     float avgUpdateInterval; ///< Average network update interval in seconds
 
+    // Update rate of the entity's changes to this user, set by the InterestManager on the server.
+    int updateInterval; ///< Number of sync ticks between sending the changes
+    u32 lastUpdateTick; ///< Sync tick on which the changes were last sent
+
     // Special cases for rigid body streaming:
     // On the server side, remember the last sent rigid body parameters, so that we can perform effective pruning of redundant data.
     Transform transform;
@@ -175,31 +184,6 @@ struct EntitySyncState
     kNet::tick_t lastNetworkSendTime;
 };
 
-struct RigidBodyInterpolationState
-{
-    // On the client side, remember the state for performing Hermite interpolation (C1, i.e. pos and vel are continuous).
-    struct RigidBodyState
-    {
-        float3 pos;
-        float3 vel;
-        Quat rot;
-        float3 scale;
-        float3 angVel; // Angular velocity in Euler ZYX.
-    };
-
-    RigidBodyState interpStart;
-    RigidBodyState interpEnd;
-    float interpTime;
-
-    // If true, we are using linear inter/extrapolation to move the entity.
-    // If false, we have handed off this entity for physics to extrapolate.
-    bool interpolatorActive;
-
-    /// Remembers the packet id of the most recently received network sync packet. Used to enforce
-    /// proper ordering (generate latest-data-guarantee messaging) for the received movement packets.
-    kNet::packet_id_t lastReceivedPacketCounter;
-};
-
 /// State change request to permit/deny changes.
 class TUNDRAPROTOCOL_MODULE_API StateChangeRequest : public QObject
 {
@@ -279,17 +263,12 @@ public:
     /// Entity sync states
     std::map<entity_id_t, EntitySyncState> entities; 
 
-    /// Entity interpolations
-    std::map<entity_id_t, RigidBodyInterpolationState> entityInterpolations;
-
-    /// Maps containing the relevance factors and visibility data
+    /// Map containing the visibility data
     /// @remarks InterestManager functionality
     std::map<entity_id_t, bool> visibleEntities;
-    std::map<entity_id_t, float> relevanceFactors;
 
-    /// Couple of maps containing the timestamps of last updates and raycasts
+    /// Map containing the timestamps of last raycasts
     /// @remarks InterestManager functionality
-    std::map<entity_id_t, float> lastUpdatedEntitys_;
     std::map<entity_id_t, float> lastRaycastedEntitys_;
 
     /// @remarks InterestManager functionality
@@ -356,6 +335,25 @@ public:
     void MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex);
     void MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex);
 
+    /// Sets the number of sync ticks between sending the changes of an entity (server only).
+    /** If the entity is waiting for its turn and the new interval makes it due sooner, it is rescheduled. */
+    void SetUpdateInterval(entity_id_t id, int ticks);
+
+    /// Sets every entity to be updated on every sync tick.
+    void ResetUpdateIntervals();
+
+    /// Appends the IDs of the entities that are waiting in the update wheel for their turn to ids. An ID may be appended more than once.
+    void GetDeferredEntities(std::vector<entity_id_t> &ids) const;
+
+    /// Advances the sync tick of this user and defers the dirty entities whose update interval has not yet passed (server only).
+    /** The deferred entities are kept in a timing wheel with a slot per tick, and are requeued on the tick their interval
+        passes. Their dirty bits are kept meanwhile, so all the changes until then are coalesced to one update. New and
+        removed entities are never deferred. Call once per sync tick before processing the dirty queue. */
+    void AdvanceUpdateWheel();
+
+    /// Longest update interval in sync ticks.
+    static const int cMaxUpdateInterval = 255;
+
     // Silently does the same as MarkEntityDirty without emitting change request signal.
     EntitySyncState& MarkEntityDirtySilent(entity_id_t id);
 
@@ -377,6 +375,11 @@ private:
     ///       with the same dirty bit in EntitySyncState and ComponentSyncState.
     std::vector<entity_id_t> pendingEntities_;
 
+    /// Timing wheel of the deferred entities, with a slot of entity IDs for each of the next cMaxUpdateInterval + 1 ticks.
+    /// A slot may contain stale IDs of entities that were removed or rescheduled since.
+    std::vector<std::vector<entity_id_t> > updateWheel_;
+    u32 currentTick_;
+
     StateChangeRequest changeRequest_;
     bool isServer_;
     u32 userConnectionID_;
@@ -0,0 +1,277 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "TransformInterpolator.h"
+#include "EC_Placeable.h"
+#include "EC_RigidBody.h"
+#include "Math/MathFunc.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Interpolates from (pos0, vel0) to (pos1, vel1) with a C1 curve (continuous in position and velocity)
+float3 HermiteInterpolate(const float3 &pos0, const float3 &vel0, const float3 &pos1, const float3 &vel1, float t)
+{
+    float tt = t*t;
+    float ttt = tt*t;
+    float h1 = 2*ttt - 3*tt + 1;
+    float h2 = 1 - h1;
+    float h3 = ttt - 2*tt + t;
+    float h4 = ttt - tt;
+
+    return h1 * pos0 + h2 * pos1 + h3 * vel0 + h4 * vel1;
+}
+
+/// Returns the rotation of orientation after rotating for the given time with an angular velocity given as axis * radians per second.
+Quat IntegrateOrientation(const Quat &orientation, const float3 &angularVelocity, float time)
+{
+    float speed = angularVelocity.Length();
+    if (speed * time < 1e-5f)
+        return orientation;
+    return (Quat(angularVelocity / speed, speed * time) * orientation).Normalized();
+}
+
+}
+
+TransformInterpolator::TransformInterpolator()
+{
+}
+
+void TransformInterpolator::Clear()
+{
+    ids_.clear();
+    placeables_.clear();
+    rigidBodies_.clear();
+    isRigidBody_.clear();
+    states_.clear();
+    snapshots_.clear();
+    transforms_.clear();
+    velocities_.clear();
+    angularVelocities_.clear();
+    lastReceivedPackets_.clear();
+    trackIndices_.clear();
+}
+
+int TransformInterpolator::FindTrack(entity_id_t id) const
+{
+    std::map<entity_id_t, int>::const_iterator iter = trackIndices_.find(id);
+    return iter != trackIndices_.end() ? iter->second : -1;
+}
+
+int TransformInterpolator::GetOrCreateTrack(entity_id_t id, const shared_ptr<EC_Placeable> &placeable, const shared_ptr<EC_RigidBody> &rigidBody)
+{
+    int track = FindTrack(id);
+    if (track >= 0)
+    {
+        // The components may have been recreated since the track was created.
+        placeables_[track] = placeable;
+        rigidBodies_[track] = rigidBody;
+        isRigidBody_[track] = rigidBody ? 1 : 0;
+        return track;
+    }
+
+    track = (int)ids_.size();
+    ids_.push_back(id);
+    placeables_.push_back(placeable);
+    rigidBodies_.push_back(rigidBody);
+    isRigidBody_.push_back(rigidBody ? 1 : 0);
+    states_.push_back(Idle);
+    snapshots_.push_back(Snapshots());
+    snapshots_.back().count = 0;
+    transforms_.push_back(placeable ? placeable->transform.Get() : Transform());
+    velocities_.push_back(float3::zero);
+    angularVelocities_.push_back(float3::zero);
+    lastReceivedPackets_.push_back(0);
+    trackIndices_[id] = track;
+    return track;
+}
+
+bool TransformInterpolator::NeedsStartSnapshot(int track, f64 renderTime) const
+{
+    const Snapshots &s = snapshots_[track];
+    return states_[track] == Idle || states_[track] == Finished || s.count == 0 || renderTime >= s.time[s.count-1];
+}
+
+void TransformInterpolator::AddSnapshot(int track, f64 time, const Transform &transform, const float3 &velocity, const float3 &angularVelocity, bool extrapolate)
+{
+    Snapshots &s = snapshots_[track];
+    if (s.count == cMaxSnapshots)
+    {
+        // Drop the oldest snapshot.
+        for(int i = 1; i < cMaxSnapshots; ++i)
+        {
+            s.time[i-1] = s.time[i];
+            s.pos[i-1] = s.pos[i];
+            s.vel[i-1] = s.vel[i];
+            s.rot[i-1] = s.rot[i];
+            s.angVel[i-1] = s.angVel[i];
+            s.scale[i-1] = s.scale[i];
+            s.extrapolate[i-1] = s.extrapolate[i];
+        }
+        --s.count;
+    }
+
+    const int i = s.count++;
+    s.time[i] = (i > 0 && time < s.time[i-1]) ? s.time[i-1] : time;
+    s.pos[i] = transform.pos;
+    s.vel[i] = extrapolate ? velocity : float3::zero;
+    s.rot[i] = transform.Orientation();
+    s.angVel[i] = extrapolate ? DegToRad(angularVelocity) : float3::zero;
+    s.scale[i] = transform.scale;
+    s.extrapolate[i] = extrapolate;
+
+    if (states_[track] == Idle || states_[track] == Finished)
+        states_[track] = Interpolating;
+}
+
+void TransformInterpolator::Stop(int track)
+{
+    snapshots_[track].count = 0;
+    states_[track] = Idle;
+}
+
+Transform TransformInterpolator::LatestTransform(int track) const
+{
+    const Snapshots &s = snapshots_[track];
+    assert(s.count > 0);
+    Transform transform;
+    transform.pos = s.pos[s.count-1];
+    transform.SetOrientation(s.rot[s.count-1]);
+    transform.scale = s.scale[s.count-1];
+    return transform;
+}
+
+float3 TransformInterpolator::LatestVelocity(int track) const
+{
+    const Snapshots &s = snapshots_[track];
+    return s.count > 0 ? s.vel[s.count-1] : float3::zero;
+}
+
+float3 TransformInterpolator::LatestAngularVelocity(int track) const
+{
+    const Snapshots &s = snapshots_[track];
+    return s.count > 0 ? RadToDeg(s.angVel[s.count-1]) : float3::zero;
+}
+
+void TransformInterpolator::Update(f64 renderTime, float maxExtrapolationTime)
+{
+    for(int i = 0; i < (int)ids_.size();)
+    {
+        if (placeables_[i].expired())
+        {
+            RemoveTrack(i); // Moves the last track to index i, so do not advance.
+            continue;
+        }
+
+        if (states_[i] == Finished)
+            states_[i] = Idle;
+        const Snapshots &s = snapshots_[i];
+        if (states_[i] == Idle || s.count == 0)
+        {
+            states_[i] = Idle;
+            ++i;
+            continue;
+        }
+
+        // Find the newest snapshot that is not newer than the render time.
+        int k = s.count - 1;
+        while(k > 0 && s.time[k] > renderTime)
+            --k;
+
+        float3 pos;
+        Quat rot;
+        float3 scale;
+        float3 vel;
+        float3 angVel;
+        if (k < s.count - 1 || renderTime < s.time[0]) // Interpolating between two snapshots.
+        {
+            const int k1 = (k < s.count - 1) ? k + 1 : k;
+            const float dt = (float)(s.time[k1] - s.time[k]);
+            const float t = dt > 0.f ? Clamp01((float)(renderTime - s.time[k]) / dt) : 1.f;
+
+            // If the snapshots carry velocities, use them as the tangents of the curve. Otherwise estimate the tangents from the
+            // neighbouring snapshots (Catmull-Rom), so that the entity does not slow down at every snapshot.
+            float3 tangent0 = s.vel[k] * dt;
+            float3 tangent1 = s.vel[k1] * dt;
+            if (!s.extrapolate[k] && dt > 0.f)
+            {
+                const int prev = (k > 0) ? k - 1 : k;
+                const float span = (float)(s.time[k1] - s.time[prev]);
+                tangent0 = span > 0.f ? (s.pos[k1] - s.pos[prev]) * (dt / span) : float3::zero;
+            }
+            if (!s.extrapolate[k1] && dt > 0.f)
+            {
+                const int next = (k1 < s.count - 1) ? k1 + 1 : k1;
+                const float span = (float)(s.time[next] - s.time[k]);
+                tangent1 = span > 0.f ? (s.pos[next] - s.pos[k]) * (dt / span) : float3::zero;
+            }
+
+            pos = HermiteInterpolate(s.pos[k], tangent0, s.pos[k1], tangent1, t);
+            rot = Quat::Slerp(s.rot[k], s.rot[k1], t);
+            scale = float3::Lerp(s.scale[k], s.scale[k1], t);
+            vel = float3::Lerp(s.vel[k], s.vel[k1], t);
+            angVel = float3::Lerp(s.angVel[k], s.angVel[k1], t);
+            states_[i] = Interpolating;
+        }
+        else // Past the newest snapshot.
+        {
+            const float elapsed = (float)(renderTime - s.time[k]);
+            const float limit = isRigidBody_[i] ? maxExtrapolationTime : 0.f;
+            if (s.extrapolate[k])
+            {
+                const float t = Min(elapsed, Max(limit, 0.f));
+                pos = s.pos[k] + s.vel[k] * t;
+                rot = IntegrateOrientation(s.rot[k], s.angVel[k], t);
+            }
+            else
+            {
+                pos = s.pos[k];
+                rot = s.rot[k];
+            }
+            scale = s.scale[k];
+            vel = s.vel[k];
+            angVel = s.angVel[k];
+            states_[i] = (elapsed >= limit) ? Finished : Extrapolating;
+        }
+
+        Transform &transform = transforms_[i];
+        transform.pos = pos;
+        transform.SetOrientation(rot);
+        transform.scale = scale;
+        velocities_[i] = vel;
+        angularVelocities_[i] = RadToDeg(angVel);
+        ++i;
+    }
+}
+
+void TransformInterpolator::RemoveTrack(int track)
+{
+    const int last = (int)ids_.size() - 1;
+    trackIndices_.erase(ids_[track]);
+    if (track != last)
+    {
+        ids_[track] = ids_[last];
+        placeables_[track] = placeables_[last];
+        rigidBodies_[track] = rigidBodies_[last];
+        isRigidBody_[track] = isRigidBody_[last];
+        states_[track] = states_[last];
+        snapshots_[track] = snapshots_[last];
+        transforms_[track] = transforms_[last];
+        velocities_[track] = velocities_[last];
+        angularVelocities_[track] = angularVelocities_[last];
+        lastReceivedPackets_[track] = lastReceivedPackets_[last];
+        trackIndices_[ids_[track]] = track;
+    }
+    ids_.pop_back();
+    placeables_.pop_back();
+    rigidBodies_.pop_back();
+    isRigidBody_.pop_back();
+    states_.pop_back();
+    snapshots_.pop_back();
+    transforms_.pop_back();
+    velocities_.pop_back();
+    angularVelocities_.pop_back();
+    lastReceivedPackets_.pop_back();
+}
@@ -0,0 +1,134 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Transform.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+
+#include <kNet/Types.h>
+
+#include <map>
+#include <vector>
+
+class EC_Placeable;
+class EC_RigidBody;
+
+/// Client-side jitter buffer for the replicated transforms of entities.
+/** Each entity whose transform is received from the server has a track holding the most recent snapshots, timestamped
+    with their local receive time. The tracks are evaluated at a render time that lags the receive clock by a configurable
+    delay, so that the entity moves smoothly through the received snapshots even if the packets arrive with jitter.
+    Between snapshots the position follows a Hermite curve and the orientation is slerped. Past the newest snapshot
+    the transform is extrapolated using the linear and angular velocity of the snapshot.
+
+    The track data is stored as parallel arrays, so that Update is a single linear pass over all tracks. */
+class TransformInterpolator
+{
+public:
+    /// Number of snapshots remembered per track.
+    static const int cMaxSnapshots = 4;
+
+    /// State of a track after the latest Update.
+    enum TrackState
+    {
+        Idle = 0, ///< The track is not driving the transform of its entity.
+        Interpolating, ///< The render time is between two snapshots.
+        Extrapolating, ///< The render time is past the newest snapshot.
+        Finished ///< The track ran out of snapshots during the latest Update and goes idle. The entity is left where the track ended.
+    };
+
+    TransformInterpolator();
+
+    /// Removes all tracks.
+    void Clear();
+
+    /// Returns the index of the track of an entity, or -1 if the entity has no track.
+    int FindTrack(entity_id_t id) const;
+
+    /// Returns the index of the track of an entity, creating an idle, empty track if it does not exist yet.
+    /** @param rigidBody The rigid body of the entity, or null. Tracks of rigid bodies keep extrapolating until the extrapolation time
+        set in Update runs out, after which the local physics simulation may take over the entity. Other tracks stop at the newest snapshot. */
+    int GetOrCreateTrack(entity_id_t id, const shared_ptr<EC_Placeable> &placeable, const shared_ptr<EC_RigidBody> &rigidBody);
+
+    /// Returns whether the next snapshot of the track needs a starting snapshot before it.
+    /** This is the case when the track is idle, or when the render time has already passed the newest snapshot. The caller should
+        then add the transform the entity currently has as the starting snapshot, timestamped with the render time. */
+    bool NeedsStartSnapshot(int track, f64 renderTime) const;
+
+    /// Appends a snapshot to a track and activates it.
+    /** @param time Local receive time of the snapshot. Must not be earlier than the previous snapshot of the track.
+        @param velocity Linear velocity in world units per second.
+        @param angularVelocity Angular velocity in degrees per second, as the rotation axis scaled by the rotation speed.
+        @param extrapolate If true, the velocities are valid. They are used as the tangents of the position curve and for extrapolating
+            past this snapshot. If false, the tangents are estimated from the neighbouring snapshots and the transform is not extrapolated. */
+    void AddSnapshot(int track, f64 time, const Transform &transform, const float3 &velocity, const float3 &angularVelocity, bool extrapolate);
+
+    /// Drops the snapshots of the track and stops it from driving the transform of its entity.
+    void Stop(int track);
+
+    /// Evaluates all active tracks at the given render time and removes the tracks whose entity has been deleted.
+    /** @param maxExtrapolationTime How long in seconds the tracks of rigid bodies keep extrapolating past their newest snapshot. */
+    void Update(f64 renderTime, float maxExtrapolationTime);
+
+    /// Returns the number of tracks. Track indices are in the range [0, NumTracks()[ and may change in Update.
+    size_t NumTracks() const { return ids_.size(); }
+
+    /// Returns the state of a track after the latest Update.
+    TrackState State(int track) const { return (TrackState)states_[track]; }
+
+    /// Returns the transform, linear velocity and angular velocity of the entity of a track, as evaluated in the latest Update.
+    const Transform &CurrentTransform(int track) const { return transforms_[track]; }
+    const float3 &CurrentVelocity(int track) const { return velocities_[track]; } ///< @copydoc CurrentTransform
+    const float3 &CurrentAngularVelocity(int track) const { return angularVelocities_[track]; } ///< @copydoc CurrentTransform
+
+    /// Returns whether the track has any snapshots.
+    bool HasSnapshots(int track) const { return snapshots_[track].count > 0; }
+
+    /// Returns the transform of the newest snapshot of a track. The track must have snapshots.
+    Transform LatestTransform(int track) const;
+
+    /// Returns the linear and angular velocity of the newest snapshot of a track, or zero if the track has no snapshots.
+    float3 LatestVelocity(int track) const;
+    float3 LatestAngularVelocity(int track) const; ///< @copydoc LatestVelocity
+
+    /// Returns the entity, placeable and rigid body of a track. The components are null if they have been deleted.
+    entity_id_t EntityId(int track) const { return ids_[track]; }
+    shared_ptr<EC_Placeable> Placeable(int track) const { return placeables_[track].lock(); } ///< @copydoc EntityId
+    shared_ptr<EC_RigidBody> RigidBody(int track) const { return rigidBodies_[track].lock(); } ///< @copydoc EntityId
+
+    /// Remembers the packet id of the most recently received packet for the track, to be able to drop out-of-order packets.
+    kNet::packet_id_t LastReceivedPacket(int track) const { return lastReceivedPackets_[track]; }
+    void SetLastReceivedPacket(int track, kNet::packet_id_t packetId) { lastReceivedPackets_[track] = packetId; } ///< @copydoc LastReceivedPacket
+
+private:
+    /// Removes a track by moving the last track in its place.
+    void RemoveTrack(int track);
+
+    /// Snapshot data of all tracks, cMaxSnapshots entries per track, oldest first.
+    struct Snapshots
+    {
+        f64 time[cMaxSnapshots];
+        float3 pos[cMaxSnapshots];
+        float3 vel[cMaxSnapshots];
+        Quat rot[cMaxSnapshots];
+        float3 angVel[cMaxSnapshots]; ///< Radians per second.
+        float3 scale[cMaxSnapshots];
+        bool extrapolate[cMaxSnapshots];
+        int count;
+    };
+
+    std::vector<entity_id_t> ids_;
+    std::vector<weak_ptr<EC_Placeable> > placeables_;
+    std::vector<weak_ptr<EC_RigidBody> > rigidBodies_;
+    std::vector<u8> isRigidBody_;
+    std::vector<u8> states_;
+    std::vector<Snapshots> snapshots_;
+    std::vector<Transform> transforms_;
+    std::vector<float3> velocities_;
+    std::vector<float3> angularVelocities_; ///< Degrees per second.
+    std::vector<kNet::packet_id_t> lastReceivedPackets_;
+
+    /// Maps entity ids to track indices. Only used when snapshots are received, not in Update.
+    std::map<entity_id_t, int> trackIndices_;
+};
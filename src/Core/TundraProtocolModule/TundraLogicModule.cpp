@@ -152,6 +152,10 @@ void TundraLogicModule::Initialize()
         "Usage: importmesh(filename, pos = 0 0 0, rot = 0 0 0, scale = 1 1 1, inspectForMaterialsAndSkeleton=true)",
         this, SLOT(ImportMesh(QString, const float3 &, const float3 &, const float3 &, bool)), SLOT(ImportMesh(QString)));
 
+    framework_->Console()->RegisterCommand("checkRigidBodyQuantization",
+        "Encodes and decodes test rigid body updates, and checks their sizes and decoding errors.",
+        this, SLOT(CheckRigidBodyQuantization()));
+
     // Take a pointer to KristalliProtocolModule so that we don't have to take/check it every time
     kristalliModule_ = framework_->GetModule<KristalliProtocolModule>();
     if (!kristalliModule_)
@@ -427,6 +431,11 @@ bool TundraLogicModule::ImportMesh(QString filename, const float3 &pos, const fl
     return entity != 0;
 }
 
+bool TundraLogicModule::CheckRigidBodyQuantization()
+{
+    return RigidBodyQuantization::RunRoundTripCheck();
+}
+
 bool TundraLogicModule::IsServer() const
 {
     return kristalliModule_->IsServer();
@@ -76,6 +76,10 @@ public slots:
     bool ImportMesh(QString filename, const float3 &pos = float3(0.f,0.f,0.f), const float3 &rot = float3(0.f,0.f,0.f),
         const float3 &scale = float3(1.f,1.f,1.f), bool inspectForMaterialsAndSkeleton = true);
 
+    /// Checks the encoding of the compact rigid body updates with the default quantization profile.
+    /** @return Whether the sizes and the decoding errors of the test updates were within their limits. */
+    bool CheckRigidBodyQuantization();
+
 private slots:
     /// Reads possible client/server startup parameters and reacts to them upon application startup.
     void ReadStartupParameters();
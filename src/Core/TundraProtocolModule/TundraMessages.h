@@ -24,6 +24,7 @@ const unsigned long cRemoveEntityMessage = 116;
 const unsigned long cCreateEntityReplyMessage = 117; // Server->client only
 const unsigned long cCreateComponentsReplyMessage = 118; // Server->client only
 const unsigned long cRigidBodyUpdateMessage = 119;
+const unsigned long cRigidBodyQuantizationMessage = 123; // Server->client only
 
 // Entity action
 const unsigned long cEntityActionMessage = 120;
@@ -8,8 +8,21 @@
 #include "Entity.h"
 #include "LoggingFunctions.h"
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
+UserConnection::UserConnection() :
+    userID(0),
+    inboundQueueBytes(0),
+    inboundMessageRate(0),
+    inboundAllowance(0.f),
+    numMessagesReceived(0),
+    numMessagesHandled(0),
+    peakInboundQueueLength(0)
+{
+}
+
 void UserConnection::Exec(Entity *entity, const QString &action, const QStringList &params)
 {
     if (entity)
@@ -56,3 +69,9 @@ void UserConnection::Close()
     if (connection)
         connection->Close(0);
 }
+
+void UserConnection::SetInboundMessageRate(int messagesPerSecond)
+{
+    inboundMessageRate = std::max(messagesPerSecond, 0);
+    inboundAllowance = (float)inboundMessageRate;
+}
@@ -11,6 +11,9 @@
 
 #include <QObject>
 
+#include <deque>
+#include <vector>
+
 class Entity;
 class SceneSyncState;
 
@@ -21,7 +24,7 @@ class TUNDRAPROTOCOL_MODULE_API UserConnection : public QObject, public enable_s
     Q_PROPERTY(int id READ ConnectionId)
 
 public:
-    UserConnection() : userID(0) {}
+    UserConnection();
 
     /// Returns the connection ID.
     u32 ConnectionId() const { return userID; }
@@ -37,6 +40,28 @@ public:
     /// Scene sync state, created and used by the SyncManager
     shared_ptr<SceneSyncState> syncState;
 
+    /// A received message waiting to be handled.
+    struct InboundMessage
+    {
+        kNet::packet_id_t packetId;
+        kNet::message_id_t messageId;
+        std::vector<char> data;
+    };
+    /// Messages received from this client that wait for their turn to be handled, in the order of arrival. Filled and drained by KristalliProtocolModule.
+    std::deque<InboundMessage> inboundQueue;
+    /// Number of payload bytes in inboundQueue
+    size_t inboundQueueBytes;
+    /// Maximum number of messages handled per second, 0 for no limit
+    int inboundMessageRate;
+    /// Number of messages that may still be handled under the rate limit. Refilled every frame, up to one second worth of messages.
+    float inboundAllowance;
+    /// Number of messages received from this client
+    u64 numMessagesReceived;
+    /// Number of messages of this client that have been handled
+    u64 numMessagesHandled;
+    /// Longest inboundQueue has been
+    size_t peakInboundQueueLength;
+
 public slots:
     /// Execute an action on an entity, sent only to the specific user
     void Exec(Entity *entity, const QString &action, const QStringList &params);
@@ -63,6 +88,25 @@ public slots:
     /// Forcibly kills this connection without notifying the peer.
     void Close();
 
+    /// Returns the maximum number of messages handled from this client per second, 0 for no limit.
+    int InboundMessageRate() const { return inboundMessageRate; }
+
+    /// Sets the maximum number of messages handled from this client per second, 0 for no limit.
+    /** The messages above the rate wait in the inbound queue. If the client keeps sending faster, the queue fills up and the client is disconnected. */
+    void SetInboundMessageRate(int messagesPerSecond);
+
+    /// Returns the number of messages received from this client that have not been handled yet.
+    int PendingInboundMessages() const { return (int)inboundQueue.size(); }
+
+    /// Returns the number of messages received from this client.
+    qulonglong MessagesReceived() const { return numMessagesReceived; }
+
+    /// Returns the number of messages of this client that have been handled.
+    qulonglong MessagesHandled() const { return numMessagesHandled; }
+
+    /// Returns the longest the inbound message queue of this client has been.
+    int PeakPendingInboundMessages() const { return (int)peakInboundQueueLength; }
+
     u32 GetConnectionID() const { return ConnectionId(); }  /**< @deprecated Use ConnectionId or 'id' @todo Add warning print */
     QString GetLoginData() const { return LoginData(); }  /**< @deprecated Use LoginData @todo Add warning print */
     QString GetProperty(const QString& key) const { return Property(key); } /**< @deprecated Use Property @todo Add warning print */